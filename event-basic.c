@@ -6,13 +6,16 @@
 bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
 	va_list ap;
 	va_start(ap, id);
+	bool ret = true;
 
 	if (id == VIS_EVENT_WIN_STATUS) {
 		Win *win = va_arg(ap, Win*);
 		window_status_update(vis, win);
+	} else if (id == VIS_EVENT_IDLE) {
+		ret = false; /* no background work */
 	}
 
 	va_end(ap);
-	return true;
+	return ret;
 }
 #endif
@@ -1481,7 +1481,7 @@ local function searchpath(name, path)
   local tried = {}
   for part in path:gmatch('[^;]+') do
     local filename = part:gsub('%?', name)
-    local ok, errmsg = loadfile(filename)
+    local ok, errmsg = (M.loadfile or loadfile)(filename)
     if ok or not errmsg:find('cannot open') then return filename end
     tried[#tried + 1] = string.format("no file '%s'", filename)
   end
@@ -1519,7 +1519,7 @@ function M.load(name, alt_name)
     require = function() return ro_lexer end -- legacy
   }
   for _, name in ipairs(env) do env[name] = _G[name] end
-  local lexer = assert(loadfile(assert(searchpath(name, path)), 't', env))(alt_name or name)
+  local lexer = assert((M.loadfile or loadfile)(assert(searchpath(name, path)), 't', env))(alt_name or name)
   assert(lexer, string.format("'%s.lua' did not return a lexer", name))
 
   -- If the lexer is a proxy or a child that embedded itself, set the parent to be the main
@@ -1,3 +1,32 @@
+-- choose among the indexed paths below the working directory matching
+-- prefix, returns nil if they might be incomplete or the prefix refers
+-- elsewhere, in which case vis-complete(1) is used instead
+local complete_indexed = function(prefix)
+	local pattern = prefix
+	while pattern:sub(1, 2) == "./" do pattern = pattern:sub(3) end
+	if pattern:match("^[/~]") or pattern:match("%.%.") then return nil end
+	local paths, complete = vis:paths(pattern, 1000)
+	if not complete then return nil end
+	if #paths == 0 then return 1, nil, nil end
+
+	-- like vis-complete(1) show the candidates relative to the directory
+	-- of the prefix and insert the remainder of the chosen one
+	local dir = pattern:match("^.*/") or ""
+	local candidates = {}
+	for i, path in ipairs(paths) do candidates[i] = path:sub(#dir + 1) end
+	table.sort(candidates)
+
+	local tmp = os.tmpname()
+	local f = io.open(tmp, "w")
+	if not f then return nil end
+	f:write(table.concat(candidates, "\n"), "\n")
+	f:close()
+	local status, out, err = vis:pipe(string.format("vis-menu -b < '%s'", tmp:gsub("'", "'\\''")))
+	os.remove(tmp)
+	if status ~= 0 or not out then return status, out, err end
+	return status, out:gsub("\n$", ""):sub(#pattern - #dir + 1), err
+end
+
 local complete_filename = function(expand)
 	local win = vis.win
 	local file = win.file
@@ -22,9 +51,13 @@ local complete_filename = function(expand)
 		range.finish = pos
 	end
 
-	local cmdfmt = "vis-complete --file '%s'"
-	if expand then cmdfmt = "vis-open -- '%s'*" end
-	local status, out, err = vis:pipe(cmdfmt:format(prefix:gsub("'", "'\\''")))
+	local status, out, err
+	if not expand then status, out, err = complete_indexed(prefix) end
+	if not status then
+		local cmdfmt = "vis-complete --file '%s'"
+		if expand then cmdfmt = "vis-open -- '%s'*" end
+		status, out, err = vis:pipe(cmdfmt:format(prefix:gsub("'", "'\\''")))
+	end
 	if status ~= 0 or not out then
 		if err then vis:info(err) end
 		return
@@ -1,4 +1,4 @@
--- complete word at primary selection location using vis-complete(1)
+-- complete word at primary selection location using vis-menu(1)
 
 vis:map(vis.modes.INSERT, "<C-n>", function()
 	local win = vis.win
@@ -13,18 +13,11 @@ vis:map(vis.modes.INSERT, "<C-n>", function()
 	local prefix = file:content(range)
 	if not prefix then return end
 
-	vis:feedkeys("<vis-selections-save><Escape><Escape>")
-	-- collect words starting with prefix
-	vis:command("x/\\b" .. prefix .. "\\w+/")
-	local candidates = {}
-	for sel in win:selections_iterator() do
-		table.insert(candidates, file:content(sel.range))
-	end
-	vis:feedkeys("<Escape><Escape><vis-selections-restore>")
-	if #candidates == 1 and candidates[1] == "\n" then return end
-	candidates = table.concat(candidates, "\n")
+	-- collect words starting with prefix, they contain no shell meta characters
+	local candidates = vis:words(prefix, 1000)
+	if #candidates == 0 then return end
 
-	local cmd = "printf '" .. candidates .. "' | sort -u | vis-menu"
+	local cmd = "printf '%s\\n' " .. table.concat(candidates, " ") .. " | vis-menu"
 	local status, out, err = vis:pipe(cmd)
 	if status ~= 0 or not out then
 		if err then vis:info(err) end
@@ -33,6 +26,4 @@ vis:map(vis.modes.INSERT, "<C-n>", function()
 	out = out:sub(#prefix + 1, #out - 1)
 	file:insert(pos, out)
 	win.selection.pos = pos + #out
-	-- restore mode to what it was on entry
-	vis.mode = vis.modes.INSERT
 end, "Complete word in file")
@@ -8,6 +8,12 @@ vis:textobject_new("ii", function(win, pos)
 		return nil
 	end
 
+	-- reuse the tokens of the latest syntax highlighting if they cover pos
+	local start, finish = win:token_at(pos)
+	if start then
+		return start, finish
+	end
+
 	local lexer = vis.lexers.load(win.syntax, nil, true)
 	if not lexer then
 		return nil
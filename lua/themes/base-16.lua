@@ -36,6 +36,8 @@ lexers.STYLE_STATUS_FOCUSED = 'reverse,bold'
 lexers.STYLE_SEPARATOR = lexers.STYLE_DEFAULT
 lexers.STYLE_INFO = 'bold'
 lexers.STYLE_EOF = ''
+lexers.STYLE_SEARCH = 'back:yellow,fore:black'
+lexers.STYLE_SEARCH = 'back:yellow,fore:black'
 
 -- lexer specific styles
 
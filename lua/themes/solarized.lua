@@ -67,3 +67,4 @@ lexers.STYLE_STATUS_FOCUSED = 'back:'..colors.base1..',fore:'..colors.base02
 lexers.STYLE_SEPARATOR = lexers.STYLE_DEFAULT
 lexers.STYLE_INFO = 'fore:default,back:default,bold'
 lexers.STYLE_EOF = 'fore:'..colors.base01
+lexers.STYLE_SEARCH = 'back:'..colors.yellow..',fore:'..colors.base03
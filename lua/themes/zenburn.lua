@@ -37,3 +37,4 @@ lexers.STYLE_STATUS_FOCUSED = 'back:#303030,fore:#afaf87,bold'
 lexers.STYLE_SEPARATOR = ''
 lexers.STYLE_INFO = ''
 lexers.STYLE_EOF = 'fore:#585858'
+lexers.STYLE_SEARCH = 'back:#5f5f00,fore:#ffffaf'
@@ -48,36 +48,143 @@ vis:option_register("horizon", "number", function(horizon)
 	return true
 end, "Number of bytes to consider for syntax highlighting")
 
+-- Positions at which a token started when the file was last lexed, lexing
+-- can resume there instead of guessing the initial state. They are kept per
+-- file, sorted and at least checkpoint_interval bytes apart. Those within
+-- checkpoint_margin bytes of a change or of the end of the lexed data are
+-- not trusted, since a token might extend across them or depend on text
+-- following them. Only a lex which started at the beginning of the file or
+-- at a checkpoint adds new ones, a guessed initial state might be wrong.
+local checkpoint_interval = 4096
+local checkpoint_margin = 1024
+local lexer_checkpoints = setmetatable({}, { __mode = 'k' })
+
+local checkpoints_get = function(file, syntax)
+	local checkpoints = lexer_checkpoints[file]
+	if not checkpoints or checkpoints.syntax ~= syntax then
+		checkpoints = { syntax = syntax, generation = file.generation }
+		lexer_checkpoints[file] = checkpoints
+		return checkpoints
+	end
+	local changed = file:changed_since(checkpoints.generation)
+	if changed then
+		while #checkpoints > 0 and checkpoints[#checkpoints] + checkpoint_margin > changed do
+			checkpoints[#checkpoints] = nil
+		end
+		if checkpoints.lexed and checkpoints.lexed > changed then
+			checkpoints.lexed = changed
+		end
+		checkpoints.generation = file.generation
+	end
+	return checkpoints
+end
+
+-- index of the last checkpoint at or before pos, 0 if there is none
+local checkpoints_find = function(checkpoints, pos)
+	local lo, hi = 1, #checkpoints
+	while lo <= hi do
+		local mid = math.floor((lo + hi) / 2)
+		if checkpoints[mid] <= pos then
+			lo = mid + 1
+		else
+			hi = mid - 1
+		end
+	end
+	return hi
+end
+
+-- remember token boundaries of data lexed from lex_start, index is the
+-- one of the last checkpoint at or before lex_start
+local checkpoints_add = function(checkpoints, index, tokens, lex_start, lex_end, eof)
+	local last = checkpoints[index] or 0
+	for i = 2, #tokens - 2, 2 do
+		local pos = lex_start + tokens[i] - 1
+		if not eof and pos + checkpoint_margin > lex_end then break end
+		while checkpoints[index+1] and checkpoints[index+1] <= pos do
+			index = index + 1
+			last = checkpoints[index]
+		end
+		local next = checkpoints[index+1]
+		if pos - last >= checkpoint_interval and (not next or next - pos >= checkpoint_interval) then
+			index = index + 1
+			table.insert(checkpoints, index, pos)
+			last = pos
+		end
+	end
+end
+
 vis.events.subscribe(vis.events.WIN_HIGHLIGHT, function(win)
 	if not win.syntax or not vis.lexers.load then return end
 	local lexer = vis.lexers.load(win.syntax, nil, true)
 	if not lexer then return end
 
-	-- TODO: improve heuristic for initial style
 	local viewport = win.viewport.bytes
 	if not viewport then return end
-	local horizon_max = win.horizon or 32768
-	local horizon = viewport.start < horizon_max and viewport.start or horizon_max
+	local file = win.file
 	local view_start = viewport.start
-	local lex_start = viewport.start - horizon
+	local checkpoints = checkpoints_get(file, win.syntax)
+	local index = checkpoints_find(checkpoints, view_start)
+	local lex_start = checkpoints[index] or 0
+	local horizon = win.horizon or 32768
+	local trusted = view_start - lex_start <= horizon
+	if not trusted then
+		-- no checkpoint close enough, guess the initial state
+		lex_start = view_start - horizon
+	end
 	viewport.start = lex_start
-	local data = win.file:content(viewport)
+	local data = file:content(viewport)
 	local token_styles = lexer._TAGS
 	local tokens = lexer:lex(data, 1)
-	local token_end = lex_start + (tokens[#tokens] or 1) - 1
+	if trusted then
+		checkpoints_add(checkpoints, index, tokens, lex_start, viewport.finish, viewport.finish == file.size)
+	end
+	win:style_tokens(tokens, lex_start, token_styles)
+	-- kept for win:token_at
+	win.tokens = { tokens = tokens, start = lex_start, syntax = win.syntax, generation = file.generation }
+end)
 
-	for i = #tokens - 1, 1, -2 do
-		local token_start = lex_start + (tokens[i-1] or 1) - 1
-		if token_end < view_start then
-			break
-		end
-		local name = tokens[i]
-		local style = token_styles[name]
-		if style ~= nil then
-			win:style(style, token_start, token_end)
-		end
-		token_end = token_start - 1
+-- While idle, lex the displayed files in slices of background_slice bytes
+-- to add checkpoints up to and ahead of the viewport. checkpoints.lexed
+-- is the position up to which this has been done, always continuing from
+-- a checkpoint, scrolling or jumping within that region then resumes
+-- lexing close to the new viewport.
+local background_slice = 65536
+local background_ahead = 1048576
+
+-- lex the next slice for win, returns whether more remain
+local background_lex = function(win)
+	if not win.syntax then return false end
+	local viewport = win.viewport.bytes
+	if not viewport then return false end
+	local file = win.file
+	local checkpoints = checkpoints_get(file, win.syntax)
+	local target = math.min(file.size, viewport.finish + background_ahead)
+	local lexed = checkpoints.lexed or 0
+	if lexed >= target then return false end
+	local lexer = vis.lexers.load(win.syntax, nil, true)
+	if not lexer then return false end
+	local index = checkpoints_find(checkpoints, lexed)
+	local lex_start = checkpoints[index] or 0
+	-- a token longer than the horizon, the lexer is not resumed from a guess
+	if lexed - lex_start > (win.horizon or 32768) then return false end
+	local lex_end = math.min(lexed + background_slice, file.size)
+	local data = file:content(lex_start, lex_end - lex_start)
+	if not data then return false end
+	local tokens = lexer:lex(data, 1)
+	checkpoints_add(checkpoints, index, tokens, lex_start, lex_end, lex_end == file.size)
+	checkpoints.lexed = lex_end
+	return lex_end < target
+end
+
+vis.events.subscribe(vis.events.IDLE, function()
+	if not vis.lexers.load then return false end
+	-- the focused window first, then at most one slice per idle event
+	local win = vis.win
+	if win and background_lex(win) then return true end
+	for w in vis:windows() do
+		if w ~= win and background_lex(w) then return true end
 	end
+	return false
 end)
 
 local modes = {
@@ -101,7 +208,9 @@ vis.events.subscribe(vis.events.WIN_STATUS, function(win)
 	end
 
 	table.insert(left_parts, (file.name or '[No Name]') ..
-		(file.modified and ' [+]' or '') .. (vis.recording and ' @' or ''))
+		(file.modified and ' [+]' or '') .. (file.loading and ' [loading]' or '') ..
+		(file.saving and ' [saving '..file.saving..'%]' or '') ..
+		(vis.recording and ' @' or ''))
 
 	local count = vis.count
 	local keys = vis.input_queue
@@ -115,6 +224,11 @@ vis.events.subscribe(vis.events.WIN_STATUS, function(win)
 		table.insert(right_parts, selection.number..'/'..#win.selections)
 	end
 
+	local match, matches, complete = file:search_count(selection.pos or 0)
+	if match and match > 0 then
+		table.insert(right_parts, '['..match..'/'..matches..(complete and '' or '+')..']')
+	end
+
 	local size = file.size
 	local pos = selection.pos
 	if not pos then pos = 0 end
@@ -128,6 +242,10 @@ vis.events.subscribe(vis.events.WIN_STATUS, function(win)
 		end
 	end
 
+	if vis.options.showstats then
+		table.insert(right_parts, string.format('%.1fms', vis.stats.frame.frame_time * 1000))
+	end
+
 	local left = ' ' .. table.concat(left_parts, " » ") .. ' '
 	local right = ' ' .. table.concat(right_parts, " « ") .. ' '
 	win:status(left, right);
@@ -121,6 +121,10 @@ elseif not vis:module_exist('lexer') then
 	vis:info('WARNING: could not find lexer module')
 else
 	vis.lexers = require('lexer')
+	-- compile lexers only once, see vis:loadfile
+	vis.lexers.loadfile = function(filename, _, env)
+		return vis:loadfile(filename, env)
+	end
 
 	--- Cache of loaded lexers
 	--
@@ -169,6 +173,7 @@ local events = {
 	TERM_CSI = "Event::TERM_CSI", -- see @{term_csi}
 	PROCESS_RESPONSE = "Event::PROCESS_RESPONSE", -- see @{process_response}
 	UI_DRAW = "Event::UI_DRAW", -- see @{ui_draw}
+	IDLE = "Event::IDLE", -- see @{idle}
 }
 
 events.file_close = function(...) events.emit(events.FILE_CLOSE, ...) end
@@ -189,6 +194,17 @@ events.ui_draw = function(...) events.emit(events.UI_DRAW, ...) end
 
 local handlers = {}
 
+events.idle = function()
+	-- every handler gets its share of the idle time
+	local h = handlers[events.IDLE]
+	if not h then return false end
+	local pending = false
+	for i = 1, #h do
+		if h[i]() then pending = true end
+	end
+	return pending
+end
+
 --- Subscribe to an event.
 --
 -- Register an event handler.
@@ -206,6 +222,7 @@ events.subscribe = function(event, handler, index)
 	if not handlers[event] then handlers[event] = {} end
 	events.unsubscribe(event, handler)
 	table.insert(handlers[event], index or #handlers[event]+1, handler)
+	vis:event_subscribers(event, #handlers[event])
 end
 
 --- Unsubscribe from an event.
@@ -220,6 +237,7 @@ events.unsubscribe = function(event, handler)
 	for i = 1, #h do
 		if h[i] == handler then
 			table.remove(h, i)
+			vis:event_subscribers(event, #h)
 			return true
 		end
 	end
@@ -251,6 +269,14 @@ vis.events = events
 --- The file type associated with this window.
 -- @tfield string syntax the syntax lexer name or `nil` if unset
 
+--- The lexer tokens computed by the latest syntax highlighting.
+--
+-- A table holding the `tokens` as returned by `lexer:lex`, the absolute
+-- file position `start` of the lexed text, the `syntax` and the file
+-- `generation` they belong to, is `nil` if none are available.
+-- @tfield table tokens
+-- @see token_at
+
 --- Change syntax lexer to use for this window
 -- @function set_syntax
 -- @tparam string syntax the syntax lexer name or `nil` to disable syntax highlighting
@@ -272,6 +298,7 @@ vis.types.window.set_syntax = function(win, syntax)
 	win:style_define(win.STYLE_SEPARATOR, lexers.STYLE_SEPARATOR or '')
 	win:style_define(win.STYLE_INFO, lexers.STYLE_INFO or '')
 	win:style_define(win.STYLE_EOF, lexers.STYLE_EOF or '')
+	win:style_define(win.STYLE_SEARCH, lexers.STYLE_SEARCH or '')
 
 	if syntax == nil or syntax == 'off' then
 		win.syntax = nil
@@ -302,6 +329,41 @@ vis.types.window.set_syntax = function(win, syntax)
 	return true
 end
 
+--- Find the lexer token at a given position.
+--
+-- Uses the tokens computed by the latest syntax highlighting of the window
+-- instead of lexing again, they cover the viewport and some text before it.
+-- @function token_at
+-- @tparam int pos the absolute file position
+-- @treturn int start,finish,string the range of the token and its name, or `nil` if
+--  the position is not covered or the file was modified in the meantime
+vis.types.window.token_at = function(win, pos)
+	local cache = win.tokens
+	local file = win.file
+	if not cache or cache.syntax ~= win.syntax or cache.generation ~= file.generation then
+		return nil
+	end
+	local tokens, start = cache.tokens, cache.start
+	local rel = pos - start + 1
+	local count = math.floor(#tokens / 2)
+	if rel < 1 or count == 0 or tokens[2*count] <= rel then return nil end
+	-- the first token ending after pos
+	local lo, hi = 1, count
+	while lo < hi do
+		local mid = math.floor((lo + hi) / 2)
+		if tokens[2*mid] > rel then
+			hi = mid
+		else
+			lo = mid + 1
+		end
+	end
+	local finish = start + tokens[2*lo] - 1
+	-- the last token might continue beyond the lexed text
+	if lo == count and finish < file.size then return nil end
+	local first = lo > 1 and tokens[2*lo-2] or 1
+	return start + first - 1, finish, tokens[2*lo-1]
+end
+
 ---
 -- @type File
 
@@ -1286,7 +1286,6 @@ static const char *selections_new(Vis *vis, const char *keys, const Arg *arg) {
 
 static const char *selections_align(Vis *vis, const char *keys, const Arg *arg) {
 	View *view = vis_view(vis);
-	Text *txt = vis_text(vis);
 	int mincol = INT_MAX;
 	for (Selection *s = view_selections(view); s; s = view_selections_next(s)) {
 		if (!s->line)
@@ -1297,7 +1296,7 @@ static const char *selections_align(Vis *vis, const char *keys, const Arg *arg)
 	for (Selection *s = view_selections(view); s; s = view_selections_next(s)) {
 		if (view_cursors_cell_set(s, mincol) == -1) {
 			size_t pos = view_cursors_pos(s);
-			size_t col = text_line_width_set(txt, pos, mincol);
+			size_t col = view_line_width_set(view, pos, mincol);
 			view_cursors_to(s, col);
 		}
 	}
@@ -1315,7 +1314,7 @@ static const char *selections_align_indent(Vis *vis, const char *keys, const Arg
 		for (Selection *s = view_selections_column(view, i); s; s = view_selections_column_next(s, i)) {
 			Filerange sel = view_selections_get(s);
 			size_t pos = left_align ? sel.start : sel.end;
-			int col = text_line_width_get(txt, pos);
+			int col = view_line_width_get(view, pos);
 			if (col < mincol)
 				mincol = col;
 			if (col > maxcol)
@@ -1332,7 +1331,7 @@ static const char *selections_align_indent(Vis *vis, const char *keys, const Arg
 			Filerange sel = view_selections_get(s);
 			size_t pos = left_align ? sel.start : sel.end;
 			size_t ipos = sel.start;
-			int col = text_line_width_get(txt, pos);
+			int col = view_line_width_get(view, pos);
 			if (col < maxcol) {
 				size_t off = maxcol - col;
 				if (off <= len)
@@ -2214,6 +2213,8 @@ static void signal_handler(int signum, siginfo_t *siginfo, void *context) {
 }
 
 int main(int argc, char *argv[]) {
+	double start = vis_time();
+	const char *startuptime = NULL;
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] != '-') {
 			continue;
@@ -2221,6 +2222,11 @@ int main(int argc, char *argv[]) {
 			continue;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
+		} else if (strcmp(argv[i], "--startuptime") == 0) {
+			if (!(startuptime = argv[++i])) {
+				fprintf(stderr, "Missing file name for option: --startuptime\n");
+				return 1;
+			}
 		} else if (strcmp(argv[i], "-v") == 0) {
 			printf("vis %s%s%s%s%s%s%s\n", VERSION,
 			       CONFIG_CURSES  ? " +curses"  : "",
@@ -2239,6 +2245,8 @@ int main(int argc, char *argv[]) {
 	vis = vis_new();
 	if (!vis)
 		return EXIT_FAILURE;
+	if (startuptime && !vis_startuptime(vis, startuptime, start))
+		vis_die(vis, "Can not open '%s': %s\n", startuptime, strerror(errno));
 
 	vis_event_emit(vis, VIS_EVENT_INIT);
 
@@ -2270,7 +2278,8 @@ int main(int argc, char *argv[]) {
 	    sigaction(SIGCONT, &sa, NULL) == -1 ||
 	    sigaction(SIGWINCH, &sa, NULL) == -1 ||
 	    sigaction(SIGTERM, &sa, NULL) == -1 ||
-	    sigaction(SIGHUP, &sa, NULL) == -1) {
+	    sigaction(SIGHUP, &sa, NULL) == -1 ||
+	    sigaction(SIGCHLD, &sa, NULL) == -1) {
 		vis_die(vis, "Failed to set signal handler: %s\n", strerror(errno));
 	}
 
@@ -2285,6 +2294,7 @@ int main(int argc, char *argv[]) {
 	sigaddset(&blockset, SIGWINCH);
 	sigaddset(&blockset, SIGTERM);
 	sigaddset(&blockset, SIGHUP);
+	sigaddset(&blockset, SIGCHLD);
 	if (sigprocmask(SIG_BLOCK, &blockset, NULL) == -1)
 		vis_die(vis, "Failed to block signals\n");
 
@@ -2294,16 +2304,8 @@ int main(int argc, char *argv[]) {
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-' && !end_of_options) {
 			if (strcmp(argv[i], "-") == 0) {
-				if (!vis_window_new_fd(vis, STDOUT_FILENO))
-					vis_die(vis, "Can not create empty buffer\n");
-				ssize_t len = 0;
-				char buf[PIPE_BUF];
-				Text *txt = vis_text(vis);
-				while ((len = read(STDIN_FILENO, buf, sizeof buf)) > 0)
-					text_insert(txt, text_size(txt), buf, len);
-				if (len == -1)
-					vis_die(vis, "Can not read from stdin\n");
-				text_snapshot(txt);
+				if (!vis_window_new_stream(vis, dup(STDIN_FILENO), STDOUT_FILENO))
+					vis_die(vis, "Can not create buffer for stdin\n");
 				int fd = open("/dev/tty", O_RDWR);
 				if (fd == -1)
 					vis_die(vis, "Can not reopen stdin\n");
@@ -2312,11 +2314,14 @@ int main(int argc, char *argv[]) {
 			} else if (strcmp(argv[i], "--") == 0) {
 				end_of_options = true;
 				continue;
+			} else if (strcmp(argv[i], "--startuptime") == 0) {
+				i++;
+				continue;
 			}
 		} else if (argv[i][0] == '+' && !end_of_options) {
 			cmd = argv[i] + (argv[i][1] == '/' || argv[i][1] == '?');
 			continue;
-		} else if (!vis_window_new(vis, argv[i])) {
+		} else if (!(cmd ? vis_window_new(vis, argv[i]) : vis_window_new_deferred(vis, argv[i]))) {
 			vis_die(vis, "Can not load '%s': %s\n", argv[i], strerror(errno));
 		}
 		win_created = true;
@@ -2333,6 +2338,9 @@ int main(int argc, char *argv[]) {
 			vis_prompt_cmd(vis, cmd);
 	}
 
+	/* the remaining files are loaded once they are displayed */
+	vis_window_focus(vis->win);
+
 	int status = vis_run(vis);
 	vis_free(vis);
 	return status;
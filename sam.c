@@ -24,6 +24,9 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include "sam.h"
 #include "vis-core.h"
 #include "buffer.h"
@@ -34,10 +37,18 @@
 #include "util.h"
 
 #define MAX_ARGV 8
+/* ranges are searched in parallel in parts of at least this size */
+#define SAM_PARALLEL_SIZE (1 << 24)
+#define SAM_PARALLEL_JOBS 64
+/* files matched by X and Y are searched in advance if at least this large in total */
+#define SAM_PREFETCH_SIZE (1 << 20)
+/* number of search results extract collects at once */
+#define EXTRACT_BATCH 4096
 
 typedef struct Address Address;
 typedef struct Command Command;
 typedef struct CommandDef CommandDef;
+typedef struct SearchTask SearchTask;
 
 struct Change {
 	enum ChangeType {
@@ -54,6 +65,22 @@ struct Change {
 	int count;         /* how often should data be inserted? */
 };
 
+struct Filter {
+	enum FilterType {
+		FILTER_CHANGE,     /* replace range by the output */
+		FILTER_PIPEIN,     /* replace range by the output, no input */
+		FILTER_PIPEOUT,    /* pass range as input, ignore output */
+	} type;
+	PipeJob job;       /* the running or terminated process */
+	Win *win;          /* window in which the command was executed */
+	Selection *sel;    /* selection associated with the command, might be NULL */
+	Filerange range;   /* range with which the command was invoked */
+	Filter *next;      /* filter started subsequently */
+	File *file;        /* file modified by a filter running in the background */
+	size_t generation; /* text generation when the background filter was started */
+	Mark start, end;   /* range of the background filter, following modifications */
+};
+
 struct Address {
 	char type;      /* # (char) l (line) g (goto line) / ? . $ + - , ; % ' */
 	Regex *regex;   /* NULL denotes default for x, y, X, and Y commands */
@@ -77,6 +104,14 @@ struct Command {
 	char flags;               /* command specific flags */
 	Command *cmd;             /* target of x, y, g, v, X, Y, { */
 	Command *next;            /* next command in {} group */
+	SearchTask *prefetch;     /* results of searches performed in advance by X and Y */
+	size_t prefetch_count;    /* number of prefetched searches */
+	struct {
+		double address;   /* seconds spent evaluating the address */
+		double time;      /* seconds spent executing, including nested commands */
+		size_t matches;   /* number of ranges found by x, y, g, v */
+		size_t bytes;     /* number of bytes searched by x, y, g, v */
+	} profile;                /* collected if the samprofile option is enabled */
 };
 
 struct CommandDef {
@@ -302,8 +337,17 @@ enum {
 	OPTION_CHANGE_256COLORS,
 	OPTION_LAYOUT,
 	OPTION_IGNORECASE,
+	OPTION_HLSEARCH,
 	OPTION_BREAKAT,
 	OPTION_WRAP_COLUMN,
+	OPTION_FILTER_JOBS,
+	OPTION_FILTER_ASYNC,
+	OPTION_AUTORELOAD,
+	OPTION_SAM_PROFILE,
+	OPTION_MAXFPS,
+	OPTION_SHOW_STATS,
+	OPTION_HISTORY_REVISIONS,
+	OPTION_HISTORY_MEMORY,
 };
 
 static const OptionDef options[] = {
@@ -402,6 +446,11 @@ static const OptionDef options[] = {
 		VIS_OPTION_TYPE_BOOL,
 		VIS_HELP("Ignore case when searching")
 	},
+	[OPTION_HLSEARCH] = {
+		{ "hlsearch", "hls" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Highlight the visible matches of the search pattern")
+	},
 	[OPTION_BREAKAT] = {
 		{ "breakat", "brk" },
 		VIS_OPTION_TYPE_STRING|VIS_OPTION_NEED_WINDOW,
@@ -412,6 +461,46 @@ static const OptionDef options[] = {
 		VIS_OPTION_TYPE_NUMBER|VIS_OPTION_NEED_WINDOW,
 		VIS_HELP("Wrap lines at minimum of window width and wrapcolumn")
 	},
+	[OPTION_FILTER_JOBS] = {
+		{ "filterjobs", "fj" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Number of filter commands run concurrently")
+	},
+	[OPTION_FILTER_ASYNC] = {
+		{ "filterasync", "fa" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Run a single filter command in the background")
+	},
+	[OPTION_AUTORELOAD] = {
+		{ "autoreload", "ar" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Load content appended to unmodified files on disk")
+	},
+	[OPTION_SAM_PROFILE] = {
+		{ "samprofile" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Report the time spent in each part of a sam command")
+	},
+	[OPTION_MAXFPS] = {
+		{ "maxfps" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximum number of screen updates per second, 0 for no limit")
+	},
+	[OPTION_SHOW_STATS] = {
+		{ "showstats" },
+		VIS_OPTION_TYPE_BOOL,
+		VIS_HELP("Display the time taken by the latest frame in the status bar")
+	},
+	[OPTION_HISTORY_REVISIONS] = {
+		{ "historyrevisions", "hr" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximum number of revisions kept in the undo history of a file, 0 for no limit")
+	},
+	[OPTION_HISTORY_MEMORY] = {
+		{ "historymemory", "hm" },
+		VIS_OPTION_TYPE_NUMBER,
+		VIS_HELP("Maximum memory in MiB used by the undo history of a file, 0 for no limit")
+	},
 };
 
 bool sam_init(Vis *vis) {
@@ -510,6 +599,34 @@ static void sam_transcript_free(Transcript *t) {
 		next = c->next;
 		change_free(c);
 	}
+	for (Filter *f = t->filters, *next; f; f = next) {
+		next = f->next;
+		vis_pipe_job_release(&f->job);
+		free(f);
+	}
+}
+
+/* apply all changes of the transcript to the text in one go */
+static bool sam_transcript_apply(Transcript *t, Text *txt) {
+	size_t count = 0;
+	for (Change *c = t->changes; c; c = c->next)
+		count++;
+	if (count == 0)
+		return true;
+	TextEdit *edits = calloc(count, sizeof *edits), *e = edits;
+	if (!edits)
+		return false;
+	for (Change *c = t->changes; c; c = c->next, e++) {
+		e->range = c->range;
+		if (c->type & TRANSCRIPT_INSERT) {
+			e->data = c->data;
+			e->len = c->len;
+			e->count = c->count;
+		}
+	}
+	bool ret = text_batch(txt, edits, count);
+	free(edits);
+	return ret;
 }
 
 static bool sam_insert(Win *win, Selection *sel, size_t pos, const char *data, size_t len, int count) {
@@ -537,6 +654,328 @@ static bool sam_change(Win *win, Selection *sel, Filerange *range, const char *d
 	return c;
 }
 
+/* number of filter processes which are still running, across all files */
+static size_t filter_running(Vis *vis) {
+	size_t running = 0;
+	for (File *file = vis->files; file; file = file->next) {
+		if (!file->internal)
+			running += file->transcript.running;
+	}
+	return running;
+}
+
+static void filter_reap(Transcript *t) {
+	while (t->pending && t->pending->job.pid == -1)
+		t->pending = t->pending->next;
+}
+
+/* service the running filters until at most max of them remain, all of
+ * them are terminated if the command is interrupted */
+static bool filter_wait(Vis *vis, size_t max) {
+	if (filter_running(vis) <= max)
+		return true;
+	bool ret = true;
+	Array fds;
+	array_init_sized(&fds, 3 * sizeof(struct pollfd));
+	ui_terminal_save(&vis->ui, false);
+	while (filter_running(vis) > max) {
+		if (vis->interrupted) {
+			ret = false;
+			break;
+		}
+		array_clear(&fds);
+		for (File *file = vis->files; file; file = file->next) {
+			if (file->internal)
+				continue;
+			for (Filter *f = file->transcript.pending; f; f = f->next) {
+				struct pollfd job[3];
+				vis_pipe_job_fds(&f->job, job);
+				if (!array_add(&fds, job)) {
+					ret = false;
+					goto out;
+				}
+			}
+		}
+		if (poll(array_get(&fds, 0), 3 * array_length(&fds), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			vis_info_show(vis, "Poll failure");
+			ret = false;
+			break;
+		}
+		size_t i = 0;
+		for (File *file = vis->files; file; file = file->next) {
+			if (file->internal)
+				continue;
+			Transcript *t = &file->transcript;
+			for (Filter *f = t->pending; f; f = f->next) {
+				/* the command is synchronous, a child which closed its
+				 * output but keeps running is waited for */
+				if (vis_pipe_job_io(vis, &f->job, array_get(&fds, i++)) ||
+				    vis_pipe_job_wait(&f->job, true))
+					t->running--;
+			}
+			filter_reap(t);
+		}
+	}
+out:
+	array_release(&fds);
+	if (!ret) {
+		for (File *file = vis->files; file; file = file->next) {
+			if (file->internal)
+				continue;
+			Transcript *t = &file->transcript;
+			for (Filter *f = t->pending; f; f = f->next) {
+				if (f->job.pid != -1) {
+					vis_pipe_job_cancel(&f->job);
+					t->running--;
+				}
+			}
+			filter_reap(t);
+		}
+	}
+	ui_terminal_restore(&vis->ui);
+	return ret;
+}
+
+/* whether the command should be run in the background, concurrently to others */
+static bool filter_concurrent(Vis *vis, Win *win, Filerange *range) {
+	return vis->filter_jobs > 1 && !win->file->internal && text_range_valid(range);
+}
+
+static bool filter_start(Vis *vis, Win *win, enum FilterType type, const char *argv[], Selection *sel, Filerange *range) {
+	if (filter_running(vis) >= (size_t)vis->filter_jobs && !filter_wait(vis, vis->filter_jobs - 1))
+		return false;
+	Filter *f = calloc(1, sizeof *f);
+	if (!f)
+		return false;
+	f->type = type;
+	f->win = win;
+	f->sel = sel;
+	f->range = *range;
+	Filerange input = type == FILTER_PIPEIN ? text_range_new(range->end, range->end) : *range;
+	if (!vis_pipe_job_start(vis, &f->job, win->file, &input, argv, type != FILTER_PIPEOUT)) {
+		free(f);
+		return false;
+	}
+	Transcript *t = &win->file->transcript;
+	if (t->filters_last)
+		t->filters_last->next = f;
+	else
+		t->filters = f;
+	t->filters_last = f;
+	if (!t->pending)
+		t->pending = f;
+	t->running++;
+	return true;
+}
+
+/* record the output of all terminated filters in the transcript */
+static void filter_apply(Vis *vis, Transcript *t) {
+	for (Filter *f = t->filters; f; f = f->next) {
+		PipeJob *job = &f->job;
+		if (job->status != 0) {
+			if (!vis->interrupted)
+				vis_info_show(vis, "Command failed %s", buffer_content0(&job->error));
+			continue;
+		}
+		if (f->type == FILTER_PIPEOUT)
+			continue;
+		Filerange range = f->range;
+		if (f->type == FILTER_PIPEIN)
+			range.start = range.end;
+		size_t len = buffer_length(&job->output);
+		char *data = buffer_move(&job->output);
+		if (!sam_change(f->win, f->sel, &range, data, len, 1))
+			free(data);
+		if (f->type == FILTER_PIPEIN)
+			sam_delete(f->win, NULL, &f->range);
+	}
+}
+
+/* whether the command should return while the filter runs in the background */
+static bool filter_async(Vis *vis, Win *win, Filerange *range) {
+	return win->file->transcript.background && !win->file->internal && text_range_valid(range);
+}
+
+static WatchFunction filter_ready;
+
+/* un/register the descriptors of a background filter with the main loop */
+static bool filter_watch(Vis *vis, Filter *f, bool watch) {
+	PipeJob *job = &f->job;
+	if (!watch) {
+		vis_unwatch(vis, job->in);
+		vis_unwatch(vis, job->out);
+		vis_unwatch(vis, job->err);
+		return true;
+	}
+	return (job->in == -1 || vis_watch(vis, job->in, POLLOUT, filter_ready, f)) &&
+	       (job->out == -1 || vis_watch(vis, job->out, POLLIN, filter_ready, f)) &&
+	       (job->err == -1 || vis_watch(vis, job->err, POLLIN, filter_ready, f));
+}
+
+static void filter_free(Vis *vis, Filter *f) {
+	for (Filter **p = &f->file->background; *p; p = &(*p)->next) {
+		if (*p == f) {
+			*p = f->next;
+			break;
+		}
+	}
+	vis_pipe_job_release(&f->job);
+	free(f);
+}
+
+/* whether the range of a background filter still has the content it had when
+ * the filter was started, range is set to its current position */
+static bool filter_unchanged(Filter *f, Filerange *range) {
+	Text *txt = f->file->text;
+	size_t changed = text_changed_since(txt, f->generation);
+	if (changed == EPOS || changed >= f->range.end) {
+		*range = f->range;
+		return true;
+	}
+	range->start = text_mark_get(txt, f->start);
+	range->end = text_mark_get(txt, f->end);
+	if (range->start == EPOS || range->end == EPOS || range->start > range->end ||
+	    text_range_size(range) != text_range_size(&f->range))
+		return false;
+	size_t pos = f->range.start;
+	const char *chunk;
+	size_t len;
+	for (Iterator it = text_iterator_get(txt, range->start);
+	     text_iterator_chunk_next(&it, range->end, &chunk, &len); ) {
+		while (len > 0) {
+			size_t frozen_len;
+			const char *frozen = text_frozen_chunk(f->job.frozen, pos, &frozen_len);
+			if (!frozen)
+				return false;
+			size_t n = MIN(len, frozen_len);
+			if (memcmp(chunk, frozen, n) != 0)
+				return false;
+			chunk += n;
+			len -= n;
+			pos += n;
+		}
+	}
+	return true;
+}
+
+/* replace the range of a terminated background filter by its output */
+static void filter_finish(Vis *vis, Filter *f) {
+	PipeJob *job = &f->job;
+	File *file = f->file;
+	Filerange range;
+	if (job->status != 0) {
+		vis_info_show(vis, "Command failed %s", buffer_content0(&job->error));
+	} else if (f->type != FILTER_PIPEOUT) {
+		if (!filter_unchanged(f, &range)) {
+			vis_info_show(vis, "Command output discarded, its input was modified meanwhile");
+		} else {
+			TextEdit edit = {
+				.range = range,
+				.data = buffer_content(&job->output),
+				.len = buffer_length(&job->output),
+				.count = 1,
+			};
+			vis_file_snapshot(vis, file);
+			text_batch(file->text, &edit, 1);
+			vis_file_snapshot(vis, file);
+		}
+	}
+	filter_free(vis, f);
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file == file)
+			view_draw(&win->view);
+	}
+}
+
+/* perform the I/O of a background filter once one of its descriptors is ready */
+static void filter_ready(Vis *vis, int fd, short revents, void *data) {
+	Filter *f = data;
+	PipeJob *job = &f->job;
+	int in = job->in, out = job->out, err = job->err;
+	struct pollfd fds[3];
+	vis_pipe_job_fds(job, fds);
+	for (size_t i = 0; i < LENGTH(fds); i++)
+		fds[i].revents = fds[i].fd == fd ? revents : 0;
+	bool done = vis_pipe_job_io(vis, job, fds);
+	if (in != -1 && job->in == -1)
+		vis_unwatch(vis, in);
+	if (out != -1 && job->out == -1)
+		vis_unwatch(vis, out);
+	if (err != -1 && job->err == -1)
+		vis_unwatch(vis, err);
+	if (done)
+		filter_finish(vis, f);
+}
+
+/* start a filter which runs against a snapshot of the text, while the
+ * editor remains responsive. Its output is applied once it terminated */
+static bool filter_detach(Vis *vis, Win *win, enum FilterType type, const char *argv[], Filerange *range) {
+	File *file = win->file;
+	Filter *f = calloc(1, sizeof *f);
+	if (!f)
+		return false;
+	f->type = type;
+	f->range = *range;
+	f->file = file;
+	Filerange input = type == FILTER_PIPEIN ? text_range_new(range->end, range->end) : *range;
+	if (!vis_pipe_job_start(vis, &f->job, file, &input, argv, type != FILTER_PIPEOUT)) {
+		free(f);
+		return false;
+	}
+	f->job.frozen = text_freeze(file->text);
+	f->generation = text_generation(file->text);
+	f->start = text_mark_set(file->text, range->start);
+	f->end = text_mark_set(file->text, range->end);
+	f->next = file->background;
+	file->background = f;
+	if (!f->job.frozen || !filter_watch(vis, f, true)) {
+		filter_watch(vis, f, false);
+		vis_pipe_job_cancel(&f->job);
+		filter_free(vis, f);
+		return false;
+	}
+	return true;
+}
+
+int file_filter_progress(File *file) {
+	size_t total = 0, written = 0;
+	for (Filter *f = file->background; f; f = f->next) {
+		size_t size = f->type == FILTER_PIPEIN ? 0 : text_range_size(&f->range);
+		total += size;
+		written += size - text_range_size(&f->job.input);
+	}
+	if (!file->background)
+		return -1;
+	return total ? (int)((double)written / total * 100) : 100;
+}
+
+bool file_filter_cancel(Vis *vis, File *file) {
+	bool cancelled = false;
+	for (File *it = file ? file : vis->files; it; it = file ? NULL : it->next) {
+		while (it->background) {
+			Filter *f = it->background;
+			filter_watch(vis, f, false);
+			vis_pipe_job_cancel(&f->job);
+			filter_free(vis, f);
+			cancelled = true;
+		}
+	}
+	return cancelled;
+}
+
+void file_filter_reap(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next) {
+		for (Filter *f = file->background; f; ) {
+			Filter *next = f->next;
+			if (vis_pipe_job_wait(&f->job, false))
+				filter_finish(vis, f);
+			f = next;
+		}
+	}
+}
+
 static Address *address_new(void) {
 	Address *addr = calloc(1, sizeof *addr);
 	if (addr)
@@ -544,12 +983,12 @@ static Address *address_new(void) {
 	return addr;
 }
 
-static void address_free(Address *addr) {
+static void address_free(Vis *vis, Address *addr) {
 	if (!addr)
 		return;
-	text_regex_free(addr->regex);
-	address_free(addr->left);
-	address_free(addr->right);
+	vis_regex_free(vis, addr->regex);
+	address_free(vis, addr->left);
+	address_free(vis, addr->right);
 	free(addr);
 }
 
@@ -790,7 +1229,7 @@ static Address *address_parse_simple(Vis *vis, const char **s, enum SamError *er
 			if (addr.type != '+' && addr.type != '-') {
 				Address *plus = address_new();
 				if (!plus) {
-					address_free(addr.right);
+					address_free(vis, addr.right);
 					return NULL;
 				}
 				plus->type = '+';
@@ -803,7 +1242,7 @@ static Address *address_parse_simple(Vis *vis, const char **s, enum SamError *er
 
 	Address *ret = address_new();
 	if (!ret) {
-		address_free(addr.right);
+		address_free(vis, addr.right);
 		return NULL;
 	}
 	*ret = addr;
@@ -838,8 +1277,8 @@ static Address *address_parse_compound(Vis *vis, const char **s, enum SamError *
 	}
 
 fail:
-	address_free(left);
-	address_free(right);
+	address_free(vis, left);
+	address_free(vis, right);
 	return NULL;
 }
 
@@ -854,19 +1293,19 @@ static Command *command_new(const char *name) {
 	return cmd;
 }
 
-static void command_free(Command *cmd) {
+static void command_free(Vis *vis, Command *cmd) {
 	if (!cmd)
 		return;
 
 	for (Command *c = cmd->cmd, *next; c; c = next) {
 		next = c->next;
-		command_free(c);
+		command_free(vis, c);
 	}
 
 	for (const char **args = cmd->argv; *args; args++)
 		free((void*)*args);
-	address_free(cmd->address);
-	text_regex_free(cmd->regex);
+	address_free(vis, cmd->address);
+	vis_regex_free(vis, cmd->regex);
 	free(cmd);
 }
 
@@ -927,7 +1366,7 @@ static Command *command_parse(Vis *vis, const char **s, enum SamError *err) {
 			*err = SAM_ERR_UNMATCHED_BRACE;
 			goto fail;
 		}
-		command_free(cmd);
+		command_free(vis, cmd);
 		return NULL;
 	}
 
@@ -996,7 +1435,7 @@ static Command *command_parse(Vis *vis, const char **s, enum SamError *err) {
 
 	return cmd;
 fail:
-	command_free(cmd);
+	command_free(vis, cmd);
 	return NULL;
 }
 
@@ -1010,13 +1449,13 @@ static Command *sam_parse(Vis *vis, const char *cmd, enum SamError *err) {
 		(*s)++;
 	if (**s) {
 		*err = SAM_ERR_NEWLINE;
-		command_free(c);
+		command_free(vis, c);
 		return NULL;
 	}
 
 	Command *sel = command_new("select");
 	if (!sel) {
-		command_free(c);
+		command_free(vis, c);
 		return NULL;
 	}
 	sel->cmd = c;
@@ -1139,10 +1578,27 @@ static bool count_evaluate(Command *cmd) {
 	return count->start <= cmd->iteration && cmd->iteration <= count->end;
 }
 
+/* append one line per command node, nested commands are indented */
+static void profile_report(Buffer *buf, Command *cmd, int depth) {
+	for (; cmd; cmd = cmd->next) {
+		const char *arg = cmd->argv[1] ? cmd->argv[1] : "";
+		int len = strcspn(arg, "\n");
+		int width = 24 - 2*depth - (int)strlen(cmd->argv[0]);
+		buffer_appendf(buf, "%*s%s %-*.*s %8d %9zu %12zu %9.3f %9.3f\n", 2*depth, "",
+		               cmd->argv[0], width < 0 ? 0 : width, len > 16 ? 16 : len, arg,
+		               cmd->iteration, cmd->profile.matches, cmd->profile.bytes,
+		               cmd->profile.address * 1e3, cmd->profile.time * 1e3);
+		profile_report(buf, cmd->cmd, depth+1);
+	}
+}
+
 static bool sam_execute(Vis *vis, Win *win, Command *cmd, Selection *sel, Filerange *range) {
 	bool ret = true;
+	double start = vis->sam_profile ? vis_time() : 0;
 	if (cmd->address && win)
 		*range = address_evaluate(cmd->address, win->file, sel, range, 0);
+	if (vis->sam_profile)
+		cmd->profile.address += vis_time() - start;
 
 	cmd->iteration++;
 	switch (cmd->argv[0][0]) {
@@ -1157,6 +1613,8 @@ static bool sam_execute(Vis *vis, Win *win, Command *cmd, Selection *sel, Filera
 		ret = cmd->cmddef->func(vis, win, cmd, cmd->argv, sel, range);
 		break;
 	}
+	if (vis->sam_profile)
+		cmd->profile.time += vis_time() - start;
 	return ret;
 }
 
@@ -1221,14 +1679,23 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 
 	err = command_validate(cmd);
 	if (err != SAM_ERR_OK) {
-		command_free(cmd);
+		command_free(vis, cmd);
 		return err;
 	}
 
+	if (vis->win)
+		file_load(vis, vis->win->file);
+
+	/* a lone filter command does not need to wait for its output */
+	Command *c = cmd->cmd;
+	bool background = vis->filter_async && c && !c->next &&
+		(c->cmddef->func == cmd_filter || c->cmddef->func == cmd_pipein || c->cmddef->func == cmd_pipeout);
+
 	for (File *file = vis->files; file; file = file->next) {
 		if (file->internal)
 			continue;
 		sam_transcript_init(&file->transcript);
+		file->transcript.background = background;
 	}
 
 	bool visual = vis->mode->visual;
@@ -1236,6 +1703,21 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 	Filerange range = text_range_empty();
 	sam_execute(vis, vis->win, cmd, NULL, &range);
 
+	/* wait for all filters which were run concurrently */
+	double filter_time = vis_time();
+	bool filtered = filter_wait(vis, 0);
+	for (File *file = vis->files; file; file = file->next) {
+		if (!file->internal)
+			filter_apply(vis, &file->transcript);
+	}
+	if (!filtered && vis->interrupted) {
+		vis_info_show(vis, "Command cancelled");
+		vis->interrupted = false;
+	}
+	filter_time = vis_time() - filter_time;
+
+	double transcript_time = vis_time();
+	size_t changes = 0;
 	for (File *file = vis->files; file; file = file->next) {
 		if (file->internal)
 			continue;
@@ -1246,12 +1728,16 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 			continue;
 		}
 		vis_file_snapshot(vis, file);
+		/* if the bulk application fails, modify the text change by change */
+		bool applied = sam_transcript_apply(t, file->text);
 		ptrdiff_t delta = 0;
 		for (Change *c = t->changes; c; c = c->next) {
+			changes++;
 			c->range.start += delta;
 			c->range.end += delta;
 			if (c->type & TRANSCRIPT_DELETE) {
-				text_delete_range(file->text, &c->range);
+				if (!applied)
+					text_delete_range(file->text, &c->range);
 				delta -= text_range_size(&c->range);
 				if (c->sel && c->type == TRANSCRIPT_DELETE) {
 					if (visual)
@@ -1262,7 +1748,8 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 			}
 			if (c->type & TRANSCRIPT_INSERT) {
 				for (int i = 0; i < c->count; i++) {
-					text_insert(file->text, c->range.start, c->data, c->len);
+					if (!applied)
+						text_insert(file->text, c->range.start, c->data, c->len);
 					delta += c->len;
 				}
 				Filerange r = text_range_new(c->range.start,
@@ -1289,6 +1776,7 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 		sam_transcript_free(&file->transcript);
 		vis_file_snapshot(vis, file);
 	}
+	transcript_time = vis_time() - transcript_time;
 
 	for (Win *win = vis->windows; win; win = win->next)
 		view_selections_normalize(&win->view);
@@ -1307,7 +1795,20 @@ enum SamError sam_cmd(Vis *vis, const char *s) {
 		}
 		vis_mode_switch(vis, completed ? VIS_MODE_NORMAL : VIS_MODE_VISUAL);
 	}
-	command_free(cmd);
+
+	if (vis->sam_profile) {
+		Buffer buf;
+		buffer_init(&buf);
+		buffer_appendf(&buf, "%-25s %8s %9s %12s %9s %9s\n", "command", "calls",
+		               "matches", "bytes", "addr/ms", "total/ms");
+		profile_report(&buf, cmd, 0);
+		buffer_appendf(&buf, "\nfilters: %.3f ms\ntranscript: %zu changes, %.3f ms\n",
+		               filter_time * 1e3, changes, transcript_time * 1e3);
+		vis_message_show(vis, buffer_content0(&buf));
+		buffer_release(&buf);
+	}
+
+	command_free(vis, cmd);
 	return err;
 }
 
@@ -1395,21 +1896,318 @@ static bool cmd_guard(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	bool match = false;
 	RegexMatch captures[1];
 	size_t len = text_range_size(range);
-	if (!cmd->regex)
+	if (!cmd->regex) {
 		match = true;
-	else if (!text_search_range_forward(win->file->text, range->start, len, cmd->regex, 1, captures, 0))
-		match = captures[0].start < range->end;
+	} else {
+		double start = vis_time();
+		if (!text_search_range_forward(win->file->text, range->start, len, cmd->regex, 1, captures, 0))
+			match = captures[0].start < range->end;
+		vis_stats_add(vis, VIS_STAT_SEARCH, 1, vis_time() - start);
+	}
+	if (cmd->regex)
+		cmd->profile.bytes += len;
+	cmd->profile.matches += match;
 	if ((count_evaluate(cmd) && match) ^ (argv[0][0] == 'v'))
 		return sam_execute(vis, win, cmd->cmd, sel, range);
 	view_selections_dispose_force(sel);
 	return true;
 }
 
+/* A range, or part thereof, to be searched by a worker process */
+struct SearchTask {
+	Text *txt;
+	Filerange range;   /* the whole range */
+	size_t start, end; /* part of it to search */
+	Buffer results;    /* elements of nsub matches */
+};
+
+/* State of the successive searches performed by extract */
+typedef struct {
+	Text *txt;
+	Regex *regex;
+	size_t nsub;       /* number of matches per result */
+	size_t first;      /* start of the whole range */
+	size_t start, end; /* part of the range still to be searched */
+	size_t last_start; /* end of the previous match */
+	bool last;         /* whether end is the end of the whole range */
+	bool done;         /* whether all results have been collected */
+} Search;
+
+static void search_init(Search *s, Text *txt, Regex *regex, size_t nsub, Filerange *range, bool x) {
+	*s = (Search){
+		.txt = txt,
+		.regex = regex,
+		.nsub = nsub,
+		.first = range->start,
+		.start = range->start,
+		.end = range->end,
+		.last_start = x ? EPOS : range->start,
+		.last = true,
+	};
+}
+
+/* Append up to max further results, nsub matches each, to buf. Unless end
+ * is the end of the whole range, results starting at end are left to the
+ * search of the following part. */
+static bool search_collect(Search *s, Buffer *buf, size_t max) {
+	RegexMatch match[MAX_REGEX_SUB];
+	size_t len = s->nsub * sizeof *match;
+	while (!s->done && max-- > 0) {
+		char c;
+		int flags = s->start > s->first &&
+		            text_byte_get(s->txt, s->start - 1, &c) && c != '\n' ?
+		            REG_NOTBOL : 0;
+		if (s->start > s->end ||
+		    text_search_range_forward(s->txt, s->start, s->end - s->start, s->regex, s->nsub, match, flags) ||
+		    (!s->last && match[0].start >= s->end)) {
+			s->done = true;
+			break;
+		}
+		if (!buffer_append(buf, match, len))
+			return false;
+		if (match[0].start == match[0].end) {
+			if (s->last_start == match[0].start) {
+				s->start++;
+				continue;
+			}
+			/* see the corresponding test in extract */
+			if (s->end == match[0].start && s->start > s->first &&
+			    text_byte_get(s->txt, s->end-1, &c) && c == '\n') {
+				s->done = true;
+				break;
+			}
+			s->start = match[0].end + 1;
+		} else {
+			s->start = match[0].end;
+		}
+		s->last_start = match[0].end;
+	}
+	return true;
+}
+
+/* Perform the searches of all tasks in up to jobs forked worker processes,
+ * each handling a consecutive share of them. The workers see the texts as of
+ * the time of the fork and report their results through a pipe, as frames
+ * prefixed by their length. An empty frame terminates the results of a task.
+ * Returns false if any search failed, the results are then to be ignored. */
+static bool search_parallel(Regex *regex, bool x, size_t nsub, SearchTask *tasks, size_t count, size_t jobs) {
+	struct {
+		pid_t pid;
+		int fd;
+		size_t first, last; /* tasks [first, last) */
+		Buffer buf;
+	} workers[SAM_PARALLEL_JOBS];
+	size_t started = 0;
+	bool ok = true;
+	jobs = MIN(MIN(jobs, count), SAM_PARALLEL_JOBS);
+	for (size_t i = 0; i < jobs; i++) {
+		size_t first = count * i / jobs, last = count * (i + 1) / jobs;
+		int fds[2];
+		if (pipe(fds) == -1) {
+			ok = false;
+			break;
+		}
+		pid_t pid = fork();
+		if (pid == -1) {
+			close(fds[0]);
+			close(fds[1]);
+			ok = false;
+			break;
+		}
+		if (pid == 0) {
+			sigset_t set;
+			sigemptyset(&set);
+			sigaddset(&set, SIGBUS);
+			signal(SIGBUS, SIG_DFL);
+			sigprocmask(SIG_UNBLOCK, &set, NULL);
+			close(fds[0]);
+			Buffer buf;
+			buffer_init(&buf);
+			for (SearchTask *t = &tasks[first]; t < &tasks[last]; t++) {
+				/* NUL bytes terminate the string seen by regexec(3), whether
+				 * ^ matches after them depends on where the search started */
+				bool part = t->start > t->range.start || t->end < t->range.end;
+				if (part && text_bytes_find_next(t->txt, t->start, t->end, "\0", 1) != EPOS)
+					_exit(1);
+				Search search;
+				search_init(&search, t->txt, regex, nsub, &t->range, x);
+				search.start = t->start;
+				search.end = t->end;
+				search.last = t->end == t->range.end;
+				if (t->start > t->range.start)
+					search.last_start = EPOS;
+				size_t len;
+				do {
+					buffer_clear(&buf);
+					while (!search.done && buffer_length(&buf) == 0) {
+						if (!search_collect(&search, &buf, 1024))
+							_exit(1);
+					}
+					len = buffer_length(&buf);
+					if (write_all(fds[1], (const char*)&len, sizeof len) == -1 ||
+					    write_all(fds[1], buffer_content(&buf), len) == -1)
+						_exit(1);
+				} while (len > 0);
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		workers[started].pid = pid;
+		workers[started].fd = fds[0];
+		workers[started].first = first;
+		workers[started].last = last;
+		buffer_init(&workers[started].buf);
+		started++;
+	}
+
+	/* read all pipes concurrently, the workers block once theirs is full */
+	for (size_t running = started; ok && running > 0; ) {
+		struct pollfd fds[SAM_PARALLEL_JOBS];
+		for (size_t i = 0; i < started; i++)
+			fds[i] = (struct pollfd){ .fd = workers[i].fd, .events = POLLIN };
+		if (poll(fds, started, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			ok = false;
+			break;
+		}
+		for (size_t i = 0; i < started; i++) {
+			if (workers[i].fd == -1 || !fds[i].revents)
+				continue;
+			char data[PIPE_BUF];
+			ssize_t len = read(workers[i].fd, data, sizeof data);
+			if (len > 0) {
+				ok &= buffer_append(&workers[i].buf, data, len);
+			} else if (len == 0 || errno != EINTR) {
+				ok &= len == 0;
+				close(workers[i].fd);
+				workers[i].fd = -1;
+				running--;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < started; i++) {
+		int status;
+		if (workers[i].fd != -1) {
+			kill(workers[i].pid, SIGKILL);
+			close(workers[i].fd);
+		}
+		pid_t pid;
+		while ((pid = waitpid(workers[i].pid, &status, 0)) == -1 && errno == EINTR);
+		ok &= pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	ok &= started == jobs;
+
+	/* split the stream of each worker into the results of its tasks */
+	for (size_t i = 0; i < started; i++) {
+		const char *data = buffer_content(&workers[i].buf);
+		const char *end = data + buffer_length(&workers[i].buf);
+		for (size_t t = workers[i].first; ok && t < workers[i].last; t++) {
+			for (;;) {
+				size_t len;
+				if (end - data < (ptrdiff_t)sizeof len) {
+					ok = false;
+					break;
+				}
+				memcpy(&len, data, sizeof len);
+				data += sizeof len;
+				if (len > (size_t)(end - data)) {
+					ok = false;
+					break;
+				}
+				if (len == 0)
+					break;
+				ok &= buffer_append(&tasks[t].results, data, len);
+				data += len;
+			}
+		}
+		buffer_release(&workers[i].buf);
+	}
+	return ok;
+}
+
+/* Search large ranges for a pattern which can not match a newline by
+ * splitting them at line boundaries, each part is handled by a worker
+ * process. The results are stored in order as elements of nsub matches.
+ * Returns false if the range is not searched this way. */
+static bool extract_search_parallel(Text *txt, Regex *regex, Filerange *range, bool x, size_t nsub, Buffer *results) {
+	size_t size = text_range_size(range);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t jobs = MIN(size / SAM_PARALLEL_SIZE, SAM_PARALLEL_JOBS);
+	if (cpus > 0 && jobs > (size_t)cpus)
+		jobs = cpus;
+	if (jobs < 2 || text_regex_multiline(regex))
+		return false;
+
+	SearchTask tasks[SAM_PARALLEL_JOBS];
+	size_t count = 0, start = range->start;
+	for (size_t i = 0; i < jobs && start < range->end; i++) {
+		size_t end = range->end;
+		if (i + 1 < jobs) {
+			size_t nl = text_bytes_find_next(txt, range->start + size / jobs * (i + 1), range->end, "\n", 1);
+			if (nl != EPOS && nl + 1 < range->end)
+				end = nl + 1;
+		}
+		if (end <= start)
+			continue;
+		tasks[count].txt = txt;
+		tasks[count].range = *range;
+		tasks[count].start = start;
+		tasks[count].end = end;
+		buffer_init(&tasks[count].results);
+		count++;
+		start = end;
+	}
+
+	/* the last part is responsible for the end of the range */
+	bool ok = count > 0 && start == range->end &&
+	          search_parallel(regex, x, nsub, tasks, count, count);
+	for (size_t i = 0; i < count; i++) {
+		Buffer *buf = &tasks[i].results;
+		if (ok && i == 0)
+			*results = *buf;
+		else if (ok)
+			ok &= buffer_append(results, buffer_content(buf), buffer_length(buf));
+		if (!ok || i > 0)
+			buffer_release(buf);
+	}
+	if (!ok)
+		buffer_release(results);
+	return ok;
+}
+
+/* copy the results of a search of the same range performed in advance */
+static bool extract_prefetched(Command *cmd, Text *txt, Filerange *range, Buffer *results) {
+	for (size_t i = 0; i < cmd->prefetch_count; i++) {
+		SearchTask *t = &cmd->prefetch[i];
+		if (t->txt != txt || t->range.start != range->start || t->range.end != range->end)
+			continue;
+		if (buffer_length(&t->results) == 0)
+			return true;
+		return buffer_put(results, buffer_content(&t->results), buffer_length(&t->results));
+	}
+	return false;
+}
+
+static void prefetch_release(Command *cmd) {
+	if (!cmd)
+		return;
+	for (size_t i = 0; i < cmd->prefetch_count; i++)
+		buffer_release(&cmd->prefetch[i].results);
+	free(cmd->prefetch);
+	cmd->prefetch = NULL;
+	cmd->prefetch_count = 0;
+}
+
 static int extract(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range, bool simulate) {
 	bool ret = true;
 	int count = 0;
 	Text *txt = win->file->text;
 
+	if (!simulate)
+		cmd->profile.bytes += text_range_size(range);
+
 	if (cmd->regex) {
 		size_t start = range->start, end = range->end;
 		size_t last_start = argv[0][0] == 'x' ? EPOS : start;
@@ -1417,14 +2215,37 @@ static int extract(Vis *vis, Win *win, Command *cmd, const char *argv[], Selecti
 		if (nsub > MAX_REGEX_SUB)
 			nsub = MAX_REGEX_SUB;
 		RegexMatch match[MAX_REGEX_SUB];
+		Buffer results;
+		buffer_init(&results);
+		Search search;
+		search_init(&search, txt, cmd->regex, nsub, range, argv[0][0] == 'x');
+		if (extract_prefetched(cmd, txt, range, &results) ||
+		    extract_search_parallel(txt, cmd->regex, range, argv[0][0] == 'x', nsub, &results))
+			search.done = true;
+		size_t result = 0, results_count = buffer_length(&results) / (nsub * sizeof *match);
 		while (start <= end) {
 			char c;
-			int flags = start > range->start &&
-			            text_byte_get(txt, start - 1, &c) && c != '\n' ?
-			            REG_NOTBOL : 0;
-			bool found = !text_search_range_forward(txt, start, end - start,
-			                                        cmd->regex, nsub, match,
-			                                        flags);
+			/* first of the collected results at or after start */
+			const RegexMatch *m = (const RegexMatch*)buffer_content(&results);
+			while (result < results_count && m[result * nsub].start < start)
+				result++;
+			if (result == results_count && !search.done) {
+				/* collect the results in batches */
+				buffer_clear(&results);
+				double search_start = vis_time();
+				bool collected = search_collect(&search, &results, EXTRACT_BATCH);
+				vis_stats_add(vis, VIS_STAT_SEARCH, 1, vis_time() - search_start);
+				if (!collected) {
+					ret = false;
+					break;
+				}
+				result = 0;
+				results_count = buffer_length(&results) / (nsub * sizeof *match);
+				continue;
+			}
+			bool found = result < results_count;
+			if (found)
+				memcpy(match, m + result * nsub, nsub * sizeof *match);
 			Filerange r = text_range_empty();
 			if (found) {
 				if (argv[0][0] == 'x')
@@ -1458,18 +2279,24 @@ static int extract(Vis *vis, Win *win, Command *cmd, const char *argv[], Selecti
 				if (found) {
 					for (size_t i = 0; i < nsub; i++) {
 						Register *reg = &vis->registers[VIS_REG_AMPERSAND+i];
-						register_put_range(vis, reg, txt, &match[i]);
+						register_put_range_lazy(vis, reg, txt, &match[i]);
 					}
 					last_start = match[0].end;
 				} else {
 					last_start = start;
 				}
-				if (simulate)
+				if (simulate) {
 					count++;
-				else
+				} else {
+					cmd->profile.matches++;
 					ret &= sam_execute(vis, win, cmd->cmd, NULL, &r);
+				}
 			}
 		}
+		buffer_release(&results);
+		/* the registers must not refer to the text once it is changed */
+		for (size_t i = 0; i < nsub; i++)
+			register_load(&vis->registers[VIS_REG_AMPERSAND+i]);
 	} else {
 		size_t start = range->start, end = range->end;
 		while (start < end) {
@@ -1479,10 +2306,12 @@ static int extract(Vis *vis, Win *win, Command *cmd, const char *argv[], Selecti
 			Filerange r = text_range_new(start, next);
 			if (start == next || !text_range_valid(&r))
 				break;
-			if (simulate)
+			if (simulate) {
 				count++;
-			else
+			} else {
+				cmd->profile.matches++;
 				ret &= sam_execute(vis, win, cmd->cmd, NULL, &r);
+			}
 			start = next;
 		}
 	}
@@ -1579,20 +2408,81 @@ static bool cmd_print(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	return true;
 }
 
+static bool files_match(Command *cmd, const char *argv[], Win *win) {
+	if (win->file->internal)
+		return false;
+	bool match = !cmd->regex ||
+	             (win->file->name && text_regex_match(cmd->regex, win->file->name, 0) == 0);
+	return match ^ (argv[0][0] == 'Y');
+}
+
+/* If the files are subject to an x or y loop over their whole content, the
+ * searches are performed upfront by a number of worker processes. The loop
+ * itself, including all modifications, is then run file by file as usual. */
+static void files_prefetch(Vis *vis, Command *cmd, const char *argv[]) {
+	Command *x = cmd->cmd && cmd->cmd->cmddef == &cmddef_select ? cmd->cmd->cmd : NULL;
+	if (!x || x->cmddef->func != cmd_extract || !x->regex || x->address || vis->mode->visual)
+		return;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 2)
+		return;
+
+	size_t count = 0, size = 0;
+	for (Win *w = vis->windows; w; w = w->next)
+		count++;
+	SearchTask *tasks = calloc(count, sizeof *tasks);
+	if (!tasks)
+		return;
+	count = 0;
+	for (Win *w = vis->windows; w; w = w->next) {
+		Text *txt = w->file->text;
+		if (!files_match(cmd, argv, w) || w->view.selection_count != 1)
+			continue;
+		bool seen = false;
+		for (size_t i = 0; i < count && !seen; i++)
+			seen = tasks[i].txt == txt;
+		if (seen)
+			continue;
+		SearchTask *t = &tasks[count++];
+		t->txt = txt;
+		t->range = text_range_new(0, text_size(txt));
+		t->start = t->range.start;
+		t->end = t->range.end;
+		buffer_init(&t->results);
+		size += text_size(txt);
+	}
+
+	size_t nsub = 1 + text_regex_nsub(x->regex);
+	if (nsub > MAX_REGEX_SUB)
+		nsub = MAX_REGEX_SUB;
+	if (count > 1 && size >= SAM_PREFETCH_SIZE &&
+	    search_parallel(x->regex, x->argv[0][0] == 'x', nsub, tasks, count, cpus)) {
+		x->prefetch = tasks;
+		x->prefetch_count = count;
+		return;
+	}
+	for (size_t i = 0; i < count; i++)
+		buffer_release(&tasks[i].results);
+	free(tasks);
+}
+
 static bool cmd_files(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	bool ret = true;
+	for (Win *w = vis->windows; w; w = w->next) {
+		if (files_match(cmd, argv, w))
+			file_load(vis, w->file);
+	}
+	files_prefetch(vis, cmd, argv);
 	for (Win *wn, *w = vis->windows; w; w = wn) {
 		/* w can get freed by sam_execute() so store w->next early */
 		wn = w->next;
-		if (w->file->internal)
-			continue;
-		bool match = !cmd->regex ||
-		             (w->file->name && text_regex_match(cmd->regex, w->file->name, 0) == 0);
-		if (match ^ (argv[0][0] == 'Y')) {
+		if (files_match(cmd, argv, w)) {
 			Filerange def = text_range_new(0, 0);
 			ret &= sam_execute(vis, w, cmd->cmd, NULL, &def);
 		}
 	}
+	if (cmd->cmd)
+		prefetch_release(cmd->cmd->cmd);
 	return ret;
 }
 
@@ -1612,6 +2502,10 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 	File *file = win->file;
 	if (sam_transcript_error(&file->transcript, SAM_ERR_WRITE_CONFLICT))
 		return false;
+	if (file->save.ctx) {
+		vis_info_show(vis, "Save of `%s' in progress", file->save.path);
+		return false;
+	}
 
 	Text *text = file->text;
 	Filerange range_all = text_range_new(0, text_size(text));
@@ -1684,6 +2578,14 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 				vis_info_show(vis, "WARNING: file has been changed since reading it");
 				goto err;
 			}
+			if (same_file && file->loadfd != -1) {
+				vis_info_show(vis, "WARNING: file is still being loaded");
+				goto err;
+			}
+			if (file->incomplete && file->name && (same_file || strcmp(file->name, path) == 0)) {
+				vis_info_show(vis, "WARNING: file was not loaded completely");
+				goto err;
+			}
 			if (existing_file && !same_file) {
 				vis_info_show(vis, "WARNING: file exists");
 				goto err;
@@ -1698,15 +2600,44 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 		if (write_entire_file)
 			*r = text_range_new(0, text_size(text));
 
-		TextSave *ctx = text_save_begin(text, AT_FDCWD, path, file->save_method);
+		bool failure = false;
+		bool visual = vis->mode->visual;
+		/* large files are written in the background, unless we are about to quit.
+		 * Only atomic saves leave the file intact if they are interrupted */
+		bool background = !visual && !strchr(argv[0], 'q') && (!argv[1] || !argv[2]) &&
+		                  text_range_size(r) > UI_LARGE_FILE_SIZE && file->save_method != TEXT_SAVE_INPLACE;
+		TextSave *ctx = NULL;
+		if (background && !(ctx = text_save_begin(text, AT_FDCWD, path, TEXT_SAVE_ATOMIC)))
+			background = false;
+		if (!ctx)
+			ctx = text_save_begin(text, AT_FDCWD, path, file->save_method);
 		if (!ctx) {
 			const char *msg = errno ? strerror(errno) : "try changing `:set savemethod`";
 			vis_info_show(vis, "Can't write `%s': %s", path, msg);
 			goto err;
 		}
+		const FileCodec *codec = file_codec(path);
+		if (codec && !text_save_filter(ctx, codec->compress)) {
+			vis_info_show(vis, "Can't compress `%s': %s", path, strerror(errno));
+			text_save_cancel(ctx);
+			goto err;
+		}
 
-		bool failure = false;
-		bool visual = vis->mode->visual;
+		if (background) {
+			int fd = text_save_background(ctx, r);
+			if (fd == -1 || !vis_watch(vis, fd, POLLIN, file_save_ready, file)) {
+				vis_info_show(vis, "Can't write `%s': %s", path, strerror(errno));
+				text_save_cancel(ctx);
+				goto err;
+			}
+			file->save.ctx = ctx;
+			file->save.fd = fd;
+			file->save.path = path;
+			file->save.size = text_range_size(r);
+			file->save.written = 0;
+			file->save.stat = same_file || (!existing_file && file->name && strcmp(file->name, path) == 0);
+			continue;
+		}
 
 		for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
 			Filerange range = visual ? view_selections_get(s) : *r;
@@ -1730,8 +2661,11 @@ static bool cmd_write(Vis *vis, Win *win, Command *cmd, const char *argv[], Sele
 			file_name_set(file, path);
 			same_file = true;
 		}
-		if (same_file || (!existing_file && strcmp(file->name, path) == 0))
+		if (same_file || (!existing_file && strcmp(file->name, path) == 0)) {
+			file->incomplete = false;
 			file->stat = text_stat(text);
+			vis_monitor_file(vis, file);
+		}
 		vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, path);
 		free(path);
 		continue;
@@ -1751,6 +2685,10 @@ static ssize_t read_buffer(void *context, char *data, size_t len) {
 static bool cmd_filter(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	if (!win)
 		return false;
+	if (filter_async(vis, win, range))
+		return filter_detach(vis, win, FILTER_CHANGE, &argv[1], range);
+	if (filter_concurrent(vis, win, range))
+		return filter_start(vis, win, FILTER_CHANGE, &argv[1], sel, range);
 
 	Buffer bufout, buferr;
 	buffer_init(&bufout);
@@ -1783,6 +2721,10 @@ static bool cmd_launch(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 static bool cmd_pipein(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	if (!win)
 		return false;
+	if (filter_async(vis, win, range))
+		return filter_detach(vis, win, FILTER_PIPEIN, &argv[1], range);
+	if (filter_concurrent(vis, win, range))
+		return filter_start(vis, win, FILTER_PIPEIN, &argv[1], sel, range);
 	Filerange filter_range = text_range_new(range->end, range->end);
 	bool ret = cmd_filter(vis, win, cmd, argv, sel, &filter_range);
 	if (ret)
@@ -1793,6 +2735,10 @@ static bool cmd_pipein(Vis *vis, Win *win, Command *cmd, const char *argv[], Sel
 static bool cmd_pipeout(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	if (!win)
 		return false;
+	if (filter_async(vis, win, range))
+		return filter_detach(vis, win, FILTER_PIPEOUT, (const char*[]){ argv[1], NULL }, range);
+	if (filter_concurrent(vis, win, range))
+		return filter_start(vis, win, FILTER_PIPEOUT, (const char*[]){ argv[1], NULL }, sel, range);
 	Buffer buferr;
 	buffer_init(&buferr);
 
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "text.h"
+#include "text-util.h"
+
+/* Filter a large synthetic text through an external command (cat(1) by
+ * default) and report the throughput as tab separated values. The input
+ * is written in PIPE_BUF sized pieces and the output read into a BUFSIZ
+ * buffer, as was done before, and with as large non-blocking writes and
+ * reads as the pipes accept. */
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static ssize_t write_small(Text *txt, Filerange *range, int fd) {
+	Filerange junk = *range;
+	if (junk.end > junk.start + PIPE_BUF)
+		junk.end = junk.start + PIPE_BUF;
+	return text_write_range(txt, &junk, fd);
+}
+
+static ssize_t write_large(Text *txt, Filerange *range, int fd) {
+	return text_write_range_nonblock(txt, range, fd);
+}
+
+static bool filter(Text *txt, const char *cmd, bool large, size_t *syscalls, size_t *output) {
+	int pin[2], pout[2];
+	if (pipe(pin) == -1 || pipe(pout) == -1)
+		return false;
+	pid_t pid = fork();
+	if (pid == -1)
+		return false;
+	if (pid == 0) {
+		dup2(pin[0], STDIN_FILENO);
+		dup2(pout[1], STDOUT_FILENO);
+		close(pin[0]);
+		close(pin[1]);
+		close(pout[0]);
+		close(pout[1]);
+		execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+		_exit(127);
+	}
+	close(pin[0]);
+	close(pout[1]);
+	fcntl(pout[0], F_SETFL, O_NONBLOCK);
+	if (large)
+		fcntl(pin[1], F_SETFL, O_NONBLOCK);
+
+	static char buf[1 << 16];
+	size_t bufsize = large ? sizeof buf : BUFSIZ;
+	Filerange range = text_range_new(0, text_size(txt));
+	*syscalls = *output = 0;
+	while (pin[1] != -1 || pout[0] != -1) {
+		struct pollfd fds[] = {
+			{ .fd = pin[1], .events = POLLOUT },
+			{ .fd = pout[0], .events = POLLIN },
+		};
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (pin[1] != -1 && fds[0].revents) {
+			ssize_t len = (large ? write_large : write_small)(txt, &range, pin[1]);
+			(*syscalls)++;
+			if (len > 0)
+				range.start += len;
+			if (len == -1 || text_range_size(&range) == 0) {
+				close(pin[1]);
+				pin[1] = -1;
+			}
+		}
+		if (pout[0] != -1 && fds[1].revents) {
+			ssize_t len;
+			do {
+				len = read(pout[0], buf, bufsize);
+				(*syscalls)++;
+				if (len > 0)
+					*output += len;
+			} while (large && len == (ssize_t)bufsize);
+			if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+				close(pout[0]);
+				pout[0] = -1;
+			}
+		}
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	signal(SIGPIPE, SIG_IGN);
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+	const char *cmd = argc > 2 ? argv[2] : "cat";
+	Text *txt = text_load(NULL);
+	if (!txt)
+		return 1;
+
+	char line[64];
+	for (unsigned long i = 0; text_size(txt) < size; i++) {
+		text_insert(txt, text_size(txt), line, snprintf(line, sizeof line, "line %lu of some text\n", i));
+		if (i % 4096 == 0)
+			text_snapshot(txt);
+	}
+	text_snapshot(txt);
+
+	printf("method\tsize\tsyscalls\tseconds\tMB/s\n");
+	for (int large = 0; large <= 1; large++) {
+		size_t syscalls, output;
+		double start = now();
+		bool ok = filter(txt, cmd, large, &syscalls, &output);
+		double elapsed = now() - start;
+		if (!ok) {
+			fprintf(stderr, "failed to filter through `%s'\n", cmd);
+			return 1;
+		}
+		printf("%s\t%zu\t%zu\t%.3f\t%.1f\n", large ? "nonblock" : "chunked", output, syscalls, elapsed,
+		       text_size(txt) / 1048576.0 / (elapsed > 0 ? elapsed : 1e-9));
+	}
+
+	text_free(txt);
+	return 0;
+}
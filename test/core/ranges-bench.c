@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "text-util.h"
+
+/* Normalize arrays of ranges as produced by saved selections: sorted with
+ * some overlap, reversed and shuffled. Reports the time taken per input
+ * as tab separated values. */
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(Array *ranges, size_t count, int order) {
+	array_clear(ranges);
+	for (size_t i = 0; i < count; i++) {
+		size_t j = order == 1 ? count - 1 - i : i;
+		/* every fourth range overlaps its successor, every eighth is empty */
+		Filerange r = { 10 * j, 10 * j + (j % 8 == 0 ? 0 : j % 4 == 0 ? 15 : 5) };
+		array_add(ranges, &r);
+	}
+	for (size_t i = count; order == 2 && i > 1; i--) {
+		size_t j = rand() % i;
+		Filerange *a = array_get(ranges, i - 1), *b = array_get(ranges, j), tmp = *a;
+		*a = *b;
+		*b = tmp;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	size_t count = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000) * 1000;
+	static const char *orders[] = { "sorted", "reversed", "shuffled" };
+	Array ranges;
+	array_init_sized(&ranges, sizeof(Filerange));
+	printf("input\tranges\tseconds\tresult\n");
+	for (int order = 0; order < 3; order++) {
+		fill(&ranges, count, order);
+		double start = now();
+		text_ranges_normalize(&ranges);
+		double elapsed = now() - start;
+		printf("%s\t%zu\t%.3f\t%zu\n", orders[order], count, elapsed, array_length(&ranges));
+	}
+	array_release(&ranges);
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+#include "text.h"
+#include "text-regex.h"
+
+/* Search a large synthetic text with a few typical patterns and report
+ * the time taken per pattern as tab separated values. Build against
+ * both regex backends to compare them on the same input. */
+
+static const struct {
+	const char *pattern;
+	int cflags;
+} patterns[] = {
+	{ "needle",               REG_EXTENDED|REG_NEWLINE },
+	{ "^line [0-9]+ needle$", REG_EXTENDED|REG_NEWLINE },
+	{ "[a-z]+ [0-9]+7 done",  REG_EXTENDED|REG_NEWLINE },
+	{ "lïne",                 REG_EXTENDED|REG_NEWLINE },
+	{ "(ab|cd)+x",            REG_EXTENDED|REG_NEWLINE|REG_ICASE },
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	setlocale(LC_CTYPE, "");
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+	Text *txt = text_load(NULL);
+	if (!txt)
+		return 1;
+
+	/* fill the text in reasonably sized pieces, with a match at the very end */
+	char line[64];
+	for (unsigned long i = 0; text_size(txt) < size; i++) {
+		text_insert(txt, text_size(txt), line, snprintf(line, sizeof line, "line %lu of some text\n", i));
+		if (i % 4096 == 0)
+			text_snapshot(txt);
+	}
+	text_insert(txt, text_size(txt), line, snprintf(line, sizeof line, "line 17 needle\n"));
+	text_snapshot(txt);
+
+	Regex *regex = text_regex_new();
+	if (!regex)
+		return 1;
+
+	printf("pattern\tsize\tseconds\tMB/s\tmatch\n");
+	for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++) {
+		if (text_regex_compile(regex, patterns[i].pattern, patterns[i].cflags))
+			continue;
+		RegexMatch match[1];
+		double start = now();
+		int ret = text_search_range_forward(txt, 0, text_size(txt), regex, 1, match, 0);
+		double elapsed = now() - start;
+		printf("%s\t%zu\t%.3f\t%.1f\t%zu\n", patterns[i].pattern, text_size(txt), elapsed,
+		       text_size(txt) / 1048576.0 / (elapsed > 0 ? elapsed : 1e-9),
+		       ret ? EPOS : match[0].start);
+	}
+
+	text_regex_free(regex);
+	text_free(txt);
+	return 0;
+}
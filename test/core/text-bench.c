@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "text.h"
+#include "text-regex.h"
+
+/* Microbenchmarks of the text core on a synthetic file of the given size
+ * in MB. Positions are drawn from a pseudo random generator with a fixed
+ * seed, such that every run performs the same operations. Each benchmark
+ * reports one line of tab separated values, the throughput is only given
+ * for those processing the whole text. */
+
+static const char *datafile = "bench-data";
+static const char *savefile = "bench-save";
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t seed;
+
+static uint64_t random64(void) {
+	/* xorshift64*, identical on all platforms unlike rand(3) */
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 2685821657736338717ULL;
+}
+
+static size_t random_pos(Text *txt) {
+	return random64() % (text_size(txt) + 1);
+}
+
+static void report(const char *name, size_t size, size_t ops, double start, size_t bytes) {
+	double elapsed = now() - start;
+	printf("%s\t%zu\t%zu\t%.3f\t%.1f\t", name, size, ops, elapsed, ops ? elapsed * 1e9 / ops : 0);
+	if (bytes)
+		printf("%.1f\n", bytes / 1048576.0 / (elapsed > 0 ? elapsed : 1e-9));
+	else
+		printf("-\n");
+}
+
+static bool generate(size_t size) {
+	FILE *file = fopen(datafile, "w");
+	if (!file)
+		return false;
+	/* lines of varying length, with a match for the search at the very end */
+	size_t len = 0;
+	for (unsigned long i = 0; len < size; i++) {
+		int n = fprintf(file, "line %lu of some text%s\n", i, i % 7 ? "" : " with a longer tail");
+		if (n < 0)
+			break;
+		len += n;
+	}
+	fprintf(file, "line 17 needle\n");
+	return fclose(file) == 0 && len >= size;
+}
+
+int main(int argc, char *argv[]) {
+	size_t size = (argc > 1 ? strtoull(argv[1], NULL, 10) : 64) << 20;
+	size_t ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+	seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 88172645463325252ULL;
+	if (!seed)
+		seed = 1;
+	if (!ops)
+		ops = 1;
+	if (!generate(size)) {
+		perror("generating input");
+		return 1;
+	}
+
+	printf("benchmark\tsize\tops\tseconds\tns/op\tMB/s\n");
+
+	double start = now();
+	Text *txt = text_load(datafile);
+	if (!txt) {
+		perror("loading input");
+		return 1;
+	}
+	size = text_size(txt);
+	report("load", size, 1, start, size);
+
+	start = now();
+	size_t lines = text_lineno_by_pos(txt, size);
+	report("lines-count", size, 1, start, size);
+
+	start = now();
+	for (size_t i = 0; i < ops; i++)
+		text_pos_by_lineno(txt, 1 + random64() % lines);
+	report("lines-jump", size, ops, start, 0);
+
+	Regex *regex = text_regex_new();
+	if (!regex || text_regex_compile(regex, "needle", REG_EXTENDED)) {
+		fprintf(stderr, "compiling regex failed\n");
+		return 1;
+	}
+	RegexMatch match[1];
+	start = now();
+	text_search_range_forward(txt, 0, size, regex, 1, match, 0);
+	report("search", size, 1, start, size);
+
+	start = now();
+	for (size_t i = 0; i < ops; i++) {
+		text_insert(txt, random_pos(txt), "inserted ", 9);
+		text_snapshot(txt);
+	}
+	report("insert", size, ops, start, 0);
+
+	start = now();
+	for (size_t i = 0; i < ops; i++) {
+		text_delete(txt, random_pos(txt), 1 + random64() % 16);
+		text_snapshot(txt);
+	}
+	report("delete", size, ops, start, 0);
+
+	size_t done = 0;
+	start = now();
+	while (text_undo(txt) != EPOS)
+		done++;
+	report("undo", size, done, start, 0);
+
+	done = 0;
+	start = now();
+	while (text_redo(txt) != EPOS)
+		done++;
+	report("redo", size, done, start, 0);
+
+	Mark *marks = malloc(ops * sizeof *marks);
+	if (!marks)
+		return 1;
+	start = now();
+	for (size_t i = 0; i < ops; i++)
+		marks[i] = text_mark_set(txt, random_pos(txt));
+	report("mark-set", size, ops, start, 0);
+
+	/* a modification invalidates all resolved marks */
+	text_insert(txt, 0, "x", 1);
+	start = now();
+	for (size_t i = 0; i < ops; i++)
+		text_mark_get(txt, marks[random64() % ops]);
+	report("mark-get", size, ops, start, 0);
+	free(marks);
+
+	size = text_size(txt);
+	start = now();
+	bool saved = text_save_method(txt, savefile, TEXT_SAVE_ATOMIC);
+	report(saved ? "save-atomic" : "save-atomic-failed", size, 1, start, size);
+	start = now();
+	saved = text_save_method(txt, savefile, TEXT_SAVE_INPLACE);
+	report(saved ? "save-inplace" : "save-inplace-failed", size, 1, start, size);
+
+	text_regex_free(regex);
+	text_free(txt);
+	unlink(datafile);
+	unlink(savefile);
+	return 0;
+}
@@ -1,12 +1,19 @@
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/wait.h>
 #include "tap.h"
 #include "text.h"
 #include "text-util.h"
+#include "text-regex.h"
+#include "text-motions.h"
+#include "text-objects.h"
 #include "util.h"
 
 #ifndef BUFSIZ
@@ -59,6 +66,14 @@ static bool compare(Text *txt, const char *data) {
 	       compare_iterator_both(txt, data);
 }
 
+/* the same for content larger than what fits into the above buffers */
+static bool compare_large(Text *txt, const char *data) {
+	char *buf = text_bytes_alloc0(txt, 0, text_size(txt));
+	bool equal = buf && strcmp(buf, data) == 0;
+	free(buf);
+	return equal;
+}
+
 static void iterator_find_everywhere(Text *txt, char *data) {
 	size_t len = strlen(data);
 
@@ -171,6 +186,129 @@ int main(int argc, char *argv[]) {
 
 			ok(txt && !text_save_method(txt, linkname, TEXT_SAVE_ATOMIC), "Text save %s atomic", names[i]);
 			text_free(txt);
+			unlink(linkname);
+		}
+
+		snprintf(buf, sizeof buf, "Hello Background!\n");
+		txt = text_load(NULL);
+		ok(txt && insert(txt, 0, buf) && compare(txt, buf), "Preparing background save");
+		TextSave *ctx = txt ? text_save_begin(txt, AT_FDCWD, filename, TEXT_SAVE_AUTO) : NULL;
+		Filerange range = text_range_new(0, txt ? text_size(txt) : 0);
+		int progressfd = ctx ? text_save_background(ctx, &range) : -1;
+		ok(progressfd != -1, "Background save started");
+		ok(txt && insert(txt, 0, "Modified: ") && text_modified(txt), "Modify during background save");
+		int status = 1;
+		size_t written = 0;
+		while (progressfd != -1 && (status = text_save_poll(ctx, &written)) == 1) {
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(progressfd, &fds);
+			select(progressfd + 1, &fds, NULL, NULL, NULL);
+		}
+		ok(status == 0 && written == strlen(buf) && text_save_commit(ctx), "Background save completed");
+		ok(txt && text_modified(txt) && text_undo(txt) != EPOS && !text_modified(txt), "Background saved revision");
+		text_free(txt);
+
+		txt = text_load(filename);
+		ok(txt && compare(txt, buf), "Verify background save");
+		text_free(txt);
+
+		txt = text_load(NULL);
+		ok(txt && insert(txt, 0, "Cancelled background save\n"), "Preparing cancelled background save");
+		range = text_range_new(0, txt ? text_size(txt) : 0);
+		ctx = txt ? text_save_begin(txt, AT_FDCWD, filename, TEXT_SAVE_ATOMIC) : NULL;
+		ok(ctx && text_save_background(ctx, &range) != -1, "Background save started");
+		text_save_cancel(ctx);
+		ok(txt && text_modified(txt), "Cancelled background save");
+		ctx = txt ? text_save_begin(txt, AT_FDCWD, "data-inplace", TEXT_SAVE_INPLACE) : NULL;
+		ok(ctx && text_save_background(ctx, &range) == -1 && errno == ENOTSUP, "Background save inplace unsupported");
+		text_save_cancel(ctx);
+		unlink("data-inplace");
+		text_free(txt);
+
+		txt = text_load(filename);
+		ok(txt && compare(txt, buf), "Verify cancelled background save");
+		text_free(txt);
+
+		const char *upper[] = { "tr", "a-z", "A-Z", NULL };
+		const char *lower[] = { "tr", "A-Z", "a-z", NULL };
+		const char *fail[] = { "sh", "-c", "cat >/dev/null; exit 1", NULL };
+		snprintf(buf, sizeof buf, "Hello Filter!\n");
+		txt = text_load(NULL);
+		ok(txt && insert(txt, 0, buf) && compare(txt, buf), "Preparing filtered save");
+		ctx = txt ? text_save_begin(txt, AT_FDCWD, filename, TEXT_SAVE_AUTO) : NULL;
+		ok(ctx && text_save_filter(ctx, upper), "Filtered save started");
+		range = text_range_new(0, txt ? text_size(txt) : 0);
+		ok(ctx && text_save_write_range(ctx, &range) == (ssize_t)strlen(buf) &&
+		   text_save_commit(ctx) && !text_modified(txt), "Filtered save completed");
+		ctx = txt ? text_save_begin(txt, AT_FDCWD, "data-fail", TEXT_SAVE_ATOMIC) : NULL;
+		ok(ctx && text_save_filter(ctx, fail) && text_save_write_range(ctx, &range) != -1 &&
+		   !text_save_commit(ctx) && access("data-fail", F_OK) == -1, "Failing filter");
+		text_free(txt);
+
+		txt = text_load(filename);
+		ok(txt && compare(txt, "HELLO FILTER!\n"), "Verify filtered save");
+		text_free(txt);
+
+		pid_t pid;
+		int loadfd = text_load_filter(AT_FDCWD, filename, lower, &pid);
+		ok(loadfd != -1, "Filtered load started");
+		txt = text_load(NULL);
+		for (ssize_t len; txt && loadfd != -1 && (len = read(loadfd, buf, sizeof buf)) > 0; )
+			text_insert(txt, text_size(txt), buf, len);
+		if (loadfd != -1)
+			close(loadfd);
+		status = 1;
+		ok(loadfd != -1 && waitpid(pid, &status, 0) == pid && status == 0, "Filter terminated");
+		ok(txt && text_modified(txt) && text_load_commit(txt, AT_FDCWD, filename) &&
+		   !text_modified(txt) && (size_t)text_stat(txt).st_size == strlen(buf), "Filtered load completed");
+		ok(txt && compare(txt, "hello filter!\n"), "Verify filtered load");
+		text_free(txt);
+		ok(text_load_filter(AT_FDCWD, "/", lower, &pid) == -1 && errno == EISDIR, "Filtered load of directory");
+
+		const char *missing[] = { "/nonexistent/decompressor", NULL };
+		const char *corrupt[] = { "sh", "-c", "head -c 3; exit 1", NULL };
+		const char *const *failing[] = { missing, corrupt };
+		for (size_t i = 0; i < LENGTH(failing); i++) {
+			loadfd = text_load_filter(AT_FDCWD, filename, failing[i], &pid);
+			size_t loaded = 0;
+			for (ssize_t len; loadfd != -1 && (len = read(loadfd, buf, sizeof buf)) > 0; )
+				loaded += len;
+			if (loadfd != -1)
+				close(loadfd);
+			status = 0;
+			ok(loadfd != -1 && loaded < strlen("hello filter!\n") && waitpid(pid, &status, 0) == pid &&
+			   WIFEXITED(status) && WEXITSTATUS(status) != 0, "Failing filtered load %zu", i);
+		}
+
+		for (size_t i = 0; i < LENGTH(load_method); i++) {
+			const char *tail = "appended\n";
+			snprintf(buf, sizeof buf, "Hello Tail!\n");
+			txt = text_load(NULL);
+			ok(txt && insert(txt, 0, buf) && text_save(txt, filename), "Preparing tail (method %zu)", i);
+			text_free(txt);
+			txt = text_load_method(filename, load_method[i]);
+			ok(txt && !text_load_tail(txt, filename, load_method[i]) && errno == 0, "Load tail of unchanged file (method %zu)", i);
+			int fd = open(filename, O_WRONLY|O_APPEND);
+			ok(fd != -1 && write(fd, tail, strlen(tail)) == (ssize_t)strlen(tail) && close(fd) == 0, "Append to file (method %zu)", i);
+			ok(txt && text_load_tail(txt, filename, load_method[i]) && !text_modified(txt), "Load tail (method %zu)", i);
+			strcat(buf, tail);
+			ok(txt && compare(txt, buf), "Verify tail (method %zu)", i);
+			ok(txt && text_save_method(txt, filename, TEXT_SAVE_INPLACE) && compare(txt, buf), "Save tail inplace (method %zu)", i);
+			ok(txt && text_undo(txt) == strlen("Hello Tail!\n") && text_modified(txt), "Undo tail (method %zu)", i);
+			text_free(txt);
+			txt = text_load(filename);
+			ok(txt && compare(txt, buf), "Verify tail save (method %zu)", i);
+			text_free(txt);
+
+			txt = text_load_method(filename, load_method[i]);
+			fd = open(filename, O_WRONLY|O_TRUNC);
+			ok(fd != -1 && write(fd, "Rewritten: ", 11) == 11 &&
+			   write(fd, buf, strlen(buf)) == (ssize_t)strlen(buf) && close(fd) == 0, "Rewrite file (method %zu)", i);
+			/* a mapped text reflects the rewrite itself */
+			bool mapped = load_method[i] == TEXT_LOAD_MMAP;
+			ok(txt && (mapped || (!text_load_tail(txt, filename, load_method[i]) && errno == 0)), "Load tail of rewritten file (method %zu)", i);
+			text_free(txt);
 		}
 	}
 
@@ -220,6 +358,26 @@ int main(int argc, char *argv[]) {
 	iterator_find_prev(txt, data_len, 'e', EPOS);
 	ok(text_undo(txt) == 0 && isempty(txt), "Undo to empty document 1");
 
+	/* code points spread over multiple pieces, some of them split */
+	ok(insert(txt, 0, "a\xc3") && insert(txt, 2, "\xa9" "b\xe2\x82\xac") &&
+	   insert(txt, 7, "cd"), "Inserting code points into multiple pieces");
+	const size_t codepoints[] = { 0, 1, 3, 4, 7, 8, 9 };
+	size_t ncodepoints = sizeof(codepoints)/sizeof(codepoints[0]);
+	bool forward = true, backward = true;
+	it = text_iterator_get(txt, 0);
+	for (size_t i = 1; i < ncodepoints; i++)
+		forward &= text_iterator_codepoint_next(&it, &b) && it.pos == codepoints[i];
+	forward &= !text_iterator_codepoint_next(&it, NULL) && it.pos == codepoints[ncodepoints-1];
+	for (size_t i = ncodepoints-1; i-- > 0; )
+		backward &= text_iterator_codepoint_prev(&it, &b) && it.pos == codepoints[i];
+	backward &= !text_iterator_codepoint_prev(&it, NULL) && it.pos == 0;
+	ok(forward && backward, "Iterator code point navigation across pieces");
+	it = text_iterator_get(txt, 7);
+	ok(text_iterator_char_next(&it, &b) && b == 'd' && it.pos == 8 &&
+	   text_iterator_char_prev(&it, &b) && b == 'c' && it.pos == 7, "Iterator ASCII character navigation");
+	while (text_undo(txt) != EPOS);
+	ok(isempty(txt), "Undo to empty document 2");
+
 	ok(insert(txt, 1, "") && isempty(txt), "Inserting empty data");
 	ok(!insert(txt, 1, " ") && isempty(txt), "Inserting with invalid offset");
 
@@ -332,6 +490,82 @@ int main(int argc, char *argv[]) {
 
 	text_snapshot(txt);
 
+	/* test piece lookup once the document consists of many pieces */
+	char shadow[512] = "";
+	size_t shadow_len = 0;
+	bool consistent = text_delete(txt, 0, text_size(txt)), lines_consistent = true;
+	unsigned int seed = 1;
+	for (size_t i = 0; i < 2048 && consistent; i++) {
+		seed = seed * 1103515245 + 12345;
+		size_t pos = shadow_len ? (seed >> 8) % (shadow_len + 1) : 0;
+		if (i % 8 == 0)
+			text_snapshot(txt);
+		if (shadow_len + 3 < sizeof(shadow) && (seed & 4 || shadow_len == 0)) {
+			const char *data = &"a\nb\ncd\n"[seed >> 28 & 3];
+			consistent = text_insert(txt, pos, data, 3);
+			memmove(shadow + pos + 3, shadow + pos, shadow_len - pos);
+			memcpy(shadow + pos, data, 3);
+			shadow_len += 3;
+		} else {
+			size_t len = MIN(shadow_len - pos, (seed >> 20 & 3) + 1);
+			consistent = text_delete(txt, pos, len);
+			memmove(shadow + pos, shadow + pos + len, shadow_len - pos - len);
+			shadow_len -= len;
+		}
+		shadow[shadow_len] = '\0';
+		char b = '\0';
+		pos = shadow_len ? (seed >> 4) % shadow_len : 0;
+		consistent = consistent && text_size(txt) == shadow_len &&
+		             (!shadow_len || (text_byte_get(txt, pos, &b) && b == shadow[pos]));
+		size_t lineno = 1, bol = 0;
+		for (size_t j = 0; j < pos; j++) {
+			if (shadow[j] == '\n') {
+				lineno++;
+				bol = j + 1;
+			}
+		}
+		lines_consistent = lines_consistent &&
+		                   text_lineno_by_pos(txt, pos) == lineno &&
+		                   text_pos_by_lineno(txt, lineno) == bol;
+	}
+	ok(consistent && compare(txt, shadow), "Lookup with many pieces");
+	ok(lines_consistent, "Line numbers with many pieces");
+	Mark marks[64];
+	size_t resolved[LENGTH(marks)];
+	for (size_t i = 0; i < LENGTH(marks); i++)
+		marks[i] = text_mark_set(txt, i * shadow_len / LENGTH(marks));
+	bool marks_consistent = true;
+	for (size_t i = 0; i < LENGTH(marks); i++)
+		marks_consistent &= text_mark_get(txt, marks[i]) == i * shadow_len / LENGTH(marks);
+	ok(marks_consistent, "Marks with many pieces");
+	text_mark_get_all(txt, marks, resolved, LENGTH(marks));
+	for (size_t i = 0; i < LENGTH(marks); i++)
+		marks_consistent &= resolved[i] == i * shadow_len / LENGTH(marks);
+	ok(marks_consistent, "Marks resolved at once with many pieces");
+	size_t chunks = 0, chunks_len = 0, chunk_len;
+	const char *slice;
+	bool chunks_consistent = true;
+	for (Iterator it = text_iterator_get(txt, 1);
+	     text_iterator_chunk_next(&it, shadow_len - 1, &slice, &chunk_len);
+	     chunks++, chunks_len += chunk_len)
+		chunks_consistent &= chunk_len > 0 && !memcmp(slice, shadow + 1 + chunks_len, chunk_len);
+	ok(chunks_consistent && chunks > 1 && chunks_len == shadow_len - 2, "Chunk iteration with many pieces");
+	/* modify the most recently inserted piece in place after freezing */
+	char frozen_expected[sizeof(shadow) + 2], frozen_buf[sizeof(frozen_expected)];
+	bool frozen_consistent = insert(txt, 1, "xz") &&
+	                         text_bytes_get(txt, 0, sizeof(frozen_expected), frozen_expected) == shadow_len + 2;
+	TextFrozen *frozen = text_freeze(txt);
+	ok(frozen && text_frozen_size(frozen) == shadow_len + 2, "Freeze text");
+	frozen_consistent &= insert(txt, 2, "y") && text_delete(txt, 1, 2) && text_delete(txt, 0, 2);
+	frozen_consistent &= text_frozen_bytes_get(frozen, 0, sizeof(frozen_buf), frozen_buf) == shadow_len + 2 &&
+	                     !memcmp(frozen_buf, frozen_expected, shadow_len + 2);
+	text_frozen_release(frozen);
+	ok(frozen_consistent, "Frozen text unaffected by modifications");
+	while (text_undo(txt) != EPOS && text_size(txt) > 0);
+	ok(isempty(txt), "Undo lookup with many pieces");
+	ok(text_lineno_by_pos(txt, 0) == 1 && text_pos_by_lineno(txt, 2) == EPOS, "Undo line numbers with many pieces");
+	text_snapshot(txt);
+
 	/* Test branching of the revision tree:
 	 *
 	 *  0 -- 1 -- 2 -- 3
@@ -399,5 +633,261 @@ int main(int argc, char *argv[]) {
 
 	text_free(txt);
 
+	/* apply several modifications at once */
+	txt = text_load(NULL);
+	ok(insert(txt, 0, "a foo b") && text_snapshot(txt) && insert(txt, 7, " foo c foo\n") &&
+	   text_snapshot(txt), "Preparing batch");
+	Mark mark_b = text_mark_set(txt, 6), mark_c = text_mark_set(txt, 12);
+	TextEdit edits[] = {
+		{ .range = { 2, 5 }, .data = "x", .len = 1, .count = 1 },
+		{ .range = { 8, 11 }, .data = "yz", .len = 2, .count = 3 },
+		{ .range = { 14, 17 } },
+		{ .range = { 18, 18 }, .data = "end", .len = 3, .count = 1 },
+	};
+	ok(text_batch(txt, edits, 0) && compare(txt, "a foo b foo c foo\n"), "Batch empty");
+	TextEdit invalid[] = { { .range = { 8, 11 } }, { .range = { 2, 5 } } };
+	ok(!text_batch(txt, invalid, LENGTH(invalid)) && compare(txt, "a foo b foo c foo\n"), "Batch unsorted");
+	ok(text_batch(txt, edits, LENGTH(edits)) && compare(txt, "a x b yzyzyz c \nend"), "Batch apply");
+	ok(text_mark_get(txt, mark_b) == 4 && text_mark_get(txt, mark_c) == 13, "Batch marks");
+	ok(text_lineno_by_pos(txt, text_size(txt)) == 2, "Batch lines");
+	text_snapshot(txt);
+	ok(text_undo(txt) == 2 && compare(txt, "a foo b foo c foo\n"), "Batch undo");
+	ok(text_redo(txt) != EPOS && compare(txt, "a x b yzyzyz c \nend"), "Batch redo");
+	size_t generation = text_generation(txt);
+	ok(text_changed_since(txt, generation) == EPOS, "Generation unchanged");
+	ok(insert(txt, 6, "!") && insert(txt, 10, "?"), "Inserting after batch");
+	ok(text_changed_since(txt, generation) == 6, "Generation modified position");
+	ok(text_undo(txt) != EPOS && text_changed_since(txt, generation) == 6, "Generation undo");
+	for (int i = 0; i < 64; i++)
+		insert(txt, text_size(txt), "x");
+	ok(text_changed_since(txt, generation) == 0, "Generation forgotten");
+	TextChange change;
+	ok(!text_change_get(txt, generation, &change), "Change forgotten");
+	ok(text_delete(txt, 2, 3) && text_change_get(txt, text_generation(txt), &change) &&
+	   change.pos == 2 && change.removed == 3 && change.inserted == 0, "Change extent of deletion");
+	ok(insert(txt, 4, "abc") && text_change_get(txt, text_generation(txt), &change) &&
+	   change.pos == 4 && change.removed == 0 && change.inserted == 3, "Change extent of insertion");
+	text_free(txt);
+
+	/* search ranges larger than the window copied at once */
+	txt = text_load(NULL);
+	size_t lines = 1 << 17, bar = 4 * lines;
+	for (size_t i = 0; i < lines; i++)
+		text_insert(txt, text_size(txt), "foo\n", 4);
+	ok(insert(txt, bar, "bar\n"), "Preparing search");
+	Regex *regex = text_regex_new();
+	RegexMatch match[1];
+	bool found = regex && !text_regex_compile(regex, "^bar$", REG_EXTENDED|REG_NEWLINE) &&
+	             !text_search_range_forward(txt, 0, text_size(txt), regex, 1, match, 0);
+	ok(found && match[0].start == bar && match[0].end == bar + 3, "Search forward");
+	found = regex && !text_regex_compile(regex, "o\nbar", REG_EXTENDED|REG_NEWLINE) &&
+	        !text_search_range_forward(txt, 1, text_size(txt) - 1, regex, 1, match, REG_NOTBOL);
+	ok(found && match[0].start == bar - 2 && match[0].end == bar + 3, "Search forward across lines");
+	found = regex && !text_regex_compile(regex, "fo+", REG_EXTENDED|REG_NEWLINE) &&
+	        !text_search_range_backward(txt, 0, text_size(txt), regex, 1, match, 0);
+	ok(found && match[0].start == bar - 4 && match[0].end == bar - 1, "Search backward");
+	ok(text_bytes_find_next(txt, 0, text_size(txt), "o\nbar", 5) == bar - 2 &&
+	   text_bytes_find_prev(txt, 0, text_size(txt), "foo", 3) == bar - 4 &&
+	   text_bytes_find_prev(txt, 0, bar - 2, "foo", 3) == bar - 8 &&
+	   text_bytes_find_next(txt, bar - 1, bar + 2, "bar", 3) == EPOS, "Find bytes");
+	found = regex && !text_regex_compile(regex, "b(a|e)r|baz", REG_EXTENDED|REG_NEWLINE) &&
+	        !text_search_range_forward(txt, 0, text_size(txt), regex, 1, match, 0);
+	ok(found && match[0].start == bar && match[0].end == bar + 3, "Search forward for alternatives");
+	found = regex && !text_regex_compile(regex, "^ba+r", REG_EXTENDED|REG_NEWLINE) &&
+	        !text_search_range_backward(txt, 0, text_size(txt), regex, 1, match, 0);
+	ok(found && match[0].start == bar && match[0].end == bar + 3, "Search backward for literal");
+	found = regex && !text_regex_compile(regex, "qux", REG_EXTENDED|REG_NEWLINE) &&
+	        !text_search_range_forward(txt, 0, text_size(txt), regex, 1, match, 0);
+	ok(!found, "Search for missing literal");
+	text_regex_free(regex);
+
+	char literal[8];
+	ok(text_pattern_literal("\\<word\\>", literal, sizeof literal) == 4 && !memcmp(literal, "word", 4) &&
+	   text_pattern_literal("x*(a|b)ab+c", literal, sizeof literal) == 2 && !memcmp(literal, "ab", 2) &&
+	   text_pattern_literal("a|b", literal, sizeof literal) == 0 &&
+	   text_pattern_literal("[xy]\\.c?", literal, sizeof literal) == 1 && literal[0] == '.', "Pattern literal");
+	text_free(txt);
+
+	/* brackets further apart than what is scanned without the index */
+	txt = text_load(NULL);
+	ok(insert(txt, 0, "{\n}\n"), "Preparing brackets");
+	for (size_t i = 0; i < 1 << 14; i++)
+		text_insert(txt, 2, "(\")\"){}\n", 8);
+	size_t close = text_size(txt) - 2;
+	ok(text_bracket_match(txt, 0, NULL) == close && text_bracket_match(txt, close, NULL) == 0, "Match distant brackets");
+	Filerange block = text_object_curly_bracket(txt, close - 1);
+	ok(block.start == 1 && block.end == close, "Block around nested ones");
+	ok(insert(txt, close / 2, "}") && text_bracket_match(txt, 0, NULL) < close / 2 + 8 &&
+	   text_bracket_match(txt, close + 1, NULL) == close + 1, "Match brackets after modification");
+	ok(text_delete(txt, close / 2, 1) && text_bracket_match(txt, 0, NULL) == close, "Match brackets after deletion");
+	ok(insert(txt, close, "\"(\"") && text_bracket_match(txt, 0, NULL) == close + 3, "Match brackets ignoring strings");
+	text_free(txt);
+
+	/* words spanning pieces and containing multibyte characters */
+	txt = text_load(NULL);
+	ok(insert(txt, 0, "foo_bar  \t baz, qu\xc3\xa9x\xcc\x81y;\nline two"), "Preparing words");
+	ok(insert(txt, 2, "oo") && insert(txt, 12, " "), "Splitting words");
+	const char *words = "foooo_bar  \t  baz, qu\xc3\xa9x\xcc\x81y;\nline two";
+	ok(compare(txt, words), "Words content");
+	size_t eow = strstr(words, "bar") - words + 2, baz = strstr(words, "baz") - words;
+	size_t qux = strstr(words, "qu") - words, semi = strchr(words, ';') - words;
+	ok(text_word_start_next(txt, 0) == baz && text_word_start_prev(txt, baz) == 0, "Word start across pieces");
+	ok(text_word_end_next(txt, 0) == eow && text_word_end_prev(txt, baz + 2) == eow, "Word end across pieces");
+	ok(text_word_end_next(txt, qux) == semi - 1 && text_word_start_prev(txt, semi) == qux, "Word with multibyte characters");
+	ok(text_longword_end_next(txt, baz) == baz + 3 && text_longword_start_next(txt, baz) == qux, "Longword motions");
+	ok(text_line_offset(txt, semi, 100) == semi + 1 && text_line_offset(txt, text_size(txt), 4) == semi + 6,
+	   "Line offset within line");
+	text_free(txt);
+
+	/* compaction of a fragmented piece chain, undo restores the original pieces */
+	txt = text_load(NULL);
+	static char content[1 << 18], previous[1 << 18];
+	size_t len = 200000, last = 0;
+	memset(content, '.', len);
+	ok(text_insert(txt, 0, content, len) && text_snapshot(txt), "Preparing compaction");
+	for (size_t i = 0; i < 3000; i++) {
+		char c = 'a' + i % 26;
+		last = (i * 7919) % (len + 1);
+		memcpy(previous, content, len);
+		memmove(content + last + 1, content + last, len - last);
+		content[last] = c;
+		content[++len] = '\0';
+		text_insert(txt, last, &c, 1);
+		text_snapshot(txt);
+	}
+	previous[len - 1] = '\0';
+	Mark kept[] = { text_mark_set(txt, 0), text_mark_set(txt, len / 3), text_mark_set(txt, len - 1) };
+	ok(compare_large(txt, content) && text_fragmented(txt), "Fragmented text");
+	size_t budget = 1;
+	size_t removed = text_compact(txt, &budget);
+	ok(removed > 0 && budget == 0 && text_fragmented(txt), "Compaction within budget");
+	budget = SIZE_MAX;
+	removed += text_compact(txt, &budget);
+	ok(removed > 3000 && !text_fragmented(txt) && compare_large(txt, content), "Compaction keeps content");
+	ok(text_mark_get(txt, kept[0]) == 0 && text_mark_get(txt, kept[1]) == len / 3 &&
+	   text_mark_get(txt, kept[2]) == len - 1, "Marks into compacted pieces");
+	Mark copied = text_mark_set(txt, last / 2);
+	ok(text_undo(txt) == last && compare_large(txt, previous), "Undo compacted revision");
+	ok(text_mark_get(txt, copied) == last / 2 && text_mark_get(txt, kept[1]) == len / 3,
+	   "Marks after undoing compaction");
+	ok(text_redo(txt) == last + 1 && compare_large(txt, content), "Redo compacted revision");
+	ok(text_undo(txt) == last && !text_fragmented(txt), "No compaction with redo pending");
+	text_free(txt);
+
+	/* huge insertions are stored in blocks backed by a temporary file */
+	txt = text_load(NULL);
+	size_t huge = 1 << 26;
+	char *buf = malloc(huge);
+	ok(buf && memset(buf, 'x', huge) && text_insert(txt, 0, buf, huge) && insert(txt, 0, "\n"),
+	   "Insert huge amount of data");
+	it = text_iterator_get(txt, 1);
+	ok(text_mmaped(txt, it.text) && text_size(txt) == huge + 1 && text_lineno_by_pos(txt, huge) == 2,
+	   "Huge insertion backed by file");
+	it = text_iterator_get(txt, 0);
+	ok(!text_mmaped(txt, it.text) && text_delete(txt, 1, huge - 1) && compare(txt, "\nx"), "Small insertion on the heap");
+	free(buf);
+	text_free(txt);
+
+	/* pruning the history down to a number of revisions */
+	txt = text_load(NULL);
+	static char states[101][101];
+	for (size_t i = 1; i < LENGTH(states); i++) {
+		char c = '0' + i % 10;
+		size_t pos = i / 2;
+		memcpy(states[i], states[i-1], pos);
+		states[i][pos] = c;
+		memcpy(states[i] + pos + 1, states[i-1] + pos, i - 1 - pos);
+		text_insert(txt, pos, &c, 1);
+		text_snapshot(txt);
+	}
+	TextHistory history = text_history(txt);
+	Mark mark = text_mark_set(txt, 50);
+	size_t pruned = text_history_prune(txt, 20, 0);
+	TextHistory pruned_history = text_history(txt);
+	ok(history.revisions == 101 && pruned > 80 && pruned_history.revisions <= 20 &&
+	   pruned_history.revisions == history.revisions - pruned && compare(txt, states[100]),
+	   "Prune history to revision limit");
+	ok(text_mark_get(txt, mark) == 50, "Mark after pruning");
+	size_t undone = 0, redone = 0;
+	while (text_undo(txt) != EPOS)
+		undone++;
+	ok(undone == pruned_history.revisions - 1 && compare(txt, states[100 - undone]),
+	   "Undo until oldest remaining revision");
+	while (text_redo(txt) != EPOS)
+		redone++;
+	ok(redone == undone && compare(txt, states[100]), "Redo after pruning");
+	ok(text_undo(txt) != EPOS && text_undo(txt) != EPOS && insert(txt, 0, "branch") &&
+	   text_snapshot(txt) && text_history_prune(txt, 5, 0) > 0 && text_history(txt).revisions == 5,
+	   "Prune history with branches");
+	ok(text_undo(txt) != EPOS && compare(txt, states[98]) && text_earlier(txt) != EPOS &&
+	   compare(txt, states[97]) && text_undo(txt) == EPOS, "Traverse history to oldest revision");
+	for (int i = 0; i < 3; i++)
+		text_later(txt);
+	ok(compare(txt, states[100]) && text_later(txt) != EPOS && text_later(txt) == EPOS &&
+	   text_size(txt) == 98 + 6, "Traverse history to newest branch");
+	text_free(txt);
+
+	/* blocks only referenced by discarded revisions are released */
+	txt = text_load(NULL);
+	size_t chunk_size = 1 << 20;
+	buf = malloc(chunk_size);
+	ok(buf && memset(buf, 'f', chunk_size) && text_insert(txt, 0, buf, chunk_size) && text_snapshot(txt),
+	   "Insert data to freeze");
+	TextFrozen *kept_frozen = text_freeze(txt);
+	for (int i = 0; i < 8; i++) {
+		text_delete(txt, 0, text_size(txt));
+		text_snapshot(txt);
+		memset(buf, 'a' + i, chunk_size);
+		text_insert(txt, 0, buf, chunk_size);
+		text_snapshot(txt);
+	}
+	history = text_history(txt);
+	pruned = text_history_prune(txt, 0, 2 * chunk_size);
+	pruned_history = text_history(txt);
+	ok(history.memory > 8 * chunk_size && pruned > 0 && pruned_history.memory < 3 * chunk_size &&
+	   text_size(txt) == chunk_size && text_undo(txt) == EPOS, "Prune history to memory limit");
+	char tail[4] = { 0 };
+	ok(text_frozen_bytes_get(kept_frozen, chunk_size - 3, 3, tail) == 3 && !strcmp(tail, "fff"),
+	   "Frozen copy after pruning");
+	text_frozen_release(kept_frozen);
+	ok(insert(txt, 0, "x") && text_snapshot(txt) && text_history_prune(txt, 1, 0) == 1 &&
+	   text_history(txt).memory < pruned_history.memory - chunk_size / 2, "Release blocks of frozen copy");
+	free(buf);
+	text_free(txt);
+
+	/* batches never merge pieces of distinct, even if adjacent, file backed blocks */
+	txt = text_load(NULL);
+	buf = malloc(huge);
+	ok(buf && memset(buf, 'a', huge) && insert(txt, 0, "x") && text_insert(txt, 1, buf, huge) &&
+	   text_snapshot(txt), "Preparing batch of huge insertions");
+	memset(buf, 'b', huge);
+	TextEdit huge_edits[] = {
+		{ .range = { 1, 1 }, .data = buf, .len = huge, .count = 1 },
+		{ .range = { 2, huge + 1 }, .data = "y", .len = 1, .count = 1 },
+	};
+	char huge_tail[4] = { 0 };
+	ok(text_batch(txt, huge_edits, LENGTH(huge_edits)) && text_snapshot(txt) &&
+	   text_history_prune(txt, 1, 0) > 0 && text_size(txt) == huge + 3 &&
+	   text_bytes_get(txt, huge, 3, huge_tail) == 3 && !strcmp(huge_tail, "bay"),
+	   "Batch huge insertions into adjacent blocks");
+	free(buf);
+	text_free(txt);
+
+	Array ranges;
+	array_init_sized(&ranges, sizeof(Filerange));
+	const Filerange unsorted[] = {
+		{ 8, 10 }, { 0, 2 }, { 4, 4 }, { 1, 3 }, { 9, 12 }, { EPOS, EPOS }, { 5, 6 }, { 3, 4 },
+	};
+	for (size_t i = 0; i < LENGTH(unsorted); i++)
+		array_add(&ranges, (void*)&unsorted[i]);
+	text_ranges_normalize(&ranges);
+	Filerange *r0 = array_get(&ranges, 0), *r1 = array_get(&ranges, 1), *r2 = array_get(&ranges, 2), *r3 = array_get(&ranges, 3);
+	ok(array_length(&ranges) == 4 &&
+	   r0->start == 0 && r0->end == 3 && r1->start == 3 && r1->end == 4 &&
+	   r2->start == 5 && r2->end == 6 && r3->start == 8 && r3->end == 12, "Normalize ranges");
+	text_ranges_normalize(&ranges);
+	ok(array_length(&ranges) == 4, "Normalize normalized ranges");
+	array_release(&ranges);
+
 	return exit_status();
 }
@@ -5,7 +5,9 @@
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include "fuzzer.h"
 #include "text.h"
 #include "text-util.h"
@@ -21,6 +23,39 @@ static Mark mark = EMARK;
 
 static char data[BUFSIZ];
 
+/* In performance mode (-p) the input is executed PERF_RUNS times, the
+ * fastest time of every command counts. A command is slow if it took at
+ * least PERF_MIN_US and its cost per unit of work, the number of pieces
+ * plus the text size in units of PERF_BYTES, exceeds PERF_RATIO times
+ * the median of the input. Slow inputs are minimized, saved in PERF_DIR
+ * and reported by aborting, such that fuzzers record them as crashes. */
+#define PERF_RUNS 3
+#ifndef PERF_MIN_US
+#define PERF_MIN_US 1000
+#endif
+#define PERF_BYTES 64
+#ifndef PERF_RATIO
+#define PERF_RATIO 64
+#endif
+/* lower bound for the median cost per unit of work, in microseconds */
+#define PERF_COST_MIN 0.01
+#define PERF_OPS_MAX 4096
+#ifndef PERF_DIR
+#define PERF_DIR "inputs/text-fuzzer"
+#endif
+
+typedef struct {
+	size_t lineno;  /* input line of the command */
+	size_t pieces;  /* number of pieces before it was executed */
+	size_t size;    /* text size before it was executed */
+	uint64_t time;  /* fastest execution time in microseconds */
+} PerfOp;
+
+static bool perf;                       /* whether to record the cost of the commands */
+static size_t perf_run;                 /* current execution of the input */
+static size_t perf_count;               /* number of commands recorded in this execution */
+static PerfOp perf_ops[PERF_OPS_MAX];
+
 static uint64_t bench(void) {
 	struct timespec ts;
 
@@ -239,6 +274,26 @@ static enum CmdStatus cmd_dump(Text *txt, const char *cmd) {
 	return CMD_OK;
 }
 
+static enum CmdStatus cmd_line(Text *txt, const char *cmd) {
+	size_t lineno;
+	if (sscanf(cmd, "%zu\n", &lineno) != 1)
+		return CMD_ERR;
+	size_t pos = text_pos_by_lineno(txt, lineno);
+	if (pos != EPOS)
+		printf("%zu\n", pos);
+	return pos != EPOS;
+}
+
+static enum CmdStatus cmd_lineno(Text *txt, const char *cmd) {
+	size_t pos;
+	if (sscanf(cmd, "%zu\n", &pos) != 1)
+		return CMD_ERR;
+	if (pos > text_size(txt))
+		return CMD_FAIL;
+	printf("%zu\n", text_lineno_by_pos(txt, pos));
+	return CMD_OK;
+}
+
 static enum CmdStatus cmd_quit(Text *txt, const char *cmd) {
 	return CMD_QUIT;
 }
@@ -254,6 +309,8 @@ static Cmd commands[] = {
 	['b'] = cmd_bench,
 	['d'] = cmd_delete,
 	['i'] = cmd_insert,
+	['l'] = cmd_line,
+	['n'] = cmd_lineno,
 	['p'] = cmd_print,
 	['q'] = cmd_quit,
 	['r'] = cmd_redo,
@@ -261,6 +318,25 @@ static Cmd commands[] = {
 	['u'] = cmd_undo,
 };
 
+static size_t pieces(Text *txt) {
+	size_t count = 0, len;
+	const char *chunk;
+	for (Iterator it = text_iterator_get(txt, 0);
+	     text_iterator_chunk_next(&it, text_size(txt), &chunk, &len); )
+		count++;
+	return count;
+}
+
+static void perf_record(size_t lineno, size_t pieces, size_t size, uint64_t time) {
+	if (perf_count >= PERF_OPS_MAX)
+		return;
+	PerfOp *op = &perf_ops[perf_count++];
+	if (perf_run == 0 || op->lineno != lineno)
+		*op = (PerfOp){ .lineno = lineno, .pieces = pieces, .size = size, .time = time };
+	else if (time < op->time)
+		op->time = time;
+}
+
 static int repl(const char *name, FILE *input) {
 	Text *txt = text_load(name);
 	if (!name)
@@ -273,7 +349,7 @@ static int repl(const char *name, FILE *input) {
 	printf("Loaded %zu bytes from `%s'\n", text_size(txt), name);
 
 	char line[BUFSIZ];
-	for (;;) {
+	for (size_t lineno = 1;; lineno++) {
 		printf("> ");
 		if (!fgets(line, sizeof(line), input))
 			break;
@@ -283,7 +359,11 @@ static int repl(const char *name, FILE *input) {
 			continue;
 		size_t idx = line[0];
 		if (idx < LENGTH(commands) && commands[idx]) {
+			size_t count = perf ? pieces(txt) : 0, size = text_size(txt);
+			uint64_t start = perf ? bench() : 0;
 			enum CmdStatus ret = commands[idx](txt, line+1);
+			if (perf)
+				perf_record(lineno, count, size, bench() - start);
 			printf("%s", cmd_status_msg[ret]);
 			if (ret == CMD_QUIT)
 				break;
@@ -310,7 +390,141 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t len) {
 
 #else
 
+static double perf_cost(const PerfOp *op) {
+	return (double)op->time / (op->pieces + op->size / PERF_BYTES + 1);
+}
+
+static int perf_cost_cmp(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* the slowest command relative to its work, NULL if none is too slow */
+static PerfOp *perf_slow(void) {
+	static double costs[PERF_OPS_MAX];
+	if (perf_count == 0)
+		return NULL;
+	for (size_t i = 0; i < perf_count; i++)
+		costs[i] = perf_cost(&perf_ops[i]);
+	qsort(costs, perf_count, sizeof costs[0], perf_cost_cmp);
+	double median = costs[perf_count / 2];
+	if (median < PERF_COST_MIN)
+		median = PERF_COST_MIN;
+	PerfOp *slow = NULL;
+	for (size_t i = 0; i < perf_count; i++) {
+		PerfOp *op = &perf_ops[i];
+		if (op->time >= PERF_MIN_US && perf_cost(op) > PERF_RATIO * median &&
+		    (!slow || perf_cost(op) > perf_cost(slow)))
+			slow = op;
+	}
+	return slow;
+}
+
+/* execute the input with its output discarded, returns the slow command */
+static PerfOp *perf_execute(const char *name, const char *input, size_t len) {
+	if (len == 0)
+		return NULL;
+	fflush(stdout);
+	int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+	if (out == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1)
+		return NULL;
+	close(null);
+	for (perf_run = 0; perf_run < PERF_RUNS; perf_run++) {
+		FILE *file = fmemopen((void*)input, len, "r");
+		if (!file)
+			break;
+		srand(1);
+		perf_count = 0;
+		repl(name, file);
+		fclose(file);
+	}
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	return perf_run == PERF_RUNS ? perf_slow() : NULL;
+}
+
+/* remove chunks of lines, halving their size, as long as the input stays slow */
+static size_t perf_minimize(const char *name, char *input, size_t len) {
+	char *copy = malloc(len);
+	if (!copy)
+		return len;
+	size_t lines = 0;
+	for (size_t i = 0; i < len; i++)
+		lines += input[i] == '\n' || i == len - 1;
+	for (size_t chunk = lines / 2; chunk > 0; chunk /= 2) {
+		for (size_t first = 0; first < lines; ) {
+			/* try without the lines [first, first + chunk) */
+			size_t start = 0, end, line = 0, copy_len;
+			for (; start < len && line < first; start++)
+				line += input[start] == '\n';
+			for (end = start; end < len && line < first + chunk; end++)
+				line += input[end] == '\n';
+			memcpy(copy, input, start);
+			memcpy(copy + start, input + end, len - end);
+			copy_len = start + len - end;
+			if (end > start && perf_execute(name, copy, copy_len)) {
+				memcpy(input, copy, copy_len);
+				len = copy_len;
+				lines -= line - first;
+			} else {
+				first += chunk;
+			}
+		}
+	}
+	free(copy);
+	return len;
+}
+
+static bool perf_save(const char *input, size_t len) {
+	char path[PATH_MAX];
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)input[i]) * 1099511628211ULL;
+	snprintf(path, sizeof path, "%s/perf-%016" PRIx64 ".in", PERF_DIR, hash);
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return false;
+	bool success = fwrite(input, len, 1, file) == 1;
+	if (fclose(file) == EOF)
+		success = false;
+	if (success)
+		fprintf(stderr, "Saved slow input to `%s'\n", path);
+	return success;
+}
+
+static int perf_main(const char *name) {
+	char *input = NULL;
+	size_t len = 0, size = 0;
+	for (;;) {
+		if (len == size) {
+			char *tmp = realloc(input, size = size ? 2 * size : BUFSIZ);
+			if (!tmp)
+				return 1;
+			input = tmp;
+		}
+		size_t n = fread(input + len, 1, size - len, stdin);
+		if (n == 0)
+			break;
+		len += n;
+	}
+	perf = true;
+	PerfOp *slow = perf_execute(name, input, len);
+	if (!slow) {
+		free(input);
+		return 0;
+	}
+	fprintf(stderr, "Slow command on line %zu: %" PRIu64 "us with %zu pieces and %zu bytes\n",
+	        slow->lineno, slow->time, slow->pieces, slow->size);
+	len = perf_minimize(name, input, len);
+	perf_save(input, len);
+	free(input);
+	abort();
+}
+
 int main(int argc, char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "-p") == 0)
+		return perf_main(argc == 2 ? NULL : argv[2]);
 	return repl(argc == 1 ? NULL : argv[1], stdin);
 }
 
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+export VIS_PATH=.
+export PATH="$(pwd)/../..:$PATH"
+export LANG="en_US.UTF-8"
+[ -z "$VIS" ] && VIS="../../vis"
+$VIS -v
+
+if ! $VIS -v | grep '+lua' >/dev/null 2>&1; then
+	echo "vis compiled without lua support, skipping tests"
+	exit 0
+fi
+
+# all tests start from the same buffer content
+awk 'BEGIN {
+	for (i = 1; i <= 300; i++) {
+		printf "static int function_%d(int value, const char *name) {\n", i
+		printf "\treturn value * %d + strlen(name); /* item %d */\n}\n\n", i, i
+	}
+}' > latency.c
+
+TESTS_OK=0
+TESTS_RUN=0
+
+if [ $# -gt 0 ]; then
+	test_files=$*
+else
+	test_files="$(find . -type f -name '*.keys')"
+fi
+
+for t in $test_files; do
+	TESTS_RUN=$((TESTS_RUN + 1))
+	t=${t%.keys}
+	t=${t%.in}
+	t=${t#./}
+	rm -f "$t".out "$t".err
+	cp latency.c "$t".in
+	$VIS "$t".in < /dev/null 2> /dev/null
+	RETURN_CODE=$?
+	rm -f "$t".in
+
+	printf "%-50s" "$t"
+	if [ $RETURN_CODE -eq 0 -a -e "$t".out -a ! -e "$t".err ]; then
+		printf "PASS\n"
+		TESTS_OK=$((TESTS_OK + 1))
+	elif [ -e "$t".err ]; then
+		printf "FAIL\n"
+		cat "$t".err
+	else
+		printf "ERROR\n"
+	fi
+	[ -e "$t".out ] && sed 's/^/\t/' "$t".out
+done
+
+rm -f latency.c
+
+printf "Tests ok %d/%d\n" $TESTS_OK $TESTS_RUN
+
+# set exit status
+[ $TESTS_OK -eq $TESTS_RUN ]
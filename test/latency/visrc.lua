@@ -0,0 +1,108 @@
+package.path = '../../lua/?.lua;'..package.path
+dofile("../../lua/vis.lua")
+
+-- maximal latencies in seconds, test.lua files might adjust them
+budget = {
+	keys = { p50 = 0.002, p99 = 0.010, max = 0.050 },
+	draw = { p50 = 0.005, p99 = 0.020, max = 0.100 },
+}
+
+-- upper bounds of the histogram buckets in seconds
+local buckets = { 0.0001, 0.001, 0.01, 0.1, math.huge }
+local labels = { "<0.1ms", "<1ms", "<10ms", "<100ms", ">=100ms" }
+
+local function run_if_exists(luafile)
+	local f = io.open(luafile, "r")
+	if f ~= nil then
+		f:close()
+		dofile(luafile)
+	end
+end
+
+-- split into single keys, either symbolic <Key> names or characters
+local function split(keys)
+	local result = {}
+	local i = 1
+	while i <= #keys do
+		local key = keys:match('^<[^<>%s]+>', i) or
+		            keys:match('^[\1-\127\194-\244][\128-\191]*', i) or
+		            keys:sub(i, i)
+		table.insert(result, key)
+		i = i + #key
+	end
+	return result
+end
+
+local function percentile(sorted, p)
+	if #sorted == 0 then return 0 end
+	return sorted[math.max(1, math.ceil(#sorted * p))]
+end
+
+local function summary(samples)
+	local sorted = {}
+	for i, v in ipairs(samples) do sorted[i] = v end
+	table.sort(sorted)
+	local counts = {}
+	for i = 1, #buckets do counts[i] = 0 end
+	for _, v in ipairs(sorted) do
+		for i, bound in ipairs(buckets) do
+			if v < bound then
+				counts[i] = counts[i] + 1
+				break
+			end
+		end
+	end
+	return {
+		p50 = percentile(sorted, 0.50),
+		p99 = percentile(sorted, 0.99),
+		max = sorted[#sorted] or 0,
+		counts = counts,
+	}
+end
+
+vis.events.subscribe(vis.events.START, function()
+	local name = vis.win.file.name
+	if not name then return end
+	name = string.gsub(name, '%.in$', '')
+	run_if_exists(string.format("%s.lua", name))
+	local file = io.open(string.format("%s.keys", name))
+	local keys = file:read('*all')
+	file:close()
+	keys = string.gsub(keys, '%s*\n', '')
+	keys = string.gsub(keys, '<Space>', ' ')
+
+	local samples = { keys = {}, draw = {} }
+	vis:draw()
+	for _, key in ipairs(split(keys)) do
+		local start = os.clock()
+		vis:feedkeys(key)
+		local processed = os.clock()
+		vis:draw()
+		local drawn = os.clock()
+		table.insert(samples.keys, processed - start)
+		table.insert(samples.draw, drawn - processed)
+	end
+
+	local out = io.open(string.format("%s.out", name), "w")
+	out:write("phase\tkeys\tp50\tp99\tmax\t"..table.concat(labels, "\t").."\n")
+	local failures = {}
+	for _, phase in ipairs({ "keys", "draw" }) do
+		local s = summary(samples[phase])
+		out:write(string.format("%s\t%d\t%.3f\t%.3f\t%.3f\t%s\n", phase, #samples[phase],
+			s.p50 * 1000, s.p99 * 1000, s.max * 1000, table.concat(s.counts, "\t")))
+		for _, stat in ipairs({ "p50", "p99", "max" }) do
+			local limit = budget[phase] and budget[phase][stat]
+			if limit and s[stat] > limit then
+				table.insert(failures, string.format("%s %s %.3fms exceeds budget of %.3fms",
+					phase, stat, s[stat] * 1000, limit * 1000))
+			end
+		end
+	end
+	out:close()
+	if #failures > 0 then
+		local err = io.open(string.format("%s.err", name), "w")
+		err:write(table.concat(failures, "\n").."\n")
+		err:close()
+	end
+	vis:exit(0)
+end)
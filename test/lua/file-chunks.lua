@@ -0,0 +1,39 @@
+require 'busted.runner'()
+
+local file = vis.win.file
+
+local concat = function(...)
+	local parts = {}
+	for _, chunk in file:chunks(...) do
+		table.insert(parts, chunk)
+	end
+	return table.concat(parts)
+end
+
+describe("file:chunks", function()
+
+	it("iterates over the whole file", function()
+		assert.are.equal(file:content(0, file.size), concat())
+	end)
+
+	it("accepts an explicit nil range", function()
+		assert.are.equal(file:content(0, file.size), concat(nil))
+	end)
+
+	it("iterates over a range", function()
+		assert.are.equal(file:content(2, 8), concat({ start = 2, finish = 10 }))
+	end)
+
+	it("iterates over a position and length", function()
+		assert.are.equal(file:content(6, 7), concat(6, 7))
+	end)
+
+	it("reports the position of every chunk", function()
+		local expected = 3
+		for pos, chunk in file:chunks({ start = 3, finish = 12 }) do
+			assert.are.equal(expected, pos)
+			expected = pos + #chunk
+		end
+		assert.are.equal(12, expected)
+	end)
+end)
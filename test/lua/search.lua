@@ -0,0 +1,49 @@
+require 'busted.runner'()
+
+local win = vis.win
+local file = win.file
+
+describe("search", function()
+
+	before_each(function()
+		vis.registers['/'] = { 'aa' }
+		win.selection.pos = 0
+	end)
+
+	it("moves to overlapping matches", function()
+		local positions = {}
+		for i = 1, 4 do
+			vis:feedkeys('n')
+			table.insert(positions, win.selection.pos)
+		end
+		assert.are.same({ 1, 2, 8, 9 }, positions)
+	end)
+
+	it("moves back to the successive matches", function()
+		win.selection.pos = 8
+		vis:feedkeys('N')
+		assert.are.equal(2, win.selection.pos)
+		vis:feedkeys('N')
+		assert.are.equal(0, win.selection.pos)
+	end)
+
+	it("has no count before the file was indexed", function()
+		local number, count, complete = file:search_count(0)
+		assert.are.equal(0, number)
+		assert.are.equal(0, count)
+		assert.is_false(complete)
+	end)
+
+	it("does not count without a pattern", function()
+		vis.registers['/'] = { '' }
+		assert.is_nil(file:search_count(0))
+	end)
+
+	it("toggles the highlighting of matches", function()
+		assert.is_false(vis.options.hlsearch)
+		vis.options.hls = true
+		assert.is_true(vis.options.hlsearch)
+		vis.options.hlsearch = false
+		assert.is_false(vis.options.hls)
+	end)
+end)
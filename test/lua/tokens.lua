@@ -0,0 +1,43 @@
+require 'busted.runner'()
+
+local win = vis.win
+local file = win.file
+
+describe("win:token_at", function()
+
+	local tokens = { 'keyword', 6, 'whitespace', 7, 'identifier', 8, 'whitespace', 9,
+	                 'operator', 10, 'whitespace', 11, 'number', 12, 'whitespace', 13 }
+
+	before_each(function()
+		win.syntax = 'lua'
+		win.tokens = { tokens = tokens, start = 0, syntax = win.syntax, generation = file.generation }
+	end)
+
+	it("finds the token containing a position", function()
+		assert.are.same({ 0, 5, 'keyword' }, { win:token_at(0) })
+		assert.are.same({ 0, 5, 'keyword' }, { win:token_at(4) })
+		assert.are.same({ 5, 6, 'whitespace' }, { win:token_at(5) })
+		assert.are.same({ 10, 11, 'number' }, { win:token_at(10) })
+		assert.are.same({ 11, 12, 'whitespace' }, { win:token_at(11) })
+	end)
+
+	it("ignores positions which are not covered", function()
+		assert.is_nil(win:token_at(12))
+		win.tokens.start = 2
+		assert.is_nil(win:token_at(1))
+	end)
+
+	it("ignores a token which might continue beyond the lexed text", function()
+		win.tokens.tokens = { 'keyword', 6, 'whitespace', 7, 'identifier', 8 }
+		assert.are.same({ 5, 6, 'whitespace' }, { win:token_at(5) })
+		assert.is_nil(win:token_at(6))
+	end)
+
+	it("ignores outdated tokens", function()
+		win.tokens.generation = file.generation - 1
+		assert.is_nil(win:token_at(0))
+		win.tokens.generation = file.generation
+		win.syntax = nil
+		assert.is_nil(win:token_at(0))
+	end)
+end)
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+export VIS_PATH=.
+export PATH="$(pwd)/../..:$PATH"
+export LANG="en_US.UTF-8"
+[ -z "$VIS" ] && VIS="../../vis"
+[ -z "$SIZES" ] && SIZES="80x24 160x48 400x120"
+[ -z "$FRAMES" ] && FRAMES=200
+export FRAMES
+$VIS -v
+
+if ! $VIS -v | grep '+lua' >/dev/null 2>&1; then
+	echo "vis compiled without lua support, skipping benchmark"
+	exit 0
+fi
+
+# long wrapped lines at the start, followed by short ones
+awk 'BEGIN {
+	for (i = 0; i < 2000; i++) {
+		printf "static const char *long_%d = \"", i
+		for (j = 0; j < 40 + i % 30; j++)
+			printf "word%d ", j
+		printf "\";\n"
+	}
+	for (i = 0; i < 10000; i++) {
+		printf "int function_%d(int arg) {\n", i
+		printf "\tint result = arg * %d; /* comment */\n", i
+		printf "\treturn result + function_%d(arg - 1);\n}\n\n", i + 1
+	}
+}' > render.c
+
+rm -f render.out
+printf "size\tscenario\twindows\tframes\tview\thighlight\tui\tblit\tbytes/frame\n" > render.out
+for size in $SIZES; do
+	COLUMNS=${size%x*} LINES=${size#*x} $VIS render.c < /dev/null 2> /dev/null
+	if [ $? -ne 0 ]; then
+		echo "benchmark failed for $size"
+		exit 1
+	fi
+done
+
+cat render.out
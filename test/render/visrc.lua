@@ -0,0 +1,48 @@
+package.path = '../../lua/?.lua;'..package.path
+dofile("../../lua/vis.lua")
+
+-- every scenario is prepared by the setup keys, afterwards a frame is
+-- drawn after each of the frame keys, repeated as often as needed
+local scenarios = {
+	{ name = "scroll-pages", setup = "G", frames = { "<C-b>" } },
+	{ name = "scroll-lines", setup = "G", frames = { "<C-y>" } },
+	{ name = "wrap", setup = "gg", frames = { "<C-e>" } },
+	{ name = "selections", setup = "GV500k:x/[a-z_]+/<Enter>", frames = { "l", "h" } },
+	{ name = "splits", setup = ":split<Enter>:vsplit<Enter>G", frames = { "x", "u" } },
+}
+
+local function windows()
+	local count = 0
+	for _ in vis:windows() do count = count + 1 end
+	return count
+end
+
+vis.events.subscribe(vis.events.START, function()
+	local frames = tonumber(os.getenv("FRAMES")) or 200
+	local size = string.format("%sx%s", os.getenv("COLUMNS") or "?", os.getenv("LINES") or "?")
+	vis.win:set_syntax("ansi_c")
+	local out = io.open("render.out", "a")
+	for _, scenario in ipairs(scenarios) do
+		vis:feedkeys("<Escape><Escape>"..scenario.setup)
+		vis:draw()
+		local time = { view = 0, highlight = 0, ui = 0, blit = 0 }
+		local bytes = vis.stats.bytes
+		for i = 1, frames do
+			vis:feedkeys(scenario.frames[(i - 1) % #scenario.frames + 1])
+			vis:draw()
+			local stats = vis.stats
+			time.view = time.view + stats.view.frame_time
+			time.highlight = time.highlight + stats.highlight.frame_time
+			time.blit = time.blit + stats.blit.frame_time
+			-- the frame time of vis:draw covers the highlighting and output
+			time.ui = time.ui + stats.frame.frame_time - stats.highlight.frame_time
+		end
+		bytes = vis.stats.bytes - bytes
+		out:write(string.format("%s\t%s\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%d\n", size,
+			scenario.name, windows(), frames, time.view * 1000 / frames,
+			time.highlight * 1000 / frames, time.ui * 1000 / frames,
+			time.blit * 1000 / frames, bytes / frames))
+	end
+	out:close()
+	vis:exit(0)
+end)
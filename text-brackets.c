@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include "text-internal.h"
+#include "array.h"
+#include "util.h"
+
+/* Index of the bracket nesting used to find matching pairs in large files.
+ *
+ * The text is split into chunks of roughly BRACKET_CHUNK_SIZE bytes. For
+ * each chunk and kind of bracket the sum over its content, counting opening
+ * brackets as +1 and closing ones as -1, is recorded together with the
+ * minimal prefix sum. A search hence skips over every chunk in which the
+ * running sum can not reach its target and only looks at the bytes of the
+ * one in which it does.
+ *
+ * Brackets within double quoted strings might be ignored. Whether a bracket
+ * is within a string depends on the number of quotes between it and the
+ * start of the search, therefore the sums are kept separately for brackets
+ * preceded by an even and an odd number of quotes within the chunk.
+ *
+ * A modification invalidates the chunks overlapping it, the positions of
+ * the following ones are adjusted. The uncovered parts are indexed anew by
+ * the next search which can not be answered by looking at no more than one
+ * chunk worth of bytes.
+ */
+
+#define BRACKET_CHUNK_SIZE (1 << 14)
+
+enum {
+	BRACKET_ALL,  /* all brackets */
+	BRACKET_EVEN, /* brackets preceded by an even number of quotes */
+	BRACKET_ODD,  /* brackets preceded by an odd number of quotes */
+	BRACKET_SETS,
+};
+
+typedef struct {
+	size_t start, end;
+	bool quotes;                 /* whether it contains an odd number of quotes */
+	struct {
+		int sum, min;        /* over the content, minimal prefix sum including the empty one */
+	} sums[4][BRACKET_SETS];     /* for the kinds of brackets in bracket_open */
+} BracketChunk;
+
+struct TextBrackets {
+	Array chunks;                /* BracketChunk ordered by position */
+	size_t generation;           /* of the text the chunks refer to */
+};
+
+static const char bracket_open[] = "({[<";
+static const char bracket_close[] = ")}]>";
+
+static void sum_add(BracketChunk *chunk, int kind, int set, int delta) {
+	if ((chunk->sums[kind][set].sum += delta) < chunk->sums[kind][set].min)
+		chunk->sums[kind][set].min = chunk->sums[kind][set].sum;
+}
+
+static void chunk_scan(Text *txt, BracketChunk *chunk) {
+	bool quotes = false;
+	const char *data;
+	size_t len;
+	memset(chunk->sums, 0, sizeof chunk->sums);
+	for (Iterator it = text_iterator_get(txt, chunk->start); text_iterator_chunk_next(&it, chunk->end, &data, &len); ) {
+		for (const char *c = data, *end = data + len; c < end; c++) {
+			int kind, delta;
+			switch (*c) {
+			case '"': quotes = !quotes; continue;
+			case '(': kind = 0; delta = +1; break;
+			case ')': kind = 0; delta = -1; break;
+			case '{': kind = 1; delta = +1; break;
+			case '}': kind = 1; delta = -1; break;
+			case '[': kind = 2; delta = +1; break;
+			case ']': kind = 2; delta = -1; break;
+			case '<': kind = 3; delta = +1; break;
+			case '>': kind = 3; delta = -1; break;
+			default: continue;
+			}
+			sum_add(chunk, kind, BRACKET_ALL, delta);
+			sum_add(chunk, kind, BRACKET_EVEN + quotes, delta);
+		}
+	}
+	chunk->quotes = quotes;
+}
+
+/* remove the chunks affected by a modification and move the later ones */
+static void brackets_change(TextBrackets *brackets, const TextChange *change) {
+	Array *chunks = &brackets->chunks;
+	size_t lo = change->pos, hi = change->pos + change->removed;
+	size_t i = 0, len = array_length(chunks);
+	for (size_t l = len; i < l; ) {
+		size_t mid = i + (l - i) / 2;
+		if (((BracketChunk*)array_get(chunks, mid))->end <= lo)
+			i = mid + 1;
+		else
+			l = mid;
+	}
+	while (i < len) {
+		BracketChunk *chunk = array_get(chunks, i);
+		if (chunk->start >= hi)
+			break;
+		array_remove(chunks, i);
+		len--;
+	}
+	for (; i < len; i++) {
+		BracketChunk *chunk = array_get(chunks, i);
+		chunk->start = chunk->start - change->removed + change->inserted;
+		chunk->end = chunk->end - change->removed + change->inserted;
+	}
+}
+
+static bool chunk_add(Text *txt, Array *chunks, size_t start, size_t end) {
+	BracketChunk chunk = { .start = start, .end = end };
+	chunk_scan(txt, &chunk);
+	return array_add(chunks, &chunk);
+}
+
+/* bring the index up to date, returns NULL unless it covers the whole text */
+static TextBrackets *brackets_update(Text *txt) {
+	TextBrackets **ptr = text_brackets(txt);
+	TextBrackets *brackets = *ptr;
+	size_t generation = text_generation(txt);
+	if (!brackets) {
+		if (!(brackets = *ptr = calloc(1, sizeof *brackets)))
+			return NULL;
+		array_init_sized(&brackets->chunks, sizeof(BracketChunk));
+		brackets->generation = generation;
+	}
+	for (size_t g = brackets->generation; g++ != generation && array_length(&brackets->chunks); ) {
+		TextChange change;
+		if (!text_change_get(txt, g, &change)) {
+			array_clear(&brackets->chunks);
+			break;
+		}
+		brackets_change(brackets, &change);
+	}
+	brackets->generation = generation;
+
+	/* index the gaps between the remaining chunks */
+	Array chunks;
+	array_init_sized(&chunks, sizeof(BracketChunk));
+	bool complete = true;
+	size_t pos = 0, size = text_size(txt);
+	for (size_t i = 0, len = array_length(&brackets->chunks); i <= len && complete; i++) {
+		BracketChunk *chunk = i < len ? array_get(&brackets->chunks, i) : NULL;
+		size_t next = chunk ? chunk->start : size;
+		if (pos < next) {
+			/* absorb small neighbours, to keep the number of chunks bounded */
+			size_t count = array_length(&chunks);
+			BracketChunk *prev = count ? array_get(&chunks, count - 1) : NULL;
+			if (prev && prev->end == pos && prev->end - prev->start < BRACKET_CHUNK_SIZE / 4) {
+				pos = prev->start;
+				array_truncate(&chunks, count - 1);
+			}
+			if (chunk && chunk->end - chunk->start < BRACKET_CHUNK_SIZE / 4) {
+				next = chunk->end;
+				chunk = NULL;
+			}
+			for (size_t end; pos < next && complete; pos = end) {
+				end = next - pos < BRACKET_CHUNK_SIZE + BRACKET_CHUNK_SIZE / 4 ? next : pos + BRACKET_CHUNK_SIZE;
+				complete = chunk_add(txt, &chunks, pos, end);
+			}
+		}
+		if (chunk && complete) {
+			complete = array_add(&chunks, chunk);
+			pos = chunk->end;
+		}
+	}
+	array_release(&brackets->chunks);
+	brackets->chunks = chunks;
+	return complete ? brackets : NULL;
+}
+
+void text_brackets_free(TextBrackets *brackets) {
+	if (!brackets)
+		return;
+	array_release(&brackets->chunks);
+	free(brackets);
+}
+
+static int bracket_kind(char open) {
+	const char *kind = strchr(bracket_open, open);
+	return open && kind ? kind - bracket_open : -1;
+}
+
+/* look at the bytes from pos up to end, returns the position at which
+ * the running sum reaches -1 or EPOS */
+static size_t scan_forward(Text *txt, size_t pos, size_t end, int kind, bool strings, ssize_t *sum, bool *quotes) {
+	const char open = bracket_open[kind], close = bracket_close[kind];
+	const char *data;
+	size_t len;
+	for (Iterator it = text_iterator_get(txt, pos); text_iterator_chunk_next(&it, end, &data, &len); pos += len) {
+		for (size_t i = 0; i < len; i++) {
+			char c = data[i];
+			if (c == '"')
+				*quotes = !*quotes;
+			else if (strings && *quotes)
+				continue;
+			else if (c == open)
+				(*sum)++;
+			else if (c == close && --(*sum) == -1)
+				return pos + i;
+		}
+	}
+	return EPOS;
+}
+
+/* look at the bytes from pos back to start, returns the position at which
+ * the running sum reaches +1 or EPOS */
+static size_t scan_backward(Text *txt, size_t start, size_t pos, int kind, bool strings, ssize_t *sum, bool *quotes) {
+	const char open = bracket_open[kind], close = bracket_close[kind];
+	char c;
+	Iterator it = text_iterator_get(txt, pos);
+	while (it.pos > start && text_iterator_byte_prev(&it, &c)) {
+		if (c == '"')
+			*quotes = !*quotes;
+		else if (strings && *quotes)
+			continue;
+		else if (c == close)
+			(*sum)--;
+		else if (c == open && ++(*sum) == 1)
+			return it.pos;
+	}
+	return EPOS;
+}
+
+static size_t chunk_find(TextBrackets *brackets, size_t pos) {
+	size_t lo = 0, hi = array_length(&brackets->chunks);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (((BracketChunk*)array_get(&brackets->chunks, mid))->end <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+size_t text_bracket_next(Text *txt, size_t pos, size_t end, char open, bool strings) {
+	int kind = bracket_kind(open);
+	end = MIN(end, text_size(txt));
+	if (kind == -1 || pos >= end)
+		return EPOS;
+	ssize_t sum = 0;
+	bool quotes = false;
+	/* nearby matches are found without bothering with the index */
+	size_t near = end - pos > BRACKET_CHUNK_SIZE ? pos + BRACKET_CHUNK_SIZE : end;
+	size_t match = scan_forward(txt, pos, near, kind, strings, &sum, &quotes);
+	if (match != EPOS || near == end)
+		return match;
+	TextBrackets *brackets = brackets_update(txt);
+	if (!brackets)
+		return scan_forward(txt, near, end, kind, strings, &sum, &quotes);
+	pos = near;
+	for (size_t i = chunk_find(brackets, pos), len = array_length(&brackets->chunks); i < len && pos < end; i++) {
+		BracketChunk *chunk = array_get(&brackets->chunks, i);
+		int set = strings ? BRACKET_EVEN + quotes : BRACKET_ALL;
+		if (chunk->start < pos || chunk->end > end || sum + chunk->sums[kind][set].min <= -1) {
+			size_t stop = MIN(chunk->end, end);
+			if ((match = scan_forward(txt, pos, stop, kind, strings, &sum, &quotes)) != EPOS)
+				return match;
+			pos = stop;
+			continue;
+		}
+		sum += chunk->sums[kind][set].sum;
+		quotes ^= chunk->quotes;
+		pos = chunk->end;
+	}
+	return EPOS;
+}
+
+size_t text_bracket_prev(Text *txt, size_t start, size_t pos, char open, bool strings) {
+	int kind = bracket_kind(open);
+	pos = MIN(pos, text_size(txt));
+	if (kind == -1 || start >= pos)
+		return EPOS;
+	ssize_t sum = 0;
+	bool quotes = false;
+	size_t near = pos - start > BRACKET_CHUNK_SIZE ? pos - BRACKET_CHUNK_SIZE : start;
+	size_t match = scan_backward(txt, near, pos, kind, strings, &sum, &quotes);
+	if (match != EPOS || near == start)
+		return match;
+	TextBrackets *brackets = brackets_update(txt);
+	if (!brackets)
+		return scan_backward(txt, start, near, kind, strings, &sum, &quotes);
+	pos = near;
+	for (size_t i = chunk_find(brackets, pos - 1) + 1; i-- > 0 && pos > start; ) {
+		BracketChunk *chunk = array_get(&brackets->chunks, i);
+		/* brackets followed by an even number of quotes up to the start of the search */
+		int set = strings ? BRACKET_EVEN + (quotes ^ chunk->quotes) : BRACKET_ALL;
+		int total = chunk->sums[kind][set].sum;
+		/* the maximal suffix sum is the total less the minimal prefix sum */
+		if (chunk->end > pos || chunk->start < start || sum + total - chunk->sums[kind][set].min >= 1) {
+			size_t stop = MAX(chunk->start, start);
+			if ((match = scan_backward(txt, stop, pos, kind, strings, &sum, &quotes)) != EPOS)
+				return match;
+			pos = stop;
+			continue;
+		}
+		sum += total;
+		quotes ^= chunk->quotes;
+		pos = chunk->start;
+	}
+	return EPOS;
+}
@@ -42,22 +42,13 @@ size_t text_bytes_get(const Text *txt, size_t pos, size_t len, char *buf) {
 	if (!buf)
 		return 0;
 	char *cur = buf;
-	size_t rem = len;
+	const char *chunk;
+	size_t chunk_len, end = len > SIZE_MAX - pos ? SIZE_MAX : pos + len;
 	for (Iterator it = text_iterator_get(txt, pos);
-	     text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		if (rem == 0)
-			break;
-		size_t piece_len = it.end - it.text;
-		if (piece_len > rem)
-			piece_len = rem;
-		if (piece_len) {
-			memcpy(cur, it.text, piece_len);
-			cur += piece_len;
-			rem -= piece_len;
-		}
-	}
-	return len - rem;
+	     text_iterator_chunk_next(&it, end, &chunk, &chunk_len);
+	     cur += chunk_len)
+		memcpy(cur, chunk, chunk_len);
+	return cur - buf;
 }
 
 char *text_bytes_alloc0(const Text *txt, size_t pos, size_t len) {
@@ -3,8 +3,11 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 #include "text.h"
 
+typedef struct Revision Revision;
+
 /* Block holding the file content, either readonly mmap(2)-ed from the original
  * file or heap allocated to store the modifications.
  */
@@ -12,6 +15,8 @@ typedef struct {
 	size_t size;               /* maximal capacity */
 	size_t len;                /* current used length / insertion position */
 	char *data;                /* actual data */
+	int fd;                    /* descriptor of the mmap(2)-ed file, used for kernel side copies, or -1 */
+	off_t offset;              /* file offset corresponding to the start of data */
 	enum {                     /* type of allocation */
 		BLOCK_TYPE_MMAP_ORIG, /* mmap(2)-ed from an external file */
 		BLOCK_TYPE_MMAP,      /* mmap(2)-ed from a temporary file only known to this process */
@@ -20,16 +25,31 @@ typedef struct {
 } Block;
 
 Block *block_alloc(size_t size);
+Block *block_alloc_file(size_t size);
 Block *block_read(size_t size, int fd);
 Block *block_mmap(size_t size, int fd, off_t offset);
 Block *block_load(int dirfd, const char *filename, enum TextLoadMethod method, struct stat *info);
+Block *block_load_range(int fd, off_t offset, size_t size, enum TextLoadMethod method);
 void block_free(Block*);
 bool block_capacity(Block*, size_t len);
 const char *block_append(Block*, const char *data, size_t len);
 bool block_insert(Block*, size_t pos, const char *data, size_t len);
 bool block_delete(Block*, size_t pos, size_t len);
 
-Block *text_block_mmaped(Text*);
-void text_saved(Text*, struct stat *meta);
+Block *text_block_mmaped(Text*, size_t index);
+/* bracket nesting index, NULL until first needed and released with the text */
+typedef struct TextBrackets TextBrackets;
+TextBrackets **text_brackets(Text*);
+void text_brackets_free(TextBrackets*);
+/* find the first position in [pos, end) at which closing brackets matching
+ * open outnumber the opening ones, optionally ignoring those within double
+ * quoted strings. Returns EPOS if there is none */
+size_t text_bracket_next(Text*, size_t pos, size_t end, char open, bool strings);
+/* find the last position in [start, pos) at which, scanning backwards, the
+ * opening brackets outnumber the closing ones */
+size_t text_bracket_prev(Text*, size_t start, size_t pos, char open, bool strings);
+void text_saved(Text*, struct stat *meta, Revision *rev);
+Revision *text_saved_revision_new(Text*);
+void text_saved_revision_release(Text*);
 
 #endif
@@ -1,3 +1,6 @@
+#if HAVE_COPY_FILE_RANGE && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* copy_file_range(2) is non-standard */
+#endif
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -6,7 +9,10 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <signal.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
 #if CONFIG_ACL
 #include <sys/acl.h>
 #endif
@@ -26,6 +32,12 @@ struct TextSave {                  /* used to hold context between text_save_{be
 	int fd;                    /* file descriptor to write data to using text_save_write */
 	int dirfd;                 /* directory file descriptor, relative to which we save */
 	enum TextSaveMethod type;  /* method used to save file */
+	pid_t pid;                 /* background process writing the data or -1 */
+	int progressfd;            /* pipe on which the background process reports progress or -1 */
+	size_t written;            /* number of bytes written by the background process */
+	pid_t filter;              /* process transforming the data before it reaches fd or -1 */
+	int filterfd;              /* pipe connected to the standard input of the filter or -1 */
+	Revision *revision;        /* revision being saved, NULL for the current one */
 };
 
 /* Allocate blocks holding the actual file content in chunks of size: */
@@ -37,6 +49,30 @@ struct TextSave {                  /* used to hold context between text_save_{be
  * results in havoc. */
 #define BLOCK_MMAP_SIZE (1 << 26)
 
+/* Blocks backed by a temporary file are allocated with at least this size,
+ * the space is reserved up front but only touched when written to. */
+#ifndef BLOCK_FILE_SIZE
+#define BLOCK_FILE_SIZE (1 << 26)
+#endif
+
+/* create an unlinked temporary file in $TMPDIR or /tmp, returns -1 on failure */
+static int block_tmpfile(void) {
+	const char *dir = getenv("TMPDIR");
+	char tmpname[PATH_MAX];
+	if (!dir || !*dir)
+		dir = "/tmp";
+	if (snprintf(tmpname, sizeof tmpname, "%s/vis-XXXXXX", dir) >= (int)sizeof tmpname)
+		return -1;
+	int fd = mkstemp(tmpname);
+	if (fd == -1)
+		return -1;
+	if (unlink(tmpname) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
 /* allocate a new block of MAX(size, BLOCK_SIZE) bytes */
 Block *block_alloc(size_t size) {
 	Block *blk = calloc(1, sizeof *blk);
@@ -50,9 +86,37 @@ Block *block_alloc(size_t size) {
 	}
 	blk->type = BLOCK_TYPE_MALLOC;
 	blk->size = size;
+	blk->fd = -1;
 	return blk;
 }
 
+/* allocate a new block of MAX(size, BLOCK_FILE_SIZE) bytes, which are
+ * mmap(2)-ed from a temporary file such that the kernel can page them out */
+Block *block_alloc_file(size_t size) {
+	if (BLOCK_FILE_SIZE > size)
+		size = BLOCK_FILE_SIZE;
+	Block *blk = calloc(1, sizeof *blk);
+	if (!blk)
+		return NULL;
+	int fd = block_tmpfile();
+	/* running out of space later on would raise SIGBUS instead of failing */
+	if (fd == -1 || (off_t)size < 0 || posix_fallocate(fd, 0, size) != 0)
+		goto err;
+	blk->data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (blk->data == MAP_FAILED)
+		goto err;
+	close(fd);
+	blk->type = BLOCK_TYPE_MMAP;
+	blk->size = size;
+	blk->fd = -1;
+	return blk;
+err:
+	if (fd != -1)
+		close(fd);
+	free(blk);
+	return NULL;
+}
+
 Block *block_read(size_t size, int fd) {
 	Block *blk = block_alloc(size);
 	if (!blk)
@@ -89,6 +153,9 @@ Block *block_mmap(size_t size, int fd, off_t offset) {
 	blk->type = BLOCK_TYPE_MMAP_ORIG;
 	blk->size = size;
 	blk->len = size;
+	/* kept open to copy unmodified content on save, failure is not fatal */
+	blk->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	blk->offset = offset;
 	return blk;
 }
 
@@ -118,6 +185,21 @@ out:
 	return block;
 }
 
+/* load size bytes starting at offset, which are found at blk->data + offset - blk->offset */
+Block *block_load_range(int fd, off_t offset, size_t size, enum TextLoadMethod method) {
+	if (method == TEXT_LOAD_READ || (method == TEXT_LOAD_AUTO && size < BLOCK_MMAP_SIZE)) {
+		if (lseek(fd, offset, SEEK_SET) == -1)
+			return NULL;
+		Block *blk = block_read(size, fd);
+		if (blk)
+			blk->offset = offset;
+		return blk;
+	}
+	/* mappings start at a page boundary */
+	off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+	return block_mmap(size + (offset - start), fd, start);
+}
+
 void block_free(Block *blk) {
 	if (!blk)
 		return;
@@ -125,6 +207,8 @@ void block_free(Block *blk) {
 		free(blk->data);
 	else if ((blk->type == BLOCK_TYPE_MMAP_ORIG || blk->type == BLOCK_TYPE_MMAP) && blk->data)
 		munmap(blk->data, blk->size);
+	if (blk->fd != -1)
+		close(blk->fd);
 	free(blk);
 }
 
@@ -182,20 +266,85 @@ Text *text_load_method(const char *filename, enum TextLoadMethod method) {
 	return text_loadat_method(AT_FDCWD, filename, method);
 }
 
-static ssize_t write_all(int fd, const char *buf, size_t count) {
+/* run argv with the given standard input and output, the error output is
+ * discarded. The descriptors are closed by the caller */
+static pid_t filter_spawn(const char *const argv[], int in, int out) {
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+	sigset_t set;
+	sigemptyset(&set);
+	sigprocmask(SIG_SETMASK, &set, NULL);
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	int null = open("/dev/null", O_WRONLY);
+	if (dup2(in, STDIN_FILENO) == -1 || dup2(out, STDOUT_FILENO) == -1)
+		_exit(127);
+	if (null != -1)
+		dup2(null, STDERR_FILENO);
+	execvp(argv[0], (char *const*)argv);
+	_exit(127);
+}
+
+static bool pipe_cloexec(int fds[2]) {
+	if (pipe(fds) == -1)
+		return false;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+}
+
+int text_load_filter(int dirfd, const char *filename, const char *const argv[], pid_t *pid) {
+	int fds[2];
+	struct stat meta;
+	int fd = openat(dirfd, filename, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &meta) == -1)
+		goto err;
+	if (!S_ISREG(meta.st_mode)) {
+		errno = S_ISDIR(meta.st_mode) ? EISDIR : ENOTSUP;
+		goto err;
+	}
+	if (!pipe_cloexec(fds))
+		goto err;
+	*pid = filter_spawn(argv, fd, fds[1]);
+	close(fds[1]);
+	if (*pid == -1) {
+		close(fds[0]);
+		goto err;
+	}
+	close(fd);
+	return fds[0];
+err:
+	close(fd);
+	return -1;
+}
+
+bool text_load_commit(Text *txt, int dirfd, const char *filename) {
+	struct stat meta;
+	if (fstatat(dirfd, filename, &meta, 0) == -1)
+		return false;
+	text_snapshot(txt);
+	text_saved(txt, &meta, NULL);
+	return true;
+}
+
+/* copy count bytes starting at offset off of srcfd to the current position
+ * of fd without passing through user space. Returns the number of bytes
+ * copied, which is zero if the kernel (or file system) does not support it. */
+static size_t copy_all(int fd, int srcfd, off_t off, size_t count) {
 	size_t rem = count;
+#if HAVE_COPY_FILE_RANGE
 	while (rem > 0) {
-		ssize_t written = write(fd, buf, rem > INT_MAX ? INT_MAX : rem);
-		if (written < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			return -1;
-		} else if (written == 0) {
+		ssize_t copied = copy_file_range(srcfd, &off, fd, NULL, rem, 0);
+		if (copied < 0 && errno == EINTR)
+			continue;
+		if (copied <= 0)
 			break;
-		}
-		rem -= written;
-		buf += written;
+		rem -= copied;
 	}
+#endif
 	return count - rem;
 }
 
@@ -333,6 +482,25 @@ err:
 	return false;
 }
 
+/* wait for the filter to process all data written so far */
+static bool filter_finish(TextSave *ctx) {
+	if (ctx->filterfd != -1) {
+		close(ctx->filterfd);
+		ctx->filterfd = -1;
+	}
+	if (ctx->filter == -1)
+		return true;
+	int status;
+	pid_t pid = ctx->filter;
+	ctx->filter = -1;
+	if (waitpid(pid, &status, 0) == -1)
+		return false;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return true;
+	errno = EIO;
+	return false;
+}
+
 static bool text_save_commit_atomic(TextSave *ctx) {
 	if (fsync(ctx->fd) == -1)
 		return false;
@@ -364,7 +532,7 @@ static bool text_save_commit_atomic(TextSave *ctx) {
 	if (close(dir) == -1)
 		return false;
 
-	text_saved(ctx->txt, &meta);
+	text_saved(ctx->txt, &meta, ctx->revision);
 	return true;
 }
 
@@ -377,19 +545,15 @@ static bool text_save_begin_inplace(TextSave *ctx) {
 	if (fstat(ctx->fd, &now) == -1)
 		goto err;
 	struct stat loaded = text_stat(txt);
-	Block *block = text_block_mmaped(txt);
-	if (block && now.st_dev == loaded.st_dev && now.st_ino == loaded.st_ino) {
+	bool same = now.st_dev == loaded.st_dev && now.st_ino == loaded.st_ino;
+	for (Block *block; same && (block = text_block_mmaped(txt, 0)); ) {
 		/* The file we are going to overwrite is currently mmap-ed from
-		 * text_load, therefore we copy the mmap-ed block to a temporary
-		 * file and remap it at the same position such that all pointers
+		 * text_load, therefore we copy the mmap-ed blocks to a temporary
+		 * file and remap them at the same position such that all pointers
 		 * from the various pieces are still valid.
 		 */
 		size_t size = block->size;
-		char tmpname[32] = "/tmp/vis-XXXXXX";
-		newfd = mkstemp(tmpname);
-		if (newfd == -1)
-			goto err;
-		if (unlink(tmpname) == -1)
+		if ((newfd = block_tmpfile()) == -1)
 			goto err;
 		ssize_t written = write_all(newfd, block->data, size);
 		if (written == -1 || (size_t)written != size)
@@ -401,6 +565,10 @@ static bool text_save_begin_inplace(TextSave *ctx) {
 		newfd = -1;
 		if (close_failed)
 			goto err;
+		/* the original file is about to be overwritten */
+		if (block->fd != -1)
+			close(block->fd);
+		block->fd = -1;
 		block->type = BLOCK_TYPE_MMAP;
 	}
 	/* overwrite the existing file content, if something goes wrong
@@ -428,7 +596,7 @@ static bool text_save_commit_inplace(TextSave *ctx) {
 		return false;
 	if (close(ctx->fd) == -1)
 		return false;
-	text_saved(ctx->txt, &meta);
+	text_saved(ctx->txt, &meta, ctx->revision);
 	return true;
 }
 
@@ -441,6 +609,10 @@ TextSave *text_save_begin(Text *txt, int dirfd, const char *filename, enum TextS
 	ctx->txt = txt;
 	ctx->fd = -1;
 	ctx->dirfd = dirfd;
+	ctx->pid = -1;
+	ctx->progressfd = -1;
+	ctx->filter = -1;
+	ctx->filterfd = -1;
 	if (!(ctx->filename = strdup(filename)))
 		goto err;
 	errno = 0;
@@ -458,13 +630,13 @@ err:
 bool text_save_commit(TextSave *ctx) {
 	if (!ctx)
 		return true;
-	bool ret;
+	bool ret = filter_finish(ctx);
 	switch (ctx->type) {
 	case TEXT_SAVE_ATOMIC:
-		ret = text_save_commit_atomic(ctx);
+		ret = ret && text_save_commit_atomic(ctx);
 		break;
 	case TEXT_SAVE_INPLACE:
-		ret = text_save_commit_inplace(ctx);
+		ret = ret && text_save_commit_inplace(ctx);
 		break;
 	default:
 		ret = false;
@@ -479,10 +651,24 @@ void text_save_cancel(TextSave *ctx) {
 	if (!ctx)
 		return;
 	int saved_errno = errno;
+	if (ctx->pid != -1) {
+		kill(ctx->pid, SIGKILL);
+		waitpid(ctx->pid, NULL, 0);
+	}
+	if (ctx->filterfd != -1)
+		close(ctx->filterfd);
+	if (ctx->filter != -1) {
+		kill(ctx->filter, SIGKILL);
+		waitpid(ctx->filter, NULL, 0);
+	}
+	if (ctx->progressfd != -1)
+		close(ctx->progressfd);
 	if (ctx->fd != -1)
 		close(ctx->fd);
 	if (ctx->tmpname && ctx->tmpname[0])
 		unlinkat(ctx->dirfd, ctx->tmpname, 0);
+	if (ctx->revision)
+		text_saved_revision_release(ctx->txt);
 	free(ctx->tmpname);
 	free(ctx->filename);
 	free(ctx);
@@ -507,7 +693,7 @@ bool text_save_method(Text *txt, const char *filename, enum TextSaveMethod metho
 
 bool text_saveat_method(Text *txt, int dirfd, const char *filename, enum TextSaveMethod method) {
 	if (!filename) {
-		text_saved(txt, NULL);
+		text_saved(txt, NULL, NULL);
 		return true;
 	}
 	TextSave *ctx = text_save_begin(txt, dirfd, filename, method);
@@ -522,8 +708,133 @@ bool text_saveat_method(Text *txt, int dirfd, const char *filename, enum TextSav
 	return text_save_commit(ctx);
 }
 
+/* write the range, reporting the total amount written after each chunk
+ * on progressfd if it is valid */
+static ssize_t save_write_range(TextSave *ctx, const Filerange *range, int progressfd) {
+	int fd = ctx->filterfd != -1 ? ctx->filterfd : ctx->fd;
+	Block *orig = ctx->filterfd == -1 ? text_block_mmaped(ctx->txt, 0) : NULL;
+	if ((!orig || orig->fd == -1) && progressfd == -1)
+		return text_write_range(ctx->txt, range, fd);
+	/* unmodified parts of the original file are copied by the kernel,
+	 * which might share the underlying storage (reflink) */
+	size_t size = text_range_size(range), rem = size;
+	const char *chunk;
+	size_t len;
+	for (Iterator it = text_iterator_get(ctx->txt, range->start);
+	     text_iterator_chunk_next(&it, range->start + size, &chunk, &len); ) {
+		size_t copied = 0;
+		if (orig && orig->fd != -1 && orig->data <= chunk && chunk < orig->data + orig->len)
+			copied = copy_all(fd, orig->fd, orig->offset + (chunk - orig->data), len);
+		ssize_t written = write_all(fd, chunk + copied, len - copied);
+		if (written == -1)
+			return -1;
+		rem -= copied + (size_t)written;
+		if (progressfd != -1) {
+			size_t total = size - rem;
+			write_all(progressfd, (char*)&total, sizeof total);
+		}
+		if (copied + (size_t)written != len)
+			break;
+	}
+	return size - rem;
+}
+
 ssize_t text_save_write_range(TextSave *ctx, const Filerange *range) {
-	return text_write_range(ctx->txt, range, ctx->fd);
+	return save_write_range(ctx, range, -1);
+}
+
+bool text_save_filter(TextSave *ctx, const char *const argv[]) {
+	int fds[2];
+	if (!ctx || ctx->fd == -1 || ctx->filter != -1 || ctx->pid != -1 || !pipe_cloexec(fds))
+		return false;
+	pid_t pid = filter_spawn(argv, fds[0], ctx->fd);
+	close(fds[0]);
+	if (pid == -1) {
+		close(fds[1]);
+		return false;
+	}
+	ctx->filter = pid;
+	ctx->filterfd = fds[1];
+	return true;
+}
+
+int text_save_background(TextSave *ctx, const Filerange *range) {
+	int fds[2];
+	if (!ctx || ctx->fd == -1 || ctx->pid != -1)
+		return -1;
+	/* killing the background process must not leave a damaged file behind */
+	if (ctx->type != TEXT_SAVE_ATOMIC) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (!pipe_cloexec(fds))
+		return -1;
+	if (ctx->revision)
+		text_saved_revision_release(ctx->txt);
+	ctx->revision = text_saved_revision_new(ctx->txt);
+	pid_t pid = fork();
+	if (pid == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		/* the child works on a copy of the address space, hence sees the
+		 * content as of the time of the fork */
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGBUS);
+		signal(SIGBUS, SIG_DFL);
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		close(fds[0]);
+		ssize_t written = save_write_range(ctx, range, fds[1]);
+		if (written == -1 || (size_t)written != text_range_size(range))
+			_exit(errno ? errno : EIO);
+		/* the filter output is synced once it terminated, see text_save_commit */
+		if (ctx->filterfd == -1 && fsync(ctx->fd) == -1)
+			_exit(errno);
+		_exit(0);
+	}
+	close(fds[1]);
+	/* the filter reaches the end of its input once the child is done */
+	if (ctx->filterfd != -1) {
+		close(ctx->filterfd);
+		ctx->filterfd = -1;
+	}
+	int flags = fcntl(fds[0], F_GETFL);
+	if (flags != -1)
+		fcntl(fds[0], F_SETFL, flags|O_NONBLOCK);
+	ctx->pid = pid;
+	ctx->progressfd = fds[0];
+	return fds[0];
+}
+
+int text_save_poll(TextSave *ctx, size_t *written) {
+	if (!ctx || ctx->pid == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	size_t buf[64];
+	ssize_t len;
+	while ((len = read(ctx->progressfd, buf, sizeof buf)) > 0) {
+		if (len >= (ssize_t)sizeof buf[0])
+			ctx->written = buf[len / sizeof buf[0] - 1];
+	}
+	if (written)
+		*written = ctx->written;
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return 1;
+	int status;
+	pid_t pid = ctx->pid;
+	ctx->pid = -1;
+	close(ctx->progressfd);
+	ctx->progressfd = -1;
+	if (waitpid(pid, &status, 0) == -1)
+		return -1;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return 0;
+	errno = WIFEXITED(status) ? WEXITSTATUS(status) : EINTR;
+	return -1;
 }
 
 ssize_t text_write(const Text *txt, int fd) {
@@ -533,17 +844,47 @@ ssize_t text_write(const Text *txt, int fd) {
 
 ssize_t text_write_range(const Text *txt, const Filerange *range, int fd) {
 	size_t size = text_range_size(range), rem = size;
+	const char *chunk;
+	size_t len;
 	for (Iterator it = text_iterator_get(txt, range->start);
-	     rem > 0 && text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		size_t prem = it.end - it.text;
-		if (prem > rem)
-			prem = rem;
-		ssize_t written = write_all(fd, it.text, prem);
+	     text_iterator_chunk_next(&it, range->start + size, &chunk, &len); ) {
+		ssize_t written = write_all(fd, chunk, len);
 		if (written == -1)
 			return -1;
 		rem -= written;
-		if ((size_t)written != prem)
+		if ((size_t)written != len)
+			break;
+	}
+	return size - rem;
+}
+
+/* maximal number of chunks passed to a single writev(2) call */
+#define TEXT_WRITE_CHUNKS 64
+
+ssize_t text_write_range_nonblock(const Text *txt, const Filerange *range, int fd) {
+	size_t size = text_range_size(range), rem = size;
+	struct iovec iov[TEXT_WRITE_CHUNKS];
+	Iterator it = text_iterator_get(txt, range->start);
+	const char *chunk;
+	size_t len;
+	while (rem > 0) {
+		int count = 0;
+		size_t total = 0;
+		while (count < TEXT_WRITE_CHUNKS && total < SSIZE_MAX / 2 &&
+		       text_iterator_chunk_next(&it, range->end, &chunk, &len)) {
+			iov[count++] = (struct iovec){ .iov_base = (char*)chunk, .iov_len = len };
+			total += len;
+		}
+		if (count == 0)
+			break;
+		ssize_t written = writev(fd, iov, count);
+		if (written == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			return -1;
+		}
+		rem -= written;
+		if ((size_t)written != total)
 			break;
 	}
 	return size - rem;
@@ -101,6 +101,16 @@ bool text_iterator_byte_find_next(Iterator *it, char b) {
 }
 
 bool text_iterator_codepoint_next(Iterator *it, char *c) {
+	/* within a piece there are no boundaries to take care of */
+	while (it->text && it->end - it->text > 1) {
+		it->text++;
+		it->pos++;
+		if (ISUTF8(*it->text)) {
+			if (c)
+				*c = *it->text;
+			return true;
+		}
+	}
 	while (text_iterator_byte_next(it, NULL)) {
 		if (ISUTF8(*it->text)) {
 			if (c)
@@ -112,6 +122,15 @@ bool text_iterator_codepoint_next(Iterator *it, char *c) {
 }
 
 bool text_iterator_codepoint_prev(Iterator *it, char *c) {
+	while (it->text && it->text > it->start) {
+		it->text--;
+		it->pos--;
+		if (ISUTF8(*it->text)) {
+			if (c)
+				*c = *it->text;
+			return true;
+		}
+	}
 	while (text_iterator_byte_prev(it, NULL)) {
 		if (ISUTF8(*it->text)) {
 			if (c)
@@ -122,16 +141,33 @@ bool text_iterator_codepoint_prev(Iterator *it, char *c) {
 	return false;
 }
 
+/* get the bytes of the character at the iterator position, preferably
+ * directly from the piece. Returns their number */
+static size_t iterator_char_bytes(const Iterator *it, char buf[MB_LEN_MAX], const char **s) {
+	*s = it->text;
+	if (it->end - it->text >= MB_LEN_MAX)
+		return MB_LEN_MAX;
+	*s = buf;
+	return text_bytes_get(text_iterator_text(it), it->pos, MB_LEN_MAX, buf);
+}
+
+/* ASCII characters neither combine with others nor need to be decoded */
+static bool iterator_ascii(const Iterator *it) {
+	return it->text < it->end && ISASCII(*it->text);
+}
+
 bool text_iterator_char_next(Iterator *it, char *c) {
 	if (!text_iterator_codepoint_next(it, c))
 		return false;
+	if (iterator_ascii(it))
+		return true;
 	mbstate_t ps = { 0 };
-	const Text *txt = text_iterator_text(it);
 	for (;;) {
 		char buf[MB_LEN_MAX];
-		size_t len = text_bytes_get(txt, it->pos, sizeof buf, buf);
+		const char *s;
+		size_t len = iterator_char_bytes(it, buf, &s);
 		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
+		size_t wclen = mbrtowc(&wc, s, len, &ps);
 		if (wclen == (size_t)-1 && errno == EILSEQ) {
 			return true;
 		} else if (wclen == (size_t)-2) {
@@ -144,6 +180,8 @@ bool text_iterator_char_next(Iterator *it, char *c) {
 				return true;
 			if (!text_iterator_codepoint_next(it, c))
 				return false;
+			if (iterator_ascii(it))
+				return true;
 		}
 	}
 	return true;
@@ -152,13 +190,15 @@ bool text_iterator_char_next(Iterator *it, char *c) {
 bool text_iterator_char_prev(Iterator *it, char *c) {
 	if (!text_iterator_codepoint_prev(it, c))
 		return false;
-	const Text *txt = text_iterator_text(it);
+	if (iterator_ascii(it))
+		return true;
 	for (;;) {
 		char buf[MB_LEN_MAX];
-		size_t len = text_bytes_get(txt, it->pos, sizeof buf, buf);
+		const char *s;
+		size_t len = iterator_char_bytes(it, buf, &s);
 		wchar_t wc;
 		mbstate_t ps = { 0 };
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
+		size_t wclen = mbrtowc(&wc, s, len, &ps);
 		if (wclen == (size_t)-1 && errno == EILSEQ) {
 			return true;
 		} else if (wclen == (size_t)-2) {
@@ -171,6 +211,8 @@ bool text_iterator_char_prev(Iterator *it, char *c) {
 				return true;
 			if (!text_iterator_codepoint_prev(it, c))
 				return false;
+			if (iterator_ascii(it))
+				return true;
 		}
 	}
 	return true;
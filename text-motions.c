@@ -4,10 +4,12 @@
 #include <wchar.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include "text-motions.h"
 #include "text-util.h"
 #include "util.h"
 #include "text-objects.h"
+#include "text-internal.h"
 
 #define blank(c) ((c) == ' ' || (c) == '\t')
 #define space(c) (isspace((unsigned char)c))
@@ -55,22 +57,10 @@ size_t text_codepoint_prev(Text *txt, size_t pos) {
 static size_t find_next(Text *txt, size_t pos, const char *s, bool line) {
 	if (!s)
 		return pos;
-	size_t len = strlen(s), matched = 0;
-	Iterator it = text_iterator_get(txt, pos), sit;
-	for (char c; matched < len && text_iterator_byte_get(&it, &c); ) {
-		if (c == s[matched]) {
-			if (matched == 0)
-				sit = it;
-			matched++;
-		} else if (matched > 0) {
-			it = sit;
-			matched = 0;
-		}
-		text_iterator_byte_next(&it, NULL);
-		if (line && c == '\n')
-			break;
-	}
-	return matched == len ? it.pos - len : pos;
+	/* a match within the line might still end with its newline */
+	size_t end = line ? text_line_next(txt, pos) : text_size(txt);
+	size_t match = text_bytes_find_next(txt, pos, end, s, strlen(s));
+	return match == EPOS ? pos : match;
 }
 
 size_t text_find_next(Text *txt, size_t pos, const char *s) {
@@ -82,27 +72,13 @@ size_t text_line_find_next(Text *txt, size_t pos, const char *s) {
 }
 
 static size_t find_prev(Text *txt, size_t pos, const char *s, bool line) {
-	if (!s)
-		return pos;
-	size_t len = strlen(s), matched = len - 1;
-	Iterator it = text_iterator_get(txt, pos), sit;
+	size_t len = s ? strlen(s) : 0;
 	if (len == 0)
 		return pos;
-	for (char c; text_iterator_byte_prev(&it, &c); ) {
-		if (c == s[matched]) {
-			if (matched == 0)
-				return it.pos;
-			if (matched == len - 1)
-				sit = it;
-			matched--;
-		} else if (matched < len - 1) {
-			it = sit;
-			matched = len - 1;
-		}
-		if (line && c == '\n')
-			break;
-	}
-	return pos;
+	/* a match within the line might still start with the previous newline */
+	size_t start = line ? text_line_prev(txt, pos) : 0;
+	size_t match = text_bytes_find_prev(txt, start, pos, s, len);
+	return match == EPOS ? pos : match;
 }
 
 size_t text_find_prev(Text *txt, size_t pos, const char *s) {
@@ -156,12 +132,12 @@ size_t text_line_next(Text *txt, size_t pos) {
 }
 
 size_t text_line_offset(Text *txt, size_t pos, size_t off) {
-	char c;
-	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
-	while (off-- > 0 && text_iterator_byte_get(&it, &c) && c != '\n')
-		text_iterator_byte_next(&it, NULL);
-	return it.pos;
+	size_t bol = text_line_begin(txt, pos), size = text_size(txt);
+	if (bol >= size)
+		return bol;
+	size_t end = off < size - bol ? bol + off : size;
+	size_t eol = text_bytes_find_next(txt, bol, end, "\n", 1);
+	return eol == EPOS ? end : eol;
 }
 
 size_t text_line_char_set(Text *txt, size_t pos, int count) {
@@ -185,80 +161,59 @@ int text_line_char_get(Text *txt, size_t pos) {
 	return count;
 }
 
-int text_line_width_get(Text *txt, size_t pos) {
-	int width = 0;
+void text_line_width_scan(Text *txt, size_t *pos, int *width, size_t end, int max) {
+	int cur_width = *width;
 	mbstate_t ps = { 0 };
-	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
+	Iterator it = text_iterator_get(txt, *pos);
 
-	while (it.pos < pos) {
+	while (it.pos < end) {
 		char buf[MB_LEN_MAX];
 		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
 		if (len == 0 || buf[0] == '\n')
 			break;
+		int w = 0;
 		wchar_t wc;
 		size_t wclen = mbrtowc(&wc, buf, len, &ps);
 		if (wclen == (size_t)-1 && errno == EILSEQ) {
 			ps = (mbstate_t){0};
 			/* assume a replacement symbol will be displayed */
-			width++;
+			w = 1;
 		} else if (wclen == (size_t)-2) {
 			/* do nothing, advance to next character */
 		} else if (wclen == 0) {
 			/* assume NUL byte will be displayed as ^@ */
-			width += 2;
+			w = 2;
 		} else if (buf[0] == '\t') {
-			width++;
+			w = 1;
 		} else {
-			int w = wcwidth(wc);
+			w = wcwidth(wc);
 			if (w == -1)
 				w = 2; /* assume non-printable will be displayed as ^{char} */
-			width += w;
 		}
 
+		if (w >= max - cur_width)
+			break;
+		cur_width += w;
 		if (!text_iterator_codepoint_next(&it, NULL))
 			break;
 	}
 
+	*pos = it.pos;
+	*width = cur_width;
+}
+
+int text_line_width_get(Text *txt, size_t pos) {
+	int width = 0;
+	size_t bol = text_line_begin(txt, pos);
+	text_line_width_scan(txt, &bol, &width, pos, INT_MAX);
 	return width;
 }
 
 size_t text_line_width_set(Text *txt, size_t pos, int width) {
 	int cur_width = 0;
-	mbstate_t ps = { 0 };
 	size_t bol = text_line_begin(txt, pos);
-	Iterator it = text_iterator_get(txt, bol);
-
-	for (;;) {
-		char buf[MB_LEN_MAX];
-		size_t len = text_bytes_get(txt, it.pos, sizeof buf, buf);
-		if (len == 0 || buf[0] == '\n')
-			break;
-		wchar_t wc;
-		size_t wclen = mbrtowc(&wc, buf, len, &ps);
-		if (wclen == (size_t)-1 && errno == EILSEQ) {
-			ps = (mbstate_t){0};
-			/* assume a replacement symbol will be displayed */
-			cur_width++;
-		} else if (wclen == (size_t)-2) {
-			/* do nothing, advance to next character */
-		} else if (wclen == 0) {
-			/* assume NUL byte will be displayed as ^@ */
-			cur_width += 2;
-		} else if (buf[0] == '\t') {
-			cur_width++;
-		} else {
-			int w = wcwidth(wc);
-			if (w == -1)
-				w = 2; /* assume non-printable will be displayed as ^{char} */
-			cur_width += w;
-		}
-
-		if (cur_width >= width || !text_iterator_codepoint_next(&it, NULL))
-			break;
-	}
-
-	return it.pos;
+	text_line_width_scan(txt, &bol, &cur_width, SIZE_MAX, width);
+	return bol;
 }
 
 size_t text_line_char_next(Text *txt, size_t pos) {
@@ -324,38 +279,109 @@ size_t text_range_line_prev(Text *txt, Filerange *r, size_t pos) {
 	return newpos != pos && r->start <= newpos ? newpos : EPOS;
 }
 
+/* character classes distinguished by the word motions */
+enum {
+	CLASS_SPACE,    /* white space */
+	CLASS_BOUNDARY, /* word boundaries other than white space */
+	CLASS_WORD,     /* everything else */
+};
+
+static bool class_has(int class, int (*isboundary)(int), char c) {
+	switch (class) {
+	case CLASS_SPACE: return space(c);
+	case CLASS_BOUNDARY: return boundary(c) && !space(c);
+	default: return !boundary(c);
+	}
+}
+
+/* membership of the ASCII characters, for the boundary function last asked for */
+static const bool *class_table(int class, int (*isboundary)(int)) {
+	static int (*cached)(int);
+	static bool table[3][128];
+	if (cached != isboundary) {
+		for (int i = 0; i < 3; i++) {
+			for (int c = 0; c < 128; c++)
+				table[i][c] = class_has(i, isboundary, c);
+		}
+		cached = isboundary;
+	}
+	return table[class];
+}
+
+/* While the character c at the iterator belongs to the class, record its
+ * position in last and move to the next one. Runs of ASCII characters are
+ * skipped directly within the piece, every one of them starts a character.
+ * Returns false at the end of the text. */
+static bool class_skip_next(Iterator *it, char *c, int class, int (*isboundary)(int), size_t *last) {
+	const bool *table = class_table(class, isboundary);
+	while (class_has(class, isboundary, *c)) {
+		const char *p = it->text;
+		if (p && it->start <= p && p < it->end) {
+			while (p + 1 < it->end && ISASCII(p[1]) && table[(unsigned char)p[1]])
+				p++;
+			it->pos += p - it->text;
+			it->text = p;
+			*c = *p;
+		}
+		if (last)
+			*last = it->pos;
+		if (!text_iterator_char_next(it, c))
+			return false;
+	}
+	return true;
+}
+
+/* same as above but moving backwards, returns false at the start of the text */
+static bool class_skip_prev(Iterator *it, char *c, int class, int (*isboundary)(int), size_t *last) {
+	const bool *table = class_table(class, isboundary);
+	while (class_has(class, isboundary, *c)) {
+		const char *p = it->text;
+		if (p && it->start <= p && p < it->end) {
+			while (p > it->start && ISASCII(p[-1]) && table[(unsigned char)p[-1]])
+				p--;
+			it->pos -= it->text - p;
+			it->text = p;
+			*c = *p;
+		}
+		if (last)
+			*last = it->pos;
+		if (!text_iterator_char_prev(it, c))
+			return false;
+	}
+	return true;
+}
+
 size_t text_customword_start_next(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
 	Iterator it = text_iterator_get(txt, pos);
 	if (!text_iterator_byte_get(&it, &c))
 		return pos;
-	if (boundary(c))
-		while (boundary(c) && !space(c) && text_iterator_char_next(&it, &c));
-	else
-		while (!boundary(c) && text_iterator_char_next(&it, &c));
-	while (space(c) && text_iterator_char_next(&it, &c));
+	class_skip_next(&it, &c, boundary(c) ? CLASS_BOUNDARY : CLASS_WORD, isboundary, NULL);
+	class_skip_next(&it, &c, CLASS_SPACE, isboundary, NULL);
 	return it.pos;
 }
 
 size_t text_customword_start_prev(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_char_prev(&it, &c) && space(c));
-	if (boundary(c))
-		do pos = it.pos; while (text_iterator_char_prev(&it, &c) && boundary(c) && !space(c));
-	else
-		do pos = it.pos; while (text_iterator_char_prev(&it, &c) && !boundary(c));
+	if (text_iterator_char_prev(&it, &c))
+		class_skip_prev(&it, &c, CLASS_SPACE, isboundary, NULL);
+	int class = boundary(c) ? CLASS_BOUNDARY : CLASS_WORD;
+	pos = it.pos;
+	if (text_iterator_char_prev(&it, &c))
+		class_skip_prev(&it, &c, class, isboundary, &pos);
 	return pos;
 }
 
 size_t text_customword_end_next(Text *txt, size_t pos, int (*isboundary)(int)) {
 	char c;
 	Iterator it = text_iterator_get(txt, pos);
-	while (text_iterator_char_next(&it, &c) && space(c));
-	if (boundary(c))
-		do pos = it.pos; while (text_iterator_char_next(&it, &c) && boundary(c) && !space(c));
-	else
-		do pos = it.pos; while (text_iterator_char_next(&it, &c) && !isboundary(c));
+	if (text_iterator_char_next(&it, &c))
+		class_skip_next(&it, &c, CLASS_SPACE, isboundary, NULL);
+	int class = boundary(c) ? CLASS_BOUNDARY : CLASS_WORD;
+	pos = it.pos;
+	if (text_iterator_char_next(&it, &c))
+		class_skip_next(&it, &c, class, isboundary, &pos);
 	return pos;
 }
 
@@ -364,11 +390,8 @@ size_t text_customword_end_prev(Text *txt, size_t pos, int (*isboundary)(int)) {
 	Iterator it = text_iterator_get(txt, pos);
 	if (!text_iterator_byte_get(&it, &c))
 		return pos;
-	if (boundary(c))
-		while (boundary(c) && !space(c) && text_iterator_char_prev(&it, &c));
-	else
-		while (!boundary(c) && text_iterator_char_prev(&it, &c));
-	while (space(c) && text_iterator_char_prev(&it, &c));
+	class_skip_prev(&it, &c, boundary(c) ? CLASS_BOUNDARY : CLASS_WORD, isboundary, NULL);
+	class_skip_prev(&it, &c, CLASS_SPACE, isboundary, NULL);
 	return it.pos;
 }
 
@@ -538,6 +561,15 @@ static size_t match_symbol(Text *txt, size_t pos, char search, int direction, co
 	Iterator it = text_iterator_get(txt, pos);
 	if (!text_iterator_byte_get(&it, &current))
 		return pos;
+	if (current != search) {
+		/* brackets are looked up in the nesting index */
+		size_t match;
+		if (direction >= 0)
+			match = text_bracket_next(txt, pos + 1, limits ? limits->end : text_size(txt), current, true);
+		else
+			match = text_bracket_prev(txt, limits ? limits->start : 0, pos, search, true);
+		return match == EPOS ? pos : match;
+	}
 	if (direction >= 0) { /* forward search */
 		while (text_iterator_byte_next(&it, &c)) {
 			if (limits && it.pos >= limits->end)
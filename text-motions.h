@@ -49,6 +49,10 @@ size_t text_line_char_set(Text*, size_t pos, int count);
 int text_line_width_get(Text*, size_t pos);
 /* get position of character being displayed at `width' in line containing `pos' */
 size_t text_line_width_set(Text*, size_t pos, int width);
+/* advance from character boundary `*pos', at which the line has display width
+ * `*width', up to `end' or the character whose display would reach `max'.
+ * Both are updated to the character boundary where the scan stopped */
+void text_line_width_scan(Text*, size_t *pos, int *width, size_t end, int max);
 /* move to the next/previous grapheme on the same line */
 size_t text_line_char_next(Text*, size_t pos);
 size_t text_line_char_prev(Text*, size_t pos);
@@ -5,6 +5,7 @@
 #include "text-motions.h"
 #include "text-objects.h"
 #include "text-util.h"
+#include "text-internal.h"
 #include "util.h"
 
 #define blank(c) ((c) == ' ' || (c) == '\t')
@@ -236,6 +237,17 @@ static Filerange text_object_bracket(Text *txt, size_t pos, char type) {
 		return r;
 	}
 
+	if (open != close) {
+		/* a closing bracket at pos belongs to the block, an opening one starts it */
+		if (pos > text_size(txt) || !text_iterator_byte_get(&it, &c))
+			return r;
+		size_t start = text_bracket_prev(txt, 0, c == close ? pos : MIN(pos + 1, text_size(txt)), open, false);
+		size_t end = text_bracket_next(txt, c == open ? pos + 1 : pos, text_size(txt), open, false);
+		if (start == EPOS || end == EPOS)
+			return r;
+		return text_range_new(start + 1, end);
+	}
+
 	while (text_iterator_byte_get(&it, &c)) {
 		if (c == open && --opened == 0) {
 			r.start = it.pos + 1;
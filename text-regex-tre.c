@@ -5,12 +5,18 @@
 
 #include "text-regex.h"
 #include "text-motions.h"
+#include "text-util.h"
+#include "util.h"
 
 struct Regex {
 	regex_t regex;
+	bool multiline;      /* whether a match might span a newline */
+	char literal[64];    /* string contained in every match, used to skip ahead */
+	size_t literal_len;  /* length of the literal, zero if there is none */
 	tre_str_source str_source;
 	Text *text;
-	Iterator it;
+	Iterator it;  /* current position, advanced chunk wise */
+	size_t start; /* absolute position of TRE offset zero */
 	size_t end;
 };
 
@@ -20,84 +26,112 @@ size_t text_regex_nsub(Regex *r) {
        return r->regex.re_nsub;
 }
 
+bool text_regex_multiline(Regex *r) {
+	return !r || r->multiline;
+}
+
 static int str_next_char(tre_char_t *c, unsigned int *pos_add, void *context) {
 	Regex *r = context;
 	Iterator *it = &r->it;
-	if (TRE_WCHAR) {
-		mbstate_t ps = { 0 };
-		bool eof = false;
-		size_t start = it->pos;
-		for (;;) {
-			if (it->pos >= r->end) {
+	/* move on to the next non-empty chunk */
+	while (it->text == it->end && it->pos < r->end && text_iterator_next(it));
+	if (it->pos >= r->end || !it->text || it->text == it->end) {
+		*c = L'\0';
+		*pos_add = 1;
+		return 1;
+	}
+
+	unsigned char b = *it->text;
+	if (!TRE_WCHAR || b < 0x80) {
+		/* fast path for single byte characters */
+		*c = b;
+		*pos_add = 1;
+		it->text++;
+		it->pos++;
+		return 0;
+	}
+
+	mbstate_t ps = { 0 };
+	bool eof = false;
+	size_t start = it->pos;
+	for (;;) {
+		if (it->pos >= r->end) {
+			eof = true;
+			break;
+		}
+		size_t rem = r->end - it->pos;
+		size_t plen = it->end - it->text;
+		size_t len = rem < plen ? rem : plen;
+		size_t wclen = mbrtowc(c, it->text, len, &ps);
+		if (wclen == (size_t)-1 && errno == EILSEQ) {
+			ps = (mbstate_t){0};
+			*c = L'\0';
+			text_iterator_codepoint_next(it, NULL);
+			break;
+		} else if (wclen == (size_t)-2) {
+			if (!text_iterator_next(it)) {
 				eof = true;
 				break;
 			}
-			size_t rem = r->end - it->pos;
-			size_t plen = it->end - it->text;
-			size_t len = rem < plen ? rem : plen;
-			size_t wclen = mbrtowc(c, it->text, len, &ps);
-			if (wclen == (size_t)-1 && errno == EILSEQ) {
-				ps = (mbstate_t){0};
-				*c = L'\0';
-				text_iterator_codepoint_next(it, NULL);
-				break;
-			} else if (wclen == (size_t)-2) {
-				if (!text_iterator_next(it)) {
-					eof = true;
-					break;
-				}
-			} else if (wclen == 0) {
-				text_iterator_byte_next(it, NULL);
-				break;
-			} else {
-				if (wclen < plen) {
-					it->text += wclen;
-					it->pos += wclen;
-				} else {
-					text_iterator_next(it);
-				}
-				break;
-			}
-		}
-
-		if (eof) {
-			*c = L'\0';
-			*pos_add = 1;
-			return 1;
-		} else {
-			*pos_add = it->pos - start;
-			return 0;
-		}
-	} else {
-		*pos_add = 1;
-		if (it->pos < r->end && text_iterator_byte_get(it, (char*)c)) {
+		} else if (wclen == 0) {
 			text_iterator_byte_next(it, NULL);
-			return 0;
+			break;
 		} else {
-			*c = '\0';
-			return 1;
+			it->text += wclen;
+			it->pos += wclen;
+			break;
 		}
 	}
+
+	if (eof) {
+		*c = L'\0';
+		*pos_add = 1;
+		return 1;
+	}
+	*pos_add = it->pos - start;
+	return 0;
 }
 
 static void str_rewind(size_t pos, void *context) {
 	Regex *r = context;
-	r->it = text_iterator_get(r->text, pos);
+	Iterator *it = &r->it;
+	pos += r->start;
+	/* stay within the current chunk if possible */
+	size_t chunk_start = it->pos - (it->text - it->start);
+	if (it->text && chunk_start <= pos && pos - chunk_start < (size_t)(it->end - it->start)) {
+		it->text = it->start + (pos - chunk_start);
+		it->pos = pos;
+	} else {
+		*it = text_iterator_get(r->text, pos);
+	}
 }
 
 static int str_compare(size_t pos1, size_t pos2, size_t len, void *context) {
 	Regex *r = context;
-	int ret = 1;
-	void *buf1 = malloc(len), *buf2 = malloc(len);
-	if (!buf1 || !buf2)
-		goto err;
-	text_bytes_get(r->text, pos1, len, buf1);
-	text_bytes_get(r->text, pos2, len, buf2);
-	ret = memcmp(buf1, buf2, len);
-err:
-	free(buf1);
-	free(buf2);
-	return ret;
+	pos1 += r->start;
+	pos2 += r->start;
+	Iterator it1 = text_iterator_get(r->text, pos1);
+	Iterator it2 = text_iterator_get(r->text, pos2);
+	const char *chunk1, *chunk2;
+	size_t len1 = 0, len2 = 0;
+	while (len > 0) {
+		if (!len1 && !text_iterator_chunk_next(&it1, pos1 + len, &chunk1, &len1))
+			return 1;
+		if (!len2 && !text_iterator_chunk_next(&it2, pos2 + len, &chunk2, &len2))
+			return 1;
+		size_t n = MIN(MIN(len1, len2), len);
+		int ret = memcmp(chunk1, chunk2, n);
+		if (ret)
+			return ret;
+		chunk1 += n;
+		chunk2 += n;
+		len1 -= n;
+		len2 -= n;
+		pos1 += n;
+		pos2 += n;
+		len -= n;
+	}
+	return 0;
 }
 
 Regex *text_regex_new(void) {
@@ -124,6 +158,10 @@ int text_regex_compile(Regex *regex, const char *string, int cflags) {
 	int r = tre_regcomp(&regex->regex, string, cflags);
 	if (r)
 		tre_regcomp(&regex->regex, "\0\0", 0);
+	regex->multiline = !r && (!(cflags & REG_NEWLINE) || text_pattern_newline(string));
+	regex->literal_len = 0;
+	if (!r && (cflags & REG_EXTENDED) && !(cflags & REG_ICASE))
+		regex->literal_len = text_pattern_literal(string, regex->literal, sizeof regex->literal);
 	return r;
 }
 
@@ -132,9 +170,24 @@ int text_regex_match(Regex *r, const char *data, int eflags) {
 }
 
 int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	size_t end = pos + len;
+	if (r->literal_len) {
+		/* no match without an occurrence of the literal */
+		size_t hit = text_bytes_find_next(txt, pos, end, r->literal, r->literal_len);
+		if (hit == EPOS)
+			return REG_NOMATCH;
+		/* skip to the line containing it */
+		size_t bol = r->multiline ? EPOS : text_bytes_find_prev(txt, pos, hit, "\n", 1);
+		if (bol != EPOS) {
+			pos = bol + 1;
+			eflags &= ~REG_NOTBOL;
+		}
+	}
+
 	r->text = txt;
 	r->it = text_iterator_get(txt, pos);
-	r->end = pos+len;
+	r->start = pos;
+	r->end = end;
 
 	regmatch_t match[MAX_REGEX_SUB];
 	int ret = tre_reguexec(&r->regex, &r->str_source, nmatch, match, eflags);
@@ -2,9 +2,37 @@
 #include <string.h>
 
 #include "text-regex.h"
+#include "text-util.h"
+#include "util.h"
+
+/* The searched range is copied into a buffer window by window. Windows
+ * start small and grow geometrically up to REGEX_WINDOW_MAX while no match
+ * is found. For patterns which can not match a newline, windows are extended
+ * to the end of a line, a line is thus always searched as a whole. For
+ * others, a match is only accepted if
+ * it ends at least REGEX_OVERLAP bytes before the end of the window and
+ * subsequent windows overlap the previous ones accordingly. Hence longer
+ * matches of such patterns crossing a window boundary might be missed. */
+#ifndef REGEX_WINDOW_MIN
+#define REGEX_WINDOW_MIN (1 << 8)
+#endif
+#ifndef REGEX_WINDOW_MAX
+#define REGEX_WINDOW_MAX (1 << 20)
+#endif
+#ifndef REGEX_OVERLAP
+#define REGEX_OVERLAP (1 << 16)
+#endif
 
 struct Regex {
 	regex_t regex;
+	int cflags;          /* flags used to compile the pattern */
+	bool multiline;      /* whether a match might span a newline */
+	char literal[64];    /* string contained in every match, used to skip ahead */
+	size_t literal_len;  /* length of the literal, zero if there is none */
+	char *buf;           /* window of the searched text, NUL terminated */
+	size_t size;         /* allocated size of the window buffer */
+	bool window;         /* whether buf holds the range [window_start, window_end) */
+	size_t window_start, window_end;
 };
 
 Regex *text_regex_new(void) {
@@ -19,6 +47,11 @@ int text_regex_compile(Regex *regex, const char *string, int cflags) {
 	int r = regcomp(&regex->regex, string, cflags);
 	if (r)
 		regcomp(&regex->regex, "\0\0", 0);
+	regex->cflags = r ? 0 : cflags;
+	regex->multiline = !r && (!(cflags & REG_NEWLINE) || text_pattern_newline(string));
+	regex->literal_len = 0;
+	if (!r && (cflags & REG_EXTENDED) && !(cflags & REG_ICASE))
+		regex->literal_len = text_pattern_literal(string, regex->literal, sizeof regex->literal);
 	return r;
 }
 
@@ -28,10 +61,15 @@ size_t text_regex_nsub(Regex *r) {
 	return r->regex.re_nsub;
 }
 
+bool text_regex_multiline(Regex *r) {
+	return !r || r->multiline;
+}
+
 void text_regex_free(Regex *r) {
 	if (!r)
 		return;
 	regfree(&r->regex);
+	free(r->buf);
 	free(r);
 }
 
@@ -39,23 +77,82 @@ int text_regex_match(Regex *r, const char *data, int eflags) {
 	return regexec(&r->regex, data, 0, NULL, eflags);
 }
 
-int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
-		return REG_NOMATCH;
+/* copy [pos, pos+len) into the window buffer */
+static char *regex_window(Regex *r, Text *txt, size_t pos, size_t len) {
+	r->window = false;
+	if (len >= r->size) {
+		size_t size = r->size ? r->size : REGEX_WINDOW_MIN;
+		while (size <= len)
+			size *= 2;
+		char *buf = realloc(r->buf, size);
+		if (!buf)
+			return NULL;
+		r->buf = buf;
+		r->size = size;
+	}
+	r->buf[text_bytes_get(txt, pos, len, r->buf)] = '\0';
+	r->window = true;
+	r->window_start = pos;
+	r->window_end = pos + len;
+	return r->buf;
+}
+
+/* end of the window starting at pos of roughly the given size */
+static size_t regex_window_end(Regex *r, Text *txt, size_t pos, size_t size, size_t end) {
+	if (size >= end - pos)
+		return end;
+	pos += size;
+	if (r->multiline)
+		return pos;
+	/* extend to the end of the line */
+	Iterator it = text_iterator_get(txt, pos);
+	const char *chunk;
+	size_t len;
+	while (text_iterator_chunk_next(&it, end, &chunk, &len)) {
+		const char *nl = memchr(chunk, '\n', len);
+		if (nl)
+			return pos + (nl - chunk) + 1;
+		pos += len;
+	}
+	return end;
+}
+
+/* Offset within the window at which to continue the search if it did not
+ * match, or 0 if the window needs to be extended. Only line starts are
+ * considered, such that anchors and word boundaries behave as if the whole
+ * range would be searched at once. */
+static size_t regex_window_next(Regex *r, const char *buf, size_t len) {
+	if (!r->multiline)
+		return len;
+	if (len < 2 * REGEX_OVERLAP)
+		return 0;
+	for (size_t i = len - REGEX_OVERLAP; i > 0; i--) {
+		if (buf[i-1] == '\n' || (buf[i-1] == '\0' && buf[i] != '\0'))
+			return i;
+	}
+	return 0;
+}
+
+/* search a NUL terminated buffer, which might contain further NUL bytes
+ * each of which terminates the string seen by regexec(3). The start of the
+ * buffer matches ^ according to bol, its end only matches $ if it is the
+ * end of the searched range. */
+static int regex_search_buf(Regex *r, char *buf, size_t len, int bol, bool last, size_t nmatch, regmatch_t match[], int eflags) {
 	char *cur = buf, *end = buf + len;
-	int ret = REG_NOMATCH;
-	regmatch_t match[MAX_REGEX_SUB];
-	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
-		ret = regexec(&r->regex, cur, nmatch, match, eflags);
-		if (!ret) {
+	for (size_t junk = len; len > 0; len -= junk) {
+		char *next = memchr(cur, 0, len);
+		int flags = cur == buf ? (eflags & ~REG_NOTBOL)|bol : eflags;
+		if (!next && !last)
+			flags |= REG_NOTEOL;
+		if (!regexec(&r->regex, cur, nmatch, match, flags)) {
 			for (size_t i = 0; i < nmatch; i++) {
-				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
-				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
+				if (match[i].rm_so != -1) {
+					match[i].rm_so += cur - buf;
+					match[i].rm_eo += cur - buf;
+				}
 			}
-			break;
+			return 0;
 		}
-		char *next = memchr(cur, 0, len);
 		if (!next)
 			break;
 		while (!*next && next != end)
@@ -63,49 +160,162 @@ int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_
 		junk = next - cur;
 		cur = next;
 	}
-	free(buf);
-	return ret;
+	return REG_NOMATCH;
 }
 
-int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
-	char *buf = text_bytes_alloc0(txt, pos, len);
-	if (!buf)
-		return REG_NOMATCH;
-	char *cur = buf, *end = buf + len;
-	int ret = REG_NOMATCH;
+/* search [pos, end), reusing the current window if it contains pos. Unless
+ * eol is set, end is not considered the end of a line. */
+static int search_forward(Text *txt, size_t pos, size_t end, bool eol, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
 	regmatch_t match[MAX_REGEX_SUB];
-	for (size_t junk = len; len > 0; len -= junk, pos += junk) {
-		char *next;
-		if (!regexec(&r->regex, cur, nmatch, match, eflags)) {
-			ret = 0;
+	size_t size = REGEX_WINDOW_MIN;
+	size_t nsub = nmatch ? nmatch : 1; /* match[0] determines where to continue */
+	int bol = eflags & REG_NOTBOL;
+	size_t hit = EPOS;
+	while (pos < end) {
+		if (!r->window || pos < r->window_start || pos >= r->window_end) {
+			if (r->literal_len && (hit == EPOS || hit < pos)) {
+				/* no match without an occurrence of the literal */
+				hit = text_bytes_find_next(txt, pos, end, r->literal, r->literal_len);
+				if (hit == EPOS)
+					return REG_NOMATCH;
+				/* skip to the line containing it */
+				size_t bol_pos = r->multiline ? EPOS : text_bytes_find_prev(txt, pos, hit, "\n", 1);
+				if (bol_pos != EPOS) {
+					pos = bol_pos + 1;
+					bol = 0;
+				}
+			}
+			size_t window_end = regex_window_end(r, txt, pos, size, end);
+			if (!regex_window(r, txt, pos, window_end - pos))
+				return REG_NOMATCH;
+		}
+		char *buf = r->buf + (pos - r->window_start);
+		size_t window_len = r->window_end - pos;
+		bool last = r->window_end == end;
+		bool found = !regex_search_buf(r, buf, window_len, bol, last && eol, nsub, match, eflags);
+		if (found && (last || !r->multiline ||
+		              (size_t)match[0].rm_eo + REGEX_OVERLAP <= window_len)) {
 			for (size_t i = 0; i < nmatch; i++) {
 				pmatch[i].start = match[i].rm_so == -1 ? EPOS : pos + match[i].rm_so;
 				pmatch[i].end = match[i].rm_eo == -1 ? EPOS : pos + match[i].rm_eo;
 			}
+			return 0;
+		}
+		if (last)
+			break;
+		size_t next = found ? 0 : regex_window_next(r, buf, window_len);
+		if (size < REGEX_WINDOW_MAX || !next)
+			size *= 2;
+		if (!next) {
+			/* retry with a larger window from the same start */
+			r->window = false;
+			continue;
+		}
+		/* continue as if the string seen by regexec(3) extended further */
+		char c = buf[next - 1];
+		next += pos;
+		if (c == '\0')
+			bol = eflags & REG_NOTBOL;
+		else if (c == '\n' && (r->cflags & REG_NEWLINE))
+			bol = 0;
+		else
+			bol = REG_NOTBOL;
+		pos = next;
+	}
+	return REG_NOMATCH;
+}
 
-			if (match[0].rm_so == 0 && match[0].rm_eo == 0) {
-				/* empty match at the beginning of cur, advance to next line */
-				next = strchr(cur, '\n');
-				if (!next)
-					break;
-				next++;
-			} else {
-				next = cur + match[0].rm_eo;
-			}
-		} else {
-			next = memchr(cur, 0, len);
-			if (!next)
+int text_search_range_forward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	r->window = false;
+	return search_forward(txt, pos, pos + len, true, r, nmatch, pmatch, eflags);
+}
+
+/* start of the window ending at end of roughly the given size, always
+ * placed at a line boundary */
+static size_t regex_window_start(Text *txt, size_t start, size_t end, size_t size) {
+	if (size >= end - start)
+		return start;
+	Iterator it = text_iterator_get(txt, end - size);
+	if (!text_iterator_byte_find_prev(&it, '\n') || it.pos < start)
+		return start;
+	return it.pos + 1;
+}
+
+/* last of the successive matches in [pos, end) */
+static int search_last(Text *txt, size_t pos, size_t end, bool eol, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	int ret = REG_NOMATCH;
+	RegexMatch match[MAX_REGEX_SUB];
+	while (!search_forward(txt, pos, end, eol, r, nmatch, match, eflags)) {
+		ret = 0;
+		memcpy(pmatch, match, nmatch * sizeof *match);
+		size_t next = match[0].end;
+		if (match[0].start == pos && match[0].end == pos) {
+			/* empty match at the beginning of the range, advance to next line */
+			Iterator it = text_iterator_get(txt, pos);
+			if (!text_iterator_byte_find_next(&it, '\n') || it.pos >= end)
 				break;
-			while (!*next && next != end)
-				next++;
+			next = it.pos + 1;
 		}
-		junk = next - cur;
-		cur = next;
-		if (cur[-1] == '\n')
+		if (next >= end)
+			break;
+		pos = next;
+		char c;
+		if (text_byte_get(txt, pos - 1, &c) && c == '\n')
 			eflags &= ~REG_NOTBOL;
 		else
 			eflags |= REG_NOTBOL;
 	}
-	free(buf);
 	return ret;
 }
+
+/* The range is searched in windows walking back from its end, each of them
+ * starting at a line boundary. Windows grow geometrically until one contains
+ * a match. For patterns which can not match a newline, successive matches
+ * continue from each line start as if the search started at the beginning
+ * of the range, hence the last match of the closest window containing one
+ * is exact. Otherwise the match is only accepted if it starts at least
+ * REGEX_OVERLAP bytes after the start of the window. */
+int text_search_range_backward(Text *txt, size_t pos, size_t len, Regex *r, size_t nmatch, RegexMatch pmatch[], int eflags) {
+	size_t start = pos, end = pos + len, size = REGEX_WINDOW_MIN;
+	size_t nsub = nmatch ? nmatch : 1;
+	if (nsub > MAX_REGEX_SUB)
+		nsub = MAX_REGEX_SUB;
+	RegexMatch match[MAX_REGEX_SUB];
+	bool eol = true;
+	size_t hit = EPOS;
+	while (start < end) {
+		r->window = false;
+		if (r->literal_len && (hit == EPOS || hit + r->literal_len > end)) {
+			/* no match without an occurrence of the literal */
+			hit = text_bytes_find_prev(txt, start, end, r->literal, r->literal_len);
+			if (hit == EPOS)
+				return REG_NOMATCH;
+			/* skip the lines following the one containing it */
+			size_t eol_pos = r->multiline ? EPOS : text_bytes_find_next(txt, hit + r->literal_len, end, "\n", 1);
+			if (eol_pos != EPOS && eol_pos + 1 < end) {
+				end = eol_pos + 1;
+				eol = false;
+			}
+		}
+		size_t window_start = regex_window_start(txt, start, end, size);
+		int flags = eflags;
+		if (window_start > start)
+			flags = r->cflags & REG_NEWLINE ? flags & ~REG_NOTBOL : flags|REG_NOTBOL;
+		bool found = !search_last(txt, window_start, end, eol, r, nsub, match, flags);
+		if (found && (window_start == start || !r->multiline ||
+		              match[0].start >= window_start + REGEX_OVERLAP)) {
+			memcpy(pmatch, match, MIN(nmatch, nsub) * sizeof *match);
+			return 0;
+		}
+		if (window_start == start)
+			break;
+		if (size < REGEX_WINDOW_MAX || r->multiline)
+			size *= 2;
+		if (!r->multiline) {
+			/* nothing matched, continue with the preceding lines */
+			end = window_start;
+			eol = false;
+		}
+	}
+	return REG_NOMATCH;
+}
@@ -1,8 +1,12 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memrchr(3) is non-standard */
+#endif
 #include "text-util.h"
 #include "util.h"
 #include <wchar.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 bool text_range_valid(const Filerange *r) {
 	return r->start != EPOS && r->end != EPOS && r->start <= r->end;
@@ -56,6 +60,40 @@ bool text_range_contains(const Filerange *r, size_t pos) {
 	return text_range_valid(r) && r->start <= pos && pos <= r->end;
 }
 
+static int ranges_comparator(const void *a, const void *b) {
+	const Filerange *r1 = a, *r2 = b;
+	if (!text_range_valid(r1))
+		return text_range_valid(r2) ? 1 : 0;
+	if (!text_range_valid(r2))
+		return -1;
+	return (r1->start < r2->start || (r1->start == r2->start && r1->end < r2->end)) ? -1 : 1;
+}
+
+void text_ranges_normalize(Array *a) {
+	size_t len = array_length(a);
+	for (size_t i = 1; i < len; i++) {
+		if (ranges_comparator(array_get(a, i), array_get(a, i-1)) < 0) {
+			array_sort(a, ranges_comparator);
+			break;
+		}
+	}
+	/* compact in place, prev is the last range kept so far */
+	Filerange *prev = NULL;
+	size_t kept = 0;
+	for (size_t i = 0; i < len; i++) {
+		Filerange *r = array_get(a, i);
+		if (text_range_size(r) == 0)
+			continue;
+		if (prev && text_range_overlap(prev, r)) {
+			*prev = text_range_union(prev, r);
+		} else {
+			prev = array_get(a, kept++);
+			*prev = *r;
+		}
+	}
+	array_truncate(a, kept);
+}
+
 int text_char_count(const char *data, size_t len) {
 	int count = 0;
 	mbstate_t ps = { 0 };
@@ -120,3 +158,192 @@ int text_string_width(const char *data, size_t len) {
 
 	return width;
 }
+
+size_t text_bytes_find_next(const Text *txt, size_t pos, size_t end, const char *s, size_t len) {
+	if (len == 0)
+		return pos <= end ? pos : EPOS;
+	const char *chunk;
+	size_t chunk_len;
+	Iterator it = text_iterator_get(txt, pos);
+	while (pos + len <= end && text_iterator_chunk_next(&it, end, &chunk, &chunk_len)) {
+		for (const char *cur = chunk, *hit; (hit = memchr(cur, s[0], chunk_len - (cur - chunk))); cur = hit + 1) {
+			size_t hit_pos = pos + (hit - chunk);
+			if (hit_pos + len > end)
+				return EPOS;
+			size_t avail = chunk_len - (hit - chunk);
+			if (avail >= len ? !memcmp(hit, s, len) :
+			    !memcmp(hit, s, avail) && text_bytes_match(txt, hit_pos + avail, s + avail, len - avail))
+				return hit_pos;
+		}
+		pos += chunk_len;
+	}
+	return EPOS;
+}
+
+size_t text_bytes_find_prev(const Text *txt, size_t start, size_t pos, const char *s, size_t len) {
+	if (len == 0)
+		return start <= pos ? pos : EPOS;
+	if (pos < start || pos - start < len)
+		return EPOS;
+	/* look for the last byte of s, without scanning beyond start */
+	size_t min = start + len - 1;
+	for (Iterator it = text_iterator_get(txt, pos); it.piece && it.pos > min; text_iterator_prev(&it)) {
+		size_t avail = MIN((size_t)(it.text - it.start), it.pos - min);
+		const char *base = it.text - avail, *hit;
+		while (avail > 0 && (hit = memrchr(base, s[len-1], avail))) {
+			size_t hit_pos = it.pos - (it.text - hit) - (len - 1);
+			if (text_bytes_match(txt, hit_pos, s, len))
+				return hit_pos;
+			avail = hit - base;
+		}
+	}
+	return EPOS;
+}
+
+bool text_bytes_match(const Text *txt, size_t pos, const char *s, size_t len) {
+	const char *chunk;
+	size_t chunk_len;
+	Iterator it = text_iterator_get(txt, pos);
+	while (len > 0 && text_iterator_chunk_next(&it, pos + len, &chunk, &chunk_len)) {
+		if (memcmp(chunk, s, chunk_len))
+			return false;
+		s += chunk_len;
+		len -= chunk_len;
+		pos += chunk_len;
+	}
+	return len == 0;
+}
+
+/* skip a bracket expression, returns a pointer after its closing bracket */
+static const char *pattern_bracket(const char *p) {
+	p++;
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	for (; *p && *p != ']'; p++) {
+		if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			const char *close = p + 2;
+			while (*close && !(close[0] == p[1] && close[1] == ']'))
+				close++;
+			if (!*close)
+				return close;
+			p = close + 1;
+		}
+	}
+	return *p ? p + 1 : p;
+}
+
+/* skip a parenthesized group, returns a pointer after its closing parenthesis */
+static const char *pattern_group(const char *p) {
+	int depth = 0;
+	while (*p) {
+		if (*p == '\\' && p[1]) {
+			p += 2;
+		} else if (*p == '[') {
+			p = pattern_bracket(p);
+		} else {
+			if (*p == '(')
+				depth++;
+			else if (*p == ')' && --depth == 0)
+				return p + 1;
+			p++;
+		}
+	}
+	return p;
+}
+
+static bool pattern_quantifier(const char *p) {
+	return *p == '*' || *p == '+' || *p == '?' || *p == '{';
+}
+
+/* skip a sequence of quantifiers, returns whether the quantified element is optional */
+static const char *pattern_quantifiers(const char *p, bool *optional) {
+	*optional = false;
+	while (pattern_quantifier(p)) {
+		if (*p == '{') {
+			*optional |= p[1] == '0' || p[1] == ',';
+			while (*p && *p != '}')
+				p++;
+			if (*p)
+				p++;
+		} else {
+			*optional |= *p != '+';
+			p++;
+		}
+	}
+	return p;
+}
+
+size_t text_pattern_literal(const char *pattern, char *buf, size_t size) {
+	char run[256];
+	size_t run_len = 0, best_len = 0;
+	bool optional;
+	if (size == 0)
+		return 0;
+	for (const char *p = pattern; ; ) {
+		int c = -1;
+		const char *next = p + 1;
+		switch (*p) {
+		case '|':
+			return 0; /* alternation, no literal is required */
+		case '(':
+			next = pattern_group(p);
+			break;
+		case '[':
+			next = pattern_bracket(p);
+			break;
+		case '\\':
+			if (p[1] && strchr(".[]()*+?{}|^$\\/", p[1]))
+				c = (unsigned char)p[1];
+			next = p[1] ? p + 2 : p + 1;
+			break;
+		case '\0':
+			next = p;
+			break;
+		case '.': case '^': case '$':
+		case '*': case '+': case '?': case '{':
+			break;
+		default:
+			c = (unsigned char)*p;
+			/* include the continuation bytes of a multibyte character */
+			while (!ISUTF8(*next))
+				next++;
+			break;
+		}
+		const char *after = pattern_quantifiers(next, &optional);
+		bool end = c == -1 || after != next;
+		if (c != -1 && !optional && run_len + (next - p) <= sizeof(run)) {
+			if (*p == '\\') {
+				run[run_len++] = c;
+			} else {
+				memcpy(run + run_len, p, next - p);
+				run_len += next - p;
+			}
+		} else if (c != -1) {
+			end = true;
+		}
+		if (end) {
+			if (run_len > best_len) {
+				best_len = MIN(run_len, size);
+				memcpy(buf, run, best_len);
+			}
+			run_len = 0;
+		}
+		if (!*p)
+			break;
+		p = after;
+	}
+	return best_len;
+}
+
+bool text_pattern_newline(const char *pattern) {
+	/* with REG_NEWLINE only explicit newlines or matching lists
+	 * containing one (e.g. [[:space:]]) can match a newline */
+	static const char *newline[] = { "\n", "\\n", "\\s", "\\W", "[:space:]", "[:cntrl:]" };
+	for (size_t i = 0; i < LENGTH(newline); i++) {
+		if (strstr(pattern, newline[i]))
+			return true;
+	}
+	return false;
+}
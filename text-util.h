@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "text.h"
+#include "array.h"
 
 /* test whether the given range is valid (start <= end) */
 bool text_range_valid(const Filerange*);
@@ -23,9 +24,24 @@ bool text_range_equal(const Filerange*, const Filerange*);
 bool text_range_overlap(const Filerange*, const Filerange*);
 /* test whether a given position is within a certain range */
 bool text_range_contains(const Filerange*, size_t pos);
+/* sort an array of ranges, merge overlapping ones and remove empty ones, in
+ * linear time if the array is already sorted */
+void text_ranges_normalize(Array*);
 /* count the number of graphemes in data */
 int text_char_count(const char *data, size_t len);
 /* get the approximate display width of data */
 int text_string_width(const char *data, size_t len);
+/* find the first occurrence of the len bytes of s in [pos, end), EPOS if there is none */
+size_t text_bytes_find_next(const Text*, size_t pos, size_t end, const char *s, size_t len);
+/* find the last occurrence of the len bytes of s in [start, pos), EPOS if there is none */
+size_t text_bytes_find_prev(const Text*, size_t start, size_t pos, const char *s, size_t len);
+/* test whether the text at pos is equal to the len bytes of s */
+bool text_bytes_match(const Text*, size_t pos, const char *s, size_t len);
+/* store the longest literal string contained in every match of the extended
+ * regular expression pattern in buf, returns its length, truncated to size */
+size_t text_pattern_literal(const char *pattern, char *buf, size_t size);
+/* test whether the extended regular expression pattern, compiled with
+ * REG_NEWLINE, might match a newline */
+bool text_pattern_newline(const char *pattern);
 
 #endif
@@ -30,12 +30,69 @@
 struct Piece {
 	Text *text;             /* text to which this piece belongs */
 	Piece *prev, *next;     /* pointers to the logical predecessor/successor */
-	Piece *global_prev;     /* double linked list in order of allocation, */
-	Piece *global_next;     /* used to free individual pieces */
 	const char *data;       /* pointer into a Block holding the data */
 	size_t len;             /* the length in number of bytes of the data */
+	Piece *parent;          /* piece tree, indexing the active pieces in */
+	Piece *left, *right;    /* the same order as the prev/next chain */
+	uint32_t prio;          /* treap priority, a parent always has a higher one */
+	uint32_t epoch;         /* last pruning of the history which found the piece in use */
+	size_t tree_len;        /* sum of the lengths of all pieces in this subtree */
+	size_t lines;           /* number of new lines '\n' in data, or LINES_UNKNOWN */
+	size_t tree_lines;      /* sum of the new lines in this subtree, or LINES_UNKNOWN */
+	size_t tree_count;      /* number of pieces in this subtree */
 };
 
+/* The pieces currently forming the document (i.e. all which are reachable
+ * from the begin sentinel) are additionally kept in a treap. The in-order
+ * traversal of the tree matches the chain order, every node stores the total
+ * length of its subtree. This turns the mapping of a byte position to a piece
+ * into a walk from the root, taking O(log n) expected time instead of a linear
+ * scan of the chain. The sentinel nodes are never part of the tree.
+ *
+ * Only the chain is relevant for undo/redo, the tree is updated in span_swap
+ * to mirror whatever part of the chain was replaced.
+ *
+ * Nodes also keep track of the number of new lines they hold, which is used
+ * to convert between byte positions and line numbers. These counts are
+ * computed lazily, such that loading a large file does not require a scan of
+ * its content. If a subtree count is known, so are all counts below it.
+ */
+#define LINES_UNKNOWN SIZE_MAX
+
+/* Marks are resolved by a linear scan of the pieces until the same text state
+ * is queried this many times, after which an index of all pieces ordered by
+ * their data address is built and used until the next modification. */
+#define MARK_INDEX_THRESHOLD 8
+
+/* The content of a loaded file is split into pieces of at most this size to
+ * bound the amount of data which needs to be scanned within a single piece. */
+#ifndef PIECE_LOAD_SIZE
+#define PIECE_LOAD_SIZE (1 << 20)
+#endif
+
+/* Editing leaves behind many small pieces, which slow down everything walking
+ * the chain. Once there are more than TEXT_COMPACT_PIECES with an average size
+ * below TEXT_COMPACT_PIECE bytes, text_compact copies runs of adjacent pieces
+ * smaller than the latter into contiguous ones of at most TEXT_COMPACT_SIZE.
+ * The copies are remembered to resolve marks into either of them, following
+ * at most TEXT_COMPACT_DEPTH copies of copies. */
+#define TEXT_COMPACT_PIECES 1024
+#define TEXT_COMPACT_PIECE 4096
+#define TEXT_COMPACT_SIZE (1 << 16)
+#define TEXT_COMPACT_DEPTH 4
+
+/* Insertions of at least this size are stored in blocks backed by a temporary
+ * file instead of the heap, as are all once the heap allocated blocks of the
+ * text exceed it. This bounds the memory use when reading huge amounts of data
+ * from a pipe, the kernel can write the content out instead of swapping. */
+#ifndef TEXT_HEAP_MAX
+#define TEXT_HEAP_MAX (1 << 26)
+#endif
+
+/* Number of recent modifications whose position is remembered, such that
+ * users like the view can find out which part of the text changed. */
+#define TEXT_GENERATIONS 32
+
 /* used to transform a global position (byte offset starting from the beginning
  * of the text) into an offset relative to a piece.
  */
@@ -52,7 +109,15 @@ typedef struct {
 	size_t len;             /* the sum of the lengths of the pieces which form this span */
 } Span;
 
-/* A Change keeps all needed information to redo/undo an insertion/deletion. */
+/* A range of data copied by text_compact, recorded in both directions */
+typedef struct {
+	const char *from;       /* start of the data */
+	size_t len;             /* length in bytes, less than TEXT_COMPACT_PIECE */
+	const char *to;         /* start of the copy */
+} Relocation;
+
+/* A Change keeps all needed information to redo/undo an insertion/deletion.
+ * Changes made by text_compact leave the content as is, their pos is EPOS. */
 typedef struct Change Change;
 struct Change {
 	Span old;               /* all pieces which are being modified/swapped out by the change */
@@ -65,7 +130,6 @@ struct Change {
 /* A Revision is a list of Changes which are used to undo/redo all modifications
  * since the last snapshot operation. Revisions are stored in a directed graph structure.
  */
-typedef struct Revision Revision;
 struct Revision {
 	Change *change;         /* the most recent change */
 	Revision *next;         /* the next (child) revision in the undo tree */
@@ -74,26 +138,93 @@ struct Revision {
 	Revision *later;        /* the next Revision, chronologically */
 	time_t time;            /* when the first change of this revision was performed */
 	size_t seq;             /* a unique, strictly increasing identifier */
+	size_t subtree;         /* number of revisions derived from this one, only valid while pruning */
+	uint32_t epoch;         /* last pruning of the history which kept the revision */
+	bool visited;           /* whether the pruning in progress already reverted the revision */
 };
 
-typedef struct {
-	size_t pos;             /* position in bytes from start of file */
-	size_t lineno;          /* line number in file i.e. number of '\n' in [0, pos) */
-} LineCache;
+/* Pieces, changes and revisions are carved out of larger slabs which are
+ * released as a whole together with the text. Those discarded by pruning the
+ * history are put on a free list and reused by later allocations. Pieces get
+ * slabs of their own, such that the unused ones can be found by a scan. */
+#define SLAB_SIZE (1 << 16)
+
+typedef union {
+	void *p;
+	long double d;
+	uintmax_t i;
+} SlabAlign;
+
+typedef struct Slab Slab;
+struct Slab {
+	Slab *next;             /* previously allocated slab */
+	size_t len;             /* number of bytes in use */
+	size_t size;            /* total capacity of data in bytes */
+	SlabAlign data[];       /* storage of the allocated objects */
+};
+
+/* Pruning the history keeps the closest ancestor of the current revision
+ * within the limits as new root of the history graph, all revisions not
+ * derived from it are released along with their changes. The pieces still
+ * in use are those of the states reachable from the new root. The pieces of
+ * a span are only linked in order while the span is part of the chain, the
+ * kept revisions are thus temporarily reverted one after another, marking
+ * the pieces of both spans of every change. All other pieces are released,
+ * as are the blocks no longer referenced by any piece or frozen copy.
+ *
+ * To amortize the cost, the history is pruned to this fraction below the
+ * limits. */
+#define HISTORY_PRUNE_SLACK 8
+
+/* An immutable copy of the piece chain at the time it was frozen */
+struct TextFrozen {
+	size_t refs;            /* number of references, freed when dropping to zero */
+	Text *text;             /* text sharing the blocks, NULL once it was freed */
+	TextFrozen *prev, *next; /* other frozen copies of the same text */
+	size_t size;            /* content size in bytes */
+	size_t count;           /* number of chunks */
+	struct {
+		const char *data;   /* content, shared with the text */
+		size_t pos;         /* absolute position of the first byte */
+		size_t len;         /* length in bytes */
+	} chunks[];
+};
 
 /* The main struct holding all information of a given file */
 struct Text {
 	Array blocks;           /* blocks which hold text content */
-	Piece *pieces;          /* all pieces which have been allocated, used to free them */
+	size_t heap;            /* bytes of the heap allocated blocks holding modifications */
+	Slab *slabs;            /* memory of all changes and revisions, most recent first */
+	Slab *piece_slabs;      /* memory of all pieces, most recent first */
+	size_t slab_size;       /* total capacity of all slabs in bytes */
+	size_t slab_free;       /* bytes of the objects on the free lists */
+	Piece *free_pieces;     /* pieces released by pruning, linked by next */
+	Change *free_changes;   /* changes released by pruning, linked by next */
+	Revision *free_revisions; /* revisions released by pruning, linked by next */
 	Piece *cache;           /* most recently modified piece */
 	Piece begin, end;       /* sentinel nodes which always exists but don't hold any data */
+	Piece *tree;            /* root of the piece tree, NULL if the chain is empty */
+	uint32_t seed;          /* state of the pseudo random treap priorities */
+	Array marks;            /* non-empty pieces ordered by data address, used to resolve marks */
+	bool marks_valid;       /* whether the mark index reflects the current pieces */
+	size_t marks_lookups;   /* number of mark look ups since the last modification */
+	Array relocations;      /* Relocation of all data copied by text_compact */
+	bool relocations_sorted; /* whether the relocations are ordered by source address */
+	size_t compact_pos;     /* position at which text_compact resumes */
+	size_t compacted;       /* generation at which the last compaction completed */
 	Revision *history;        /* undo tree */
 	Revision *current_revision; /* revision holding all file changes until a snapshot is performed */
 	Revision *last_revision;    /* the last revision added to the tree, chronologically */
 	Revision *saved_revision;   /* the last revision at the time of the save operation */
+	size_t revisions;       /* number of revisions in the history graph */
+	size_t saving;          /* number of saves which refer to a revision, see text_saved_revision_new */
+	uint32_t epoch;         /* number of times the history was pruned */
+	TextFrozen *frozen;     /* frozen copies referring to the blocks */
 	size_t size;            /* current file content size in bytes */
 	struct stat info;       /* stat as probed at load time */
-	LineCache lines;        /* mapping between absolute pos in bytes and logical line breaks */
+	size_t generation;      /* number of modifications so far */
+	TextChange modified[TEXT_GENERATIONS]; /* extent of the recent modifications */
+	TextBrackets *brackets; /* bracket nesting index, NULL until first needed */
 };
 
 /* block management */
@@ -104,39 +235,67 @@ static bool cache_contains(Text *txt, Piece *p);
 static bool cache_insert(Text *txt, Piece *p, size_t off, const char *data, size_t len);
 static bool cache_delete(Text *txt, Piece *p, size_t off, size_t len);
 /* piece management */
+/* slab allocation */
+static size_t slab_aligned(size_t size);
+static void *slab_alloc(Text *txt, Slab **slabs, size_t size);
 static Piece *piece_alloc(Text *txt);
-static void piece_free(Piece *p);
+static void piece_free(Text *txt, Piece *p);
 static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, size_t len);
 static Location piece_get_intern(Text *txt, size_t pos);
 static Location piece_get_extern(const Text *txt, size_t pos);
+/* piece tree management */
+static void tree_update(Piece *p);
+static void tree_resize(Piece *p, size_t old_len, size_t old_lines);
+static Piece *tree_merge(Piece *l, Piece *r);
+static void tree_split(Piece *p, bool after, Piece **l, Piece **r);
+static Piece *tree_build(Piece *start, Piece *end);
+static void tree_replace(Text *txt, Piece *prev, Piece *next, Span *span);
+static Location tree_lookup(const Text *txt, size_t pos);
+static size_t tree_lines(Piece *p);
+static size_t tree_pos(const Piece *p);
+/* mark resolution */
+static int mark_index_cmp(const void *a, const void *b);
+static bool mark_index_build(Text *txt);
+static bool mark_in_piece(const Piece *p, Mark mark);
+static Piece *mark_piece(Text *txt, Mark mark, bool indexed);
 /* span management */
 static void span_init(Span *span, Piece *start, Piece *end);
 static void span_swap(Text *txt, Span *old, Span *new);
 /* change management */
+static Change *change_new(Text *txt);
 static Change *change_alloc(Text *txt, size_t pos);
-static void change_free(Change *c);
+static void change_free(Text *txt, Change *c);
 /* revision management */
 static Revision *revision_alloc(Text *txt);
-static void revision_free(Revision *rev);
-/* logical line counting cache */
-static void lineno_cache_invalidate(LineCache *cache);
-static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skipped);
-static size_t lines_count(Text *txt, size_t pos, size_t len);
+static void revision_free(Text *txt, Revision *rev);
+/* logical line counting */
+static size_t lines_count(const char *data, size_t len);
+static size_t piece_lines(Piece *p);
+static size_t piece_lines_range(const Piece *p, size_t off, size_t len);
+
+/* allocates a new block of at least len bytes and adds it to the text */
+static Block *block_new(Text *txt, size_t len) {
+	Block *blk = NULL;
+	if (len >= TEXT_HEAP_MAX || txt->heap >= TEXT_HEAP_MAX - len)
+		blk = block_alloc_file(len);
+	if (!blk && !(blk = block_alloc(len)))
+		return NULL;
+	if (!array_add_ptr(&txt->blocks, blk)) {
+		block_free(blk);
+		return NULL;
+	}
+	if (blk->type == BLOCK_TYPE_MALLOC)
+		txt->heap += blk->size;
+	return blk;
+}
 
 /* stores the given data in a block, allocates a new one if necessary. Returns
  * a pointer to the storage location or NULL if allocation failed. */
 static const char *block_store(Text *txt, const char *data, size_t len) {
 	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
-	if (!blk || !block_capacity(blk, len)) {
-		blk = block_alloc(len);
-		if (!blk)
-			return NULL;
-		if (!array_add_ptr(&txt->blocks, blk)) {
-			block_free(blk);
-			return NULL;
-		}
-	}
-	return block_append(blk, data, len);
+	if (!blk || !block_capacity(blk, len))
+		blk = block_new(txt, len);
+	return blk ? block_append(blk, data, len) : NULL;
 }
 
 /* cache the given piece if it is the most recently changed one */
@@ -177,7 +336,11 @@ static bool cache_insert(Text *txt, Piece *p, size_t off, const char *data, size
 	size_t bufpos = p->data + off - blk->data;
 	if (!block_insert(blk, bufpos, data, len))
 		return false;
+	size_t lines = p->lines;
+	if (p->lines != LINES_UNKNOWN)
+		p->lines += lines_count(data, len);
 	p->len += len;
+	tree_resize(p, p->len - len, lines);
 	txt->current_revision->change->new.len += len;
 	txt->size += len;
 	return true;
@@ -193,9 +356,16 @@ static bool cache_delete(Text *txt, Piece *p, size_t off, size_t len) {
 	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
 	size_t end;
 	size_t bufpos = p->data + off - blk->data;
-	if (!addu(off, len, &end) || end > p->len || !block_delete(blk, bufpos, len))
+	if (!addu(off, len, &end) || end > p->len)
+		return false;
+	size_t lines = p->lines;
+	size_t deleted = piece_lines_range(p, off, len);
+	if (!block_delete(blk, bufpos, len))
 		return false;
+	if (p->lines != LINES_UNKNOWN)
+		p->lines -= deleted;
 	p->len -= len;
+	tree_resize(p, p->len + len, lines);
 	txt->current_revision->change->new.len -= len;
 	txt->size -= len;
 	return true;
@@ -214,6 +384,16 @@ static void span_init(Span *span, Piece *start, Piece *end) {
 	span->len = len;
 }
 
+/* record a modification replacing removed bytes at pos by inserted ones */
+static void generation_add(Text *txt, size_t pos, size_t removed, size_t inserted) {
+	txt->generation++;
+	txt->modified[txt->generation % TEXT_GENERATIONS] = (TextChange){
+		.pos = pos,
+		.removed = removed,
+		.inserted = inserted,
+	};
+}
+
 /* swap out an old span and replace it with a new one.
  *
  *  - if old is an empty span do not remove anything, just insert the new one
@@ -228,27 +408,218 @@ static void span_swap(Text *txt, Span *old, Span *new) {
 		/* insert new span */
 		new->start->prev->next = new->start;
 		new->end->next->prev = new->end;
+		tree_replace(txt, new->start->prev, new->end->next, new);
 	} else if (new->len == 0) {
 		/* delete old span */
 		old->start->prev->next = old->end->next;
 		old->end->next->prev = old->start->prev;
+		tree_replace(txt, old->start->prev, old->end->next, NULL);
 	} else {
 		/* replace old with new */
 		old->start->prev->next = new->start;
 		old->end->next->prev = new->end;
+		tree_replace(txt, new->start->prev, new->end->next, new);
 	}
 	txt->size -= old->len;
 	txt->size += new->len;
 }
 
+/* recompute the subtree length after one of the children changed */
+static void tree_update(Piece *p) {
+	Piece *l = p->left, *r = p->right;
+	p->tree_len = p->len;
+	p->tree_count = 1;
+	if (l) {
+		p->tree_len += l->tree_len;
+		p->tree_count += l->tree_count;
+	}
+	if (r) {
+		p->tree_len += r->tree_len;
+		p->tree_count += r->tree_count;
+	}
+	p->tree_lines = p->lines;
+	if ((l && l->tree_lines == LINES_UNKNOWN) || (r && r->tree_lines == LINES_UNKNOWN))
+		p->tree_lines = LINES_UNKNOWN;
+	else if (p->tree_lines != LINES_UNKNOWN)
+		p->tree_lines += (l ? l->tree_lines : 0) + (r ? r->tree_lines : 0);
+}
+
+/* propagate an in-place change of a piece part of the tree */
+static void tree_resize(Piece *p, size_t old_len, size_t old_lines) {
+	for (Piece *cur = p; cur; cur = cur->parent) {
+		cur->tree_len = cur->tree_len - old_len + p->len;
+		if (cur->tree_lines != LINES_UNKNOWN)
+			cur->tree_lines = cur->tree_lines - old_lines + p->lines;
+	}
+}
+
+/* join two trees, all pieces of l logically precede those of r */
+static Piece *tree_merge(Piece *l, Piece *r) {
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+	if (l->prio > r->prio) {
+		l->right = tree_merge(l->right, r);
+		l->right->parent = l;
+		tree_update(l);
+		return l;
+	} else {
+		r->left = tree_merge(l, r->left);
+		r->left->parent = r;
+		tree_update(r);
+		return r;
+	}
+}
+
+/* split the tree containing p into two parts, by walking up towards the root.
+ * If after is false, l will hold all predecessors of p and r the piece itself
+ * followed by all its successors. Otherwise p will be the last piece of l. */
+static void tree_split(Piece *p, bool after, Piece **l, Piece **r) {
+	Piece *left, *right, *child = p, *parent = p->parent;
+	if (after) {
+		left = p;
+		right = p->right;
+		p->right = NULL;
+	} else {
+		left = p->left;
+		right = p;
+		p->left = NULL;
+	}
+	if (left)
+		left->parent = NULL;
+	if (right)
+		right->parent = NULL;
+	tree_update(p);
+	while (parent) {
+		Piece *grandparent = parent->parent;
+		parent->parent = NULL;
+		if (parent->right == child) {
+			parent->right = left;
+			if (left)
+				left->parent = parent;
+			left = parent;
+		} else {
+			parent->left = right;
+			if (right)
+				right->parent = parent;
+			right = parent;
+		}
+		tree_update(parent);
+		child = parent;
+		parent = grandparent;
+	}
+	*l = left;
+	*r = right;
+}
+
+/* build a tree out of all pieces [start, end] of a span in linear time,
+ * by maintaining the right spine of the tree constructed so far */
+static Piece *tree_build(Piece *start, Piece *end) {
+	Piece *root = NULL, *last = NULL;
+	for (Piece *p = start; p; p = p->next) {
+		Piece *child = NULL, *cur = last;
+		while (cur && cur->prio < p->prio) {
+			/* the subtree rooted at cur is complete */
+			tree_update(cur);
+			child = cur;
+			cur = cur->parent;
+		}
+		p->left = child;
+		p->right = NULL;
+		p->parent = cur;
+		if (child)
+			child->parent = p;
+		if (cur)
+			cur->right = p;
+		else
+			root = p;
+		last = p;
+		if (p == end)
+			break;
+	}
+	for (Piece *p = last; p; p = p->parent)
+		tree_update(p);
+	return root;
+}
+
+/* replace all pieces located between prev and next (both exclusive, either
+ * might be a sentinel node) by those of the given span */
+static void tree_replace(Text *txt, Piece *prev, Piece *next, Span *span) {
+	Piece *head = txt->tree, *middle = NULL, *tail = NULL;
+	if (next != &txt->end)
+		tree_split(next, false, &head, &tail);
+	if (prev != &txt->begin) {
+		tree_split(prev, true, &head, &middle);
+	} else {
+		middle = head;
+		head = NULL;
+	}
+	/* the pieces in middle are no longer part of the document, their tree
+	 * links are rebuilt should they ever be swapped in again */
+	if (span && span->start)
+		head = tree_merge(head, tree_build(span->start, span->end));
+	txt->tree = tree_merge(head, tail);
+	if (txt->tree)
+		txt->tree->parent = NULL;
+	txt->marks_valid = false;
+	txt->marks_lookups = 0;
+}
+
+/* get the position of the first byte of a piece part of the tree */
+static size_t tree_pos(const Piece *p) {
+	size_t pos = p->left ? p->left->tree_len : 0;
+	for (; p->parent; p = p->parent) {
+		const Piece *parent = p->parent;
+		if (parent->right == p)
+			pos += parent->tree_len - p->tree_len;
+	}
+	return pos;
+}
+
+/* get the number of new lines in the given subtree, counting where necessary */
+static size_t tree_lines(Piece *p) {
+	if (!p)
+		return 0;
+	if (p->tree_lines == LINES_UNKNOWN) {
+		size_t left = tree_lines(p->left);
+		size_t right = tree_lines(p->right);
+		p->tree_lines = left + piece_lines(p) + right;
+	}
+	return p->tree_lines;
+}
+
+/* find the piece holding the byte at position pos < text_size() */
+static Location tree_lookup(const Text *txt, size_t pos) {
+	Piece *p = txt->tree;
+	while (p) {
+		size_t left = p->left ? p->left->tree_len : 0;
+		if (pos < left) {
+			p = p->left;
+		} else if (pos < left + p->len) {
+			return (Location){ .piece = p, .off = pos - left };
+		} else {
+			pos -= left + p->len;
+			p = p->right;
+		}
+	}
+	return (Location){ 0 };
+}
+
 /* Allocate a new revision and place it in the revision graph.
  * All further changes will be associated with this revision. */
 static Revision *revision_alloc(Text *txt) {
-	Revision *rev = calloc(1, sizeof *rev);
-	if (!rev)
+	Revision *rev = txt->free_revisions;
+	if (rev) {
+		txt->free_revisions = rev->next;
+		txt->slab_free -= slab_aligned(sizeof *rev);
+		memset(rev, 0, sizeof *rev);
+	} else if (!(rev = slab_alloc(txt, &txt->slabs, sizeof *rev))) {
 		return NULL;
+	}
 	rev->time = time(NULL);
 	txt->current_revision = rev;
+	txt->revisions++;
 
 	/* set sequence number */
 	if (!txt->last_revision)
@@ -273,40 +644,65 @@ static Revision *revision_alloc(Text *txt) {
 	return rev;
 }
 
-static void revision_free(Revision *rev) {
-	if (!rev)
-		return;
-	for (Change *next, *c = rev->change; c; c = next) {
+static void revision_free(Text *txt, Revision *rev) {
+	for (Change *c = rev->change, *next; c; c = next) {
 		next = c->next;
-		change_free(c);
+		change_free(txt, c);
+	}
+	rev->change = NULL;
+	rev->next = txt->free_revisions;
+	txt->free_revisions = rev;
+	txt->slab_free += slab_aligned(sizeof *rev);
+	txt->revisions--;
+}
+
+/* size of an object within a slab */
+static size_t slab_aligned(size_t size) {
+	return (size + sizeof(SlabAlign) - 1) / sizeof(SlabAlign) * sizeof(SlabAlign);
+}
+
+/* get zero initialized memory which remains valid until the text is freed */
+static void *slab_alloc(Text *txt, Slab **slabs, size_t size) {
+	size = slab_aligned(size);
+	Slab *slab = *slabs;
+	if (!slab || slab->size - slab->len < size) {
+		size_t cap = MAX(size, SLAB_SIZE);
+		if (!(slab = calloc(1, sizeof *slab + cap)))
+			return NULL;
+		slab->size = cap;
+		slab->next = *slabs;
+		*slabs = slab;
+		txt->slab_size += cap;
 	}
-	free(rev);
+	void *mem = (char*)slab->data + slab->len;
+	slab->len += size;
+	return mem;
 }
 
 static Piece *piece_alloc(Text *txt) {
-	Piece *p = calloc(1, sizeof *p);
-	if (!p)
+	Piece *p = txt->free_pieces;
+	if (p) {
+		txt->free_pieces = p->next;
+		txt->slab_free -= slab_aligned(sizeof *p);
+		memset(p, 0, sizeof *p);
+	} else if (!(p = slab_alloc(txt, &txt->piece_slabs, sizeof *p))) {
 		return NULL;
+	}
 	p->text = txt;
-	p->global_next = txt->pieces;
-	if (txt->pieces)
-		txt->pieces->global_prev = p;
-	txt->pieces = p;
+	/* xorshift32, only used to keep the piece tree balanced */
+	txt->seed ^= txt->seed << 13;
+	txt->seed ^= txt->seed >> 17;
+	txt->seed ^= txt->seed << 5;
+	p->prio = txt->seed;
 	return p;
 }
 
-static void piece_free(Piece *p) {
-	if (!p)
-		return;
-	if (p->global_prev)
-		p->global_prev->global_next = p->global_next;
-	if (p->global_next)
-		p->global_next->global_prev = p->global_prev;
-	if (p->text->pieces == p)
-		p->text->pieces = p->global_next;
-	if (p->text->cache == p)
-		p->text->cache = NULL;
-	free(p);
+/* a released piece no longer belongs to a text */
+static void piece_free(Text *txt, Piece *p) {
+	p->text = NULL;
+	p->next = txt->free_pieces;
+	txt->free_pieces = p;
+	txt->slab_free += slab_aligned(sizeof *p);
 }
 
 static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, size_t len) {
@@ -325,14 +721,15 @@ static void piece_init(Piece *p, Piece *prev, Piece *next, const char *data, siz
  * in particular if pos is zero, the begin sentinel piece is returned.
  */
 static Location piece_get_intern(Text *txt, size_t pos) {
-	size_t cur = 0;
-	for (Piece *p = &txt->begin; p->next; p = p->next) {
-		if (cur <= pos && pos <= cur + p->len)
-			return (Location){ .piece = p, .off = pos - cur };
-		cur += p->len;
-	}
-
-	return (Location){ 0 };
+	if (pos == 0)
+		return (Location){ .piece = &txt->begin, .off = 0 };
+	if (pos > txt->size)
+		return (Location){ 0 };
+	/* the piece holding the preceding byte */
+	Location loc = tree_lookup(txt, pos - 1);
+	if (loc.piece)
+		loc.off++;
+	return loc;
 }
 
 /* similar to piece_get_intern but usable as a public API. Returns the piece
@@ -341,21 +738,33 @@ static Location piece_get_intern(Text *txt, size_t pos) {
  * the last piece holding data is returned.
  */
 static Location piece_get_extern(const Text *txt, size_t pos) {
-	size_t cur = 0;
-	Piece *p;
+	if (pos < txt->size)
+		return tree_lookup(txt, pos);
 
-	for (p = txt->begin.next; p->next; p = p->next) {
-		if (cur <= pos && pos < cur + p->len)
-			return (Location){ .piece = p, .off = pos - cur };
-		cur += p->len;
+	if (pos == txt->size) {
+		Piece *p = txt->end.prev;
+		return (Location){ .piece = p, .off = p->len };
 	}
 
-	if (cur == pos)
-		return (Location){ .piece = p->prev, .off = p->prev->len };
-
 	return (Location){ 0 };
 }
 
+static Change *change_new(Text *txt) {
+	Change *c = txt->free_changes;
+	if (!c)
+		return slab_alloc(txt, &txt->slabs, sizeof *c);
+	txt->free_changes = c->next;
+	txt->slab_free -= slab_aligned(sizeof *c);
+	memset(c, 0, sizeof *c);
+	return c;
+}
+
+static void change_free(Text *txt, Change *c) {
+	c->next = txt->free_changes;
+	txt->free_changes = c;
+	txt->slab_free += slab_aligned(sizeof *c);
+}
+
 /* allocate a new change, associate it with current revision or a newly
  * allocated one if none exists. */
 static Change *change_alloc(Text *txt, size_t pos) {
@@ -365,7 +774,7 @@ static Change *change_alloc(Text *txt, size_t pos) {
 		if (!rev)
 			return NULL;
 	}
-	Change *c = calloc(1, sizeof *c);
+	Change *c = change_new(txt);
 	if (!c)
 		return NULL;
 	c->pos = pos;
@@ -376,16 +785,6 @@ static Change *change_alloc(Text *txt, size_t pos) {
 	return c;
 }
 
-static void change_free(Change *c) {
-	if (!c)
-		return;
-	/* only free the new part of the span, the old one is still in use */
-	if (c->new.start != c->new.end)
-		piece_free(c->new.end);
-	piece_free(c->new.start);
-	free(c);
-}
-
 /* When inserting new data there are 2 cases to consider.
  *
  *  - in the first the insertion point falls into the middle of an existing
@@ -418,8 +817,7 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 		return true;
 	if (pos > txt->size)
 		return false;
-	if (pos < txt->lines.pos)
-		lineno_cache_invalidate(&txt->lines);
+	generation_add(txt, pos, 0, len);
 
 	Location loc = piece_get_intern(txt, pos);
 	Piece *p = loc.piece;
@@ -444,6 +842,7 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 		if (!(new = piece_alloc(txt)))
 			return false;
 		piece_init(new, p, p->next, data, len);
+		new->lines = lines_count(data, len);
 		span_init(&c->new, new, new);
 		span_init(&c->old, NULL, NULL);
 	} else {
@@ -460,6 +859,9 @@ bool text_insert(Text *txt, size_t pos, const char *data, size_t len) {
 		piece_init(before, p->prev, new, p->data, off);
 		piece_init(new, before, after, data, len);
 		piece_init(after, new, p->next, p->data + off, p->len - off);
+		before->lines = piece_lines_range(p, 0, off);
+		new->lines = lines_count(data, len);
+		after->lines = before->lines == LINES_UNKNOWN ? LINES_UNKNOWN : p->lines - before->lines;
 
 		span_init(&c->new, before, after);
 		span_init(&c->old, p, p);
@@ -474,6 +876,11 @@ static size_t revision_undo(Text *txt, Revision *rev) {
 	size_t pos = EPOS;
 	for (Change *c = rev->change; c; c = c->next) {
 		span_swap(txt, &c->new, &c->old);
+		if (c->pos == EPOS)
+			continue;
+		/* the spans start at a piece boundary at or before c->pos,
+		 * the recorded extent thus covers the modified content */
+		generation_add(txt, c->pos, c->new.len, c->old.len);
 		pos = c->pos;
 	}
 	return pos;
@@ -486,6 +893,9 @@ static size_t revision_redo(Text *txt, Revision *rev) {
 		c = c->next;
 	for ( ; c; c = c->prev) {
 		span_swap(txt, &c->old, &c->new);
+		if (c->pos == EPOS)
+			continue;
+		generation_add(txt, c->pos, c->old.len, c->new.len);
 		pos = c->pos;
 		if (c->new.len > c->old.len)
 			pos += c->new.len - c->old.len;
@@ -502,7 +912,6 @@ size_t text_undo(Text *txt) {
 		return pos;
 	pos = revision_undo(txt, txt->history);
 	txt->history = rev;
-	lineno_cache_invalidate(&txt->lines);
 	return pos;
 }
 
@@ -515,7 +924,6 @@ size_t text_redo(Text *txt) {
 		return pos;
 	pos = revision_redo(txt, rev);
 	txt->history = rev;
-	lineno_cache_invalidate(&txt->lines);
 	return pos;
 }
 
@@ -538,7 +946,7 @@ static size_t history_traverse_to(Text *txt, Revision *rev) {
 	bool changed = history_change_branch(rev);
 	if (!changed) {
 		if (rev->seq == txt->history->seq) {
-			return txt->lines.pos;
+			return rev->change ? rev->change->pos : pos;
 		} else if (rev->seq > txt->history->seq) {
 			while (txt->history != rev)
 				pos = text_redo(txt);
@@ -589,12 +997,13 @@ Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod me
 	Text *txt = calloc(1, sizeof *txt);
 	if (!txt)
 		return NULL;
-	Piece *p = piece_alloc(txt);
-	if (!p)
-		goto out;
+	txt->seed = 2463534242;
 	Block *block = NULL;
 	array_init(&txt->blocks);
-	lineno_cache_invalidate(&txt->lines);
+	array_init(&txt->marks);
+	array_init_sized(&txt->relocations, sizeof(Relocation));
+	piece_init(&txt->begin, NULL, &txt->end, NULL, 0);
+	piece_init(&txt->end, &txt->begin, NULL, NULL, 0);
 	if (filename) {
 		errno = 0;
 		block = block_load(dirfd, filename, method, &txt->info);
@@ -606,14 +1015,26 @@ Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod me
 		}
 	}
 
-	if (!block)
-		piece_init(p, &txt->begin, &txt->end, "\0", 0);
-	else
-		piece_init(p, &txt->begin, &txt->end, block->data, block->len);
-
-	piece_init(&txt->begin, NULL, p, NULL, 0);
-	piece_init(&txt->end, p, NULL, NULL, 0);
-	txt->size = p->len;
+	const char *data = block ? block->data : "\0";
+	size_t size = block ? block->len : 0;
+	Piece *first = NULL;
+	do {
+		Piece *p = piece_alloc(txt);
+		if (!p)
+			goto out;
+		size_t len = MIN(size, PIECE_LOAD_SIZE);
+		piece_init(p, txt->end.prev, &txt->end, data, len);
+		p->lines = len ? LINES_UNKNOWN : 0;
+		txt->end.prev->next = p;
+		txt->end.prev = p;
+		if (!first)
+			first = p;
+		data += len;
+		size -= len;
+	} while (size > 0);
+
+	txt->tree = tree_build(first, txt->end.prev);
+	txt->size = txt->tree->tree_len;
 	/* write an empty revision */
 	change_alloc(txt, EPOS);
 	text_snapshot(txt);
@@ -625,21 +1046,103 @@ out:
 	return NULL;
 }
 
+bool text_load_tail(Text *txt, const char *filename, enum TextLoadMethod method) {
+	size_t size = txt->size;
+	struct stat meta;
+	bool success = false;
+	errno = 0;
+	if (text_modified(txt) || (off_t)size != txt->info.st_size)
+		return false;
+	int fd = open(filename, O_RDONLY|O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &meta) == -1 || !S_ISREG(meta.st_mode) || meta.st_size <= txt->info.st_size ||
+	    meta.st_dev != txt->info.st_dev || meta.st_ino != txt->info.st_ino)
+		goto out;
+	/* a file rewritten from scratch is unlikely to end in the same way */
+	char old[256], new[256];
+	size_t check = MIN(size, sizeof old);
+	if (text_bytes_get(txt, size - check, check, old) != check ||
+	    pread(fd, new, check, size - check) != (ssize_t)check || memcmp(old, new, check))
+		goto out;
+
+	Block *block = block_load_range(fd, size, meta.st_size - size, method);
+	if (!block)
+		goto out;
+	if (!array_add_ptr(&txt->blocks, block)) {
+		block_free(block);
+		goto out;
+	}
+	const char *data = block->data + (size - block->offset);
+	size_t len = block->len - (size - block->offset);
+	if (len == 0)
+		goto out;
+
+	text_snapshot(txt);
+	Change *c = change_alloc(txt, size);
+	if (!c)
+		goto out;
+	Piece *first = NULL, *last = txt->end.prev;
+	for (size_t rem = len; rem > 0; ) {
+		Piece *p = piece_alloc(txt);
+		if (!p)
+			goto out;
+		size_t plen = MIN(rem, PIECE_LOAD_SIZE);
+		piece_init(p, last, &txt->end, data, plen);
+		p->lines = LINES_UNKNOWN;
+		if (first)
+			last->next = p;
+		else
+			first = p;
+		last = p;
+		data += plen;
+		rem -= plen;
+	}
+	generation_add(txt, size, 0, len);
+	span_init(&c->new, first, last);
+	span_init(&c->old, NULL, NULL);
+	span_swap(txt, &c->old, &c->new);
+	/* the file might have shrunk in the meantime */
+	meta.st_size = size + len;
+	text_saved(txt, &meta, NULL);
+	success = true;
+out:
+	close(fd);
+	return success;
+}
+
 struct stat text_stat(const Text *txt) {
 	return txt->info;
 }
 
-void text_saved(Text *txt, struct stat *meta) {
+/* mark the given revision, or the current one if NULL, as saved */
+void text_saved(Text *txt, struct stat *meta, Revision *rev) {
 	if (meta)
 		txt->info = *meta;
-	txt->saved_revision = txt->history;
+	txt->saved_revision = rev ? rev : txt->history;
 	text_snapshot(txt);
 }
 
-Block *text_block_mmaped(Text *txt) {
-	Block *block = array_get_ptr(&txt->blocks, 0);
-	if (block && block->type == BLOCK_TYPE_MMAP_ORIG && block->size)
-		return block;
+/* complete the current revision, which is about to be saved. The history
+ * is not pruned until the revision is released */
+Revision *text_saved_revision_new(Text *txt) {
+	text_snapshot(txt);
+	txt->saving++;
+	return txt->history;
+}
+
+void text_saved_revision_release(Text *txt) {
+	if (txt->saving > 0)
+		txt->saving--;
+}
+
+/* the index-th block mapped from the original file, see also text_load_tail */
+Block *text_block_mmaped(Text *txt, size_t index) {
+	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++) {
+		Block *block = array_get_ptr(&txt->blocks, i);
+		if (block->type == BLOCK_TYPE_MMAP_ORIG && block->size && index-- == 0)
+			return block;
+	}
 	return NULL;
 }
 
@@ -663,8 +1166,7 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 	size_t pos_end;
 	if (!addu(pos, len, &pos_end) || pos_end > txt->size)
 		return false;
-	if (pos < txt->lines.pos)
-		lineno_cache_invalidate(&txt->lines);
+	generation_add(txt, pos, len, 0);
 
 	Location loc = piece_get_intern(txt, pos);
 	Piece *p = loc.piece;
@@ -715,11 +1217,13 @@ bool text_delete(Text *txt, size_t pos, size_t len) {
 		if (!after)
 			return false;
 		piece_init(after, before, p->next, p->data + p->len - (cur - len), cur - len);
+		after->lines = piece_lines_range(p, p->len - (cur - len), cur - len);
 	}
 
 	if (midway_start) {
 		/* we finally know which piece follows our newly allocated before piece */
 		piece_init(before, start->prev, after, start->data, off);
+		before->lines = piece_lines_range(start, 0, off);
 	}
 
 	Piece *new_start = NULL, *new_end = NULL;
@@ -746,6 +1250,132 @@ bool text_delete_range(Text *txt, const Filerange *r) {
 	return text_delete(txt, r->start, text_range_size(r));
 }
 
+/* append data to the span being built by text_batch, extending the last
+ * piece whenever it directly precedes the data in memory. The range from base
+ * up to the data is known to lie within one block, pieces of distinct blocks
+ * are never merged even if the blocks happen to be adjacent in memory */
+static bool batch_append(Text *txt, Span *span, Piece *prev, const char *base, const char *data, size_t len, size_t lines) {
+	if (len == 0)
+		return true;
+	Piece *last = span->end;
+	if (last && last->data >= base && last->data + last->len == data) {
+		last->len += len;
+		if (lines == LINES_UNKNOWN)
+			last->lines = LINES_UNKNOWN;
+		else if (last->lines != LINES_UNKNOWN)
+			last->lines += lines;
+	} else {
+		Piece *p = piece_alloc(txt);
+		if (!p)
+			return false;
+		piece_init(p, last ? last : prev, NULL, data, len);
+		p->lines = lines;
+		if (last)
+			last->next = p;
+		else
+			span->start = p;
+		span->end = p;
+	}
+	span->len += len;
+	return true;
+}
+
+/* advance loc by len bytes through the current pieces, if keep is set the
+ * passed over content is appended to the span */
+static bool batch_advance(Text *txt, Span *span, Piece *prev, Location *loc, size_t len, bool keep) {
+	while (len > 0) {
+		Piece *p = loc->piece;
+		size_t n = MIN(len, p->len - loc->off);
+		if (keep) {
+			size_t lines = n == p->len ? p->lines : piece_lines_range(p, loc->off, n);
+			if (!batch_append(txt, span, prev, p->data, p->data + loc->off, n, lines))
+				return false;
+		}
+		loc->off += n;
+		len -= n;
+		if (loc->off == p->len) {
+			loc->piece = p->next;
+			loc->off = 0;
+		}
+	}
+	return true;
+}
+
+/* All pieces from the one holding the first edit up to the one holding the
+ * end of the last edit are replaced by a freshly built span. It consists of
+ * copies of the retained fragments, sharing their data, interleaved with the
+ * inserted text. The tree is rebuilt once for the whole span.
+ */
+bool text_batch(Text *txt, const TextEdit *edits, size_t count) {
+	size_t pos = 0, modified = 0, removed = 0, inserted = 0;
+	for (size_t i = 0; i < count; i++) {
+		const TextEdit *e = &edits[i];
+		if (e->range.start < pos || e->range.start > e->range.end || e->range.end > txt->size)
+			return false;
+		if (e->count && e->len > SIZE_MAX / e->count)
+			return false;
+		if (!addu(modified, e->len * e->count, &modified) ||
+		    !addu(modified, text_range_size(&e->range), &modified))
+			return false;
+		removed += text_range_size(&e->range);
+		inserted += e->len * e->count;
+		pos = e->range.end;
+	}
+	if (modified == 0)
+		return true;
+	size_t extent = edits[count-1].range.end - edits[0].range.start;
+	generation_add(txt, edits[0].range.start, extent, extent - removed + inserted);
+
+	Location loc = piece_get_intern(txt, edits[0].range.start);
+	if (!loc.piece)
+		return false;
+	Change *c = change_alloc(txt, edits[0].range.start);
+	if (!c)
+		return false;
+	txt->cache = NULL;
+
+	/* the piece preceding the modified region remains unchanged */
+	Piece *prev = loc.off == loc.piece->len ? loc.piece : loc.piece->prev;
+	Piece *start = prev->next;
+	Span span = { 0 };
+	pos = edits[0].range.start - (loc.off == loc.piece->len ? 0 : loc.off);
+	loc = (Location){ .piece = start, .off = 0 };
+
+	for (size_t i = 0; i < count; i++) {
+		const TextEdit *e = &edits[i];
+		if (!batch_advance(txt, &span, prev, &loc, e->range.start - pos, true))
+			return false;
+		for (size_t j = 0; j < e->count && e->len; j++) {
+			const char *data = block_store(txt, e->data, e->len);
+			if (!data)
+				return false;
+			Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
+			if (!batch_append(txt, &span, prev, blk->data, data, e->len, lines_count(data, e->len)))
+				return false;
+		}
+		if (!batch_advance(txt, &span, prev, &loc, text_range_size(&e->range), false))
+			return false;
+		pos = e->range.end;
+	}
+
+	/* keep the remainder of the last piece, if the region ends midway */
+	Piece *next = loc.piece, *end = next->prev;
+	if (loc.off > 0) {
+		if (!batch_advance(txt, &span, prev, &loc, next->len - loc.off, true))
+			return false;
+		end = next;
+		next = next->next;
+	}
+	if (span.end)
+		span.end->next = next;
+
+	c->new = span;
+	if (start != next)
+		span_init(&c->old, start, end);
+	span_swap(txt, &c->old, &c->new);
+	return true;
+}
+
 /* preserve the current text content such that it can be restored by
  * means of undo/redo operations */
 bool text_snapshot(Text *txt) {
@@ -756,33 +1386,383 @@ bool text_snapshot(Text *txt) {
 	return true;
 }
 
+bool text_fragmented(const Text *txt) {
+	size_t pieces = txt->tree ? txt->tree->tree_count : 0;
+	/* later revisions would refer to the original pieces */
+	return pieces > TEXT_COMPACT_PIECES && txt->size / pieces < TEXT_COMPACT_PIECE &&
+	       txt->compacted != txt->generation && txt->history && !txt->history->next;
+}
+
+/* replace the pieces [start, end] by a contiguous copy, as an additional
+ * change of the revision representing the current state */
+static bool compact_run(Text *txt, Piece *start, Piece *end, size_t len) {
+	Revision *rev = txt->history;
+	Block *blk = array_get_ptr(&txt->blocks, array_length(&txt->blocks)-1);
+	if (!blk || !block_capacity(blk, len))
+		blk = block_new(txt, len);
+	if (!blk)
+		return false;
+	Piece *new = piece_alloc(txt);
+	Change *c = change_new(txt);
+	if (!new || !c)
+		return false;
+	const char *data = blk->data + blk->len;
+	size_t lines = 0;
+	for (Piece *p = start; ; p = p->next) {
+		Relocation moved = { .from = p->data, .len = p->len, .to = block_append(blk, p->data, p->len) };
+		Relocation back = { .from = moved.to, .len = p->len, .to = p->data };
+		if (p->len && (!array_add(&txt->relocations, &moved) || !array_add(&txt->relocations, &back)))
+			return false;
+		lines += piece_lines(p);
+		if (p == end)
+			break;
+	}
+	txt->relocations_sorted = false;
+	piece_init(new, start->prev, end->next, data, len);
+	new->lines = lines;
+	c->pos = EPOS;
+	span_init(&c->old, start, end);
+	span_init(&c->new, new, new);
+	c->next = rev->change;
+	if (rev->change)
+		rev->change->prev = c;
+	rev->change = c;
+	span_swap(txt, &c->old, &c->new);
+	return true;
+}
+
+size_t text_compact(Text *txt, size_t *budget) {
+	size_t removed = 0;
+	if (!text_fragmented(txt))
+		return removed;
+	Location loc = txt->compact_pos < txt->size ? tree_lookup(txt, txt->compact_pos) : (Location){ 0 };
+	Piece *p = loc.piece;
+	size_t pos = txt->compact_pos - loc.off;
+	while (p && p->next && *budget > 0) {
+		Piece *end = p;
+		size_t len = p->len, count = 1;
+		while (len < TEXT_COMPACT_SIZE && end->len < TEXT_COMPACT_PIECE && end->next->next &&
+		       end->next->len < TEXT_COMPACT_PIECE && len + end->next->len <= TEXT_COMPACT_SIZE) {
+			end = end->next;
+			len += end->len;
+			count++;
+		}
+		Piece *next = end->next;
+		if (count > 1) {
+			if (!compact_run(txt, p, end, len)) {
+				next = NULL;
+			} else {
+				removed += count - 1;
+				*budget -= MIN(*budget, len);
+			}
+		}
+		pos += len;
+		p = next;
+	}
+	if (p && p->next) {
+		txt->compact_pos = pos;
+	} else {
+		txt->compact_pos = 0;
+		txt->compacted = txt->generation;
+	}
+	if (removed)
+		txt->cache = NULL;
+	return removed;
+}
+
+TextHistory text_history(const Text *txt) {
+	TextHistory history = {
+		.revisions = txt->revisions,
+		.memory = txt->slab_size - txt->slab_free,
+	};
+	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		if (blk->type != BLOCK_TYPE_MMAP_ORIG)
+			history.memory += blk->size;
+	}
+	return history;
+}
+
+/* mark the pieces of a span which is part of the chain */
+static void span_mark(Span *span, uint32_t epoch) {
+	if (!span->start)
+		return;
+	for (Piece *p = span->start; p; p = p->next) {
+		p->epoch = epoch;
+		if (p == span->end)
+			break;
+	}
+	span->end->epoch = epoch;
+}
+
+/* revert a revision like revision_undo, without recording a modification */
+static void history_mark_undo(Text *txt, Revision *rev, uint32_t epoch) {
+	for (Change *c = rev->change; c; c = c->next) {
+		span_mark(&c->new, epoch);
+		span_swap(txt, &c->new, &c->old);
+		span_mark(&c->old, epoch);
+	}
+	rev->visited = true;
+}
+
+static void history_mark_redo(Text *txt, Revision *rev) {
+	Change *c = rev->change;
+	while (c && c->next)
+		c = c->next;
+	for ( ; c; c = c->prev)
+		span_swap(txt, &c->old, &c->new);
+}
+
+/* move from one state to another via their closest common ancestor, path
+ * needs to have room for all revisions along the way */
+static void history_mark_move(Text *txt, Revision *from, Revision *to, Array *path, uint32_t epoch) {
+	array_clear(path);
+	while (from != to) {
+		if (from->seq > to->seq) {
+			history_mark_undo(txt, from, epoch);
+			from = from->prev;
+		} else {
+			array_add_ptr(path, to);
+			to = to->prev;
+		}
+	}
+	for (size_t i = array_length(path); i-- > 0; )
+		history_mark_redo(txt, array_get_ptr(path, i));
+}
+
+static int block_cmp(const void *a, const void *b) {
+	const Block *blk = *(Block* const*)a, *other = *(Block* const*)b;
+	return blk->data < other->data ? -1 : blk->data > other->data;
+}
+
+/* index of the block holding data among those ordered by address, or len */
+static size_t block_find(Array *blocks, const char *data) {
+	size_t lo = 0, len = array_length(blocks), hi = len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Block *blk = array_get_ptr(blocks, mid);
+		if (blk->data <= data)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	Block *blk = lo > 0 ? array_get_ptr(blocks, lo - 1) : NULL;
+	return blk && data < blk->data + blk->size ? lo - 1 : len;
+}
+
+/* release the blocks which are neither referenced by a piece in use nor by a
+ * frozen copy, together with the relocations into them */
+static void history_blocks_free(Text *txt) {
+	Array sorted;
+	array_init(&sorted);
+	size_t count = array_length(&txt->blocks);
+	/* the last entry stands for data outside of all blocks */
+	bool *used = calloc(count + 1, sizeof *used);
+	if (!used || !array_reserve(&sorted, count)) {
+		free(used);
+		array_release(&sorted);
+		return;
+	}
+	for (size_t i = 0; i < count; i++)
+		array_add_ptr(&sorted, array_get_ptr(&txt->blocks, i));
+	array_sort(&sorted, block_cmp);
+
+	size_t size = slab_aligned(sizeof(Piece));
+	for (Slab *slab = txt->piece_slabs; slab; slab = slab->next) {
+		for (size_t off = 0; off + size <= slab->len; off += size) {
+			Piece *p = (Piece*)((char*)slab->data + off);
+			if (p->text && p->len)
+				used[block_find(&sorted, p->data)] = true;
+		}
+	}
+	for (TextFrozen *frozen = txt->frozen; frozen; frozen = frozen->next) {
+		for (size_t i = 0; i < frozen->count; i++)
+			used[block_find(&sorted, frozen->chunks[i].data)] = true;
+	}
+
+	for (size_t i = array_length(&txt->relocations); i-- > 0; ) {
+		Relocation *r = array_get(&txt->relocations, i);
+		if (!used[block_find(&sorted, r->from)] || !used[block_find(&sorted, r->to)])
+			array_remove(&txt->relocations, i);
+	}
+
+	for (size_t i = count; i-- > 0; ) {
+		Block *blk = array_get_ptr(&txt->blocks, i);
+		if (!blk->size || !used[block_find(&sorted, blk->data)])
+			array_remove(&txt->blocks, i);
+	}
+	/* the lookups above need all blocks to remain valid */
+	for (size_t i = 0; i < count; i++) {
+		Block *blk = array_get_ptr(&sorted, i);
+		if (blk->size && used[i])
+			continue;
+		if (blk->type == BLOCK_TYPE_MALLOC)
+			txt->heap -= MIN(txt->heap, blk->size);
+		block_free(blk);
+	}
+	free(used);
+	array_release(&sorted);
+}
+
+/* prune the history such that at most keep revisions remain, unless more
+ * are derived from the current one. Returns the number of revisions released */
+static size_t history_prune(Text *txt, size_t keep) {
+	Revision *first = txt->history;
+	while (first->prev)
+		first = first->prev;
+	/* children are always more recent than their parent */
+	for (Revision *rev = first; rev; rev = rev->later)
+		rev->subtree = 1;
+	for (Revision *rev = txt->last_revision; rev && rev->prev; rev = rev->earlier)
+		rev->prev->subtree += rev->subtree;
+	Revision *root = txt->history;
+	while (root->prev && root->prev->subtree <= keep)
+		root = root->prev;
+	if (!root->prev)
+		return 0;
+
+	if (++txt->epoch == 0)
+		txt->epoch++;
+	uint32_t epoch = txt->epoch;
+	size_t kept = 0;
+	for (Revision *rev = root; rev; rev = rev->later) {
+		if (rev == root || (rev->prev && rev->prev->epoch == epoch)) {
+			rev->epoch = epoch;
+			rev->visited = false;
+			kept++;
+		}
+	}
+	Array path;
+	array_init(&path);
+	if (!array_reserve(&path, kept)) {
+		array_release(&path);
+		return 0;
+	}
+
+	/* every piece in use is either part of the current chain or of a span
+	 * of a kept change, each of which is reverted at least once */
+	for (Piece *p = txt->begin.next; p != &txt->end; p = p->next)
+		p->epoch = epoch;
+	Revision *state = txt->history;
+	for (Revision *rev = root->later; rev; rev = rev->later) {
+		if (rev->epoch == epoch && !rev->visited) {
+			history_mark_move(txt, state, rev, &path, epoch);
+			state = rev;
+		}
+	}
+	history_mark_move(txt, state, root, &path, epoch);
+	history_mark_move(txt, root, txt->history, &path, epoch);
+	array_release(&path);
+
+	size_t pruned = 0;
+	Revision *earlier = NULL;
+	for (Revision *rev = first, *later; rev; rev = later) {
+		later = rev->later;
+		if (rev->epoch != epoch) {
+			if (txt->saved_revision == rev)
+				txt->saved_revision = NULL;
+			revision_free(txt, rev);
+			pruned++;
+			continue;
+		}
+		rev->earlier = earlier;
+		if (earlier)
+			earlier->later = rev;
+		earlier = rev;
+	}
+	earlier->later = NULL;
+	txt->last_revision = earlier;
+	/* the new root is never reverted */
+	for (Change *c = root->change, *next; c; c = next) {
+		next = c->next;
+		change_free(txt, c);
+	}
+	root->change = NULL;
+	root->prev = NULL;
+
+	size_t size = slab_aligned(sizeof(Piece));
+	for (Slab *slab = txt->piece_slabs; slab; slab = slab->next) {
+		for (size_t off = 0; off + size <= slab->len; off += size) {
+			Piece *p = (Piece*)((char*)slab->data + off);
+			if (p->text && p->epoch != epoch)
+				piece_free(txt, p);
+		}
+	}
+	history_blocks_free(txt);
+	txt->cache = NULL;
+	txt->marks_valid = false;
+	txt->marks_lookups = 0;
+	array_clear(&txt->marks);
+	return pruned;
+}
+
+size_t text_history_prune(Text *txt, size_t revisions, size_t memory) {
+	size_t pruned = 0;
+	if (txt->current_revision || txt->saving)
+		return pruned;
+	if (revisions && txt->revisions > revisions)
+		pruned += history_prune(txt, MAX(revisions - revisions / HISTORY_PRUNE_SLACK, 1));
+	while (memory && text_history(txt).memory > memory) {
+		size_t removed = history_prune(txt, txt->revisions - MAX(txt->revisions / HISTORY_PRUNE_SLACK, 1));
+		if (!removed)
+			break;
+		pruned += removed;
+	}
+	return pruned;
+}
 
 void text_free(Text *txt) {
 	if (!txt)
 		return;
 
-	// free history
-	Revision *hist = txt->history;
-	while (hist && hist->prev)
-		hist = hist->prev;
-	while (hist) {
-		Revision *later = hist->later;
-		revision_free(hist);
-		hist = later;
+	for (Slab *next, *slab = txt->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
 	}
-
-	for (Piece *next, *p = txt->pieces; p; p = next) {
-		next = p->global_next;
-		piece_free(p);
+	for (Slab *next, *slab = txt->piece_slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
 	}
+	/* the content of frozen copies must be read before */
+	for (TextFrozen *frozen = txt->frozen; frozen; frozen = frozen->next)
+		frozen->text = NULL;
 
 	for (size_t i = 0, len = array_length(&txt->blocks); i < len; i++)
 		block_free(array_get_ptr(&txt->blocks, i));
 	array_release(&txt->blocks);
+	array_release(&txt->marks);
+	array_release(&txt->relocations);
+	text_brackets_free(txt->brackets);
 
 	free(txt);
 }
 
+TextBrackets **text_brackets(Text *txt) {
+	return &txt->brackets;
+}
+
+size_t text_generation(const Text *txt) {
+	return txt->generation;
+}
+
+size_t text_changed_since(const Text *txt, size_t generation) {
+	if (generation == txt->generation)
+		return EPOS;
+	if (generation > txt->generation || txt->generation - generation > TEXT_GENERATIONS)
+		return 0;
+	size_t pos = EPOS;
+	while (generation++ != txt->generation)
+		pos = MIN(pos, txt->modified[generation % TEXT_GENERATIONS].pos);
+	return pos;
+}
+
+bool text_change_get(const Text *txt, size_t generation, TextChange *change) {
+	if (generation == 0 || generation > txt->generation || txt->generation - generation >= TEXT_GENERATIONS)
+		return false;
+	*change = txt->modified[generation % TEXT_GENERATIONS];
+	return true;
+}
+
 bool text_modified(const Text *txt) {
 	return txt->saved_revision != txt->history;
 }
@@ -825,6 +1805,21 @@ bool text_iterator_next(Iterator *it) {
 	return iterator_init(it, it->pos+rem, it->piece ? it->piece->next : NULL, 0);
 }
 
+bool text_iterator_chunk_next(Iterator *it, size_t end, const char **chunk, size_t *len) {
+	for (; text_iterator_valid(it) && it->pos < end; text_iterator_next(it)) {
+		size_t rem = it->end - it->text;
+		if (rem == 0)
+			continue;
+		if (rem > end - it->pos)
+			rem = end - it->pos;
+		*chunk = it->text;
+		*len = rem;
+		text_iterator_next(it);
+		return true;
+	}
+	return false;
+}
+
 bool text_iterator_prev(Iterator *it) {
 	size_t off = it->text - it->start;
 	size_t len = it->piece && it->piece->prev ? it->piece->prev->len : 0;
@@ -852,100 +1847,81 @@ size_t text_size(const Text *txt) {
 	return txt->size;
 }
 
-/* count the number of new lines '\n' in range [pos, pos+len) */
-static size_t lines_count(Text *txt, size_t pos, size_t len) {
+/* count the number of new lines '\n' in the given memory region */
+static size_t lines_count(const char *data, size_t len) {
 	size_t lines = 0;
-	for (Iterator it = text_iterator_get(txt, pos);
-	     text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		const char *start = it.text;
-		while (len > 0 && start < it.end) {
-			size_t n = MIN(len, (size_t)(it.end - start));
-			const char *end = memchr(start, '\n', n);
-			if (!end) {
-				len -= n;
-				break;
-			}
-			lines++;
-			len -= end - start + 1;
-			start = end + 1;
-		}
-
-		if (len == 0)
-			break;
-	}
+	for (const char *end = data + len; (data = memchr(data, '\n', end - data)); data++)
+		lines++;
 	return lines;
 }
 
-/* skip n lines forward and return position afterwards */
-static size_t lines_skip_forward(Text *txt, size_t pos, size_t lines, size_t *lines_skipped) {
-	size_t lines_old = lines;
-	for (Iterator it = text_iterator_get(txt, pos);
-	     text_iterator_valid(&it);
-	     text_iterator_next(&it)) {
-		const char *start = it.text;
-		while (lines > 0 && start < it.end) {
-			size_t n = it.end - start;
-			const char *end = memchr(start, '\n', n);
-			if (!end) {
-				pos += n;
-				break;
-			}
-			pos += end - start + 1;
-			start = end + 1;
-			lines--;
-		}
-
-		if (lines == 0)
-			break;
-	}
-	if (lines_skipped)
-		*lines_skipped = lines_old - lines;
-	return pos;
+/* get the number of new lines of a piece, counting them if necessary */
+static size_t piece_lines(Piece *p) {
+	if (p->lines == LINES_UNKNOWN)
+		p->lines = lines_count(p->data, p->len);
+	return p->lines;
 }
 
-static void lineno_cache_invalidate(LineCache *cache) {
-	cache->pos = 0;
-	cache->lineno = 1;
+/* count the new lines in range [off, off+len) of a piece, if the total is
+ * known the complement is scanned whenever it is smaller */
+static size_t piece_lines_range(const Piece *p, size_t off, size_t len) {
+	if (p->lines == LINES_UNKNOWN)
+		return LINES_UNKNOWN;
+	if (len <= p->len / 2)
+		return lines_count(p->data + off, len);
+	return p->lines - lines_count(p->data, off) -
+	       lines_count(p->data + off + len, p->len - off - len);
 }
 
 size_t text_pos_by_lineno(Text *txt, size_t lineno) {
-	size_t lines_skipped;
-	LineCache *cache = &txt->lines;
 	if (lineno <= 1)
 		return 0;
-	if (lineno > cache->lineno) {
-		cache->pos = lines_skip_forward(txt, cache->pos, lineno - cache->lineno, &lines_skipped);
-		cache->lineno += lines_skipped;
-	} else if (lineno < cache->lineno) {
-	#if 0
-		// TODO does it make sense to scan memory backwards here?
-		size_t diff = cache->lineno - lineno;
-		if (diff < lineno) {
-			lines_skip_backward(txt, cache->pos, diff);
-		} else
-	#endif
-		cache->pos = lines_skip_forward(txt, 0, lineno - 1, &lines_skipped);
-		cache->lineno = lines_skipped + 1;
-	}
-	return cache->lineno == lineno ? cache->pos : EPOS;
+	size_t pos = 0, lines = lineno - 1;
+	Piece *p = txt->tree;
+	while (p) {
+		size_t left = tree_lines(p->left);
+		if (lines <= left) {
+			p = p->left;
+			continue;
+		}
+		lines -= left;
+		if (p->left)
+			pos += p->left->tree_len;
+		if (lines <= piece_lines(p)) {
+			/* the line starts after the n-th new line of this piece */
+			const char *cur = p->data, *end = p->data + p->len;
+			while (--lines > 0)
+				cur = (const char*)memchr(cur, '\n', end - cur) + 1;
+			cur = memchr(cur, '\n', end - cur);
+			return pos + (cur - p->data) + 1;
+		}
+		lines -= p->lines;
+		pos += p->len;
+		p = p->right;
+	}
+	return EPOS;
 }
 
 size_t text_lineno_by_pos(Text *txt, size_t pos) {
-	LineCache *cache = &txt->lines;
+	size_t lineno = 1;
 	if (pos > txt->size)
 		pos = txt->size;
-	if (pos < cache->pos) {
-		size_t diff = cache->pos - pos;
-		if (diff < pos)
-			cache->lineno -= lines_count(txt, pos, diff);
-		else
-			cache->lineno = lines_count(txt, 0, pos) + 1;
-	} else if (pos > cache->pos) {
-		cache->lineno += lines_count(txt, cache->pos, pos - cache->pos);
+	Piece *p = txt->tree;
+	while (p) {
+		size_t left = p->left ? p->left->tree_len : 0;
+		if (pos < left) {
+			p = p->left;
+			continue;
+		}
+		lineno += tree_lines(p->left);
+		pos -= left;
+		if (pos < p->len)
+			return lineno + lines_count(p->data, pos);
+		lineno += piece_lines(p);
+		pos -= p->len;
+		p = p->right;
 	}
-	cache->pos = text_line_begin(txt, pos);
-	return cache->lineno;
+	return lineno;
 }
 
 Mark text_mark_set(Text *txt, size_t pos) {
@@ -957,21 +1933,229 @@ Mark text_mark_set(Text *txt, size_t pos) {
 	return (Mark)(loc.piece->data + loc.off);
 }
 
-size_t text_mark_get(const Text *txt, Mark mark) {
-	size_t cur = 0;
+static int mark_index_cmp(const void *a, const void *b) {
+	const Piece *p = *(Piece**)a, *q = *(Piece**)b;
+	return p->data < q->data ? -1 : p->data > q->data;
+}
+
+static bool mark_index_build(Text *txt) {
+	array_clear(&txt->marks);
+	for (Piece *p = txt->begin.next; p->next; p = p->next) {
+		if (p->len > 0 && !array_add_ptr(&txt->marks, p))
+			return false;
+	}
+	array_sort(&txt->marks, mark_index_cmp);
+	txt->marks_valid = true;
+	return true;
+}
+
+static bool mark_in_piece(const Piece *p, Mark mark) {
+	Mark start = (Mark)p->data;
+	return start <= mark && mark < start + p->len;
+}
+
+/* find the piece containing the mark, either by scanning the chain or by a
+ * binary search in the index */
+static Piece *mark_piece(Text *txt, Mark mark, bool indexed) {
+	if (!txt->marks_valid && (indexed || ++txt->marks_lookups > MARK_INDEX_THRESHOLD))
+		indexed = mark_index_build(txt);
+	else
+		indexed = txt->marks_valid;
+
+	if (!indexed) {
+		for (Piece *p = txt->begin.next; p->next; p = p->next) {
+			if (mark_in_piece(p, mark))
+				return p;
+		}
+		return NULL;
+	}
+
+	/* find the last piece starting at or before the mark */
+	size_t lo = 0, hi = array_length(&txt->marks);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Piece *p = array_get_ptr(&txt->marks, mid);
+		if ((Mark)p->data <= mark)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* pieces emptied by a cached delete might share their start address */
+	for (Piece *p; lo > 0 && (p = array_get_ptr(&txt->marks, --lo)); ) {
+		if (mark_in_piece(p, mark))
+			return p;
+		if (p->len > 0)
+			break;
+	}
+	return NULL;
+}
+
+static int relocation_cmp(const void *a, const void *b) {
+	const Relocation *r = a, *s = b;
+	return r->from < s->from ? -1 : r->from > s->from;
+}
 
+/* find the piece containing a copy of the data the mark refers to, made by
+ * text_compact, or the original from which the data was copied. Updates the
+ * mark to point into the piece */
+static Piece *mark_relocate(Text *txt, Mark *mark, int depth) {
+	if (depth == 0)
+		return NULL;
+	if (!txt->relocations_sorted) {
+		array_sort(&txt->relocations, relocation_cmp);
+		txt->relocations_sorted = true;
+	}
+	/* the first relocation starting after the mark */
+	size_t lo = 0, hi = array_length(&txt->relocations);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		Relocation *r = array_get(&txt->relocations, mid);
+		if ((Mark)r->from <= *mark)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* ranges might overlap, but none is longer than TEXT_COMPACT_PIECE */
+	for (Relocation *r; lo > 0 && (r = array_get(&txt->relocations, --lo)); ) {
+		size_t off = *mark - (Mark)r->from;
+		if (off >= TEXT_COMPACT_PIECE)
+			break;
+		if (off >= r->len)
+			continue;
+		Mark moved = (Mark)(r->to + off);
+		Piece *p = mark_piece(txt, moved, true);
+		if (!p)
+			p = mark_relocate(txt, &moved, depth - 1);
+		if (p) {
+			*mark = moved;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+size_t text_mark_get(const Text *txt, Mark mark) {
 	if (mark == EMARK)
 		return EPOS;
 	if (mark == (Mark)&txt->end)
 		return txt->size;
+	/* the mark index is merely a cache, the text content is not modified */
+	Piece *p = mark_piece((Text*)txt, mark, false);
+	if (!p)
+		p = mark_relocate((Text*)txt, &mark, TEXT_COMPACT_DEPTH);
+	return p ? tree_pos(p) + (mark - (Mark)p->data) : EPOS;
+}
 
-	for (Piece *p = txt->begin.next; p->next; p = p->next) {
-		Mark start = (Mark)(p->data);
-		Mark end = start + p->len;
-		if (start <= mark && mark < end)
-			return cur + (mark - start);
-		cur += p->len;
+void text_mark_get_all(const Text *txt, const Mark *marks, size_t *pos, size_t count) {
+	Piece *p = NULL;
+	size_t off = 0;
+	for (size_t i = 0; i < count; i++) {
+		Mark mark = marks[i];
+		if (mark == EMARK || mark == (Mark)&txt->end) {
+			pos[i] = text_mark_get(txt, mark);
+			continue;
+		}
+		/* consecutive marks are likely in the same or the following piece */
+		if (p && !mark_in_piece(p, mark)) {
+			off += p->len;
+			p = p->next;
+			while (p->next && p->len == 0)
+				p = p->next;
+			if (!p->next || !mark_in_piece(p, mark))
+				p = NULL;
+		}
+		if (!p) {
+			p = mark_piece((Text*)txt, mark, true);
+			if (!p)
+				p = mark_relocate((Text*)txt, &mark, TEXT_COMPACT_DEPTH);
+			if (!p) {
+				pos[i] = EPOS;
+				continue;
+			}
+			off = tree_pos(p);
+		}
+		pos[i] = off + (mark - (Mark)p->data);
 	}
+}
 
-	return EPOS;
+TextFrozen *text_freeze(Text *txt) {
+	size_t count = 0;
+	for (Piece *p = txt->begin.next; p->next; p = p->next)
+		count += p->len > 0;
+	TextFrozen *frozen = malloc(sizeof *frozen + count * sizeof frozen->chunks[0]);
+	if (!frozen)
+		return NULL;
+	frozen->refs = 1;
+	frozen->text = txt;
+	frozen->prev = NULL;
+	frozen->next = txt->frozen;
+	if (txt->frozen)
+		txt->frozen->prev = frozen;
+	txt->frozen = frozen;
+	frozen->size = txt->size;
+	frozen->count = 0;
+	size_t pos = 0;
+	for (Piece *p = txt->begin.next; p->next; pos += p->len, p = p->next) {
+		if (p->len == 0)
+			continue;
+		frozen->chunks[frozen->count].data = p->data;
+		frozen->chunks[frozen->count].pos = pos;
+		frozen->chunks[frozen->count].len = p->len;
+		frozen->count++;
+	}
+	/* the cached piece is the only one modified in place */
+	txt->cache = NULL;
+	return frozen;
+}
+
+TextFrozen *text_frozen_ref(TextFrozen *frozen) {
+	if (frozen)
+		frozen->refs++;
+	return frozen;
+}
+
+void text_frozen_release(TextFrozen *frozen) {
+	if (!frozen || --frozen->refs > 0)
+		return;
+	if (frozen->prev)
+		frozen->prev->next = frozen->next;
+	else if (frozen->text)
+		frozen->text->frozen = frozen->next;
+	if (frozen->next)
+		frozen->next->prev = frozen->prev;
+	free(frozen);
+}
+
+size_t text_frozen_size(const TextFrozen *frozen) {
+	return frozen->size;
+}
+
+const char *text_frozen_chunk(const TextFrozen *frozen, size_t pos, size_t *len) {
+	if (pos >= frozen->size)
+		return NULL;
+	/* find the last chunk starting at or before pos */
+	size_t lo = 0, hi = frozen->count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (frozen->chunks[mid].pos <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	size_t off = pos - frozen->chunks[lo].pos;
+	*len = frozen->chunks[lo].len - off;
+	return frozen->chunks[lo].data + off;
+}
+
+size_t text_frozen_bytes_get(const TextFrozen *frozen, size_t pos, size_t len, char *buf) {
+	size_t rem = len, chunk_len;
+	for (const char *chunk; rem > 0 && (chunk = text_frozen_chunk(frozen, pos, &chunk_len)); ) {
+		if (chunk_len > rem)
+			chunk_len = rem;
+		memcpy(buf, chunk, chunk_len);
+		buf += chunk_len;
+		pos += chunk_len;
+		rem -= chunk_len;
+	}
+	return len - rem;
 }
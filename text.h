@@ -29,6 +29,7 @@ typedef struct {
 typedef struct Text Text;
 typedef struct Piece Piece;
 typedef struct TextSave TextSave;
+typedef struct TextFrozen TextFrozen;
 
 /** A contiguous part of the text. */
 typedef struct {
@@ -111,6 +112,45 @@ Text *text_loadat(int dirfd, const char *filename);
  */
 Text *text_load_method(const char *filename, enum TextLoadMethod);
 Text *text_loadat_method(int dirfd, const char *filename, enum TextLoadMethod);
+/**
+ * Append the content added to the end of a file since it was loaded or
+ * last saved, as is the case for growing log files.
+ *
+ * The new content becomes a revision of its own, which is marked as saved.
+ *
+ * @param filename The name of the file the text was loaded from or saved to.
+ * @param method How the new content should be loaded.
+ * @return Whether the text was extended.
+ * @rst
+ * .. note:: Fails with ``errno`` set to zero, if the text contains unsaved
+ *           modifications, the file was replaced or did not grow, or if
+ *           the end of the previously known content changed.
+ * @endrst
+ */
+bool text_load_tail(Text*, const char *filename, enum TextLoadMethod);
+/**
+ * Start a filter process, typically a decompressor like ``gzip -dc``,
+ * reading the given file on its standard input.
+ *
+ * The output is meant to be appended to an empty text in chunks, possibly
+ * while the editor remains responsive, followed by ``text_load_commit``.
+ *
+ * @param argv The command and its arguments, looked up in ``$PATH``.
+ * @param pid Set to the process which has to be reaped using ``waitpid(2)``.
+ * @return The read end of a pipe connected to the standard output of the
+ *         filter or ``-1`` in case of an error.
+ * @rst
+ * .. note:: The same ``errno`` values as for ``text_load_method`` apply
+ *           to non-regular files.
+ * @endrst
+ */
+int text_load_filter(int dirfd, const char *filename, const char *const argv[], pid_t *pid);
+/**
+ * Complete loading content which was inserted piece wise, e.g. as produced
+ * by ``text_load_filter``. The current revision is marked as saved and the
+ * file information of the given file is recorded, see ``text_stat``.
+ */
+bool text_load_commit(Text*, int dirfd, const char *filename);
 /** Release all resources associated with this text instance. */
 void text_free(Text*);
 /**
@@ -133,6 +173,39 @@ size_t text_size(const Text*);
 struct stat text_stat(const Text*);
 /** Query whether the text contains any unsaved modifications. */
 bool text_modified(const Text*);
+/**
+ * Get a counter which is incremented by every modification, including
+ * undo and redo operations.
+ */
+size_t text_generation(const Text*);
+/**
+ * Get the lowest position modified since the given generation.
+ * @rst
+ * .. note:: Content before the returned position is unchanged, its
+ *           positions remain valid.
+ * @endrst
+ * @return The modified position, ``EPOS`` if nothing changed or ``0``
+ *         if the information is no longer available.
+ */
+size_t text_changed_since(const Text*, size_t generation);
+/** A modification, ``removed`` bytes at ``pos`` were replaced by ``inserted`` ones. */
+typedef struct {
+	size_t pos;
+	size_t removed;
+	size_t inserted;
+} TextChange;
+/**
+ * Get the extent of the modification which produced a generation.
+ * @rst
+ * .. note:: The extent might be larger than the content which actually
+ *           changed, but never smaller.
+ * @endrst
+ * @param generation A generation, up to the current one, as returned by
+ *   ``text_generation``.
+ * @return Whether the information is still available, only the most
+ *   recent modifications are kept.
+ */
+bool text_change_get(const Text*, size_t generation, TextChange*);
 /**
  * @}
  * @defgroup modify
@@ -156,6 +229,28 @@ bool text_insert(Text*, size_t pos, const char *data, size_t len);
  */
 bool text_delete(Text*, size_t pos, size_t len);
 bool text_delete_range(Text*, const Filerange*);
+/**
+ * A single modification as part of a batch.
+ */
+typedef struct {
+	Filerange range;        /**< Range to delete, empty for a pure insertion. */
+	const char *data;       /**< Data to insert at ``range.start``. */
+	size_t len;             /**< Length of ``data`` in bytes. */
+	size_t count;           /**< How often ``data`` is inserted. */
+} TextEdit;
+/**
+ * Apply a list of modifications in a single pass over the piece chain.
+ *
+ * The result is the same as performing the deletions and insertions one by
+ * one, but it is recorded as one change and takes time linear in the number
+ * of edits and affected pieces.
+ *
+ * @param edits The modifications, with ranges referring to the text before
+ *   any of them is applied. They need to be sorted and must not overlap.
+ * @param count The number of edits.
+ * @return Whether the text was modified. Upon failure the text is unchanged.
+ */
+bool text_batch(Text*, const TextEdit *edits, size_t count);
 bool text_printf(Text*, size_t pos, const char *format, ...) __attribute__((format(printf, 3, 4)));
 bool text_appendf(Text*, const char *format, ...) __attribute__((format(printf, 2, 3)));
 /**
@@ -198,6 +293,60 @@ size_t text_restore(Text*, time_t);
  * @endrst
  */
 time_t text_state(const Text*);
+/**
+ * Check whether the text consists of many small pieces which ``text_compact``
+ * would coalesce.
+ * @rst
+ * .. note:: This is only the case if the current state is the most recent one
+ *           of its branch in the history graph, and if the text was modified
+ *           since the last complete compaction.
+ * @endrst
+ */
+bool text_fragmented(const Text*);
+/**
+ * Copy runs of adjacent small pieces into contiguous ones.
+ *
+ * The content is left unchanged and the generation is not incremented. The
+ * replacement is recorded as part of the current revision, undoing it thus
+ * restores the original pieces. Marks into the copied data remain valid.
+ * @rst
+ * .. note:: Continues where a previous invocation stopped, until the end
+ *           of the text is reached.
+ * @endrst
+ * @param budget The maximal number of bytes to copy, reduced by the amount
+ *        copied. The last run might exceed it.
+ * @return The number of pieces eliminated.
+ */
+size_t text_compact(Text*, size_t *budget);
+/** Resources held by the undo history. */
+typedef struct {
+	size_t revisions;       /**< Number of revisions in the history graph. */
+	size_t memory;          /**< Bytes of the pieces, changes and revisions and of the blocks not mapped from a file. */
+} TextHistory;
+/**
+ * Get the resources currently used by the history.
+ */
+TextHistory text_history(const Text*);
+/**
+ * Discard the oldest revisions if the history exceeds the given limits.
+ *
+ * The most distant ancestor of the current revision within the limits
+ * becomes the oldest state which can be restored, all revisions not derived
+ * from it are discarded. Pieces and blocks which are no longer needed are
+ * released. Marks referring to content only found in discarded revisions
+ * become invalid.
+ * @rst
+ * .. note:: The revisions which can be redone from the current state are
+ *           always kept. Nothing is discarded while the current revision is
+ *           incomplete i.e. before ``text_snapshot`` or while it is being
+ *           saved in the background.
+ * @endrst
+ * @param revisions The maximal number of revisions, ``0`` for no limit.
+ * @param memory The maximal ``memory`` as reported by ``text_history``,
+ *        ``0`` for no limit.
+ * @return The number of revisions discarded.
+ */
+size_t text_history_prune(Text*, size_t revisions, size_t memory);
 /**
  * @}
  * @defgroup lines
@@ -257,6 +406,22 @@ bool text_iterator_has_next(const Iterator*);
 bool text_iterator_has_prev(const Iterator*);
 bool text_iterator_next(Iterator*);
 bool text_iterator_prev(Iterator*);
+/**
+ * Get the next contiguous chunk of text before ``end``.
+ *
+ * The chunk references the underlying storage, nothing is copied.
+ * Afterwards the iterator refers to the following piece.
+ * @param end The absolute position at which to stop.
+ * @param chunk Is set to the start of the chunk.
+ * @param len Is set to the length of the chunk in bytes.
+ * @return Whether a non-empty chunk was found.
+ * @rst
+ * .. note:: To process a range ``r`` chunk by chunk, initialize the iterator
+ *           at ``r.start`` and call this function with ``r.end`` until it
+ *           returns ``false``.
+ * @endrst
+ */
+bool text_iterator_chunk_next(Iterator*, size_t end, const char **chunk, size_t *len);
 /**
  * @}
  * @defgroup iterator_byte
@@ -302,6 +467,51 @@ Mark text_mark_set(Text*, size_t pos);
  * @return The byte position or ``EPOS`` for an invalid mark.
  */
 size_t text_mark_get(const Text*, Mark);
+/**
+ * Lookup multiple marks at once.
+ * @rst
+ * .. note:: This is most efficient if the marks are ordered by position,
+ *           nearby marks are then resolved without a new look up.
+ * @endrst
+ * @param marks The marks to look up.
+ * @param pos The array storing the corresponding byte positions or ``EPOS``.
+ * @param count The number of marks.
+ */
+void text_mark_get_all(const Text*, const Mark *marks, size_t *pos, size_t count);
+/**
+ * @}
+ * @defgroup frozen
+ * @{
+ */
+/**
+ * Capture the current content in an immutable, reference counted object.
+ *
+ * Only the piece boundaries are recorded, the content itself is shared
+ * with the text. Subsequent modifications of the text do not affect it,
+ * hence a frozen text can be read while the original is being edited.
+ * @rst
+ * .. warning:: A frozen text must not outlive the text it was created from.
+ * .. note:: The reference count is not synchronized, acquiring and releasing
+ *           references must happen from the thread modifying the text.
+ * @endrst
+ * @return The frozen text with a reference count of one, or ``NULL``.
+ */
+TextFrozen *text_freeze(Text*);
+/** Acquire an additional reference. */
+TextFrozen *text_frozen_ref(TextFrozen*);
+/** Release a reference, freeing the object once none is left. */
+void text_frozen_release(TextFrozen*);
+/** Return the size in bytes of the captured content. */
+size_t text_frozen_size(const TextFrozen*);
+/**
+ * Get the contiguous chunk of content starting at ``pos``.
+ * @param pos The absolute position.
+ * @param len Is set to the number of bytes available at the returned address.
+ * @return A pointer to the content or ``NULL`` if ``pos >= size``.
+ */
+const char *text_frozen_chunk(const TextFrozen*, size_t pos, size_t *len);
+/** Store at most ``len`` bytes starting from ``pos`` into ``buf``. */
+size_t text_frozen_bytes_get(const TextFrozen*, size_t pos, size_t len, char *buf);
 /**
  * @}
  * @defgroup save
@@ -375,6 +585,42 @@ TextSave *text_save_begin(Text*, int dirfd, const char *filename, enum TextSaveM
  * @return The number of bytes written or ``-1`` in case of an error.
  */
 ssize_t text_save_write_range(TextSave*, const Filerange*);
+/**
+ * Pass all subsequently written data through a filter process, typically
+ * a compressor like ``gzip -c``, whose output is stored in the file.
+ *
+ * @param argv The command and its arguments, looked up in ``$PATH``.
+ * @return Whether the filter was started.
+ * @rst
+ * .. note:: ``text_save_commit`` waits for the filter to terminate and
+ *           fails unless it exited successfully.
+ * @endrst
+ */
+bool text_save_filter(TextSave*, const char *const argv[]);
+/**
+ * Write file range in a background process.
+ *
+ * The content is written as it was at the time of the call, subsequent
+ * modifications do not affect it. Once ``text_save_poll`` reports completion,
+ * ``text_save_commit`` marks the revision current at the time of this
+ * call as saved.
+ * @return A non-blocking file descriptor which becomes readable whenever
+ *         progress is made, or ``-1`` in case of an error.
+ * @rst
+ * .. note:: The descriptor is owned by the ``TextSave`` context and closed
+ *           once the write completes or ``text_save_cancel`` is called.
+ * .. note:: Only supported for atomic saves, which leave the file untouched
+ *           if they are cancelled. Otherwise ``errno`` is set to ``ENOTSUP``.
+ * @endrst
+ */
+int text_save_background(TextSave*, const Filerange*);
+/**
+ * Check the progress of a background write.
+ * @param written Set to the number of bytes written so far.
+ * @return ``1`` if the write is in progress, ``0`` if it completed successfully
+ *         and ``-1`` in case of an error, with ``errno`` set accordingly.
+ */
+int text_save_poll(TextSave*, size_t *written);
 /**
  * Commit changes to disk.
  * @return Whether changes have been saved.
@@ -403,6 +649,13 @@ ssize_t text_write(const Text*, int fd);
  * @return The number of bytes written or ``-1`` in case of an error.
  */
 ssize_t text_write_range(const Text*, const Filerange*, int fd);
+/**
+ * Write as much of the file range as a non-blocking file descriptor accepts.
+ * Consecutive pieces are written with a single system call where possible.
+ * @return The number of bytes written, which is zero if the descriptor did not
+ *         accept any data, or ``-1`` in case of an error.
+ */
+ssize_t text_write_range_nonblock(const Text*, const Filerange*, int fd);
 /**
  * @}
  * @defgroup misc
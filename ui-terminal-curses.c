@@ -163,6 +163,9 @@ static inline unsigned int color_pair_hash(short fg, short bg) {
 	return fg * (COLORS + 2) + bg;
 }
 
+/* whether a color pair in use was redefined, see color_pair_get */
+static bool color_pairs_recycled;
+
 static short color_pair_get(short fg, short bg) {
 	static bool has_default_colors;
 	static short *color2palette;
@@ -203,6 +206,9 @@ static short color_pair_get(short fg, short bg) {
 		pair_content(color_pair_current, &oldfg, &oldbg);
 		unsigned int old_index = color_pair_hash(oldfg, oldbg);
 		if (init_pair(color_pair_current, fg, bg) == OK) {
+			/* cells displayed with the old colors change appearance */
+			if (color2palette[old_index] == color_pair_current)
+				color_pairs_recycled = true;
 			color2palette[old_index] = 0;
 			color2palette[index] = color_pair_current;
 		}
@@ -215,31 +221,87 @@ static inline attr_t style_to_attr(CellStyle *style) {
 	return style->attr | COLOR_PAIR(color_pair_get(style->fg, style->bg));
 }
 
+typedef struct {
+	Cell *cells;        /* grid submitted to curses during the previous frame */
+	size_t cells_size;  /* allocated bytes for cells */
+	bool valid;         /* whether cells reflect the content of stdscr */
+} UiCurses;
+
+static bool cell_equal(const Cell *c1, const Cell *c2) {
+	return c1->style.attr == c2->style.attr && c1->style.fg == c2->style.fg &&
+	       c1->style.bg == c2->style.bg && !strcmp(c1->data, c2->data);
+}
+
 static void ui_term_backend_blit(Ui *tui) {
+	UiCurses *c = tui->ctx;
 	int w = tui->width, h = tui->height;
-	Cell *cell = tui->cells;
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			attrset(style_to_attr(&cell->style));
-			mvaddstr(y, x, cell->data);
-			cell++;
+	size_t size = w*h*sizeof(Cell);
+	if (size > c->cells_size) {
+		Cell *cells = realloc(c->cells, size);
+		if (!cells) {
+			c->valid = false;
+		} else {
+			c->cells = cells;
+			c->cells_size = size;
 		}
 	}
+
+	Cell *shown = c->cells_size >= size ? c->cells : NULL;
+	for (bool full = !c->valid;; full = true) {
+		Cell *cell = tui->cells;
+		bool attr_known = false;
+		attr_t attr = A_NORMAL;
+		color_pairs_recycled = false;
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++, cell++) {
+				if (shown) {
+					Cell *prev = &shown[y*w + x];
+					if (!full && cell_equal(prev, cell))
+						continue;
+					*prev = *cell;
+				}
+				attr_t a = style_to_attr(&cell->style);
+				if (!attr_known || a != attr) {
+					attrset(a);
+					attr = a;
+					attr_known = true;
+				}
+				mvaddstr(y, x, cell->data);
+				tui->stats.cells++;
+			}
+		}
+		/* skipped cells might refer to a redefined color pair */
+		if (full || !color_pairs_recycled)
+			break;
+	}
+	c->valid = shown != NULL;
+
 	wnoutrefresh(stdscr);
 	if (tui->doupdate)
 		doupdate();
 }
 
 static void ui_term_backend_clear(Ui *tui) {
+	UiCurses *c = tui->ctx;
+	c->valid = false;
 	clear();
 }
 
 static bool ui_term_backend_resize(Ui *tui, int width, int height) {
+	UiCurses *c = tui->ctx;
+	c->valid = false;
 	return resizeterm(height, width) == OK &&
 	       wresize(stdscr, height, width) == OK;
 }
 
+/* curses does not know about bracketed paste mode, set it directly */
+static void bracketed_paste(bool enable) {
+	fputs(enable ? "\x1b[?2004h" : "\x1b[?2004l", stderr);
+	fflush(stderr);
+}
+
 static void ui_term_backend_save(Ui *tui, bool fscr) {
+	bracketed_paste(false);
 	curs_set(1);
 	if (fscr) {
 		def_prog_mode();
@@ -250,9 +312,12 @@ static void ui_term_backend_save(Ui *tui, bool fscr) {
 }
 
 static void ui_term_backend_restore(Ui *tui) {
+	UiCurses *c = tui->ctx;
+	c->valid = false;
 	reset_prog_mode();
 	wclear(stdscr);
 	curs_set(0);
+	bracketed_paste(true);
 }
 
 int ui_terminal_colors(void) {
@@ -273,23 +338,35 @@ static bool ui_term_backend_init(Ui *tui, char *term) {
 	keypad(stdscr, TRUE);
 	meta(stdscr, TRUE);
 	curs_set(0);
+	bracketed_paste(true);
 	return true;
 }
 
 static bool ui_backend_init(Ui *ui) {
+	UiCurses *c = calloc(1, sizeof(UiCurses));
+	if (!c)
+		return false;
+	ui->ctx = c;
 	return true;
 }
 
-void ui_terminal_resume(Ui *term) { }
+void ui_terminal_resume(Ui *term) {
+	bracketed_paste(true);
+}
 
 static void ui_term_backend_suspend(Ui *term) {
+	bracketed_paste(false);
 	if (change_colors == 1)
 		undo_palette();
 }
 
 static void ui_term_backend_free(Ui *term) {
+	UiCurses *c = term->ctx;
 	ui_term_backend_suspend(term);
 	endwin();
+	if (c)
+		free(c->cells);
+	free(c);
 }
 
 bool is_default_color(CellColor c) {
@@ -5,8 +5,12 @@
  * This is useful for debugging and fuzzing purposes as well as for environments
  * with no curses support.
  *
- * Currently no attempt is made to optimize terminal output. The amount of
- * flickering will depend on the smartness of your terminal emulator.
+ * The cells displayed by the terminal are remembered, every frame only
+ * outputs those which changed since the previous one. Output of a frame is
+ * collected and written at once, wrapped in a synchronized update such that
+ * terminals supporting it do not display partial frames. Others ignore the
+ * unknown mode. A full repaint happens after a resize, a requested redraw
+ * and whenever other programs might have used the terminal.
  *
  * The following terminal escape sequences are used:
  *
@@ -14,9 +18,14 @@
  *  - CSI ? 1049 l             Use Normal Screen Buffer and restore cursor (DECRST)
  *  - CSI ? 25 l               Hide Cursor (DECTCEM)
  *  - CSI ? 25 h               Show Cursor (DECTCEM)
+ *  - CSI ? 2004 h             Enable Bracketed Paste Mode
+ *  - CSI ? 2004 l             Disable Bracketed Paste Mode
+ *  - CSI ? 2026 h             Begin Synchronized Update
+ *  - CSI ? 2026 l             End Synchronized Update
  *  - CSI 2 J                  Erase in Display (ED)
  *  - CSI row ; column H       Cursor Position (CUP)
- *  - CSI ... m                Character Attributes (SGR)
+ *  - CSI n C                  Cursor Forward (CUF)
+ *  - CSI ... m                Character Attributes (SGR), parameters are combined
  *    - CSI 0 m                     Normal
  *    - CSI 1 m                     Bold
  *    - CSI 3 m                     Italicized
@@ -37,6 +46,7 @@
  * for further information.
  */
 #include <stdio.h>
+#include <wchar.h>
 #include "buffer.h"
 
 #define UI_TERMKEY_FLAGS TERMKEY_FLAG_UTF8
@@ -91,84 +101,177 @@ static void cursor_visible(bool visible) {
 	output_literal(visible ? "\x1b[?25h" : "\x1b[?25l");
 }
 
+static void bracketed_paste(bool enable) {
+	output_literal(enable ? "\x1b[?2004h" : "\x1b[?2004l");
+}
+
+typedef struct {
+	Buffer buf;         /* escape sequences and content of the current frame */
+	Cell *cells;        /* what the terminal currently displays */
+	size_t cells_size;  /* allocated bytes for cells */
+	bool valid;         /* whether cells reflect the terminal content */
+	CellStyle style;    /* character attributes currently in effect */
+	int x, y;           /* cursor position, x is -1 if unknown */
+} UiVt100;
+
+static bool cell_style_equal(const CellStyle *s1, const CellStyle *s2) {
+	return s1->attr == s2->attr && cell_color_equal(s1->fg, s2->fg) &&
+	       cell_color_equal(s1->bg, s2->bg);
+}
+
+/* number of columns the cursor advances when outputting the cell data, -1 if unknown */
+static int cell_advance(const Cell *cell) {
+	unsigned char c = cell->data[0];
+	if (!c)
+		return 0;
+	if (c < 0x80)
+		return cell->data[1] ? -1 : 1;
+	wchar_t wc;
+	mbstate_t ps = { 0 };
+	size_t len = mbrtowc(&wc, cell->data, strlen(cell->data), &ps);
+	if (len == (size_t)-1 || len == (size_t)-2)
+		return -1;
+	return wcwidth(wc);
+}
+
+static int color_param(char *seq, size_t size, int base, CellColor color) {
+	if (color.index != (uint8_t)-1)
+		return snprintf(seq, size, ";%d", base + color.index);
+	return snprintf(seq, size, ";%d;2;%d;%d;%d", base + 8, color.r, color.g, color.b);
+}
+
+/* switch the character attributes in effect to the given style with a single sequence */
+static void style_set(UiVt100 *vt, const CellStyle *style) {
+	static const struct {
+		CellAttr attr;
+		char on[4], off[4];
+	} cell_attrs[] = {
+		{ CELL_ATTR_BOLD, "1", "22" },
+		{ CELL_ATTR_DIM, "2", "22" },
+		{ CELL_ATTR_ITALIC, "3", "23" },
+		{ CELL_ATTR_UNDERLINE, "4", "24" },
+		{ CELL_ATTR_BLINK, "5", "25" },
+		{ CELL_ATTR_REVERSE, "7", "27" },
+	};
+
+	if (cell_style_equal(&vt->style, style))
+		return;
+	char seq[128];
+	int len = 0;
+	CellAttr attr = vt->style.attr;
+	/* bold and dim are both turned off by the same parameter */
+	const CellAttr intensity = CELL_ATTR_BOLD|CELL_ATTR_DIM;
+	if ((attr & intensity) & ~style->attr) {
+		len += snprintf(seq + len, sizeof(seq) - len, ";22");
+		attr &= ~intensity;
+	}
+	for (size_t i = 0; i < LENGTH(cell_attrs); i++) {
+		CellAttr a = cell_attrs[i].attr;
+		if ((style->attr & a) == (attr & a))
+			continue;
+		len += snprintf(seq + len, sizeof(seq) - len, ";%s",
+		                style->attr & a ? cell_attrs[i].on : cell_attrs[i].off);
+	}
+	if (!cell_color_equal(vt->style.fg, style->fg))
+		len += color_param(seq + len, sizeof(seq) - len, 30, style->fg);
+	if (!cell_color_equal(vt->style.bg, style->bg))
+		len += color_param(seq + len, sizeof(seq) - len, 40, style->bg);
+	/* skip the separator in front of the first parameter */
+	if (len > 0)
+		buffer_appendf(&vt->buf, "\x1b[%sm", seq + 1);
+	vt->style = *style;
+}
+
+static void cursor_move(UiVt100 *vt, int x, int y) {
+	if (vt->x == x && vt->y == y)
+		return;
+	if (vt->x != -1 && vt->y == y && vt->x < x)
+		buffer_appendf(&vt->buf, "\x1b[%dC", x - vt->x);
+	else
+		buffer_appendf(&vt->buf, "\x1b[%d;%dH", y + 1, x + 1);
+	vt->x = x;
+	vt->y = y;
+}
+
 static void ui_term_backend_blit(Ui *tui) {
-	Buffer *buf = tui->ctx;
-	buffer_clear(buf);
-	CellAttr attr = CELL_ATTR_NORMAL;
-	CellColor fg = CELL_COLOR_DEFAULT, bg = CELL_COLOR_DEFAULT;
+	UiVt100 *vt = tui->ctx;
+	Buffer *buf = &vt->buf;
 	int w = tui->width, h = tui->height;
-	Cell *cell = tui->cells;
-	/* reposition cursor, erase screen, reset attributes */
-	buffer_append0(buf, "\x1b[H" "\x1b[J" "\x1b[0m");
-	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			CellStyle *style = &cell->style;
-			if (style->attr != attr) {
-
-				static const struct {
-					CellAttr attr;
-					char on[4], off[4];
-				} cell_attrs[] = {
-					{ CELL_ATTR_BOLD, "1", "22" },
-					{ CELL_ATTR_DIM, "2", "22" },
-					{ CELL_ATTR_ITALIC, "3", "23" },
-					{ CELL_ATTR_UNDERLINE, "4", "24" },
-					{ CELL_ATTR_BLINK, "5", "25" },
-					{ CELL_ATTR_REVERSE, "7", "27" },
-				};
-
-				for (size_t i = 0; i < LENGTH(cell_attrs); i++) {
-					CellAttr a = cell_attrs[i].attr;
-					if ((style->attr & a) == (attr & a))
-						continue;
-					buffer_appendf(buf, "\x1b[%sm",
-					               style->attr & a ? 
-					               cell_attrs[i].on :
-					               cell_attrs[i].off);
-				}
-
-				attr = style->attr;
-			}
+	size_t size = w*h*sizeof(Cell);
+	if (size > vt->cells_size) {
+		Cell *cells = realloc(vt->cells, size);
+		if (!cells) {
+			vt->valid = false;
+		} else {
+			vt->cells = cells;
+			vt->cells_size = size;
+		}
+	}
 
-			if (!cell_color_equal(fg, style->fg)) {
-				fg = style->fg;
-				if (fg.index != (uint8_t)-1) {
-					buffer_appendf(buf, "\x1b[%dm", 30 + fg.index);
-				} else {
-					buffer_appendf(buf, "\x1b[38;2;%d;%d;%dm",
-					               fg.r, fg.g, fg.b);
-				}
-			}
+	buffer_clear(buf);
+	buffer_append0(buf, "\x1b[?2026h");
+	size_t empty = buffer_length0(buf);
+	bool full = !vt->valid;
+	if (full) {
+		/* reposition cursor, erase screen, reset attributes */
+		buffer_append0(buf, "\x1b[H" "\x1b[J" "\x1b[0m");
+		vt->style = (CellStyle){ .attr = CELL_ATTR_NORMAL, .fg = CELL_COLOR_DEFAULT, .bg = CELL_COLOR_DEFAULT };
+		vt->x = vt->y = 0;
+	}
 
-			if (!cell_color_equal(bg, style->bg)) {
-				bg = style->bg;
-				if (bg.index != (uint8_t)-1) {
-					buffer_appendf(buf, "\x1b[%dm", 40 + bg.index);
-				} else {
-					buffer_appendf(buf, "\x1b[48;2;%d;%d;%dm",
-					               bg.r, bg.g, bg.b);
-				}
+	Cell *cell = tui->cells;
+	Cell *shown = vt->cells_size >= size ? vt->cells : NULL;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++, cell++) {
+			if (shown) {
+				Cell *prev = &shown[y*w + x];
+				if (!full && cell_style_equal(&prev->style, &cell->style) &&
+				    !strcmp(prev->data, cell->data))
+					continue;
+				*prev = *cell;
 			}
-
+			tui->stats.cells++;
+			cursor_move(vt, x, y);
+			style_set(vt, &cell->style);
 			buffer_append0(buf, cell->data);
-			cell++;
+			int advance = cell_advance(cell);
+			if (advance < 0 || x + advance >= w)
+				vt->x = -1;
+			else
+				vt->x += advance;
 		}
 	}
+
+	vt->valid = shown != NULL;
+	if (buffer_length0(buf) == empty)
+		return;
+	buffer_append0(buf, "\x1b[?2026l");
+	tui->stats.bytes += buffer_length0(buf);
 	output(buffer_content(buf), buffer_length0(buf));
 }
 
-static void ui_term_backend_clear(Ui *tui) { }
+static void ui_term_backend_clear(Ui *tui) {
+	UiVt100 *vt = tui->ctx;
+	vt->valid = false;
+}
 
 static bool ui_term_backend_resize(Ui *tui, int width, int height) {
+	UiVt100 *vt = tui->ctx;
+	if (width != tui->width || height != tui->height)
+		vt->valid = false;
 	return true;
 }
 
 static void ui_term_backend_save(Ui *tui, bool fscr) {
+	bracketed_paste(false);
 	cursor_visible(true);
 }
 
 static void ui_term_backend_restore(Ui *tui) {
+	UiVt100 *vt = tui->ctx;
+	vt->valid = false;
 	cursor_visible(false);
+	bracketed_paste(true);
 }
 
 int ui_terminal_colors(void) {
@@ -179,13 +282,17 @@ int ui_terminal_colors(void) {
 static void ui_term_backend_suspend(Ui *tui) {
 	if (!tui->termkey) return;
 	termkey_stop(tui->termkey);
+	bracketed_paste(false);
 	cursor_visible(true);
 	screen_alternate(false);
 }
 
 void ui_terminal_resume(Ui *tui) {
+	UiVt100 *vt = tui->ctx;
+	vt->valid = false;
 	screen_alternate(true);
 	cursor_visible(false);
+	bracketed_paste(true);
 	termkey_start(tui->termkey);
 }
 
@@ -195,19 +302,20 @@ static bool ui_term_backend_init(Ui *tui, char *term) {
 }
 
 static bool ui_backend_init(Ui *ui) {
-	Buffer *buf = calloc(1, sizeof(Buffer));
-	if (!buf)
+	UiVt100 *vt = calloc(1, sizeof(UiVt100));
+	if (!vt)
 		return false;
-	buffer_init(buf);
-	ui->ctx = buf;
+	buffer_init(&vt->buf);
+	ui->ctx = vt;
 	return true;
 }
 
 static void ui_term_backend_free(Ui *tui) {
-	Buffer *buf = tui->ctx;
+	UiVt100 *vt = tui->ctx;
 	ui_term_backend_suspend(tui);
-	buffer_release(buf);
-	free(buf);
+	buffer_release(&vt->buf);
+	free(vt->cells);
+	free(vt);
 }
 
 static bool is_default_color(CellColor c) {
@@ -236,7 +236,6 @@ static void ui_window_draw(Win *win) {
 			} else {
 				size_t number = l->lineno;
 				if (rnu) {
-					number = (win->options & UI_OPTION_LARGE_FILE) ? 0 : l->lineno;
 					if (l->lineno > cursor_lineno)
 						number = l->lineno - cursor_lineno;
 					else if (l->lineno < cursor_lineno)
@@ -340,13 +339,19 @@ void ui_arrange(Ui *tui, enum UiLayout layout) {
 
 void ui_draw(Ui *tui) {
 	debug("ui-draw\n");
+	/* keys are being replayed, the main loop draws once they are done */
+	if (tui->vis->batch)
+		return;
 	ui_arrange(tui, tui->layout);
 	for (Win *win = tui->windows; win; win = win->next)
 		ui_window_draw(win);
 	if (tui->info[0])
 		ui_draw_string(tui, 0, tui->height-1, tui->info, NULL, UI_STYLE_INFO);
 	vis_event_emit(tui->vis, VIS_EVENT_UI_DRAW);
+	double start = vis_time();
 	ui_term_backend_blit(tui);
+	vis_stats_add(tui->vis, VIS_STAT_BLIT, 1, vis_time() - start);
+	tui->stats.frames++;
 }
 
 void ui_redraw(Ui *tui) {
@@ -364,6 +369,13 @@ void ui_resize(Ui *tui) {
 			width = ws.ws_col;
 		if (ws.ws_row > 0)
 			height = ws.ws_row;
+	} else {
+		/* not a terminal, as for benchmarks, use the size given by the environment */
+		const char *columns = getenv("COLUMNS"), *lines = getenv("LINES");
+		if (columns && atoi(columns) > 0)
+			width = atoi(columns);
+		if (lines && atoi(lines) > 0)
+			height = atoi(lines);
 	}
 
 	width  = MIN(width,  UI_MAX_WIDTH);
@@ -469,15 +481,14 @@ bool ui_window_init(Ui *tui, Win *w, enum UiOption options) {
 	styles[UI_STYLE_STATUS].attr |= CELL_ATTR_REVERSE;
 	styles[UI_STYLE_STATUS_FOCUSED].attr |= CELL_ATTR_REVERSE|CELL_ATTR_BOLD;
 	styles[UI_STYLE_INFO].attr |= CELL_ATTR_BOLD;
+	styles[UI_STYLE_SEARCH].attr |= CELL_ATTR_UNDERLINE;
 
 	if (tui->windows)
 		tui->windows->prev = w->prev;
 	tui->windows = w;
 
-	if (text_size(w->file->text) > UI_LARGE_FILE_SIZE) {
+	if (text_size(w->file->text) > UI_LARGE_FILE_SIZE)
 		options |= UI_OPTION_LARGE_FILE;
-		options &= ~UI_OPTION_LINE_NUMBERS_ABSOLUTE;
-	}
 
 	win_options_set(w, options);
 
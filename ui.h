@@ -48,6 +48,7 @@ enum UiStyle {
 	UI_STYLE_SEPARATOR,
 	UI_STYLE_INFO,
 	UI_STYLE_EOF,
+	UI_STYLE_SEARCH,
 	UI_STYLE_MAX,
 };
 
@@ -71,13 +72,13 @@ typedef struct {
 	char data[16];      /* utf8 encoded character displayed in this cell (might be more than
 	                       one Unicode codepoint. might also not be the same as in the
 	                       underlying text, for example tabs get expanded */
-	size_t len;         /* number of bytes the character displayed in this cell uses, for
+	uint32_t len;       /* number of bytes the character displayed in this cell uses, for
 	                       characters which use more than 1 column to display, their length
 	                       is stored in the leftmost cell whereas all following cells
 	                       occupied by the same character have a length of 0. */
-	int width;          /* display width i.e. number of columns occupied by this character */
+	uint8_t width;      /* display width i.e. number of columns occupied by this character */
 	CellStyle style;    /* colors and attributes used to display this cell */
-} Cell;
+} Cell;                 /* kept small, the grid is copied for every window on each redraw */
 
 struct Win;
 struct Vis;
@@ -96,6 +97,11 @@ typedef struct {
 	Cell *cells;              /* 2D grid of cells, at least as large as current terminal size */
 	bool doupdate;            /* Whether to update the screen after refreshing contents */
 	void *ctx;                /* Any additional data needed by the backend */
+	struct {
+		unsigned long frames; /* number of frames passed to the backend */
+		unsigned long cells;  /* number of changed cells submitted to the terminal */
+		unsigned long bytes;  /* output written for all frames, only counted by the vt100 backend */
+	} stats;
 } Ui;
 
 #include "view.h"
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 
 #define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
 #define MIN(a, b)  ((a) > (b) ? (b) : (a))
@@ -34,6 +37,25 @@ static void *memrchr(const void *m, int c, size_t n)
 }
 #endif
 
+/* write(2) all count bytes retrying on EINTR and EAGAIN, returns the number
+ * of bytes written or -1 on error */
+static inline ssize_t write_all(int fd, const char *buf, size_t count) {
+	size_t rem = count;
+	while (rem > 0) {
+		ssize_t written = write(fd, buf, rem > INT_MAX ? INT_MAX : rem);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		} else if (written == 0) {
+			break;
+		}
+		rem -= written;
+		buf += written;
+	}
+	return count - rem;
+}
+
 /* Needed for building on GNU Hurd */
 
 #ifndef PIPE_BUF
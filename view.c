@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <wchar.h>
 
 #include "vis-core.h"
@@ -47,6 +48,28 @@ static const char *symbols_default[] = {
 
 static Cell cell_blank = { .width = 0, .len = 0, .data = " ", };
 
+/* Lines longer than this many bytes get an index of checkpoints, placed
+ * every VIEW_LINE_CHECKPOINT bytes, which record the number of characters
+ * before them. Column computations then only scan from the nearest one. */
+#define VIEW_LINE_INDEX_SIZE (1 << 16)
+#define VIEW_LINE_CHECKPOINT (1 << 12)
+
+typedef struct {
+	size_t pos;   /* character boundary */
+	size_t chars; /* number of characters from the start of the line */
+} LineCheckpoint;
+
+/* Display widths of lines up to recently queried positions, used to move
+ * vertically. Additional entries are placed every VIEW_LINE_CHECKPOINT bytes
+ * of long lines. The cache is emptied once it holds VIEW_WIDTH_CACHE entries. */
+#define VIEW_WIDTH_CACHE (1 << 12)
+
+typedef struct {
+	size_t bol;   /* start of the line */
+	size_t pos;   /* character boundary within it */
+	int width;    /* display width of the line up to pos */
+} LineWidth;
+
 /* move visible viewport n-lines up/down, redraws the view but does not change
  * cursor position which becomes invalid and should be corrected by calling
  * view_cursors_to. the return value indicates whether the visible area changed.
@@ -54,16 +77,18 @@ static Cell cell_blank = { .width = 0, .len = 0, .data = " ", };
 static bool view_viewport_up(View *view, int n);
 static bool view_viewport_down(View *view, int n);
 
-static void view_clear(View *view);
+static size_t view_clear(View *view);
 static bool view_add_cell(View *view, const Cell *cell);
 static bool view_addch(View *view, Cell *cell);
 static void selection_free(Selection*);
 /* set/move current cursor position to a given (line, column) pair */
 static size_t cursor_set(Selection*, Line *line, int col);
+/* turn the resolved anchor and cursor marks of a selection into a range */
+static Filerange selection_range(Text*, size_t anchor, size_t cursor);
 
 void window_status_update(Vis *vis, Win *win) {
 	char left_parts[4][255] = { "", "", "", "" };
-	char right_parts[4][32] = { "", "", "", "" };
+	char right_parts[5][32] = { "", "", "", "", "" };
 	char left[sizeof(left_parts)+LENGTH(left_parts)*8];
 	char right[sizeof(right_parts)+LENGTH(right_parts)*8];
 	char status[sizeof(left)+sizeof(right)+1];
@@ -82,9 +107,19 @@ void window_status_update(Vis *vis, Win *win) {
 	if (focused && mode)
 		strcpy(left_parts[left_count++], mode);
 
-	snprintf(left_parts[left_count++], sizeof(left_parts[0]), "%s%s%s",
+	char saving[32] = "";
+	if (file->save.ctx)
+		snprintf(saving, sizeof saving, " [saving %d%%]", file_save_progress(file));
+	char filtering[32] = "";
+	if (file->background)
+		snprintf(filtering, sizeof filtering, " [filtering %d%%]", file_filter_progress(file));
+
+	snprintf(left_parts[left_count++], sizeof(left_parts[0]), "%s%s%s%s%s%s",
 	         filename ? filename : "[No Name]",
 	         text_modified(txt) ? " [+]" : "",
+	         file->loadfd != -1 ? " [loading]" : "",
+	         saving,
+	         filtering,
 	         vis_macro_recording(vis) ? " @": "");
 
 	int count = vis->action.count;
@@ -124,6 +159,11 @@ void window_status_update(Vis *vis, Win *win) {
 		         "%zu, %zu", line, col);
 	}
 
+	if (vis->show_stats) {
+		snprintf(right_parts[right_count++], sizeof(right_parts[0]),
+		         "%.1fms", vis->stats[VIS_STAT_FRAME].frame_time * 1e3);
+	}
+
 	int left_len = snprintf(left, sizeof(left), " %s%s%s%s%s%s%s",
 	         left_parts[0],
 	         left_parts[1][0] ? " » " : "",
@@ -133,14 +173,16 @@ void window_status_update(Vis *vis, Win *win) {
 	         left_parts[3][0] ? " » " : "",
 	         left_parts[3]);
 
-	int right_len = snprintf(right, sizeof(right), "%s%s%s%s%s%s%s ",
+	int right_len = snprintf(right, sizeof(right), "%s%s%s%s%s%s%s%s%s ",
 	         right_parts[0],
 	         right_parts[1][0] ? " « " : "",
 	         right_parts[1],
 	         right_parts[2][0] ? " « " : "",
 	         right_parts[2],
 	         right_parts[3][0] ? " « " : "",
-	         right_parts[3]);
+	         right_parts[3],
+	         right_parts[4][0] ? " « " : "",
+	         right_parts[4]);
 
 	if (left_len < 0 || right_len < 0)
 		return;
@@ -162,9 +204,22 @@ void view_tabwidth_set(View *view, int tabwidth) {
 	view_draw(view);
 }
 
-/* reset internal view data structures (cell matrix, line offsets etc.) */
-static void view_clear(View *view) {
-	memset(view->lines, 0, view->lines_size);
+/* find the lowest position which might affect the layout of the previous draw */
+static size_t view_layout_changed(View *view) {
+	if (!view->layout.valid || view->layout.start != view->start ||
+	    view->layout.width != view->width || view->layout.height != view->height ||
+	    view->layout.tabwidth != view->tabwidth || view->layout.wrapcolumn != view->wrapcolumn ||
+	    memcmp(view->layout.symbols, view->symbols, sizeof(view->symbols)))
+		return 0;
+	return text_changed_since(view->text, view->layout.generation);
+}
+
+/* reset internal view data structures (cell matrix, line offsets etc.).
+ * Lines are only laid out anew from the start of the logical line in which
+ * the text was modified since the previous draw, for the preceding ones only
+ * the styles are reset. Returns the position from which the layout needs to
+ * be redone, EPOS if the previous one is still valid. */
+static size_t view_clear(View *view) {
 	if (view->start != view->start_last) {
 		if (view->start == 0)
 			view->start_mark = EMARK;
@@ -181,31 +236,73 @@ static void view_clear(View *view) {
 	}
 
 	view->start_last = view->start;
-	view->topline = view->lines;
-	view->topline->lineno = view->large_file ? 1 : text_lineno_by_pos(view->text, view->start);
-	view->lastline = view->topline;
+
+	/* FIXME: awful garbage that only exists because every
+	 * struct in this program is an interdependent hellscape */
+	Win *win = (Win *)((char *)view - offsetof(Win, view));
+	ui_window_style_set(win, &cell_blank, UI_STYLE_DEFAULT);
+
+	Line *line = view->lines;
+	size_t lineno = 0, pos = view->start, changed = view_layout_changed(view);
+	if (changed == EPOS) {
+		line = NULL;
+		pos = EPOS;
+	} else if (changed > view->start) {
+		/* a logical line is not affected by anything following its newline,
+		 * except for combining characters right after it. Whether the first
+		 * character of the next line is one depends on its first 4 bytes. */
+		size_t cur = view->start;
+		for (Line *l = view->topline; l != view->lastline; l = l->next) {
+			cur += l->len;
+			if (cur >= changed || changed - cur < 4)
+				break;
+			if (l->next->lineno != l->lineno) {
+				line = l->next;
+				lineno = line->lineno;
+				pos = cur;
+			}
+		}
+	}
+
+	for (Line *l = view->topline; line != view->lines && l != line; l = l->next) {
+		for (int x = 0; x < view->width; x++)
+			l->cells[x].style = cell_blank.style;
+	}
+
+	if (!line)
+		return pos;
 
 	size_t line_size = sizeof(Line) + view->width*sizeof(Cell);
 	size_t end = view->height * line_size;
+	memset(line, 0, end - ((char*)line - (char*)view->lines));
 	Line *prev = NULL;
 	for (size_t i = 0; i < end; i += line_size) {
-		Line *line = (Line*)(((char*)view->lines) + i);
-		line->prev = prev;
+		Line *l = (Line*)(((char*)view->lines) + i);
+		l->prev = prev;
 		if (prev)
-			prev->next = line;
-		prev = line;
+			prev->next = l;
+		prev = l;
 	}
+	view->topline = view->lines;
 	view->bottomline = prev ? prev : view->topline;
 	view->bottomline->next = NULL;
-	view->line = view->topline;
+	if (line == view->topline)
+		lineno = text_lineno_by_pos(view->text, view->start);
+	line->lineno = lineno;
+	view->lastline = line;
+	view->line = line;
 	view->col = 0;
 	view->wrapcol = 0;
 	view->prevch_breakat = false;
 
-	/* FIXME: awful garbage that only exists because every
-	 * struct in this program is an interdependent hellscape */
-	Win *win = (Win *)((char *)view - offsetof(Win, view));
-	ui_window_style_set(win, &cell_blank, UI_STYLE_DEFAULT);
+	view->layout.valid = true;
+	view->layout.start = view->start;
+	view->layout.width = view->width;
+	view->layout.height = view->height;
+	view->layout.tabwidth = view->tabwidth;
+	view->layout.wrapcolumn = view->wrapcolumn;
+	memcpy(view->layout.symbols, view->symbols, sizeof(view->symbols));
+	return pos;
 }
 
 static int view_max_text_width(const View *view) {
@@ -266,6 +363,7 @@ static bool view_add_cell(View *view, const Cell *cell) {
 }
 
 static bool view_expand_tab(View *view, Cell *cell) {
+	size_t len = cell->len;
 	cell->width = 1;
 
 	int displayed_width = view->tabwidth - (view->col % view->tabwidth);
@@ -273,13 +371,13 @@ static bool view_expand_tab(View *view, Cell *cell) {
 		int t = (w == 0) ? SYNTAX_SYMBOL_TAB : SYNTAX_SYMBOL_TAB_FILL;
 		const char *symbol = view->symbols[t];
 		strncpy(cell->data, symbol, sizeof(cell->data) - 1);
-		cell->len = (w == 0) ? 1 : 0;
+		cell->len = (w == 0) ? len : 0;
 
 		if (!view_add_cell(view, cell))
 			return false;
 	}
 
-	cell->len = 1;
+	cell->len = len;
 	return true;
 }
 
@@ -328,7 +426,7 @@ static bool view_addch(View *view, Cell *cell) {
 		/* non-printable ascii char, represent it as ^(char + 64) */
 		*cell = (Cell) {
 			.data = { '^', ch == 127 ? '?' : ch + 64, '\0' },
-			.len = 1,
+			.len = cell->len,
 			.width = 2,
 			.style = cell->style,
 		};
@@ -336,6 +434,48 @@ static bool view_addch(View *view, Cell *cell) {
 	return view_add_cell(view, cell);
 }
 
+/* length of the run of printable ASCII characters (including space) at the
+ * start of s, stopping at the first tab, newline, control or non-ASCII byte */
+static size_t ascii_run(const char *s, size_t len) {
+	size_t i = 0;
+	while (i < len && (unsigned char)(s[i] - ' ') < 0x5f)
+		i++;
+	return i;
+}
+
+/* add a run of printable ASCII characters to the current line without
+ * going through multibyte decoding. equivalent to calling view_addch for
+ * each of them, except that it stops instead of wrapping the line.
+ * returns the number of characters added. */
+static size_t view_add_ascii(View *view, const char *s, size_t len) {
+	Line *line = view->line;
+	if (!line)
+		return 0;
+	int col = view->col, max = view_max_text_width(view);
+	if (len > (size_t)(max - col))
+		len = max > col ? max - col : 0;
+	const char *breakat = view->breakat[0] ? view->breakat : NULL;
+	Cell ch = { .len = 1, .width = 1, .style = cell_blank.style };
+	Cell space = ch;
+	strncpy(space.data, view->symbols[SYNTAX_SYMBOL_SPACE], sizeof(space.data) - 1);
+	for (size_t i = 0; i < len; i++) {
+		bool ch_breakat = breakat && strchr(breakat, s[i]);
+		if (view->prevch_breakat && !ch_breakat)
+			view->wrapcol = col;
+		view->prevch_breakat = ch_breakat;
+		if (s[i] == ' ') {
+			line->cells[col++] = space;
+		} else {
+			ch.data[0] = s[i];
+			line->cells[col++] = ch;
+		}
+	}
+	line->width += len;
+	line->len += len;
+	view->col = col;
+	return len;
+}
+
 static void cursor_to(Selection *s, size_t pos) {
 	Text *txt = s->view->text;
 	s->cursor = text_mark_set(txt, pos);
@@ -394,20 +534,17 @@ bool view_coord_get(View *view, size_t pos, Line **retline, int *retrow, int *re
 	return true;
 }
 
-/* redraw the complete with data starting from view->start bytes into the file.
+/* lay out the text starting from pos at the current drawing position.
  * stop once the screen is full, update view->end, view->lastline */
-void view_draw(View *view) {
-	view_clear(view);
+static void view_layout(View *view, size_t pos) {
 	/* read a screenful of text considering each character as 4-byte UTF character*/
 	const size_t size = view->width * view->height * 4;
 	/* current buffer to work with */
 	char *text = view->textbuf;
 	/* remaining bytes to process in buffer */
-	size_t rem = text_bytes_get(view->text, view->start, size, text);
+	size_t rem = text_bytes_get(view->text, pos, size, text);
 	/* NUL terminate text section */
 	text[rem] = '\0';
-	/* absolute position of character currently being added to display */
-	size_t pos = view->start;
 	/* current position into buffer from which to interpret a character */
 	char *cur = text;
 	/* start from known multibyte state */
@@ -417,6 +554,28 @@ void view_draw(View *view) {
 
 	while (rem > 0) {
 
+		/* printable ASCII text is copied into cells directly. a run
+		 * excludes its last byte if it is followed by a (potentially
+		 * combining) non-ASCII character or the end of the buffer */
+		size_t run = ascii_run(cur, rem);
+		if (run > 0 && (run == rem || (cur[run] & 0x80)))
+			run--;
+		if (run > 0) {
+			if (prev_cell.len) {
+				if (!view_addch(view, &prev_cell))
+					break;
+				pos += prev_cell.len;
+				prev_cell = (Cell){ .data = "", .len = 0, .width = 0 };
+			}
+			size_t added = view_add_ascii(view, cur, run);
+			if (added) {
+				pos += added;
+				rem -= added;
+				cur += added;
+				continue;
+			}
+		}
+
 		/* current 'parsed' character' */
 		wchar_t wchar;
 
@@ -447,9 +606,8 @@ void view_draw(View *view) {
 				cell.data[i] = cur[i];
 			cell.data[len] = '\0';
 			cell.len = len;
-			cell.width = wcwidth(wchar);
-			if (cell.width == -1)
-				cell.width = 1;
+			int width = wcwidth(wchar);
+			cell.width = width == -1 ? 1 : width;
 		}
 
 		if (cell.width == 0) {
@@ -488,6 +646,17 @@ void view_draw(View *view) {
 		for (int x = view->col; x < view->width; x++)
 			view->line->cells[x] = cell_blank;
 	}
+	view->layout.generation = text_generation(view->text);
+}
+
+/* redraw the view with data starting from view->start bytes into the file,
+ * only the lines affected by changes since the previous draw are laid out */
+void view_draw(View *view) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t pos = view_clear(view);
+	if (pos != EPOS)
+		view_layout(view, pos);
 
 	/* resync position of cursors within visible area */
 	for (Selection *s = view->selections; s; s = s->next) {
@@ -501,6 +670,9 @@ void view_draw(View *view) {
 	}
 
 	view->need_update = true;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	view->stats.time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	view->stats.count++;
 }
 
 bool view_update(View *view) {
@@ -541,6 +713,7 @@ bool view_resize(View *view, int width, int height) {
 	view->width = width;
 	view->height = height;
 	memset(view->lines, 0, view->lines_size);
+	view->layout.valid = false;
 	view_draw(view);
 	return true;
 }
@@ -553,10 +726,15 @@ void view_free(View *view) {
 	free(view->textbuf);
 	free(view->lines);
 	free(view->breakat);
+	array_release(&view->line_index.checkpoints);
+	array_release(&view->widths.entries);
 }
 
 void view_reload(View *view, Text *text) {
 	view->text = text;
+	view->layout.valid = false;
+	view->line_index.begin = EPOS;
+	array_clear(&view->widths.entries);
 	view_selections_clear_all(view);
 	view_cursors_to(view->selection, 0);
 }
@@ -570,6 +748,9 @@ bool view_init(Win *win, Text *text) {
 	view->tabwidth = 8;
 	view->breakat = strdup("");
 	view->wrapcolumn = 0;
+	view->line_index.begin = EPOS;
+	array_init_sized(&view->line_index.checkpoints, sizeof(LineCheckpoint));
+	array_init_sized(&view->widths.entries, sizeof(LineWidth));
 	win_options_set(win, 0);
 
 	if (!view->breakat ||
@@ -781,7 +962,8 @@ size_t view_line_up(Selection *sel) {
 	int lastcol = sel->lastcol;
 	if (!lastcol)
 		lastcol = sel->col;
-	size_t pos = text_line_up(sel->view->text, sel->pos);
+	int width = view_line_width_get(view, sel->pos);
+	size_t pos = view_line_width_set(view, text_line_prev(view->text, sel->pos), width);
 	bool offscreen = view->selection == sel && pos < view->start;
 	view_cursors_to(sel, pos);
 	if (offscreen)
@@ -797,7 +979,12 @@ size_t view_line_down(Selection *sel) {
 	int lastcol = sel->lastcol;
 	if (!lastcol)
 		lastcol = sel->col;
-	size_t pos = text_line_down(sel->view->text, sel->pos);
+	int width = view_line_width_get(view, sel->pos);
+	size_t pos = text_line_next(view->text, sel->pos);
+	if (pos == text_size(view->text))
+		pos = sel->pos;
+	else
+		pos = view_line_width_set(view, pos, width);
 	bool offscreen = view->selection == sel && pos > view->end;
 	view_cursors_to(sel, pos);
 	if (offscreen)
@@ -877,11 +1064,6 @@ void win_options_set(Win *win, enum UiOption options) {
 			symbols_none[i];
 	}
 
-	if (options & UI_OPTION_LINE_NUMBERS_ABSOLUTE)
-		options &= ~UI_OPTION_LARGE_FILE;
-
-	win->view.large_file = (options & UI_OPTION_LARGE_FILE);
-
 	ui_window_options_set(win, options);
 }
 
@@ -891,6 +1073,7 @@ bool view_breakat_set(View *view, const char *breakat) {
 		return false;
 	free(view->breakat);
 	view->breakat = copy;
+	view->layout.valid = false;
 	return true;
 }
 
@@ -902,12 +1085,14 @@ size_t view_screenline_goto(View *view, int n) {
 }
 
 static Selection *selections_new(View *view, size_t pos, bool force) {
+	static unsigned long selection_id;
 	if (pos > text_size(view->text))
 		return NULL;
 	Selection *s = calloc(1, sizeof(*s));
 	if (!s)
 		return NULL;
 	s->view = view;
+	s->id = ++selection_id;
 	s->generation = view->selection_generation;
 	if (!view->selections) {
 		view->selection = s;
@@ -942,19 +1127,20 @@ static Selection *selections_new(View *view, size_t pos, bool force) {
 	if (pos == cur && !force)
 		goto err;
 
-	for (Selection *after = next; after; after = after->next)
-		after->number++;
-
 	s->prev = prev;
 	s->next = next;
 	if (next)
 		next->prev = s;
-	if (prev) {
+	if (prev)
 		prev->next = s;
-		s->number = prev->number + 1;
-	} else {
+	else
 		view->selections = s;
-	}
+	/* appending keeps the numbering valid, which is the common case when
+	 * many selections are created in order, e.g. by sam's x command */
+	if (next)
+		view->selection_renumber = true;
+	else if (prev)
+		s->number = prev->number + 1;
 	view->selection_latest = s;
 	view->selection_count++;
 	view_selections_dispose(view->selection_dead);
@@ -974,6 +1160,14 @@ Selection *view_selections_new_force(View *view, size_t pos) {
 }
 
 int view_selections_number(Selection *sel) {
+	View *view = sel->view;
+	if (view->selection_renumber) {
+		/* numbering all selections at once keeps insertion and removal O(1) */
+		int number = 0;
+		for (Selection *s = view->selections; s; s = s->next)
+			s->number = number++;
+		view->selection_renumber = false;
+	}
 	return sel->number;
 }
 
@@ -1033,8 +1227,8 @@ Selection *view_selections_column_next(Selection *sel, int column) {
 static void selection_free(Selection *s) {
 	if (!s)
 		return;
-	for (Selection *after = s->next; after; after = after->next)
-		after->number--;
+	if (s->next)
+		s->view->selection_renumber = true;
 	if (s->prev)
 		s->prev->next = s->next;
 	if (s->next)
@@ -1057,8 +1251,12 @@ bool view_selections_dispose(Selection *sel) {
 	View *view = sel->view;
 	if (!view->selections || !view->selections->next)
 		return false;
+	bool primary = view->selection == sel;
 	selection_free(sel);
-	view_selections_primary_set(view->selection);
+	/* otherwise the primary selection is unaffected, avoid updating it
+	 * for each of the many selections removed by a normalization */
+	if (primary)
+		view_selections_primary_set(view->selection);
 	return true;
 }
 
@@ -1127,9 +1325,241 @@ size_t view_cursors_line(Selection *s) {
 	return text_lineno_by_pos(s->view->text, pos);
 }
 
+/* start indexing the line beginning at bol */
+static void line_index_reset(View *view, size_t bol) {
+	view->line_index.generation = text_generation(view->text);
+	view->line_index.begin = view->line_index.end = bol;
+	view->line_index.chars = 0;
+	view->line_index.complete = false;
+	array_clear(&view->line_index.checkpoints);
+}
+
+/* drop the part of the index affected by modifications */
+static void line_index_update(View *view) {
+	if (view->line_index.begin == EPOS)
+		return;
+	size_t changed = text_changed_since(view->text, view->line_index.generation);
+	if (changed == EPOS)
+		return;
+	if (changed <= view->line_index.begin) {
+		view->line_index.begin = EPOS;
+		return;
+	}
+	/* a character boundary depends on the bytes following it */
+	Array *checkpoints = &view->line_index.checkpoints;
+	size_t count = array_length(checkpoints);
+	while (count > 0) {
+		LineCheckpoint *cp = array_get(checkpoints, count-1);
+		if (cp->pos + MB_LEN_MAX < changed)
+			break;
+		count--;
+	}
+	array_truncate(checkpoints, count);
+	LineCheckpoint *last = array_peek(checkpoints);
+	view->line_index.generation = text_generation(view->text);
+	if (view->line_index.end + MB_LEN_MAX >= changed) {
+		view->line_index.end = last ? last->pos : view->line_index.begin;
+		view->line_index.chars = last ? last->chars : 0;
+		view->line_index.complete = false;
+	}
+}
+
+/* scan the indexed line until reaching pos or the given number of characters */
+static void line_index_extend(View *view, size_t pos, size_t chars) {
+	if (view->line_index.complete)
+		return;
+	char c;
+	Text *txt = view->text;
+	Array *checkpoints = &view->line_index.checkpoints;
+	LineCheckpoint *last = array_peek(checkpoints);
+	LineCheckpoint cp = { .pos = view->line_index.end, .chars = view->line_index.chars };
+	size_t prev = last ? last->pos : view->line_index.begin;
+	Iterator it = text_iterator_get(txt, cp.pos);
+	if (!text_iterator_byte_get(&it, &c) || c == '\n') {
+		view->line_index.complete = true;
+		return;
+	}
+	while (it.pos < pos && cp.chars < chars) {
+		if (!text_iterator_char_next(&it, &c)) {
+			view->line_index.complete = true;
+			break;
+		}
+		cp.pos = it.pos;
+		cp.chars++;
+		if (cp.pos - prev >= VIEW_LINE_CHECKPOINT) {
+			if (!array_add(checkpoints, &cp))
+				break;
+			prev = cp.pos;
+		}
+		if (c == '\n') {
+			view->line_index.complete = true;
+			break;
+		}
+	}
+	view->line_index.end = cp.pos;
+	view->line_index.chars = cp.chars;
+}
+
+/* find the checkpoint preceding the given position, respectively number of characters */
+static LineCheckpoint line_index_find(View *view, size_t pos, size_t chars) {
+	LineCheckpoint cp = { .pos = view->line_index.begin, .chars = 0 };
+	if (view->line_index.end <= pos && view->line_index.chars <= chars)
+		return (LineCheckpoint){ .pos = view->line_index.end, .chars = view->line_index.chars };
+	Array *checkpoints = &view->line_index.checkpoints;
+	size_t lo = 0, hi = array_length(checkpoints);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		LineCheckpoint *c = array_get(checkpoints, mid);
+		if (c->pos <= pos && c->chars <= chars) {
+			cp = *c;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return cp;
+}
+
+/* like text_line_char_get, but using the index for long lines */
+static size_t line_index_char_get(View *view, size_t pos) {
+	Text *txt = view->text;
+	line_index_update(view);
+	size_t bol = view->line_index.begin;
+	if (bol == EPOS || pos < bol || (view->line_index.complete && pos > view->line_index.end)) {
+		bol = text_line_begin(txt, pos);
+		if (pos - bol < VIEW_LINE_INDEX_SIZE)
+			return text_line_char_get(txt, pos);
+		line_index_reset(view, bol);
+	}
+	line_index_extend(view, pos, SIZE_MAX);
+	if (pos > view->line_index.end) {
+		/* pos is located on a subsequent line */
+		bol = text_line_begin(txt, pos);
+		if (pos - bol < VIEW_LINE_INDEX_SIZE)
+			return text_line_char_get(txt, pos);
+		line_index_reset(view, bol);
+		line_index_extend(view, pos, SIZE_MAX);
+	}
+	LineCheckpoint cp = line_index_find(view, pos, SIZE_MAX);
+	char c = '\0';
+	Iterator it = text_iterator_get(txt, cp.pos);
+	text_iterator_byte_get(&it, &c);
+	while (it.pos < pos && c != '\n' && text_iterator_char_next(&it, &c))
+		cp.chars++;
+	return cp.chars;
+}
+
+/* like text_line_char_set, but using the index for long lines */
+static size_t line_index_char_set(View *view, size_t bol, size_t count) {
+	Text *txt = view->text;
+	line_index_update(view);
+	if (view->line_index.begin != bol) {
+		if (count < VIEW_LINE_INDEX_SIZE)
+			return text_line_char_set(txt, bol, count);
+		line_index_reset(view, bol);
+	}
+	line_index_extend(view, SIZE_MAX, count);
+	LineCheckpoint cp = line_index_find(view, SIZE_MAX, count);
+	char c;
+	Iterator it = text_iterator_get(txt, cp.pos);
+	if (!text_iterator_byte_get(&it, &c) || c == '\n')
+		return it.pos;
+	while (cp.chars++ < count && text_iterator_char_next(&it, &c) && c != '\n');
+	return it.pos;
+}
+
+/* drop the cached widths affected by modifications */
+static void widths_update(View *view) {
+	Array *entries = &view->widths.entries;
+	size_t changed = text_changed_since(view->text, view->widths.generation);
+	view->widths.generation = text_generation(view->text);
+	if (changed == EPOS)
+		return;
+	/* a character boundary depends on the bytes following it */
+	size_t lo = 0, hi = array_length(entries);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		LineWidth *w = array_get(entries, mid);
+		if (w->pos + MB_LEN_MAX < changed)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	array_truncate(entries, lo);
+}
+
+/* index of the first entry which is not on an earlier line or before pos and below width */
+static size_t widths_search(View *view, size_t bol, size_t pos, int width) {
+	Array *entries = &view->widths.entries;
+	size_t lo = 0, hi = array_length(entries);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		LineWidth *w = array_get(entries, mid);
+		if (w->bol < bol || (w->bol == bol && w->pos <= pos && w->width < width))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void widths_add(View *view, size_t bol, size_t pos, int width) {
+	Array *entries = &view->widths.entries;
+	if (pos == bol)
+		return;
+	size_t idx = widths_search(view, bol, pos - 1, INT_MAX);
+	LineWidth *next = array_get(entries, idx);
+	if (next && next->pos == pos)
+		return;
+	if (array_length(entries) >= VIEW_WIDTH_CACHE) {
+		array_clear(entries);
+		idx = 0;
+	}
+	LineWidth w = { .bol = bol, .pos = pos, .width = width };
+	if (!array_add(entries, &w))
+		return;
+	size_t len = array_length(entries);
+	if (idx + 1 < len) {
+		LineWidth *first = array_get(entries, idx);
+		memmove(first + 1, first, (len - idx - 1) * sizeof *first);
+		*first = w;
+	}
+}
+
+/* scan the line starting at bol until reaching pos or the character displayed at width */
+static size_t widths_scan(View *view, size_t bol, size_t pos, int width, int *result) {
+	Text *txt = view->text;
+	widths_update(view);
+	size_t idx = widths_search(view, bol, pos, width);
+	LineWidth *w = idx > 0 ? array_get(&view->widths.entries, idx - 1) : NULL;
+	LineWidth cp = { .bol = bol, .pos = bol, .width = 0 };
+	if (w && w->bol == bol)
+		cp = *w;
+	for (;;) {
+		size_t end = pos - cp.pos > VIEW_LINE_CHECKPOINT ? cp.pos + VIEW_LINE_CHECKPOINT : pos;
+		text_line_width_scan(txt, &cp.pos, &cp.width, end, width);
+		widths_add(view, bol, cp.pos, cp.width);
+		if (cp.pos < end || end == pos)
+			break;
+	}
+	if (result)
+		*result = cp.width;
+	return cp.pos;
+}
+
+int view_line_width_get(View *view, size_t pos) {
+	int width;
+	widths_scan(view, text_line_begin(view->text, pos), pos, INT_MAX, &width);
+	return width;
+}
+
+size_t view_line_width_set(View *view, size_t pos, int width) {
+	return widths_scan(view, text_line_begin(view->text, pos), SIZE_MAX, width, NULL);
+}
+
 size_t view_cursors_col(Selection *s) {
 	size_t pos = view_cursors_pos(s);
-	return text_line_char_get(s->view->text, pos) + 1;
+	return line_index_char_get(s->view, pos) + 1;
 }
 
 int view_cursors_cell_set(Selection *s, int cell) {
@@ -1188,7 +1618,7 @@ void view_cursors_to(Selection *s, size_t pos) {
 void view_cursors_place(Selection *s, size_t line, size_t col) {
 	Text *txt = s->view->text;
 	size_t pos = text_pos_by_lineno(txt, line);
-	pos = text_line_char_set(txt, pos, col > 0 ? col-1 : col);
+	pos = line_index_char_set(s->view, pos, col > 0 ? col-1 : col);
 	view_cursors_to(s, pos);
 }
 
@@ -1223,16 +1653,20 @@ void view_selections_dispose_all(View *view) {
 	view_draw(view);
 }
 
+static Filerange selection_range(Text *txt, size_t anchor, size_t cursor) {
+	Filerange sel = text_range_new(anchor, cursor);
+	if (text_range_valid(&sel))
+		sel.end = text_char_next(txt, sel.end);
+	return sel;
+}
+
 Filerange view_selections_get(Selection *s) {
 	if (!s)
 		return text_range_empty();
 	Text *txt = s->view->text;
 	size_t anchor = text_mark_get(txt, s->anchor);
 	size_t cursor = text_mark_get(txt, s->cursor);
-	Filerange sel = text_range_new(anchor, cursor);
-	if (text_range_valid(&sel))
-		sel.end = text_char_next(txt, sel.end);
-	return sel;
+	return selection_range(txt, anchor, cursor);
 }
 
 bool view_selections_set(Selection *s, const Filerange *r) {
@@ -1255,10 +1689,25 @@ Filerange view_regions_restore(View *view, SelectionRegion *s) {
 	Text *txt = view->text;
 	size_t anchor = text_mark_get(txt, s->anchor);
 	size_t cursor = text_mark_get(txt, s->cursor);
-	Filerange sel = text_range_new(anchor, cursor);
-	if (text_range_valid(&sel))
-		sel.end = text_char_next(txt, sel.end);
-	return sel;
+	return selection_range(txt, anchor, cursor);
+}
+
+void view_regions_restore_all(View *view, const Array *regions, Array *ranges) {
+	Mark marks[128];
+	size_t pos[LENGTH(marks)];
+	for (size_t i = 0, len = array_length(regions); i < len; ) {
+		size_t count = 0;
+		for (SelectionRegion *s; count < (size_t)LENGTH(marks) && (s = array_get(regions, i)); i++) {
+			marks[count++] = s->anchor;
+			marks[count++] = s->cursor;
+		}
+		text_mark_get_all(view->text, marks, pos, count);
+		for (size_t j = 0; j < count; j += 2) {
+			Filerange r = selection_range(view->text, pos[j], pos[j+1]);
+			if (text_range_valid(&r))
+				array_add(ranges, &r);
+		}
+	}
 }
 
 bool view_regions_save(View *view, Filerange *r, SelectionRegion *s) {
@@ -1305,10 +1754,20 @@ Array view_selections_get_all(View *view) {
 	array_init_sized(&arr, sizeof(Filerange));
 	if (!array_reserve(&arr, view->selection_count))
 		return arr;
-	for (Selection *s = view->selections; s; s = s->next) {
-		Filerange r = view_selections_get(s);
-		if (text_range_valid(&r))
-			array_add(&arr, &r);
+	Mark marks[128];
+	size_t pos[LENGTH(marks)];
+	for (Selection *s = view->selections; s; ) {
+		size_t count = 0;
+		for (; s && count < (size_t)LENGTH(marks); s = s->next) {
+			marks[count++] = s->anchor;
+			marks[count++] = s->cursor;
+		}
+		text_mark_get_all(view->text, marks, pos, count);
+		for (size_t i = 0; i < count; i += 2) {
+			Filerange r = selection_range(view->text, pos[i], pos[i+1]);
+			if (text_range_valid(&r))
+				array_add(&arr, &r);
+		}
 	}
 	return arr;
 }
@@ -1370,3 +1829,52 @@ void win_style(Win *win, enum UiStyle style, size_t start, size_t end) {
 		col = 0;
 	} while (pos <= end && (line = line->next));
 }
+
+/* same as calling win_style for each range, but continues from the cell
+ * reached by the previous range instead of starting at the top */
+void win_style_ranges(Win *win, const StyleRange *ranges, size_t count) {
+	View *view = &win->view;
+	int col = 0, width = view->width;
+	size_t pos = view->start, line_pos = view->start;
+	Line *line = view->topline;
+
+	for (const StyleRange *r = ranges; line && r < ranges + count; r++) {
+		if (r->end < view->start)
+			continue;
+		if (r->start > view->end)
+			break;
+
+		/* skip lines before range to be styled */
+		while (line && line_pos + line->len <= r->start) {
+			line_pos += line->len;
+			line = line->next;
+			pos = line_pos;
+			col = 0;
+		}
+
+		if (!line)
+			break;
+
+		/* skip columns before range to be styled */
+		while (pos < r->start && col < width)
+			pos += line->cells[col++].len;
+
+		/* skip empty columns */
+		while (col < width && !line->cells[col].len)
+			col++;
+
+		while (pos <= r->end) {
+			while (pos <= r->end && col < width) {
+				pos += line->cells[col].len;
+				ui_window_style_set(win, &line->cells[col++], r->style);
+			}
+			if (pos > r->end)
+				break;
+			line_pos += line->len;
+			line = line->next;
+			col = 0;
+			if (!line)
+				break;
+		}
+	}
+}
@@ -41,7 +41,8 @@ typedef struct Selection {
 	int lastcol;            /* remembered column used when moving across lines */
 	Line *line;             /* screen line on which cursor currently resides */
 	int generation;         /* used to filter out newly created cursors during iteration */
-	int number;             /* how many cursors are located before this one */
+	int number;             /* how many cursors are located before this one, see view_selections_number */
+	unsigned long id;       /* unique among all selections ever created */
 	struct View *view;      /* associated view to which this cursor belongs */
 	struct Selection *prev, *next; /* previous/next cursors ordered by location at creation time */
 } Selection;
@@ -68,13 +69,36 @@ typedef struct View {
 	int tabwidth;       /* how many spaces should be used to display a tab character */
 	Selection *selections;    /* all cursors currently active */
 	int selection_generation; /* used to filter out newly created cursors during iteration */
+	bool selection_renumber;  /* whether Selection.number is outdated, recomputed on demand */
 	bool need_update;   /* whether view has been redrawn */
-	bool large_file;    /* optimize for displaying large files */
 	int colorcolumn;
 	char *breakat;  /* characters which might cause a word wrap */
 	int wrapcolumn; /* wrap lines at minimum of window width and wrapcolumn (if != 0) */
 	int wrapcol;    /* used while drawing view content, column where word wrap might happen */
 	bool prevch_breakat; /* used while drawing view content, previous char is part of breakat */
+	struct {
+		bool valid;          /* whether the lines reflect the parameters below */
+		size_t start;        /* start of visible area */
+		size_t generation;   /* text generation, see text_changed_since */
+		int width, height, tabwidth, wrapcolumn;
+		const char *symbols[SYNTAX_SYMBOL_LAST];
+	} layout;           /* parameters of the previous draw, used to only redo the affected lines */
+	struct {
+		size_t generation;  /* text generation for which the index is valid */
+		size_t begin;       /* start of the indexed line, EPOS if there is none */
+		size_t end;         /* position up to which the line has been scanned */
+		size_t chars;       /* number of characters before end */
+		bool complete;      /* whether end is the end of the line */
+		Array checkpoints;  /* LineCheckpoint, ordered by position */
+	} line_index;       /* character positions within a long line, see view_cursors_col */
+	struct {
+		size_t generation;  /* text generation for which the entries are valid */
+		Array entries;      /* LineWidth, ordered by position */
+	} widths;           /* display widths of lines, see view_line_width_get */
+	struct {
+		unsigned long count;
+		double time;
+	} stats;            /* calls of and seconds spent in view_draw, collected every frame */
 } View;
 
 /**
@@ -260,6 +284,16 @@ size_t view_cursors_line(Selection*);
  * @endrst
  */
 size_t view_cursors_col(Selection*);
+/**
+ * Get display width of the line up to `pos`.
+ * @rst
+ * .. note:: Equivalent to ``text_line_width_get`` but remembers the results
+ *           of previous queries until the text is modified.
+ * @endrst
+ */
+int view_line_width_get(View*, size_t pos);
+/** Get position of the character displayed at `width` on the line containing `pos`. */
+size_t view_line_width_set(View*, size_t pos, int width);
 /**
  * @}
  * @defgroup view_place
@@ -332,6 +366,8 @@ size_t view_cursor_get(View*);
  * @{
  */
 Filerange view_regions_restore(View*, SelectionRegion*);
+/** Append the valid ``Filerange`` of each ``SelectionRegion`` in ``regions`` to ``ranges``. */
+void view_regions_restore_all(View*, const Array *regions, Array *ranges);
 bool view_regions_save(View*, Filerange*, SelectionRegion*);
 /**
  * @}
@@ -346,6 +382,17 @@ void view_tabwidth_set(View*, int tabwidth);
 /** Apply a style to a text range. */
 void win_style(struct Win*, enum UiStyle, size_t start, size_t end);
 
+typedef struct {
+	size_t start, end;   /* text range, including end */
+	enum UiStyle style;
+} StyleRange;
+
+/**
+ * Apply styles to several text ranges with one pass over the displayed cells.
+ * The ranges must be sorted by position and must not overlap.
+ */
+void win_style_ranges(struct Win*, const StyleRange*, size_t count);
+
 /** @} */
 
 #endif
@@ -122,6 +122,9 @@ bool vis_option_unregister(Vis *vis, const char *name) {
 
 static bool cmd_user(Vis *vis, Win *win, Command *cmd, const char *argv[], Selection *sel, Filerange *range) {
 	CmdUser *user = map_get(vis->usercmds, argv[0]);
+	/* the handler might change the text the match registers refer to */
+	for (enum VisRegister id = VIS_REG_AMPERSAND; id <= VIS_REG_9; id++)
+		register_load(&vis->registers[id]);
 	return user && user->func(vis, win, user->data, cmd->flags == '!', argv, sel, range);
 }
 
@@ -359,6 +362,10 @@ static bool cmd_set(Vis *vis, Win *win, Command *cmd, const char *argv[], Select
 	case OPTION_IGNORECASE:
 		vis->ignorecase = toggle ? !vis->ignorecase : arg.b;
 		break;
+	case OPTION_HLSEARCH:
+		vis->search_highlight = toggle ? !vis->search_highlight : arg.b;
+		vis_draw(vis);
+		break;
 	case OPTION_BREAKAT:
 		if (!view_breakat_set(&win->view, arg.s)) {
 			vis_info_show(vis, "Failed to set breakat");
@@ -369,6 +376,38 @@ static bool cmd_set(Vis *vis, Win *win, Command *cmd, const char *argv[], Select
 		if (arg.i >= 0)
 			win->view.wrapcolumn = arg.i;
 		break;
+	case OPTION_SAM_PROFILE:
+		vis->sam_profile = toggle ? !vis->sam_profile : arg.b;
+		break;
+	case OPTION_FILTER_JOBS:
+		if (arg.i < 1 || arg.i > SAM_PARALLEL_JOBS) {
+			vis_info_show(vis, "Invalid number of filter jobs, expected 1-%d", SAM_PARALLEL_JOBS);
+			return false;
+		}
+		vis->filter_jobs = arg.i;
+		break;
+	case OPTION_FILTER_ASYNC:
+		vis->filter_async = toggle ? !vis->filter_async : arg.b;
+		break;
+	case OPTION_AUTORELOAD:
+		vis->autoreload = toggle ? !vis->autoreload : arg.b;
+		break;
+	case OPTION_MAXFPS:
+		if (arg.i < 0) {
+			vis_info_show(vis, "Invalid frame rate, expected a positive number or 0");
+			return false;
+		}
+		vis->maxfps = arg.i;
+		break;
+	case OPTION_SHOW_STATS:
+		vis->show_stats = toggle ? !vis->show_stats : arg.b;
+		break;
+	case OPTION_HISTORY_REVISIONS:
+		vis->history_revisions = arg.i;
+		break;
+	case OPTION_HISTORY_MEMORY:
+		vis->history_memory = (size_t)arg.i << 20;
+		break;
 	default:
 		if (!opt->func)
 			return false;
@@ -2,6 +2,9 @@
 #define VIS_CORE_H
 
 #include <setjmp.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <poll.h>
 #include "vis.h"
 #include "sam.h"
 #include "vis-lua.h"
@@ -21,12 +24,28 @@
  *
  * if no binding is found, mode->input(...) is called and the user entered
  * keys are passed as argument. this is used to change the document content.
+ *
+ * for key processing all bindings which are effective in a mode, including
+ * those of a window overlay and of the parent modes, are flattened into a
+ * lookup table which is rebuilt once any mapping changed.
  */
+typedef struct {
+	const char *key;
+	KeyBinding *binding;
+} KeyEntry;
+
+typedef struct {
+	unsigned long generation;           /* vis->bindings_generation the table was built for */
+	Array entries;                      /* KeyEntry of all consulted modes, sorted by key within each */
+	Array levels;                       /* size_t end index into entries for every consulted mode, in search order */
+} KeyTable;
+
 typedef struct Mode Mode;
 struct Mode {
 	enum VisMode id;
 	Mode *parent;                       /* if no match is found in this mode, search will continue there */
 	Map *bindings;
+	KeyTable *lookup;                   /* flattened bindings, see mode_lookup */
 	const char *name;                   /* descriptive, user facing name of the mode */
 	const char *status;                 /* name displayed in the window status bar */
 	const char *help;                   /* short description used by :help */
@@ -39,9 +58,21 @@ struct Mode {
 };
 
 typedef struct {
-	Array values;
+	Buffer buf;
+	TextFrozen *frozen;  /* if non-NULL, the content is the range of it not yet copied to buf */
+	Text *txt;           /* text the frozen content was captured from */
+	Filerange range;
+} RegisterSlot;
+
+typedef struct {
+	Array values;        /* RegisterSlot */
 	bool linewise; /* place register content on a new line when inserting? */
 	bool append;
+	bool cached;   /* does the first slot of a clipboard register hold its current content? */
+	struct {
+		Text *txt;       /* if non-NULL, the content is the range of txt not yet copied */
+		Filerange range;
+	} lazy;
 	enum {
 		REGISTER_NORMAL,
 		REGISTER_NUMBER,
@@ -67,6 +98,11 @@ typedef struct {
 	 * the cursor is disposed (except if it is the primary one) */
 	VisOperatorFunction *func;
 	void *context;
+	/* optional, used when operating on multiple selections: appends the
+	 * modifications func would perform as edits of the unmodified text,
+	 * returns the cursor position as if only these were applied or EPOS
+	 * if the operation can not be expressed this way */
+	size_t (*batch)(Vis*, Text*, OperatorContext*, Array *edits);
 } Operator;
 
 typedef struct { /* Motion implementation, takes a cursor position and returns a new one */
@@ -127,29 +163,147 @@ typedef struct {             /** collects all information until an operator is e
 } Action;
 
 typedef struct Change Change;
+typedef struct Filter Filter;
 typedef struct {
 	Change *changes;      /* all changes in monotonically increasing file position */
 	Change *latest;       /* most recent change */
 	enum SamError error;  /* non-zero in case something went wrong */
+	Filter *filters;      /* external commands started for this file, in address order */
+	Filter *filters_last; /* most recently started filter */
+	Filter *pending;      /* oldest filter which might still be running */
+	size_t running;       /* number of filters which did not yet terminate */
+	bool background;      /* whether filters are applied once terminated, after the command */
 } Transcript;
 
+typedef struct {              /* an external process started in the background */
+	Text *text;           /* text from which input is read */
+	TextFrozen *frozen;   /* snapshot of the text from which input is read instead, if any */
+	pid_t pid;            /* process id or -1 once it was reaped */
+	int in, out, err;     /* our ends of the pipes or -1 once closed */
+	Filerange input;      /* part of the input which still needs to be written */
+	Buffer output, error; /* data written by the process to stdout/stderr */
+	int status;           /* exit status once terminated, -1 on failure */
+} PipeJob;
+
+/* invoked by the main loop with the events reported by poll(2) */
+typedef void WatchFunction(Vis*, int fd, short revents, void *data);
+
+typedef struct {
+	WatchFunction *func;
+	void *data;
+} Watch;
+
+/* invoked by the main loop for deferred work or an expired timer,
+ * returns whether it should be invoked again */
+typedef bool TaskFunction(Vis*, void *data);
+/* invoked once a task is done or discarded */
+typedef void TaskRelease(Vis*, void *data);
+
+typedef struct {
+	TaskFunction *func;
+	TaskRelease *release; /* might be NULL */
+	void *data;
+	unsigned int id;      /* identifier of a timer, 0 for idle tasks */
+	double due;           /* vis_time at which a timer expires */
+	double interval;      /* repeat interval of a timer in seconds, 0 for a single shot */
+} Task;
+
+typedef struct PathDir PathDir;
+
+typedef struct {
+	char *root;           /* absolute path of the indexed directory, NULL until first used */
+	Map *dirs;            /* PathDir by path relative to the root */
+	Array all;            /* PathDir* of all directories in no particular order */
+	Array queue;          /* PathDir* which need to be scanned */
+	Array watches;        /* PathDir* by inotify(7) watch descriptor */
+	int inotify;          /* inotify instance or -1 if directories are polled */
+	unsigned int timer;   /* periodically starts checking the polled directories */
+	size_t poll;          /* number of directories which remain to be checked */
+	size_t poll_next;     /* index into all of the next one to check */
+	bool task;            /* whether the index is being updated in the background */
+} PathIndex;
+
+typedef struct {
+	Array watches;        /* size_t number of files by inotify(7) watch descriptor */
+	int inotify;          /* inotify instance or -1 if files are polled, valid once initialized */
+	bool init;            /* whether the inotify instance was created */
+	unsigned int timer;   /* periodically checks the polled files, 0 if there are none */
+} FileMonitor;
+
 typedef struct {
 	Array prev;
 	Array next;
 	size_t max;
 } MarkList;
 
+typedef struct Word Word;
+
+typedef struct {
+	size_t start, end;               /* indexed part of the text, ending with a non-word byte */
+	Array words;                     /* distinct words contained in it, with their counts */
+} WordChunk;
+
+typedef struct {
+	Array chunks;                    /* WordChunk in increasing position, with gaps yet to be indexed */
+	size_t generation;               /* text generation the chunk positions refer to */
+	bool complete;                   /* whether there are no gaps */
+} WordIndex;
+
+typedef struct {
+	size_t start, end;               /* searched part of the text, both at a line boundary */
+	Array matches;                   /* Filerange of the successive matches, relative to start */
+} SearchChunk;
+
+typedef struct {
+	Array chunks;                    /* SearchChunk in increasing position, with gaps yet to be searched */
+	char *pattern;                   /* search pattern the matches belong to, NULL if there is none */
+	int cflags;                      /* flags the pattern was compiled with */
+	size_t generation;               /* text generation the chunk positions refer to */
+	size_t count;                    /* number of matches in all chunks */
+	bool complete;                   /* whether there are no gaps */
+	bool disabled;                   /* whether the pattern is not indexed, it might match a newline or matches too often */
+} SearchIndex;
+
+typedef struct {
+	const char *suffix;              /* file name suffix, e.g. ".gz" */
+	const char *const decompress[4]; /* command writing the uncompressed content of its input */
+	const char *const compress[4];   /* command writing the compressed content of its input */
+} FileCodec;
+
 struct File { /* shared state among windows displaying the same file */
 	Text *text;                      /* data structure holding the file content */
 	const char *name;                /* file name used when loading/saving */
 	volatile sig_atomic_t truncated; /* whether the underlying memory mapped region became invalid (SIGBUS) */
 	int fd;                          /* output file descriptor associated with this file or -1 if loaded by file name */
+	int loadfd;                      /* input file descriptor from which content is still being streamed or -1 */
+	pid_t loadpid;                   /* decompressor writing to loadfd or -1 */
+	size_t loadgen;                  /* text generation after the latest streamed data, SIZE_MAX once edited meanwhile */
 	bool internal;                   /* whether it is an internal file (e.g. used for the prompt) */
+	bool pending;                    /* whether loading the content is deferred until needed, see file_load */
+	bool incomplete;                 /* whether loading failed, the file is then only overwritten with :w! */
+	bool announce;                   /* whether the content was loaded but FILE_OPEN not yet emitted */
+	int error;                       /* errno of a failed deferred load, which is not retried */
 	struct stat stat;                /* filesystem information when loaded/saved, used to detect changes outside the editor */
 	int refcount;                    /* how many windows are displaying this file? (always >= 1) */
 	Array marks[VIS_MARK_INVALID];   /* marks which are shared across windows */
 	enum TextSaveMethod save_method; /* whether the file is saved using rename(2) or overwritten */
+	struct {
+		TextSave *ctx;           /* save in progress or NULL */
+		int fd;                  /* descriptor reporting the progress of the save or -1 */
+		char *path;              /* absolute path of the file being written */
+		size_t size, written;    /* total amount of data to write, part already written */
+		bool stat;               /* whether to update the file information once completed */
+	} save;                          /* background save, used for large files */
 	Transcript transcript;           /* keeps track of changes performed by sam commands */
+	Filter *background;              /* filters running in the background, see the filterasync option */
+	size_t stats_generation;         /* text generation at the latest frame, to count edits */
+	WordIndex words;                 /* contribution to the word completion index */
+	SearchIndex search;              /* matches of the search pattern */
+	struct {
+		int wd;                  /* inotify(7) watch descriptor of the containing directory or -1 */
+		struct stat seen;        /* information last found on disk, to report every change once */
+		bool check;              /* whether an event asks to compare it with the file system */
+	} monitor;                       /* detection of modifications outside the editor */
 	File *next, *prev;
 };
 
@@ -171,6 +325,46 @@ struct Win {
 	Win *prev, *next;       /* neighbouring windows */
 };
 
+#define VIS_REGEX_CACHE_SIZE 16
+
+typedef struct {
+	char *pattern;      /* source of the compiled regex, NULL for unused entries */
+	int cflags;         /* flags the pattern was compiled with */
+	Regex *regex;       /* compiled regex shared by all users of the pattern */
+	int refs;           /* number of references not yet released by vis_regex_free */
+	unsigned long used; /* cache clock at the last lookup, to evict the least recently used */
+} RegexCacheEntry;
+
+typedef struct {
+	RegexCacheEntry entries[VIS_REGEX_CACHE_SIZE];
+	unsigned long clock; /* incremented on every lookup */
+	size_t hits, misses; /* lookup statistics */
+} RegexCache;
+
+/* hot paths whose invocations and run time are measured */
+enum VisStats {
+	VIS_STAT_INPUT,     /* decoding of terminal input into keys */
+	VIS_STAT_KEYS,      /* processing of keys by vis_keys_process */
+	VIS_STAT_VIEW,      /* layout of windows by view_draw */
+	VIS_STAT_HIGHLIGHT, /* handlers of the WIN_HIGHLIGHT event */
+	VIS_STAT_BLIT,      /* output of the frame by the UI backend */
+	VIS_STAT_SEARCH,    /* regular expression searches */
+	VIS_STAT_EDIT,      /* text modifications, only counted */
+	VIS_STAT_COMPACT,   /* compaction of the piece chains, counting the eliminated pieces */
+	VIS_STAT_HISTORY,   /* pruning of the undo histories, counting the discarded revisions */
+	VIS_STAT_FRAME,     /* everything done between two frames, including the latter */
+	VIS_STAT_LAST,
+};
+
+typedef struct {
+	unsigned long count;         /* number of measurements, in total */
+	double time;                 /* seconds measured, in total */
+	unsigned long frame_count;   /* the same restricted to the latest frame */
+	double frame_time;
+	unsigned long pending_count; /* the same since the latest frame */
+	double pending_time;
+} VisStat;
+
 struct Vis {
 	File *files;                         /* all files currently managed by this editor instance */
 	File *command_file;                  /* special internal file used to store :-command prompt */
@@ -183,6 +377,7 @@ struct Vis {
 	Register registers[VIS_REG_INVALID]; /* registers used for text manipulations yank/put etc. and macros */
 	Macro *recording, *last_recording;   /* currently (if non NULL) and least recently recorded macro */
 	const Macro *replaying;              /* macro currently being replayed */
+	int batch;                           /* nesting level of key replays, drawing is deferred while > 0 */
 	Macro *macro_operator;               /* special macro used to repeat certain operators */
 	Mode *mode_before_prompt;            /* user mode which was active before entering prompt */
 	char search_char[8];                 /* last used character to search for via 'f', 'F', 't', 'T' */
@@ -200,6 +395,8 @@ struct Vis {
 	char key_current[VIS_KEY_LENGTH_MAX];/* current key being processed by the input queue */
 	char key_prev[VIS_KEY_LENGTH_MAX];   /* previous key which was processed by the input queue */
 	Buffer input_queue;                  /* holds pending input keys */
+	Buffer paste;                        /* text received so far by an ongoing bracketed paste */
+	bool pasting;                        /* whether input is currently part of a bracketed paste */
 	bool errorhandler;                   /* whether we are currently in an error handler, used to avoid recursion */
 	Action action;                       /* current action which is in progress */
 	Action action_prev;                  /* last operator action used by the repeat (dot) command */
@@ -213,16 +410,50 @@ struct Vis {
 	volatile sig_atomic_t need_resize;   /* need to resize UI (SIGWINCH occurred) */
 	volatile sig_atomic_t resume;        /* need to resume UI (SIGCONT occurred) */
 	volatile sig_atomic_t terminate;     /* need to terminate we were being killed by SIGTERM */
+	volatile sig_atomic_t children;      /* a child process terminated (SIGCHLD) */
+	int signal_pipe[2];                  /* written to by the signal handler to wake up the main loop */
+	Array pollfds;                       /* struct pollfd of all descriptors the main loop waits for */
+	Array watches;                       /* Watch for every entry of pollfds */
+	Array tasks;                         /* Task run in slices while no input is pending, in order */
+	Array timers;                        /* Task for every pending timer, unordered */
+	unsigned int timer_id;               /* identifier of the most recently added timer */
+	unsigned int timer_active;           /* identifier of the timer being invoked, 0 once cancelled */
 	sigjmp_buf sigbus_jmpbuf;            /* used to jump back to a known good state in the mainloop after (SIGBUS) */
 	Map *actions;                        /* registered editor actions / special keys commands */
 	Array actions_user;                  /* dynamically allocated editor actions */
 	lua_State *lua;                      /* lua context used for syntax highlighting */
+	unsigned int lua_subscribers[VIS_LUA_EVENT_LAST]; /* number of Lua handlers per event */
 	enum TextLoadMethod load_method;     /* how existing files should be loaded */
 	Array operators;
 	Array motions;
 	Array textobjects;
 	Array bindings;
+	unsigned long bindings_generation;   /* incremented whenever a key mapping changes */
 	bool ignorecase;                     /* whether to ignore case when searching */
+	int filter_jobs;                     /* how many filter commands should run concurrently */
+	bool filter_async;                   /* whether single filter commands run in the background */
+	bool autoreload;                     /* whether content appended to unmodified files on disk is loaded */
+	bool sam_profile;                    /* whether to report where time is spent by sam commands */
+	bool show_stats;                     /* whether to display the duration of the latest frame in the status bar */
+	VisStat stats[VIS_STAT_LAST];        /* performance counters of hot paths */
+	int maxfps;                          /* maximum number of frames drawn per second, 0 for no limit */
+	size_t history_revisions;            /* revisions kept in the history of a file, 0 for no limit */
+	size_t history_memory;               /* bytes used by the history of a file, 0 for no limit */
+	struct {
+		FILE *log;                   /* where startup phases are logged, NULL once the first frame is drawn */
+		double start, last;          /* time at which startup began and of the previous log entry */
+		double nested;               /* time spent in modules required by the one being loaded */
+	} startup;
+	RegexCache regex_cache;              /* recently compiled regular expressions */
+	Map *words;                          /* Word of all files by text, NULL until completion is first used */
+	size_t words_serial;                 /* number of word chunks built so far */
+	bool words_task;                     /* whether the index is being updated in the background */
+	bool search_task;                    /* whether the match indices are being updated in the background */
+	bool need_redraw;                    /* a background task changed the content of a window */
+	bool search_highlight;               /* whether to highlight the visible matches of the search pattern */
+	bool compact_task;                   /* whether fragmented texts are being compacted in the background */
+	PathIndex paths;                     /* file names below the working directory */
+	FileMonitor monitor;                 /* changes of the open files outside the editor */
 };
 
 enum VisEvents {
@@ -239,10 +470,18 @@ enum VisEvents {
 	VIS_EVENT_WIN_STATUS,
 	VIS_EVENT_TERM_CSI,
 	VIS_EVENT_UI_DRAW,
+	VIS_EVENT_IDLE,
 };
 
 bool vis_event_emit(Vis*, enum VisEvents, ...);
 
+/* note the completion of a startup phase, if requested by vis_startuptime */
+void vis_startup_mark(Vis*, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+/* record count invocations of a hot path which took time seconds */
+void vis_stats_add(Vis*, enum VisStats, unsigned long count, double time);
+/* end a frame which took the given time, making the figures since the previous one its own */
+void vis_stats_frame(Vis*, double time);
+
 typedef struct {
 	char name;
 	VIS_HELP_DECL(const char *help;)
@@ -268,6 +507,9 @@ size_t vis_text_insert_nl(Vis*, Text*, size_t pos);
 
 Mode *mode_get(Vis*, enum VisMode);
 void mode_set(Vis *vis, Mode *new_mode);
+/* lookup table of the bindings effective in the current mode and window */
+const KeyTable *mode_lookup(Vis*);
+void mode_lookup_free(Mode*);
 Macro *macro_get(Vis *vis, enum VisRegister);
 
 Win *window_new_file(Vis*, File*, enum UiOption);
@@ -276,8 +518,98 @@ void window_status_update(Vis *vis, Win *win);
 
 char *absolute_path(const char *path);
 
+/* start an external process reading the given range and optionally
+ * capturing its output, returns false if it could not be launched */
+bool vis_pipe_job_start(Vis*, PipeJob*, File*, Filerange*, const char *argv[], bool output);
+/* fill in the descriptors the job is waiting for, unused entries are set to -1 */
+void vis_pipe_job_fds(PipeJob*, struct pollfd fds[3]);
+/* perform pending I/O after poll(2) returned, true once the job terminated */
+bool vis_pipe_job_io(Vis*, PipeJob*, const struct pollfd fds[3]);
+/* reap the process once all descriptors are closed, true if it terminated */
+bool vis_pipe_job_wait(PipeJob*, bool block);
+/* terminate the process and wait for it */
+void vis_pipe_job_cancel(PipeJob*);
+void vis_pipe_job_release(PipeJob*);
+
 const char *file_name_get(File*);
 void file_name_set(File*, const char *name);
+/* load the content of a file opened by vis_window_new_deferred, emits the
+ * events withheld so far. Does nothing if it is already loaded */
+bool file_load(Vis*, File*);
+/* the external compressor used for the file name, NULL for regular files */
+const FileCodec *file_codec(const char *name);
+int file_save_progress(File*);
+/* percentage of the input consumed by the filters running in the background, -1 if there are none */
+int file_filter_progress(File*);
+/* terminate the filters running in the background for the file, or all files
+ * if NULL, returns whether any were running */
+bool file_filter_cancel(Vis*, File*);
+/* apply the background filters which terminated after closing their output */
+void file_filter_reap(Vis*);
+/* watch function committing a background save of the file passed as data */
+void file_save_ready(Vis*, int fd, short revents, void *data);
+
+/* have the main loop invoke func once fd is ready for the given poll(2)
+ * events, replaces an existing watch of the same descriptor */
+bool vis_watch(Vis*, int fd, short events, WatchFunction *func, void *data);
+void vis_unwatch(Vis*, int fd);
+/* queue func to be run while no input is pending, it is invoked again in
+ * later idle slices for as long as it returns true. Each invocation should
+ * only perform a small amount of work */
+bool vis_defer(Vis*, TaskFunction *func, TaskRelease *release, void *data);
+/* have func invoked after timeout seconds and then every interval seconds
+ * for as long as it returns true, a zero interval fires only once. Returns
+ * an identifier for vis_timer_cancel, 0 on failure */
+unsigned int vis_timer(Vis*, double timeout, double interval, TaskFunction *func, TaskRelease *release, void *data);
+bool vis_timer_cancel(Vis*, unsigned int id);
+
+/* invoke func for all words of the open files which start with, but are
+ * longer than, prefix in lexicographical order until it returns false.
+ * The index is built at the first call and afterwards kept up to date at
+ * idle time. Returns whether all files could be indexed */
+bool vis_words_complete(Vis*, const char *prefix, bool (*func)(const char *word, void *data), void *data);
+/* queue an update of the index if any file changed since it was built */
+void vis_words_schedule(Vis*);
+void vis_words_file_free(Vis*, File*);
+void vis_words_free(Vis*);
+
+/* position of the next match of the search pattern after pos, wrapping around
+ * at the end of the text. Uses the match index built at idle time, returns
+ * EPOS if it does not cover the way there. The index records every match
+ * start, the result is thus the same as for text_search_forward */
+size_t vis_search_next(Vis*, Text*, size_t pos);
+/* number of the match of the search pattern starting at pos, or 0 if it is not
+ * known, and the number of matches found so far. Returns whether the file is
+ * indexed at all, complete indicates whether the count is final */
+bool vis_search_count(Vis*, File*, size_t pos, size_t *number, size_t *count, bool *complete);
+/* invoke func for the successive matches of the search pattern overlapping
+ * range until it returns false, such as those in the viewport. Returns
+ * whether there is a search pattern */
+bool vis_search_matches(Vis*, Text*, Filerange *range, bool (*func)(const Filerange *match, void *data), void *data);
+/* queue an update of the match indices of the displayed files if the search
+ * pattern or their content changed */
+void vis_search_schedule(Vis*);
+void vis_search_file_free(Vis*, File*);
+
+/* invoke func for the paths below the working directory which start with
+ * pattern or, if fuzzy, contain its characters in order, until it returns
+ * false. Directories have a trailing slash, hidden entries are skipped.
+ * The index is built at the first call and afterwards kept up to date at
+ * idle time. Returns whether the whole tree was already indexed */
+bool vis_paths_match(Vis*, const char *pattern, bool fuzzy, bool (*func)(const char *path, void *data), void *data);
+void vis_paths_free(Vis*);
+
+/* watch the file for modifications outside the editor, to be called
+ * whenever it is (re)named or its disk information was updated. Changes
+ * are reported, content appended to unmodified files might be loaded */
+void vis_monitor_file(Vis*, File*);
+void vis_monitor_file_free(Vis*, File*);
+/* compare the file with the one found on disk, changes during a save are only noticed afterwards */
+void vis_monitor_file_check(Vis*, File*);
+void vis_monitor_free(Vis*);
+
+Regex *regex_cache_get(Vis*, const char *pattern, int cflags);
+void regex_cache_release(RegexCache*);
 
 bool register_init(Register*);
 void register_release(Register*);
@@ -290,13 +622,25 @@ void marklist_release(MarkList*);
 
 const char *register_get(Vis*, Register*, size_t *len);
 const char *register_slot_get(Vis*, Register*, size_t slot, size_t *len);
+Buffer *register_slot_buffer(Register*, size_t slot);
+/* insert the slot content, without copying referenced text into the register
+ * first, returns the number of inserted bytes */
+size_t register_slot_insert(Vis*, Register*, size_t slot, Text*, size_t pos);
 
 bool register_put0(Vis*, Register*, const char *data);
 bool register_put(Vis*, Register*, const char *data, size_t len);
 bool register_slot_put(Vis*, Register*, size_t slot, const char *data, size_t len);
 
 bool register_put_range(Vis*, Register*, Text*, Filerange*);
+/* like register_put_range, but only copy the text once it is accessed,
+ * register_load must be called before the text is changed */
+bool register_put_range_lazy(Vis*, Register*, Text*, Filerange*);
+bool register_load(Register*);
 bool register_slot_put_range(Vis*, Register*, size_t slot, Text*, Filerange*);
+/* copy the content of all registers still referring to a text which is about to be freed */
+void register_text_free(Vis*, Text*);
+/* clipboard content is cached until the user had the chance to change it elsewhere */
+void register_clipboard_invalidate(Vis*);
 
 size_t vis_register_count(Vis*, Register*);
 bool register_resize(Register*, size_t count);
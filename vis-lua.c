@@ -13,12 +13,14 @@
  */
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <pwd.h>
 
 #include "vis-lua.h"
@@ -61,6 +63,8 @@ bool vis_lua_path_add(Vis *vis, const char *path) { return true; }
 bool vis_lua_paths_get(Vis *vis, char **lpath, char **cpath) { return false; }
 void vis_lua_process_response(Vis *vis, const char *name,
                               char *buffer, size_t len, ResponseType rtype) { }
+void vis_lua_process_messages(Vis *vis, const char *name,
+                              const ProcessMessage *msgs, size_t count, ResponseType rtype) { }
 
 #else
 
@@ -320,20 +324,18 @@ static void *obj_ref_new(lua_State *L, void *addr, const char *type) {
 	}
 	lua_getfield(L, LUA_REGISTRYINDEX, "vis.objects");
 	lua_pushlightuserdata(L, addr);
-	lua_gettable(L, -2);
+	lua_rawget(L, -2);
 	lua_remove(L, -2);
-	const char *old_type = obj_type_get(L);
-	if (strcmp(type, old_type) == 0) {
-		debug("new: vis.objects[%p] = %s (returning existing object)\n", addr, old_type);
-		void **handle = luaL_checkudata(L, -1, type);
-		if (!handle)
-			debug("new: vis.objects[%p] = %s (BUG: invalid handle)\n", addr, old_type);
-		else if (*handle != addr)
-			debug("new: vis.objects[%p] = %s (BUG: handle mismatch %p)\n", addr, old_type, *handle);
+	/* compares the metatable, cheaper than looking up the type name */
+	void **existing = luaL_testudata(L, -1, type);
+	if (existing) {
+		debug("new: vis.objects[%p] = %s (returning existing object)\n", addr, type);
+		if (*existing != addr)
+			debug("new: vis.objects[%p] = %s (BUG: handle mismatch %p)\n", addr, type, *existing);
 		return addr;
 	}
 	if (!lua_isnil(L, -1))
-		debug("new: vis.objects[%p] = %s (WARNING: changing object type from %s)\n", addr, type, old_type);
+		debug("new: vis.objects[%p] = %s (WARNING: changing object type from %s)\n", addr, type, obj_type_get(L));
 	else
 		debug("new: vis.objects[%p] = %s (creating new object)\n", addr, type);
 	lua_pop(L, 1);
@@ -356,6 +358,18 @@ static void *obj_ref_check_containerof(lua_State *L, int idx, const char *type,
 	return obj ? ((char*)obj-offset) : obj;
 }
 
+/* like obj_ref_check, but loads the content of files opened deferred */
+static File *file_check(lua_State *L, int idx) {
+	File *file = obj_ref_check(L, idx, VIS_LUA_TYPE_FILE);
+	if (file && file->pending) {
+		lua_getglobal(L, "vis");
+		Vis *vis = obj_ref_check(L, -1, "vis");
+		lua_pop(L, 1);
+		file_load(vis, file);
+	}
+	return file;
+}
+
 static void *obj_lightref_new(lua_State *L, void *addr, const char *type) {
 	if (!addr)
 		return NULL;
@@ -369,6 +383,39 @@ static void *obj_lightref_check(lua_State *L, int idx, const char *type) {
 	return *addr;
 }
 
+typedef struct {
+	Selection *sel; /* first member, checked like other light references */
+	unsigned long id;
+} SelectionHandle;
+
+/* Selections are too short lived to be tracked in registry["vis.objects"].
+ * Instead their objects are cached in registry["vis.selections"][addr]
+ * with weak values, such that repeated accesses do not produce garbage.
+ * Comparing the id detects a later selection reusing the same address. */
+static Selection *obj_selection_new(lua_State *L, Selection *sel) {
+	if (!sel) {
+		lua_pushnil(L);
+		return NULL;
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, "vis.selections");
+	lua_pushlightuserdata(L, sel);
+	lua_rawget(L, -2);
+	SelectionHandle *handle = lua_touserdata(L, -1);
+	if (handle && handle->sel == sel && handle->id == sel->id) {
+		lua_remove(L, -2);
+		return sel;
+	}
+	lua_pop(L, 1);
+	handle = obj_new(L, sizeof *handle, VIS_LUA_TYPE_SELECTION);
+	handle->sel = sel;
+	handle->id = sel->id;
+	lua_pushlightuserdata(L, sel);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, -4);
+	lua_remove(L, -2);
+	return sel;
+}
+
 static int index_common(lua_State *L) {
 	lua_getmetatable(L, 1);
 	lua_pushvalue(L, 2);
@@ -441,6 +488,13 @@ static Filerange getrange(lua_State *L, int index) {
 	return range;
 }
 
+/* push text content as string, copied straight into the Lua managed buffer */
+static void pushtext(lua_State *L, Text *txt, size_t pos, size_t len) {
+	luaL_Buffer b;
+	char *buf = luaL_buffinitsize(L, &b, len);
+	luaL_pushresultsize(&b, text_bytes_get(txt, pos, len, buf));
+}
+
 static const char *keymapping(Vis *vis, const char *keys, const Arg *arg) {
 	lua_State *L = vis->lua;
 	if (!func_ref_get(L, arg->v))
@@ -1108,7 +1162,7 @@ static bool command_lua(Vis *vis, Win *win, void *data, bool force, const char *
 		return false;
 	if (!sel)
 		sel = view_selections_primary_get(&win->view);
-	if (!obj_lightref_new(L, sel, VIS_LUA_TYPE_SELECTION))
+	if (!obj_selection_new(L, sel))
 		return false;
 	pushrange(L, range);
 	if (pcall(vis, L, 5, 1) != 0)
@@ -1243,7 +1297,7 @@ static int pipe_func(lua_State *L) {
 	if (lua_gettop(L) <= 3) {
 		cmd_idx = 2;
 	} else if (!(lua_isnil(L, 2) && lua_isnil(L, 3))) {
-		file = obj_ref_check(L, 2, VIS_LUA_TYPE_FILE);
+		file = file_check(L, 2);
 		range = getrange(L, 3);
 	}
 	const char *cmd = luaL_checkstring(L, cmd_idx);
@@ -1280,6 +1334,188 @@ static int redraw(lua_State *L) {
 	vis_redraw(vis);
 	return 0;
 }
+
+/***
+ * Draw user interface as the main loop does after processing input.
+ *
+ * In contrast to @{Vis:redraw} only changed cells are sent to the terminal.
+ * The drawing concludes a frame of the performance counters in @{Vis.stats}.
+ *
+ * @function draw
+ */
+static int draw(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	double start = vis_time();
+	ui_draw(&vis->ui);
+	vis_stats_frame(vis, vis_time() - start);
+	return 0;
+}
+
+/* the task data is a reference to the function in the registry */
+static bool task_lua(Vis *vis, void *data) {
+	lua_State *L = vis->lua;
+	if (!L)
+		return false;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, (int)(intptr_t)data);
+	if (pcall(vis, L, 0, 1) != 0)
+		return false;
+	bool ret = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return ret;
+}
+
+static void task_lua_release(Vis *vis, void *data) {
+	if (vis->lua)
+		luaL_unref(vis->lua, LUA_REGISTRYINDEX, (int)(intptr_t)data);
+}
+
+static void *task_lua_new(lua_State *L, int narg) {
+	luaL_checktype(L, narg, LUA_TFUNCTION);
+	lua_pushvalue(L, narg);
+	return (void*)(intptr_t)luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+/***
+ * Defer work until no input is pending.
+ *
+ * Deferred functions are run in order, once the screen is up to date and
+ * for as long as no key is pressed. A function returning `true` is invoked
+ * again later, hence expensive work can be split into small steps.
+ *
+ * @function defer
+ * @tparam function func the function to invoke without arguments
+ * @treturn bool whether the function was queued
+ * @usage
+ * local i = 0
+ * vis:defer(function()
+ * 	i = i + 1
+ * 	-- process a small piece of work
+ * 	return i < 100
+ * end)
+ */
+static int defer(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	void *data = task_lua_new(L, 2);
+	bool ret = vis_defer(vis, task_lua, task_lua_release, data);
+	if (!ret)
+		task_lua_release(vis, data);
+	lua_pushboolean(L, ret);
+	return 1;
+}
+
+/***
+ * Invoke a function once a timeout expired.
+ *
+ * A repeating timer keeps firing for as long as the function returns `true`.
+ *
+ * @function timer
+ * @tparam number timeout the number of seconds after which the function is invoked
+ * @tparam function func the function to invoke without arguments
+ * @tparam[opt] number interval the number of seconds between further invocations
+ * @treturn int an identifier for @{Vis:timer_cancel} or `nil` on failure
+ * @usage
+ * vis:timer(0.5, function()
+ * 	vis:info(os.date())
+ * 	return true
+ * end, 1)
+ */
+static int timer(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	double timeout = luaL_checknumber(L, 2);
+	void *data = task_lua_new(L, 3);
+	double interval = luaL_optnumber(L, 4, 0);
+	unsigned int id = vis_timer(vis, timeout, interval, task_lua, task_lua_release, data);
+	if (!id) {
+		task_lua_release(vis, data);
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushunsigned(L, id);
+	return 1;
+}
+
+/***
+ * Cancel a timer.
+ *
+ * @function timer_cancel
+ * @tparam int id the identifier returned by @{Vis:timer}
+ * @treturn bool whether the timer was still pending
+ */
+static int timer_cancel(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	unsigned int id = luaL_checkunsigned(L, 2);
+	lua_pushboolean(L, vis_timer_cancel(vis, id));
+	return 1;
+}
+typedef struct {
+	lua_State *L;
+	size_t count, limit;
+} WordsCollect;
+
+static bool words_collect(const char *word, void *data) {
+	WordsCollect *collect = data;
+	lua_pushstring(collect->L, word);
+	lua_rawseti(collect->L, -2, ++collect->count);
+	return collect->count < collect->limit;
+}
+
+/***
+ * Find words for completion.
+ *
+ * Looks up the words of all open files which start with, but are longer
+ * than, the given prefix. Words consist of alphanumeric ASCII characters,
+ * underscores and non-ASCII characters. The index is built by the first
+ * call and afterwards kept up to date while the editor is idle.
+ *
+ * @function words
+ * @tparam string prefix the prefix of the words
+ * @tparam[opt] int limit the maximal number of words to return
+ * @treturn {string,...} the words in lexicographical order
+ * @usage
+ * for _, word in ipairs(vis:words("vis_", 10)) do
+ * 	print(word)
+ * end
+ */
+static int words(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	const char *prefix = luaL_checkstring(L, 2);
+	WordsCollect collect = { .L = L, .limit = luaL_optunsigned(L, 3, SIZE_MAX) };
+	lua_newtable(L);
+	if (collect.limit)
+		vis_words_complete(vis, prefix, words_collect, &collect);
+	return 1;
+}
+
+/***
+ * Find file names for completion.
+ *
+ * Looks up the paths below the current working directory which start with
+ * the given pattern or, if fuzzy matching is requested, contain all its
+ * characters in order. Paths are relative to the working directory, those of
+ * directories end with a slash, hidden entries are skipped and symbolic
+ * links are not followed. The index is built by the first call and
+ * afterwards kept up to date while the editor is idle.
+ *
+ * @function paths
+ * @tparam string pattern the pattern to match, relative to the working directory
+ * @tparam[opt] int limit the maximal number of paths to return
+ * @tparam[opt] bool fuzzy whether to match the pattern as a subsequence
+ * @treturn {string,...} the matching paths, in no particular order if fuzzy
+ * @treturn bool whether the whole directory tree is indexed, otherwise matches might be missing
+ * @usage
+ * local paths, complete = vis:paths("src/", 100)
+ */
+static int paths(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	const char *pattern = luaL_checkstring(L, 2);
+	WordsCollect collect = { .L = L, .limit = luaL_optunsigned(L, 3, SIZE_MAX) };
+	bool fuzzy = lua_toboolean(L, 4);
+	lua_newtable(L);
+	bool complete = collect.limit && vis_paths_match(vis, pattern, fuzzy, words_collect, &collect);
+	lua_pushboolean(L, complete);
+	return 2;
+}
+
 /***
  * Closes a stream returned by @{Vis:communicate}.
  *
@@ -1305,9 +1541,18 @@ static int close_subprocess(lua_State *L) {
  *
  * The editor core won't be blocked while the external process is running.
  *
+ * By default the output is passed on as it was read. Alternatively it can
+ * be split into messages, all messages completed during one main loop
+ * iteration are then passed as a table to a single @{process_response} event:
+ *
+ * - `"line"` newline terminated lines, without the newline
+ * - `"length"` each message is prefixed by its length as 4 byte big endian integer
+ * - `"jsonrpc"` message bodies announced by a `Content-Length` header as used by the Language Server Protocol
+ *
  * @function communicate
  * @tparam string name the name of subprocess (to distinguish processes in the @{process_response} event)
  * @tparam string command the command to execute
+ * @tparam[opt] string framing how the output is split into messages, one of `"raw"` (the default), `"line"`, `"length"` or `"jsonrpc"`
  * @return the file handle to write data to the process, in case of error the return values are equivalent to @{io.open} error values.
  */
 static int communicate_func(lua_State *L) {
@@ -1321,9 +1566,11 @@ static int communicate_func(lua_State *L) {
 	Vis *vis = obj_ref_check(L, 1, "vis");
 	const char *name = luaL_checkstring(L, 2);
 	const char *cmd = luaL_checkstring(L, 3);
+	static const char *framings[] = { "raw", "line", "length", "jsonrpc", NULL };
+	Framing framing = luaL_checkoption(L, 4, "raw", framings);
 	ProcessStream *inputfd = (ProcessStream *)lua_newuserdata(L, sizeof(ProcessStream));
 	luaL_setmetatable(L, LUA_FILEHANDLE);
-	inputfd->handler = vis_process_communicate(vis, name, cmd, &(inputfd->stream.closef));
+	inputfd->handler = vis_process_communicate(vis, name, cmd, framing, &(inputfd->stream.closef));
 	if (inputfd->handler) {
 		inputfd->stream.f = fdopen(inputfd->handler->inpfd, "w");
 		inputfd->stream.closef = &close_subprocess;
@@ -1355,6 +1602,23 @@ static int communicate_func(lua_State *L) {
  * Mark name in use.
  * @tfield string mark
  */
+/***
+ * Performance counters of hot paths.
+ *
+ * A table with an entry for each of `input` (decoding of terminal input),
+ * `keys` (key processing), `view` (window layout), `highlight` (handlers
+ * of the `WIN_HIGHLIGHT` event), `blit` (terminal output), `search`
+ * (regular expression searches), `edit` (text modifications, without
+ * timing), `compact` (coalescing of small pieces of the texts in the
+ * background, counting the pieces eliminated), `history` (pruning of the
+ * undo histories, counting the revisions discarded) and `frame` (all work
+ * between two frames). Each is a table with
+ * the fields `count` and `time` (in seconds) in total, and `frame_count`
+ * and `frame_time` for the latest frame. The field `cells` holds the
+ * number of changed cells sent to the terminal so far, `bytes` the size
+ * of the output of the vt100 backend and `frames` the number of frames.
+ * @tfield table stats
+ */
 static int vis_index(lua_State *L) {
 	Vis *vis = obj_ref_check(L, 1, "vis");
 
@@ -1418,6 +1682,42 @@ static int vis_index(lua_State *L) {
 			obj_ref_new(L, &vis->ui, VIS_LUA_TYPE_UI);
 			return 1;
 		}
+
+		if (strcmp(key, "stats") == 0) {
+			static const char *names[] = {
+				[VIS_STAT_INPUT]     = "input",
+				[VIS_STAT_KEYS]      = "keys",
+				[VIS_STAT_VIEW]      = "view",
+				[VIS_STAT_HIGHLIGHT] = "highlight",
+				[VIS_STAT_BLIT]      = "blit",
+				[VIS_STAT_SEARCH]    = "search",
+				[VIS_STAT_EDIT]      = "edit",
+				[VIS_STAT_COMPACT]   = "compact",
+				[VIS_STAT_HISTORY]   = "history",
+				[VIS_STAT_FRAME]     = "frame",
+			};
+			lua_createtable(L, 0, VIS_STAT_LAST + 3);
+			for (size_t i = 0; i < VIS_STAT_LAST; i++) {
+				const VisStat *stat = &vis->stats[i];
+				lua_createtable(L, 0, 4);
+				lua_pushunsigned(L, stat->count);
+				lua_setfield(L, -2, "count");
+				lua_pushnumber(L, stat->time);
+				lua_setfield(L, -2, "time");
+				lua_pushunsigned(L, stat->frame_count);
+				lua_setfield(L, -2, "frame_count");
+				lua_pushnumber(L, stat->frame_time);
+				lua_setfield(L, -2, "frame_time");
+				lua_setfield(L, -2, names[i]);
+			}
+			lua_pushunsigned(L, vis->ui.stats.cells);
+			lua_setfield(L, -2, "cells");
+			lua_pushunsigned(L, vis->ui.stats.bytes);
+			lua_setfield(L, -2, "bytes");
+			lua_pushunsigned(L, vis->ui.stats.frames);
+			lua_setfield(L, -2, "frames");
+			return 1;
+		}
 	}
 
 	return index_common(L);
@@ -1430,6 +1730,8 @@ static int vis_options_assign(Vis *vis, lua_State *L, const char *key, int next)
 		vis->change_colors = lua_toboolean(L, next);
 	} else if (strcmp(key, "escdelay") == 0) {
 		termkey_set_waittime(vis->ui.termkey, luaL_checkint(L, next));
+	} else if (strcmp(key, "hlsearch") == 0 || strcmp(key, "hls") == 0) {
+		vis->search_highlight = lua_toboolean(L, next);
 	} else if (strcmp(key, "ignorecase") == 0 || strcmp(key, "ic") == 0) {
 		vis->ignorecase = lua_toboolean(L, next);
 	} else if (strcmp(key, "loadmethod") == 0) {
@@ -1446,6 +1748,8 @@ static int vis_options_assign(Vis *vis, lua_State *L, const char *key, int next)
 		if (!lua_isstring(L, next))
 			return newindex_common(L);
 		vis_shell_set(vis, lua_tostring(L, next));
+	} else if (strcmp(key, "showstats") == 0) {
+		vis->show_stats = lua_toboolean(L, next);
 	}
 	return 0;
 }
@@ -1511,6 +1815,212 @@ static int vis_newindex(lua_State *L) {
 	return newindex_common(L);
 }
 
+/* Lua files compiled from source are cached as bytecode in $XDG_CACHE_HOME/vis,
+ * one file per source with slashes in its absolute path replaced by '%'.
+ * An entry starts with a line identifying the source it was compiled from,
+ * it is used as long as the modification time, size, device and inode of the
+ * source match. */
+static bool chunk_cache_path(const char *source, char *path, size_t size) {
+	char real[PATH_MAX];
+	if (!realpath(source, real))
+		return false;
+	const char *cache = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int len;
+	if (cache && *cache)
+		len = snprintf(path, size, "%s/vis", cache);
+	else if (home && *home)
+		len = snprintf(path, size, "%s/.cache/vis", home);
+	else
+		return false;
+	if (len < 0 || (size_t)len + 1 + strlen(real) >= size)
+		return false;
+	/* create the directory and its parent if needed, failure is detected later */
+	char *slash = strrchr(path, '/');
+	if (slash && slash != path) {
+		*slash = '\0';
+		mkdir(path, 0700);
+		*slash = '/';
+	}
+	mkdir(path, 0700);
+	char *d = path + len;
+	*d++ = '/';
+	for (const char *s = real; *s; s++)
+		*d++ = *s == '/' ? '%' : *s;
+	*d = '\0';
+	return true;
+}
+
+static int chunk_cache_writer(lua_State *L, const void *p, size_t size, void *ud) {
+	return fwrite(p, 1, size, ud) != size;
+}
+
+/* the first line of a cache entry for the source with the given attributes */
+static int chunk_cache_stamp(const struct stat *st, char *buf, size_t size) {
+	return snprintf(buf, size, "%jd.%09ld %jd %ju %ju\n", (intmax_t)st->st_mtim.tv_sec,
+	                (long)st->st_mtim.tv_nsec, (intmax_t)st->st_size,
+	                (uintmax_t)st->st_dev, (uintmax_t)st->st_ino);
+}
+
+/* load the bytecode of a cache entry if its stamp matches */
+static bool chunk_cache_load(lua_State *L, const char *cache, const char *filename, const char *stamp, size_t len) {
+	FILE *file = fopen(cache, "rb");
+	if (!file)
+		return false;
+	Buffer buf;
+	buffer_init(&buf);
+	char data[BUFSIZ];
+	for (size_t n; (n = fread(data, 1, sizeof data, file)) > 0; ) {
+		if (!buffer_append(&buf, data, n))
+			break;
+	}
+	bool ok = !ferror(file) && buffer_length(&buf) > len && !memcmp(buffer_content(&buf), stamp, len);
+	fclose(file);
+	if (ok) {
+		lua_pushfstring(L, "@%s", filename);
+		ok = luaL_loadbufferx(L, buffer_content(&buf) + len, buffer_length(&buf) - len,
+		                      lua_tostring(L, -1), "b") == LUA_OK;
+		if (ok)
+			lua_remove(L, -2);
+		else
+			lua_pop(L, 2);
+	}
+	buffer_release(&buf);
+	return ok;
+}
+
+/* load a Lua file like luaL_loadfilex(3), source or precompiled, but reuse or
+ * create its cache entry */
+static int chunk_load(lua_State *L, const char *filename) {
+	char cache[PATH_MAX], tmp[PATH_MAX], stamp[128];
+	struct stat src;
+	if (!chunk_cache_path(filename, cache, sizeof cache) || stat(filename, &src) == -1)
+		return luaL_loadfilex(L, filename, NULL);
+	int stamp_len = chunk_cache_stamp(&src, stamp, sizeof stamp);
+	if (stamp_len < 0 || (size_t)stamp_len >= sizeof stamp)
+		return luaL_loadfilex(L, filename, NULL);
+	if (chunk_cache_load(L, cache, filename, stamp, stamp_len))
+		return LUA_OK;
+	int status = luaL_loadfilex(L, filename, NULL);
+	if (status != LUA_OK)
+		return status;
+	/* write a temporary file first, others never see a partial entry */
+	int len = snprintf(tmp, sizeof tmp, "%s.%ld", cache, (long)getpid());
+	if (len < 0 || (size_t)len >= sizeof tmp)
+		return LUA_OK;
+	FILE *file = fopen(tmp, "wb");
+	if (!file)
+		return LUA_OK;
+	bool ok = fwrite(stamp, 1, stamp_len, file) == (size_t)stamp_len;
+#if LUA_VERSION_NUM >= 503
+	ok = lua_dump(L, chunk_cache_writer, file, 0) == 0 && ok;
+#else
+	ok = lua_dump(L, chunk_cache_writer, file) == 0 && ok;
+#endif
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp, cache) == -1)
+		unlink(tmp);
+	return LUA_OK;
+}
+
+/* runs the module loader in its first upvalue and logs how long it took,
+ * including and excluding nested requires */
+static int chunk_timed(lua_State *L) {
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	Vis *vis = ud;
+	int nargs = lua_gettop(L);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	double nested = vis->startup.nested, start = vis_time();
+	vis->startup.nested = 0;
+	lua_call(L, nargs, LUA_MULTRET);
+	double total = vis_time() - start;
+	if (vis->startup.log) {
+		fprintf(vis->startup.log, "%08.3f %08.3f %08.3f: require %s\n",
+		        (start + total - vis->startup.start) * 1e3, total * 1e3,
+		        (total - vis->startup.nested) * 1e3, lua_tostring(L, lua_upvalueindex(2)));
+		vis->startup.last = start + total;
+	}
+	vis->startup.nested = nested + total;
+	return lua_gettop(L);
+}
+
+/* replacement for the package.searchers entry loading Lua files */
+static int chunk_searcher(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "searchpath");
+	lua_pushstring(L, name);
+	lua_getfield(L, -3, "path");
+	lua_call(L, 2, 2);
+	if (lua_isnil(L, -2))
+		return 1; /* error message listing the files tried */
+	const char *filename = lua_tostring(L, -2);
+	if (chunk_load(L, filename) != LUA_OK) {
+		return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+		                  name, filename, lua_tostring(L, -1));
+	}
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	Vis *vis = ud;
+	if (vis->startup.log) {
+		lua_pushstring(L, name);
+		lua_pushcclosure(L, chunk_timed, 2);
+	}
+	lua_pushstring(L, filename);
+	return 2;
+}
+
+/***
+ * Load a Lua file.
+ *
+ * Like @{loadfile} for source files, but the compiled chunk is cached
+ * in `$XDG_CACHE_HOME/vis` until the file is modified. Modules loaded
+ * through @{require} are cached the same way.
+ * @function loadfile
+ * @tparam string filename the file to load
+ * @tparam[opt] table env the environment of the loaded chunk
+ * @treturn function the loaded chunk or `nil` and an error message
+ */
+static int loadfile_func(lua_State *L) {
+	const char *filename = luaL_checkstring(L, 2);
+	if (chunk_load(L, filename) != LUA_OK) {
+		lua_pushnil(L);
+		lua_insert(L, -2);
+		return 2;
+	}
+	if (!lua_isnoneornil(L, 3)) {
+		lua_pushvalue(L, 3);
+		if (!lua_setupvalue(L, -2, 1))
+			lua_pop(L, 1);
+	}
+	return 1;
+}
+
+/* names used by vis.events, indexed by enum VisLuaEvent */
+static const char *lua_events[] = {
+	[VIS_LUA_EVENT_INPUT]            = "Event::INPUT",
+	[VIS_LUA_EVENT_WIN_HIGHLIGHT]    = "Event::WIN_HIGHLIGHT",
+	[VIS_LUA_EVENT_WIN_STATUS]       = "Event::WIN_STATUS",
+	[VIS_LUA_EVENT_TERM_CSI]         = "Event::TERM_CSI",
+	[VIS_LUA_EVENT_PROCESS_RESPONSE] = "Event::PROCESS_RESPONSE",
+	[VIS_LUA_EVENT_UI_DRAW]          = "Event::UI_DRAW",
+	[VIS_LUA_EVENT_IDLE]             = "Event::IDLE",
+};
+
+/* called by vis.events whenever the number of handlers of an event changes */
+static int event_subscribers(lua_State *L) {
+	Vis *vis = obj_ref_check(L, 1, "vis");
+	const char *event = luaL_checkstring(L, 2);
+	unsigned int count = luaL_checkunsigned(L, 3);
+	for (size_t i = 0; i < LENGTH(lua_events); i++) {
+		if (strcmp(lua_events[i], event) == 0)
+			vis->lua_subscribers[i] = count;
+	}
+	return 0;
+}
+
 static const struct luaL_Reg vis_lua[] = {
 	{ "files", files },
 	{ "windows", windows },
@@ -1538,7 +2048,15 @@ static const struct luaL_Reg vis_lua[] = {
 	{ "exit", exit_func },
 	{ "pipe", pipe_func },
 	{ "redraw", redraw },
+	{ "draw", draw },
+	{ "defer", defer },
+	{ "timer", timer },
+	{ "timer_cancel", timer_cancel },
+	{ "words", words },
+	{ "paths", paths },
 	{ "communicate", communicate_func },
+	{ "loadfile", loadfile_func },
+	{ "event_subscribers", event_subscribers },
 	{ "__index", vis_index },
 	{ "__newindex", vis_newindex },
 	{ NULL, NULL },
@@ -1550,9 +2068,11 @@ static const struct luaL_Reg vis_lua[] = {
  * @tfield[opt=false] boolean autoindent {ai}
  * @tfield[opt=false] boolean changecolors
  * @tfield[opt=50] int escdelay
+ * @tfield[opt=false] boolean hlsearch {hls}
  * @tfield[opt=false] boolean ignorecase {ic}
  * @tfield[opt="auto"] string loadmethod `"auto"`, `"read"`, or `"mmap"`.
  * @tfield[opt="/bin/sh"] string shell
+ * @tfield[opt=false] boolean showstats
  * @see Window.options
  */
 
@@ -1571,6 +2091,9 @@ static int vis_options_index(lua_State *L) {
 		} else if (strcmp(key, "escdelay") == 0) {
 			lua_pushunsigned(L, termkey_get_waittime(vis->ui.termkey));
 			return 1;
+		} else if (strcmp(key, "hlsearch") == 0 || strcmp(key, "hls") == 0) {
+			lua_pushboolean(L, vis->search_highlight);
+			return 1;
 		} else if (strcmp(key, "ignorecase") == 0 || strcmp(key, "ic") == 0) {
 			lua_pushboolean(L, vis->ignorecase);
 			return 1;
@@ -1590,6 +2113,9 @@ static int vis_options_index(lua_State *L) {
 		} else if (strcmp(key, "shell") == 0) {
 			lua_pushstring(L, vis->shell);
 			return 1;
+		} else if (strcmp(key, "showstats") == 0) {
+			lua_pushboolean(L, vis->show_stats);
+			return 1;
 		}
 	}
 	return index_common(L);
@@ -1802,7 +2328,7 @@ static int window_index(lua_State *L) {
 
 		if (strcmp(key, "selection") == 0) {
 			Selection *sel = view_selections_primary_get(&win->view);
-			obj_lightref_new(L, sel, VIS_LUA_TYPE_SELECTION);
+			obj_selection_new(L, sel);
 			return 1;
 		}
 
@@ -1927,7 +2453,7 @@ static int window_selections_iterator_next(lua_State *L) {
 	Selection **handle = lua_touserdata(L, lua_upvalueindex(1));
 	if (!*handle)
 		return 0;
-	Selection *sel = obj_lightref_new(L, *handle, VIS_LUA_TYPE_SELECTION);
+	Selection *sel = obj_selection_new(L, *handle);
 	if (!sel)
 		return 0;
 	*handle = view_selections_next(sel);
@@ -1947,6 +2473,64 @@ static int window_selections_iterator(lua_State *L) {
 	return 1;
 }
 
+/***
+ * Get or replace the ranges of all selections at once.
+ *
+ * The ranges are represented as a flat array of alternating start and
+ * end positions, ordered like the selections. This avoids creating an
+ * object for every selection.
+ * @function selections_ranges
+ * @tparam[opt] {int,...} ranges the new selection ranges, replacing all existing ones
+ * @treturn {int,...} the ranges of the selections, if `ranges` was not given
+ * @usage
+ * local ranges = win:selections_ranges()
+ * for i = 1, #ranges, 2 do
+ * 	ranges[i+1] = ranges[i] + 1
+ * end
+ * win:selections_ranges(ranges)
+ */
+static int window_selections_ranges(lua_State *L) {
+	Win *win = obj_ref_check(L, 1, VIS_LUA_TYPE_WINDOW);
+	View *view = &win->view;
+	if (lua_isnoneornil(L, 2)) {
+		Array ranges = view_selections_get_all(view);
+		size_t count = array_length(&ranges);
+		lua_createtable(L, 2 * count, 0);
+		for (size_t i = 0; i < count; i++) {
+			Filerange *r = array_get(&ranges, i);
+			lua_pushunsigned(L, r->start);
+			lua_rawseti(L, -2, 2 * i + 1);
+			lua_pushunsigned(L, r->end);
+			lua_rawseti(L, -2, 2 * i + 2);
+		}
+		array_release(&ranges);
+		return 1;
+	}
+	luaL_checktype(L, 2, LUA_TTABLE);
+	size_t len = lua_rawlen(L, 2) & ~(size_t)1;
+	/* positions are checked before any memory is allocated, since errors do not return */
+	for (size_t i = 1; i <= len; i++) {
+		lua_rawgeti(L, 2, i);
+		checkpos(L, -1);
+		lua_pop(L, 1);
+	}
+	Array ranges;
+	array_init_sized(&ranges, sizeof(Filerange));
+	if (!array_reserve(&ranges, len / 2))
+		return luaL_error(L, "out of memory");
+	for (size_t i = 1; i <= len; i += 2) {
+		lua_rawgeti(L, 2, i);
+		lua_rawgeti(L, 2, i + 1);
+		Filerange r = text_range_new(lua_tounsigned(L, -2), lua_tounsigned(L, -1));
+		lua_pop(L, 2);
+		if (text_range_valid(&r) && r.end <= text_size(win->file->text))
+			array_add(&ranges, &r);
+	}
+	view_selections_set_all(view, &ranges, true);
+	array_release(&ranges);
+	return 0;
+}
+
 /***
  * Set up a window local key mapping.
  * The function signatures are the same as for @{Vis:map}.
@@ -2012,6 +2596,49 @@ static int window_style(lua_State *L) {
 	return 0;
 }
 
+/***
+ * Style lexed text.
+ *
+ * Equivalent to calling @{style} for every token, but all tokens are
+ * applied with a single pass over the window content.
+ * The style will be cleared after every window redraw.
+ * @function style_tokens
+ * @tparam {string|int,...} tokens as returned by `lexer:lex`, alternating
+ *  token names and 1-based positions following the end of each token
+ * @tparam int offset the absolute file position in bytes of the lexed text
+ * @tparam table styles display styles registered with @{style_define} by
+ *  token name, tokens without one are left unstyled
+ * @see style
+ */
+static int window_style_tokens(lua_State *L) {
+	Win *win = obj_ref_check(L, 1, VIS_LUA_TYPE_WINDOW);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	size_t start = checkpos(L, 3);
+	luaL_checktype(L, 4, LUA_TTABLE);
+	View *view = &win->view;
+	size_t offset = start, count = lua_rawlen(L, 2);
+	Array ranges;
+	array_init_sized(&ranges, sizeof(StyleRange));
+	for (size_t i = 1; i < count && start <= view->end; i += 2) {
+		lua_rawgeti(L, 2, i + 1);
+		size_t end = offset + lua_tointeger(L, -1) - 1;
+		lua_pop(L, 1);
+		if (end > start && end > view->start) {
+			lua_rawgeti(L, 2, i);
+			lua_gettable(L, 4);
+			if (lua_isnumber(L, -1)) {
+				StyleRange range = { start, end - 1, lua_tointeger(L, -1) };
+				array_add(&ranges, &range);
+			}
+			lua_pop(L, 1);
+		}
+		start = end;
+	}
+	win_style_ranges(win, array_get(&ranges, 0), array_length(&ranges));
+	array_release(&ranges);
+	return 0;
+}
+
 /***
  * Style the single terminal cell at the given coordinates, relative to this window.
  *
@@ -2103,10 +2730,12 @@ static const struct luaL_Reg window_funcs[] = {
 	{ "__index", window_index },
 	{ "__newindex", window_newindex },
 	{ "selections_iterator", window_selections_iterator },
+	{ "selections_ranges", window_selections_ranges },
 	{ "map", window_map },
 	{ "unmap", window_unmap },
 	{ "style_define", window_style_define },
 	{ "style", window_style },
+	{ "style_tokens", window_style_tokens },
 	{ "style_pos", window_style_pos },
 	{ "status", window_status },
 	{ "draw", window_draw },
@@ -2206,7 +2835,7 @@ static int window_selections_index(lua_State *L) {
 		goto err;
 	for (Selection *s = view_selections(view); s; s = view_selections_next(s)) {
 		if (!--index) {
-			obj_lightref_new(L, s, VIS_LUA_TYPE_SELECTION);
+			obj_selection_new(L, s);
 			return 1;
 		}
 	}
@@ -2474,15 +3103,38 @@ static const struct luaL_Reg window_selection_funcs[] = {
  * File state.
  * @tfield bool modified whether the file contains unsaved changes
  */
+/***
+ * File load state.
+ * @tfield bool loading whether content is still being read from a stream
+ */
+/***
+ * File save state.
+ * @tfield int saving percentage of a background save completed so far or `nil`
+ */
 /***
  * File permission.
  * @tfield int permission the file permission bits as of the most recent load/save
  */
+/***
+ * File modification counter.
+ * @tfield int generation incremented by every change, including undo and redo
+ * @see changed_since
+ */
+/***
+ * Undo history usage.
+ *
+ * A table with the fields `revisions`, the number of states which can be
+ * restored, and `memory`, the bytes held to represent them.
+ * @tfield table history
+ */
 static int file_index(lua_State *L) {
 	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
 
 	if (lua_isstring(L, 2)) {
 		const char *key = lua_tostring(L, 2);
+		if (strcmp(key, "name") != 0 && strcmp(key, "path") != 0)
+			file = file_check(L, 1);
+
 		if (strcmp(key, "name") == 0) {
 			lua_pushstring(L, file_name_get(file));
 			return 1;
@@ -2503,11 +3155,39 @@ static int file_index(lua_State *L) {
 			return 1;
 		}
 
+		if (strcmp(key, "generation") == 0) {
+			lua_pushunsigned(L, text_generation(file->text));
+			return 1;
+		}
+
+		if (strcmp(key, "history") == 0) {
+			TextHistory history = text_history(file->text);
+			lua_createtable(L, 0, 2);
+			lua_pushunsigned(L, history.revisions);
+			lua_setfield(L, -2, "revisions");
+			lua_pushunsigned(L, history.memory);
+			lua_setfield(L, -2, "memory");
+			return 1;
+		}
+
 		if (strcmp(key, "modified") == 0) {
 			lua_pushboolean(L, text_modified(file->text));
 			return 1;
 		}
 
+		if (strcmp(key, "loading") == 0) {
+			lua_pushboolean(L, file->loadfd != -1);
+			return 1;
+		}
+
+		if (strcmp(key, "saving") == 0) {
+			if (file->save.ctx)
+				lua_pushinteger(L, file_save_progress(file));
+			else
+				lua_pushnil(L);
+			return 1;
+		}
+
 		if (strcmp(key, "permission") == 0) {
 			struct stat stat = text_stat(file->text);
 			lua_pushunsigned(L, stat.st_mode & 0777);
@@ -2534,7 +3214,7 @@ static int file_index(lua_State *L) {
 }
 
 static int file_newindex(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 
 	if (lua_isstring(L, 2)) {
 		const char *key = lua_tostring(L, 2);
@@ -2575,7 +3255,7 @@ static int file_newindex(lua_State *L) {
  * @treturn bool whether the file content was successfully changed
  */
 static int file_insert(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	size_t pos = checkpos(L, 2);
 	size_t len;
 	luaL_checkstring(L, 3);
@@ -2600,7 +3280,7 @@ static int file_insert(lua_State *L) {
  * @treturn bool whether the file content was successfully changed
  */
 static int file_delete(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	Filerange range = getrange(L, 2);
 	lua_pushboolean(L, text_delete_range(file->text, &range));
 	return 1;
@@ -2620,7 +3300,7 @@ static int file_delete(lua_State *L) {
  */
 static int file_lines_iterator_it(lua_State *L);
 static int file_lines_iterator(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	size_t line = luaL_optunsigned(L, 2, 1);
 	size_t *pos = lua_newuserdata(L, sizeof *pos);
 	*pos = text_pos_by_lineno(file->text, line);
@@ -2634,12 +3314,7 @@ static int file_lines_iterator_it(lua_State *L) {
 	if (*start == text_size(file->text))
 		return 0;
 	size_t end = text_line_end(file->text, *start);
-	size_t len = end - *start;
-	char *buf = lua_newuserdata(L, len);
-	if (!buf && len)
-		return 0;
-	len = text_bytes_get(file->text, *start, len, buf);
-	lua_pushlstring(L, buf, len);
+	pushtext(L, file->text, *start, end - *start);
 	*start = text_line_next(file->text, end);
 	return 1;
 }
@@ -2664,22 +3339,156 @@ static int file_lines_iterator_it(lua_State *L) {
  * @treturn string the file content corresponding to the range
  */
 static int file_content(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	Filerange range = getrange(L, 2);
 	if (!text_range_valid(&range))
 		goto err;
-	size_t len = text_range_size(&range);
-	char *data = lua_newuserdata(L, len);
-	if (!data)
-		goto err;
-	len = text_bytes_get(file->text, range.start, len, data);
-	lua_pushlstring(L, data, len);
+	pushtext(L, file->text, range.start, text_range_size(&range));
 	return 1;
 err:
 	lua_pushnil(L);
 	return 1;
 }
 
+/***
+ * Create an iterator over the file content in pieces.
+ *
+ * Each step yields the position and content of a contiguous chunk of the
+ * underlying storage. Unlike @{content} the range is never assembled into
+ * a single string, which makes it suitable to scan large files.
+ * Changing the file during the iteration is allowed, the iterator then
+ * continues at the position following the previous chunk.
+ * @function chunks
+ * @tparam[opt] Range range the range to iterate over, defaults to the whole file
+ * @return the new iterator
+ * @see content
+ * @usage
+ * for pos, chunk in file:chunks() do
+ * 	-- do something with chunk
+ * end
+ */
+static int file_chunks_it(lua_State *L);
+static int file_chunks(lua_State *L) {
+	File *file = file_check(L, 1);
+	Filerange range = text_range_new(0, text_size(file->text));
+	if (!lua_isnoneornil(L, 2))
+		range = getrange(L, 2);
+	/* the file and the range become the upvalues of the iterator */
+	lua_settop(L, 1);
+	Filerange *r = lua_newuserdata(L, sizeof *r);
+	*r = range;
+	lua_pushcclosure(L, file_chunks_it, 2);
+	return 1;
+}
+
+static int file_chunks_it(lua_State *L) {
+	File *file = *(File**)lua_touserdata(L, lua_upvalueindex(1));
+	Filerange *r = lua_touserdata(L, lua_upvalueindex(2));
+	size_t end = MIN(r->end, text_size(file->text));
+	Iterator it;
+	const char *chunk;
+	size_t len;
+	if (r->start >= end || !text_iterator_init(file->text, &it, r->start) ||
+	    !text_iterator_chunk_next(&it, end, &chunk, &len))
+		return 0;
+	lua_pushunsigned(L, r->start);
+	lua_pushlstring(L, chunk, len);
+	r->start += len;
+	return 2;
+}
+
+/***
+ * Search the file content for a regular expression.
+ *
+ * The search is performed directly on the underlying storage, the content
+ * is not copied to a Lua string.
+ * @function find
+ * @tparam string pattern the extended regular expression to look for
+ * @tparam[opt] Range range the range to search, defaults to the whole file
+ * @treturn int the 0-based start of the first match or `nil` if not found
+ * @treturn int the end of the match
+ * @usage
+ * local start, finish = file:find("TODO|FIXME")
+ */
+static int file_find(lua_State *L) {
+	File *file = file_check(L, 1);
+	const char *pattern = luaL_checkstring(L, 2);
+	Filerange range = text_range_new(0, text_size(file->text));
+	if (!lua_isnoneornil(L, 3))
+		range = getrange(L, 3);
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	Vis *vis = ud;
+	Regex *regex = regex_cache_get(vis, pattern, REG_EXTENDED|REG_NEWLINE);
+	if (!regex)
+		return luaL_error(L, "invalid regular expression: %s", pattern);
+	RegexMatch match[1];
+	bool found = text_range_valid(&range) && range.end <= text_size(file->text) &&
+		text_search_range_forward(file->text, range.start, text_range_size(&range), regex, 1, match, 0) == 0;
+	vis_regex_free(vis, regex);
+	if (!found) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushunsigned(L, match[0].start);
+	lua_pushunsigned(L, match[0].end);
+	return 2;
+}
+
+/***
+ * Count the matches of the search pattern.
+ *
+ * The matches are counted while the editor is idle, the result might thus
+ * not be final yet. Patterns which can match a newline are not counted.
+ *
+ * @function search_count
+ * @tparam int pos the 0-based file position of a match
+ * @treturn int the 1-based number of the match starting at `pos`, `0` if
+ *  there is none or it is not known yet, `nil` if matches are not counted
+ * @treturn int the number of matches found so far
+ * @treturn bool whether all of the file was searched
+ * @usage
+ * local number, count, complete = file:search_count(win.selection.pos)
+ */
+static int file_search_count(lua_State *L) {
+	File *file = file_check(L, 1);
+	size_t pos = checkpos(L, 2);
+	void *ud = NULL;
+	lua_getallocf(L, &ud);
+	Vis *vis = ud;
+	size_t number, count;
+	bool complete;
+	if (!vis_search_count(vis, file, pos, &number, &count, &complete)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushunsigned(L, number);
+	lua_pushunsigned(L, count);
+	lua_pushboolean(L, complete);
+	return 3;
+}
+
+/***
+ * Get the lowest position modified since a given generation.
+ *
+ * Content before the returned position is unchanged since then.
+ *
+ * @function changed_since
+ * @tparam int generation a value of `file.generation` obtained earlier
+ * @treturn int the 0-based file position of the first change, `0` if it is no
+ *  longer known or `nil` if the file was not modified
+ * @see generation
+ */
+static int file_changed_since(lua_State *L) {
+	File *file = file_check(L, 1);
+	size_t pos = text_changed_since(file->text, luaL_checkunsigned(L, 2));
+	if (pos == EPOS)
+		lua_pushnil(L);
+	else
+		lua_pushunsigned(L, pos);
+	return 1;
+}
+
 /***
  * Set mark.
  * @function mark_set
@@ -2687,7 +3496,7 @@ err:
  * @treturn Mark mark the mark which can be looked up later
  */
 static int file_mark_set(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	size_t pos = checkpos(L, 2);
 	Mark mark = text_mark_set(file->text, pos);
 	if (mark)
@@ -2704,7 +3513,7 @@ static int file_mark_set(lua_State *L) {
  * @treturn int pos the position of the mark, or `nil` if invalid
  */
 static int file_mark_get(lua_State *L) {
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	Mark mark = (Mark)obj_lightref_check(L, 2, VIS_LUA_TYPE_MARK);
 	size_t pos = text_mark_get(file->text, mark);
 	if (pos == EPOS)
@@ -2732,7 +3541,7 @@ static int file_mark_get(lua_State *L) {
 
 static int file_text_object(lua_State *L) {
 	Filerange range = text_range_empty();
-	File *file = obj_ref_check(L, 1, VIS_LUA_TYPE_FILE);
+	File *file = file_check(L, 1);
 	size_t pos = checkpos(L, 2);
 	size_t idx = lua_tointeger(L, lua_upvalueindex(1));
 	if (idx < LENGTH(vis_textobjects)) {
@@ -2751,6 +3560,10 @@ static const struct luaL_Reg file_funcs[] = {
 	{ "delete", file_delete },
 	{ "lines_iterator", file_lines_iterator },
 	{ "content", file_content },
+	{ "chunks", file_chunks },
+	{ "find", file_find },
+	{ "search_count", file_search_count },
+	{ "changed_since", file_changed_since },
 	{ "mark_set", file_mark_set },
 	{ "mark_get", file_mark_get },
 	{ NULL, NULL },
@@ -2762,15 +3575,9 @@ static int file_lines_index(lua_State *L) {
 	size_t start = text_pos_by_lineno(txt, line);
 	size_t end = text_line_end(txt, start);
 	if (start != EPOS && end != EPOS) {
-		size_t size = end - start;
-		char *data = lua_newuserdata(L, size);
-		if (!data && size)
-			goto err;
-		size = text_bytes_get(txt, start, size, data);
-		lua_pushlstring(L, data, size);
+		pushtext(L, txt, start, end - start);
 		return 1;
 	}
-err:
 	lua_pushnil(L);
 	return 1;
 }
@@ -3123,6 +3930,15 @@ static void vis_lua_init(Vis *vis) {
 	lua_pop(L, 2);
 #endif
 
+	/* load Lua files through the bytecode cache */
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "searchers");
+	if (lua_istable(L, -1)) {
+		lua_pushcfunction(L, chunk_searcher);
+		lua_rawseti(L, -2, 2);
+	}
+	lua_pop(L, 2);
+
 	/* remove any relative paths from lua's default package.path */
 	vis_lua_path_strip(vis);
 
@@ -3181,6 +3997,13 @@ static void vis_lua_init(Vis *vis) {
 	/* table in registry to track lifetimes of C objects */
 	lua_newtable(L);
 	lua_setfield(L, LUA_REGISTRYINDEX, "vis.objects");
+	/* weak table caching selection objects, see obj_selection_new */
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushstring(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, "vis.selections");
 	/* table in registry to store references to Lua functions */
 	lua_newtable(L);
 	lua_setfield(L, LUA_REGISTRYINDEX, "vis.functions");
@@ -3236,6 +4059,7 @@ static void vis_lua_init(Vis *vis) {
 		{ UI_STYLE_SEPARATOR,         "STYLE_SEPARATOR"         },
 		{ UI_STYLE_INFO,              "STYLE_INFO"              },
 		{ UI_STYLE_EOF,               "STYLE_EOF"               },
+		{ UI_STYLE_SEARCH,            "STYLE_SEARCH"            },
 	};
 
 	for (size_t i = 0; i < LENGTH(styles); i++) {
@@ -3310,10 +4134,13 @@ static void vis_lua_init(Vis *vis) {
 	if (!package_exist(vis, L, "visrc")) {
 		vis_info_show(vis, "WARNING: failed to load visrc.lua");
 	} else {
+		vis_startup_mark(vis, "initialize Lua");
 		lua_getglobal(L, "require");
 		lua_pushstring(L, "visrc");
 		pcall(vis, L, 1, 0);
+		vis_startup_mark(vis, "execute visrc.lua");
 		vis_lua_event_call(vis, "init");
+		vis_startup_mark(vis, "init event");
 	}
 }
 
@@ -3348,7 +4175,7 @@ static void vis_lua_quit(Vis *vis) {
  */
 static bool vis_lua_input(Vis *vis, const char *key, size_t len) {
 	lua_State *L = vis->lua;
-	if (!L || !vis->win || vis->win->file->internal)
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_INPUT] || !vis->win || vis->win->file->internal)
 		return false;
 	bool ret = false;
 	vis_lua_event_get(L, "input");
@@ -3506,7 +4333,7 @@ static void vis_lua_win_close(Vis *vis, Win *win) {
  */
 static void vis_lua_win_highlight(Vis *vis, Win *win) {
 	lua_State *L = vis->lua;
-	if (!L)
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_WIN_HIGHLIGHT])
 		return;
 	vis_lua_event_get(L, "win_highlight");
 	if (lua_isfunction(L, -1)) {
@@ -3524,7 +4351,7 @@ static void vis_lua_win_highlight(Vis *vis, Win *win) {
  */
 static void vis_lua_win_status(Vis *vis, Win *win) {
 	lua_State *L = vis->lua;
-	if (!L || win->file->internal) {
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_WIN_STATUS] || win->file->internal) {
 		window_status_update(vis, win);
 		return;
 	}
@@ -3545,7 +4372,7 @@ static void vis_lua_win_status(Vis *vis, Win *win) {
  */
 static void vis_lua_term_csi(Vis *vis, const long *csi) {
 	lua_State *L = vis->lua;
-	if (!L)
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_TERM_CSI])
 		return;
 	vis_lua_event_get(L, "term_csi");
 	if (lua_isfunction(L, -1)) {
@@ -3563,12 +4390,12 @@ static void vis_lua_term_csi(Vis *vis, const long *csi) {
  * @tparam string name the name of process given to @{Vis:communicate}
  * @tparam string response_type can be "STDOUT" or "STDERR" if new output was received in corresponding channel, "SIGNAL" if the process was terminated by a signal or "EXIT" when the process terminated normally
  * @tparam int code the exit code number if response_type is "EXIT", or the signal number if response_type is "SIGNAL"
- * @tparam string buffer the available content sent by the process
+ * @tparam string|{string,...} buffer the available content sent by the process, or the list of received messages if a framing was given to @{Vis:communicate}
  */
 void vis_lua_process_response(Vis *vis, const char *name,
                               char *buffer, size_t len, ResponseType rtype) {
 	lua_State *L = vis->lua;
-	if (!L) {
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_PROCESS_RESPONSE]) {
 		return;
 	}
 	vis_lua_event_get(L, "process_response");
@@ -3595,6 +4422,27 @@ void vis_lua_process_response(Vis *vis, const char *name,
 	lua_pop(L, 1);
 }
 
+void vis_lua_process_messages(Vis *vis, const char *name,
+                              const ProcessMessage *msgs, size_t count, ResponseType rtype) {
+	lua_State *L = vis->lua;
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_PROCESS_RESPONSE]) {
+		return;
+	}
+	vis_lua_event_get(L, "process_response");
+	if (lua_isfunction(L, -1)) {
+		lua_pushstring(L, name);
+		lua_pushstring(L, rtype == STDOUT ? "STDOUT" : "STDERR");
+		lua_pushnil(L);
+		lua_createtable(L, count, 0);
+		for (size_t i = 0; i < count; i++) {
+			lua_pushlstring(L, msgs[i].data, msgs[i].len);
+			lua_rawseti(L, -2, i + 1);
+		}
+		pcall(vis, L, 4, 0);
+	}
+	lua_pop(L, 1);
+}
+
 /***
  * Emitted immediately before the UI is drawn to the screen.
  * Allows last-minute overrides to the styling of UI elements.
@@ -3604,7 +4452,33 @@ void vis_lua_process_response(Vis *vis, const char *name,
  * @function ui_draw
  */
 static void vis_lua_ui_draw(Vis *vis) {
-	vis_lua_event_call(vis, "ui_draw");
+	if (vis->lua && vis->lua_subscribers[VIS_LUA_EVENT_UI_DRAW])
+		vis_lua_event_call(vis, "ui_draw");
+}
+
+/***
+ * No input is pending.
+ * Emitted repeatedly after a frame was drawn, as long as a handler reports
+ * remaining work and no key is pressed. Each invocation should only perform
+ * a small slice of work, input is not processed meanwhile.
+ * Unlike other events it is passed to all handlers.
+ * @function idle
+ * @treturn bool whether more work is pending
+ */
+static bool vis_lua_idle(Vis *vis) {
+	lua_State *L = vis->lua;
+	if (!L || !vis->lua_subscribers[VIS_LUA_EVENT_IDLE])
+		return false;
+	bool ret = false;
+	vis_lua_event_get(L, "idle");
+	if (lua_isfunction(L, -1)) {
+		if (pcall(vis, L, 0, 1) == 0) {
+			ret = lua_toboolean(L, -1);
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+	return ret;
 }
 
 bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
@@ -3668,6 +4542,9 @@ bool vis_event_emit(Vis *vis, enum VisEvents id, ...) {
 	case VIS_EVENT_UI_DRAW:
 		vis_lua_ui_draw(vis);
 		break;
+	case VIS_EVENT_IDLE:
+		ret = vis_lua_idle(vis);
+		break;
 	}
 
 	va_end(ap);
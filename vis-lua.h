@@ -11,6 +11,18 @@ typedef struct lua_State lua_State;
 typedef void* lua_CFunction;
 #endif
 
+/* frequently emitted events, only dispatched to Lua if handlers exist */
+enum VisLuaEvent {
+	VIS_LUA_EVENT_INPUT,
+	VIS_LUA_EVENT_WIN_HIGHLIGHT,
+	VIS_LUA_EVENT_WIN_STATUS,
+	VIS_LUA_EVENT_TERM_CSI,
+	VIS_LUA_EVENT_PROCESS_RESPONSE,
+	VIS_LUA_EVENT_UI_DRAW,
+	VIS_LUA_EVENT_IDLE,
+	VIS_LUA_EVENT_LAST,
+};
+
 #include "vis.h"
 #include "vis-subprocess.h"
 
@@ -30,5 +42,6 @@ void vis_event_mode_insert_input(Vis*, const char *key, size_t len);
 void vis_event_mode_replace_input(Vis*, const char *key, size_t len);
 #endif
 void vis_lua_process_response(Vis *, const char *, char *, size_t, ResponseType);
+void vis_lua_process_messages(Vis *, const char *, const ProcessMessage *, size_t count, ResponseType);
 
 #endif
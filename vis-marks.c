@@ -1,28 +1,7 @@
 #include "vis-core.h"
 
-static int ranges_comparator(const void *a, const void *b) {
-	const Filerange *r1 = a, *r2 = b;
-	if (!text_range_valid(r1))
-		return text_range_valid(r2) ? 1 : 0;
-	if (!text_range_valid(r2))
-		return -1;
-	return (r1->start < r2->start || (r1->start == r2->start && r1->end < r2->end)) ? -1 : 1;
-}
-
 void vis_mark_normalize(Array *a) {
-	array_sort(a, ranges_comparator);
-	Filerange *prev = NULL, *r = array_get(a, 0);
-	for (size_t i = 0; r; r = array_get(a, i)) {
-		if (text_range_size(r) == 0) {
-			array_remove(a, i);
-		} else if (prev && text_range_overlap(prev, r)) {
-			*prev = text_range_union(prev, r);
-			array_remove(a, i);
-		} else {
-			prev = r;
-			i++;
-		}
-	}
+	text_ranges_normalize(a);
 }
 
 bool vis_mark_equal(Array *a, Array *b) {
@@ -72,14 +51,8 @@ static Array mark_get(Win *win, Array *mark) {
 	array_init_sized(&sel, sizeof(Filerange));
 	if (!mark)
 		return sel;
-	size_t len = array_length(mark);
-	array_reserve(&sel, len);
-	for (size_t i = 0; i < len; i++) {
-		SelectionRegion *sr = array_get(mark, i);
-		Filerange r = view_regions_restore(&win->view, sr);
-		if (text_range_valid(&r))
-			array_add(&sel, &r);
-	}
+	array_reserve(&sel, array_length(mark));
+	view_regions_restore_all(&win->view, mark, &sel);
 	vis_mark_normalize(&sel);
 	return sel;
 }
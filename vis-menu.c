@@ -31,6 +31,7 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,6 +43,7 @@
 #include <termios.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #define CONTROL(ch)   (ch ^ 0x40)
 #define MIN(a,b)      ((a) < (b) ? (a) : (b))
@@ -58,14 +60,34 @@ struct Item {
 	Item *left, *right;
 };
 
+/* items matching the query are kept in the order they were read, grouped
+ * into exact matches, prefix and substring matches */
+enum {
+	M_Exact,
+	M_Prefix,
+	M_Substr,
+	M_Last
+};
+
 static char   text[BUFSIZ] = "";
 static int    barpos = 0;
 static size_t mw, mh;
 static size_t lines = 0;
-static size_t inputw, promptw;
+static size_t inputw, inputmax, promptw;
 static size_t cursor;
 static char  *prompt = NULL;
-static Item  *items = NULL;
+static Item **items = NULL;            /* all items read so far */
+static size_t nitems, itemsize;
+static Item **cands = NULL;            /* items matching candtext, in input order */
+static size_t ncands;
+static char   candtext[sizeof text];
+static bool   candvalid;
+static char   tokbuf[sizeof text], *tokv[sizeof text / 2 + 1];
+static int    tokc;                    /* tokens of the query, in tokbuf */
+static Item  *lists[M_Last], *listends[M_Last];
+static int    infd = -1;               /* from which items are read, -1 once at end of file */
+static char  *pending;                 /* incomplete last line read from infd */
+static size_t npending, pendingsize;
 static Item  *matches, *matchend;
 static Item  *prev, *curr, *next, *sel;
 static struct termios tio_old, tio_new;
@@ -241,62 +263,78 @@ drawmenu(void) {
 
 static char*
 fstrstr(const char *s, const char *sub) {
-	for (size_t len = strlen(sub); *s; s++)
+	/* case sensitive search is left to the (usually vectorized) libc,
+	 * otherwise skip ahead to occurrences of the first character */
+	if (fstrncmp == strncmp)
+		return strstr(s, sub);
+	char first[] = { tolower((unsigned char)*sub), toupper((unsigned char)*sub), '\0' };
+	for (size_t len = strlen(sub); *(s += strcspn(s, first)); s++)
 		if (!fstrncmp(s, sub, len))
 			return (char*)s;
 	return NULL;
 }
 
+/* add item to the matching list if all tokens of the query match */
+static bool
+matchitem(Item *item) {
+	int i;
+
+	for (i = 0; i < tokc; i++)
+		if (!fstrstr(item->text, tokv[i]))
+			return false;
+	/* exact matches go first, then prefixes, then substrings */
+	if (!tokc || !fstrncmp(text, item->text, strlen(text) + 1))
+		i = M_Exact;
+	else if (!fstrncmp(tokv[0], item->text, strlen(tokv[0])))
+		i = M_Prefix;
+	else
+		i = M_Substr;
+	appenditem(item, &lists[i], &listends[i]);
+	return true;
+}
+
+/* join the lists of matching items */
+static void
+linkmatches(void) {
+	matches = matchend = NULL;
+	for (int i = 0; i < M_Last; i++) {
+		if (!lists[i])
+			continue;
+		lists[i]->left = matchend;
+		if (matchend)
+			matchend->right = lists[i];
+		else
+			matches = lists[i];
+		matchend = listends[i];
+		matchend->right = NULL;
+	}
+}
+
 static void
 match(void)
 {
-	static char **tokv = NULL;
-	static int tokn = 0;
-
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
-	size_t len, textsize;
-	Item *item, *lprefix, *lsubstr, *prefixend, *substrend;
+	Item **source = items;
+	size_t i, n = nitems;
+	char *s;
 
-	strcpy(buf, text);
+	strcpy(tokbuf, text);
 	/* separate input text into tokens to be matched individually */
-	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
-		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
-			die("Can't realloc.");
-	len = tokc ? strlen(tokv[0]) : 0;
+	for (tokc = 0, s = strtok(tokbuf, " "); s; s = strtok(NULL, " "))
+		tokv[tokc++] = s;
 
-	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
-	textsize = strlen(text) + 1;
-	for (item = items; item && item->text; item++) {
-		for (i = 0; i < tokc; i++)
-			if (!fstrstr(item->text, tokv[i]))
-				break;
-		if (i != tokc) /* not all tokens match */
-			continue;
-		/* exact matches go first, then prefixes, then substrings */
-		if (!tokc || !fstrncmp(text, item->text, textsize))
-			appenditem(item, &matches, &matchend);
-		else if (!fstrncmp(tokv[0], item->text, len))
-			appenditem(item, &lprefix, &prefixend);
-		else
-			appenditem(item, &lsubstr, &substrend);
-	}
-	if (lprefix) {
-		if (matches) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
-		} else
-			matches = lprefix;
-		matchend = prefixend;
-	}
-	if (lsubstr) {
-		if (matches) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
-		} else
-			matches = lsubstr;
-		matchend = substrend;
+	/* an extended query matches a subset of the previous matches */
+	if (candvalid && !strncmp(text, candtext, strlen(candtext))) {
+		source = cands;
+		n = ncands;
 	}
+	for (i = 0; i < M_Last; i++)
+		lists[i] = listends[i] = NULL;
+	for (i = 0, ncands = 0; i < n; i++)
+		if (matchitem(source[i]))
+			cands[ncands++] = source[i];
+	strcpy(candtext, text);
+	candvalid = true;
+	linkmatches();
 	curr = sel = matches;
 	calcoffsets();
 }
@@ -321,24 +359,117 @@ nextrune(int inc) {
 }
 
 static void
-readstdin(void) {
-	char buf[sizeof text], *p, *maxstr = NULL;
-	size_t i, max = 0, size = 0;
+additem(const char *s, size_t len) {
+	Item *item;
+
+	if (nitems == itemsize) {
+		itemsize = itemsize ? 2 * itemsize : BUFSIZ;
+		if (!(items = realloc(items, itemsize * sizeof *items)) ||
+		    !(cands = realloc(cands, itemsize * sizeof *cands)))
+			die("Can't realloc.");
+	}
+	if (!(item = malloc(sizeof *item + len + 1)))
+		die("Can't malloc.");
+	item->text = memcpy(item + 1, s, len);
+	item->text[len] = '\0';
+	items[nitems++] = item;
+	if (textw(item->text) > inputmax)
+		inputmax = textw(item->text);
+	if (candvalid && matchitem(item))
+		cands[ncands++] = item;
+}
 
-	for(i = 0; fgets(buf, sizeof buf, stdin); i++) {
-		if (i+1 >= size / sizeof *items)
-			if (!(items = realloc(items, (size += BUFSIZ))))
+/* read what is available from the input, at most a few megabytes at a
+ * time to stay responsive, and match the new items against the query */
+static void
+readinput(void) {
+	static char buf[1 << 16];
+	char *p, *s;
+	ssize_t r;
+
+	for (int i = 0; infd != -1 && i < 64; i++) {
+		if ((r = read(infd, buf, sizeof buf)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+		}
+		if (r <= 0) {
+			if (npending)
+				additem(pending, npending);
+			npending = 0;
+			close(infd);
+			infd = -1;
+			break;
+		}
+		for (s = buf; (p = memchr(s, '\n', buf + r - s)); s = p + 1) {
+			if (npending) {
+				if (npending + (p - s) > pendingsize &&
+				    !(pending = realloc(pending, pendingsize = npending + (p - s))))
+					die("Can't realloc.");
+				memcpy(pending + npending, s, p - s);
+				additem(pending, npending + (p - s));
+				npending = 0;
+			} else {
+				additem(s, p - s);
+			}
+		}
+		if (s < buf + r) {
+			if (npending + (buf + r - s) > pendingsize &&
+			    !(pending = realloc(pending, pendingsize = 2 * (npending + (buf + r - s)))))
 				die("Can't realloc.");
-		if ((p = strchr(buf, '\n')))
-			*p = '\0';
-		if (!(items[i].text = strdup(buf)))
-			die("Can't strdup.");
-		if (strlen(items[i].text) > max)
-			max = textw(maxstr = items[i].text);
+			memcpy(pending + npending, s, buf + r - s);
+			npending += buf + r - s;
+		}
+	}
+	inputw = mw ? MIN(inputmax, mw/3) : inputmax;
+	if (!candvalid)
+		return;
+	linkmatches();
+	if (!curr)
+		curr = sel = matches;
+	calcoffsets();
+}
+
+/* wait until a key is pressed, meanwhile keep reading the input */
+static void
+waitkey(void) {
+	while (infd != -1) {
+		struct pollfd fds[] = {
+			{ .fd = 0, .events = POLLIN },
+			{ .fd = infd, .events = POLLIN },
+		};
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("Can not poll.");
+		}
+		if (fds[1].revents) {
+			readinput();
+			drawmenu();
+		}
+		if (fds[0].revents)
+			return;
+	}
+}
+
+static void
+openinput(void) {
+	inputmax = textw(NULL);
+	if (isatty(0)) {
+		/* items are typed in, read them all before the keyboard is used */
+		infd = 0;
+		while (infd != -1)
+			readinput();
+		return;
 	}
-	if (items)
-		items[i].text = NULL;
-	inputw = textw(maxstr);
+	/* keep the input open once stdin is reopened to read the keyboard,
+	 * the menu is shown and filtered while items are still arriving */
+	if ((infd = dup(0)) == -1)
+		die("Can't dup.");
+	fcntl(infd, F_SETFD, FD_CLOEXEC);
+	fcntl(infd, F_SETFL, fcntl(infd, F_GETFL) | O_NONBLOCK);
+	readinput();
 }
 
 static void
@@ -386,7 +517,7 @@ setup(void) {
 
 	lines = MIN(MAX(lines, 0), mh);
 	promptw = prompt ? textw(prompt) : 0;
-	inputw = MIN(inputw, mw/3);
+	inputw = MIN(inputmax, mw/3);
 	match();
 	if (barpos != 0) resetline();
 	drawmenu();
@@ -398,6 +529,7 @@ run(void) {
 	char c;
 
 	for (;;) {
+		waitkey();
 		xread(0, &c, 1);
 		memset(buf, '\0', sizeof buf);
 		buf[0] = c;
@@ -635,7 +767,7 @@ main(int argc, char **argv) {
 		}
 	}
 
-	readstdin();
+	openinput();
 	setup();
 	int status = run();
 	cleanup();
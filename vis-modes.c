@@ -106,16 +106,86 @@ enum VisMode vis_mode_get(Vis *vis) {
 	return vis->mode->id;
 }
 
-static bool mode_unmap(Mode *mode, const char *key) {
-	return mode && mode->bindings && map_delete(mode->bindings, key);
+typedef struct {
+	Array *entries;
+	bool error;
+} LookupCollect;
+
+static bool lookup_collect(const char *key, void *value, void *data) {
+	LookupCollect *collect = data;
+	KeyEntry entry = { .key = key, .binding = value };
+	collect->error = !array_add(collect->entries, &entry);
+	return !collect->error;
+}
+
+static int lookup_cmp(const void *a, const void *b) {
+	return strcmp(((const KeyEntry*)a)->key, ((const KeyEntry*)b)->key);
+}
+
+/* append the bindings of all modes in the order they are searched: the
+ * window overlay before the global mode, the mode before its parent */
+static bool lookup_build(Vis *vis, KeyTable *table) {
+	array_clear(&table->entries);
+	array_clear(&table->levels);
+	for (Mode *global_mode = vis->mode; global_mode; global_mode = global_mode->parent) {
+		for (int global = vis->win ? 0 : 1; global < 2; global++) {
+			Mode *mode = global ? global_mode : &vis->win->modes[global_mode->id];
+			if (!mode->bindings || map_empty(mode->bindings))
+				continue;
+			LookupCollect collect = { .entries = &table->entries };
+			size_t start = array_length(&table->entries);
+			map_iterate(mode->bindings, lookup_collect, &collect);
+			size_t end = array_length(&table->entries);
+			if (collect.error || !array_add(&table->levels, &end))
+				return false;
+			qsort(array_get(&table->entries, start), end - start, sizeof(KeyEntry), lookup_cmp);
+		}
+	}
+	table->generation = vis->bindings_generation;
+	return true;
+}
+
+const KeyTable *mode_lookup(Vis *vis) {
+	Mode *mode = vis->win ? &vis->win->modes[vis->mode->id] : vis->mode;
+	KeyTable *table = mode->lookup;
+	if (table && table->generation == vis->bindings_generation)
+		return table;
+	if (!table) {
+		if (!(table = calloc(1, sizeof *table)))
+			return NULL;
+		array_init_sized(&table->entries, sizeof(KeyEntry));
+		array_init_sized(&table->levels, sizeof(size_t));
+		mode->lookup = table;
+	}
+	if (!lookup_build(vis, table)) {
+		mode_lookup_free(mode);
+		return NULL;
+	}
+	return table;
+}
+
+void mode_lookup_free(Mode *mode) {
+	if (!mode->lookup)
+		return;
+	array_release(&mode->lookup->entries);
+	array_release(&mode->lookup->levels);
+	free(mode->lookup);
+	mode->lookup = NULL;
+}
+
+static bool mode_unmap(Vis *vis, Mode *mode, const char *key) {
+	if (!mode || !mode->bindings || !map_delete(mode->bindings, key))
+		return false;
+	vis->bindings_generation++;
+	return true;
 }
 
 bool vis_mode_unmap(Vis *vis, enum VisMode id, const char *key) {
-	return id < LENGTH(vis_modes) && mode_unmap(&vis_modes[id], key);
+	return id < LENGTH(vis_modes) && mode_unmap(vis, &vis_modes[id], key);
 }
 
 bool vis_window_mode_unmap(Win *win, enum VisMode id, const char *key) {
-	return id < LENGTH(win->modes) && mode_unmap(&win->modes[id], key);
+	return id < LENGTH(win->modes) && mode_unmap(win->vis, &win->modes[id], key);
 }
 
 static bool mode_map(Vis *vis, Mode *mode, bool force, const char *key, const KeyBinding *binding) {
@@ -125,9 +195,12 @@ static bool mode_map(Vis *vis, Mode *mode, bool force, const char *key, const Ke
 		return false;
 	if (!mode->bindings && !(mode->bindings = map_new()))
 		return false;
-	if (force)
-		map_delete(mode->bindings, key);
-	return map_put(mode->bindings, key, binding);
+	if (force && map_delete(mode->bindings, key))
+		vis->bindings_generation++;
+	if (!map_put(mode->bindings, key, binding))
+		return false;
+	vis->bindings_generation++;
+	return true;
 }
 
 bool vis_mode_map(Vis *vis, enum VisMode id, bool force, const char *key, const KeyBinding *binding) {
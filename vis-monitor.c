@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+#include "vis-core.h"
+
+/* Detection of modifications of the open files outside the editor.
+ *
+ * On Linux the directories containing the files are watched with inotify(7),
+ * which also notices files replaced by a rename(2). An event merely marks
+ * the files with a matching name, they are compared with the information
+ * found on disk once all pending events were read. Otherwise, or once no
+ * more watches can be added, the files are checked periodically.
+ *
+ * A change is reported once. If the autoreload option is enabled, content
+ * appended to an unmodified file is loaded, as for a log file which is being
+ * written to. Everything else is left to an explicit :e!
+ */
+
+#define MONITOR_POLL_INTERVAL 2 /* seconds between checks of the files which are not watched */
+
+static bool monitored(File *file) {
+	return file->name && !file->internal;
+}
+
+static bool stat_differ(const struct stat *a, const struct stat *b) {
+	return a->st_dev != b->st_dev || a->st_ino != b->st_ino || a->st_size != b->st_size ||
+	       a->st_mtime != b->st_mtime;
+}
+
+/* append the new content to the text, moving cursors at its end along */
+static bool file_follow(Vis *vis, File *file) {
+	size_t size = text_size(file->text);
+	/* appending to compressed data does not append to the content */
+	if (file_codec(file->name) || !text_load_tail(file->text, file->name, vis->load_method))
+		return false;
+	file->stat = file->monitor.seen = text_stat(file->text);
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file != file)
+			continue;
+		if (view_cursors_pos(win->view.selection) == size)
+			view_cursors_to(win->view.selection, text_size(file->text));
+		view_draw(&win->view);
+	}
+	return true;
+}
+
+static void file_check(Vis *vis, File *file) {
+	file->monitor.check = false;
+	/* content read later is up to date, the own saves are compared once completed */
+	if (!monitored(file) || file->pending || file->save.ctx)
+		return;
+	struct stat now = { 0 };
+	bool exists = stat(file->name, &now) == 0;
+	if (!stat_differ(&now, &file->monitor.seen))
+		return;
+	file->monitor.seen = now;
+	if (!stat_differ(&now, &file->stat))
+		return;
+	if (!exists)
+		vis_info_show(vis, "WARNING: file `%s' was removed", file_name_get(file));
+	else if (!vis->autoreload || !file_follow(vis, file))
+		vis_info_show(vis, "WARNING: file `%s' changed on disk", file_name_get(file));
+}
+
+static bool monitor_timer(Vis *vis, void *data) {
+	bool polled = false;
+	for (File *file = vis->files; file; file = file->next) {
+		if (monitored(file) && file->monitor.wd == -1) {
+			file_check(vis, file);
+			polled = true;
+		}
+	}
+	if (!polled)
+		vis->monitor.timer = 0;
+	return polled;
+}
+
+static void monitor_poll(Vis *vis, File *file) {
+	file->monitor.wd = -1;
+	if (!vis->monitor.timer)
+		vis->monitor.timer = vis_timer(vis, MONITOR_POLL_INTERVAL, MONITOR_POLL_INTERVAL, monitor_timer, NULL, NULL);
+}
+
+#if HAVE_INOTIFY
+static void monitor_unwatch(Vis *vis, File *file) {
+	FileMonitor *mon = &vis->monitor;
+	size_t *refs = file->monitor.wd >= 0 ? array_get(&mon->watches, file->monitor.wd) : NULL;
+	if (refs && *refs > 0 && --(*refs) == 0)
+		inotify_rm_watch(mon->inotify, file->monitor.wd);
+	file->monitor.wd = -1;
+}
+
+static void monitor_inotify_ready(Vis *vis, int fd, short revents, void *data) {
+	FileMonitor *mon = &vis->monitor;
+	char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof buf)) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *event = (struct inotify_event*)p;
+			p += sizeof(*event) + event->len;
+			for (File *file = vis->files; file; file = file->next) {
+				if (!monitored(file))
+					continue;
+				if (event->mask & IN_Q_OVERFLOW) {
+					file->monitor.check = true;
+				} else if (file->monitor.wd == event->wd) {
+					if (event->mask & IN_IGNORED) {
+						/* the directory is gone */
+						file->monitor.check = true;
+						monitor_poll(vis, file);
+					} else if (event->len && !strcmp(event->name, strrchr(file->name, '/') + 1)) {
+						file->monitor.check = true;
+					}
+				}
+			}
+			if ((event->mask & IN_IGNORED) && event->wd >= 0 && (size_t)event->wd < array_length(&mon->watches))
+				*(size_t*)array_get(&mon->watches, event->wd) = 0;
+		}
+	}
+	if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+		/* fall back to polling */
+		vis_unwatch(vis, fd);
+		close(mon->inotify);
+		mon->inotify = -1;
+		array_clear(&mon->watches);
+		for (File *file = vis->files; file; file = file->next) {
+			if (monitored(file))
+				monitor_poll(vis, file);
+		}
+	}
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->monitor.check)
+			file_check(vis, file);
+	}
+}
+
+static bool monitor_watch(Vis *vis, File *file) {
+	FileMonitor *mon = &vis->monitor;
+	if (!mon->init) {
+		mon->init = true;
+		array_init_sized(&mon->watches, sizeof(size_t));
+		mon->inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if (mon->inotify != -1 && !vis_watch(vis, mon->inotify, POLLIN, monitor_inotify_ready, NULL)) {
+			close(mon->inotify);
+			mon->inotify = -1;
+		}
+	}
+	if (mon->inotify == -1)
+		return false;
+	char *dir = strdup(file->name);
+	if (!dir)
+		return false;
+	/* the name is absolute, the root directory thus becomes empty */
+	*strrchr(dir, '/') = '\0';
+	int wd = inotify_add_watch(mon->inotify, dir[0] ? dir : "/",
+		IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR);
+	free(dir);
+	if (wd < 0)
+		return false;
+	size_t none = 0;
+	while (array_length(&mon->watches) <= (size_t)wd) {
+		if (!array_add(&mon->watches, &none)) {
+			inotify_rm_watch(mon->inotify, wd);
+			return false;
+		}
+	}
+	(*(size_t*)array_get(&mon->watches, wd))++;
+	file->monitor.wd = wd;
+	return true;
+}
+#endif
+
+void vis_monitor_file(Vis *vis, File *file) {
+	vis_monitor_file_free(vis, file);
+	if (!monitored(file))
+		return;
+	file->monitor.seen = file->stat;
+#if HAVE_INOTIFY
+	if (monitor_watch(vis, file))
+		return;
+#endif
+	monitor_poll(vis, file);
+}
+
+void vis_monitor_file_check(Vis *vis, File *file) {
+	file_check(vis, file);
+}
+
+void vis_monitor_file_free(Vis *vis, File *file) {
+#if HAVE_INOTIFY
+	monitor_unwatch(vis, file);
+#endif
+	file->monitor.wd = -1;
+	file->monitor.check = false;
+}
+
+void vis_monitor_free(Vis *vis) {
+	FileMonitor *mon = &vis->monitor;
+	for (File *file = vis->files; file; file = file->next)
+		vis_monitor_file_free(vis, file);
+	if (mon->timer)
+		vis_timer_cancel(vis, mon->timer);
+#if HAVE_INOTIFY
+	if (mon->init && mon->inotify != -1) {
+		vis_unwatch(vis, mon->inotify);
+		close(mon->inotify);
+	}
+	if (mon->init)
+		array_release(&mon->watches);
+#endif
+	*mon = (FileMonitor){ 0 };
+}
@@ -7,6 +7,14 @@
 #include "text-util.h"
 #include "util.h"
 
+static size_t search_timed(Vis *vis, Text *txt, size_t pos, Regex *regex,
+                           size_t (*search)(Text*, size_t, Regex*)) {
+	double start = vis_time();
+	pos = search(txt, pos, regex);
+	vis_stats_add(vis, VIS_STAT_SEARCH, 1, vis_time() - start);
+	return pos;
+}
+
 static Regex *search_word(Vis *vis, Text *txt, size_t pos) {
 	char expr[512];
 	Filerange word = text_object_word(txt, pos);
@@ -29,9 +37,9 @@ static size_t search_word_forward(Vis *vis, Text *txt, size_t pos) {
 	Regex *regex = search_word(vis, txt, pos);
 	if (regex) {
 		vis->search_direction = VIS_MOVE_SEARCH_REPEAT_FORWARD;
-		pos = text_search_forward(txt, pos, regex);
+		pos = search_timed(vis, txt, pos, regex, text_search_forward);
 	}
-	text_regex_free(regex);
+	vis_regex_free(vis, regex);
 	return pos;
 }
 
@@ -39,25 +47,30 @@ static size_t search_word_backward(Vis *vis, Text *txt, size_t pos) {
 	Regex *regex = search_word(vis, txt, pos);
 	if (regex) {
 		vis->search_direction = VIS_MOVE_SEARCH_REPEAT_BACKWARD;
-		pos = text_search_backward(txt, pos, regex);
+		pos = search_timed(vis, txt, pos, regex, text_search_backward);
 	}
-	text_regex_free(regex);
+	vis_regex_free(vis, regex);
 	return pos;
 }
 
 static size_t search_forward(Vis *vis, Text *txt, size_t pos) {
+	size_t match = vis_search_next(vis, txt, pos);
+	if (match != EPOS)
+		return match;
 	Regex *regex = vis_regex(vis, NULL);
 	if (regex)
-		pos = text_search_forward(txt, pos, regex);
-	text_regex_free(regex);
+		pos = search_timed(vis, txt, pos, regex, text_search_forward);
+	vis_regex_free(vis, regex);
 	return pos;
 }
 
 static size_t search_backward(Vis *vis, Text *txt, size_t pos) {
+	/* not taken from the index, the preceding match is the last one of the
+	 * successive matches before pos, which excludes overlapping ones */
 	Regex *regex = vis_regex(vis, NULL);
 	if (regex)
-		pos = text_search_backward(txt, pos, regex);
-	text_regex_free(regex);
+		pos = search_timed(vis, txt, pos, regex, text_search_backward);
+	vis_regex_free(vis, regex);
 	return pos;
 }
 
@@ -298,7 +311,7 @@ bool vis_motion(Vis *vis, enum VisMotion motion, ...) {
 			vis_cancel(vis);
 			goto err;
 		}
-		text_regex_free(regex);
+		vis_regex_free(vis, regex);
 		if (motion == VIS_MOVE_SEARCH_FORWARD)
 			motion = VIS_MOVE_SEARCH_REPEAT_FORWARD;
 		else
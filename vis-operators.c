@@ -1,14 +1,19 @@
 #include <string.h>
 #include <ctype.h>
+#include <wchar.h>
 #include "vis-core.h"
 #include "text-motions.h"
 #include "text-objects.h"
 #include "text-util.h"
 #include "util.h"
 
-static size_t op_delete(Vis *vis, Text *txt, OperatorContext *c) {
+static void op_delete_register(Vis *vis, Text *txt, OperatorContext *c) {
 	c->reg->linewise = c->linewise;
 	register_slot_put_range(vis, c->reg, c->reg_slot, txt, &c->range);
+}
+
+static size_t op_delete(Vis *vis, Text *txt, OperatorContext *c) {
+	op_delete_register(vis, txt, c);
 	text_delete_range(txt, &c->range);
 	size_t pos = c->range.start;
 	if (c->linewise && pos == text_size(txt))
@@ -16,6 +21,16 @@ static size_t op_delete(Vis *vis, Text *txt, OperatorContext *c) {
 	return pos;
 }
 
+static size_t op_delete_batch(Vis *vis, Text *txt, OperatorContext *c, Array *edits) {
+	if (c->linewise && c->range.end == text_size(txt))
+		return EPOS;
+	TextEdit edit = { .range = c->range };
+	if (!array_add(edits, &edit))
+		return EPOS;
+	op_delete_register(vis, txt, c);
+	return c->range.start;
+}
+
 static size_t op_change(Vis *vis, Text *txt, OperatorContext *c) {
 	bool linewise = c->linewise || text_range_is_linewise(txt, &c->range);
 	op_delete(vis, txt, c);
@@ -28,6 +43,12 @@ static size_t op_change(Vis *vis, Text *txt, OperatorContext *c) {
 	return pos;
 }
 
+static size_t op_change_batch(Vis *vis, Text *txt, OperatorContext *c, Array *edits) {
+	if (c->linewise || text_range_is_linewise(txt, &c->range))
+		return EPOS;
+	return op_delete_batch(vis, txt, c, edits);
+}
+
 static size_t op_yank(Vis *vis, Text *txt, OperatorContext *c) {
 	c->reg->linewise = c->linewise;
 	register_slot_put_range(vis, c->reg, c->reg_slot, txt, &c->range);
@@ -62,15 +83,11 @@ static size_t op_put(Vis *vis, Text *txt, OperatorContext *c) {
 		break;
 	}
 
-	size_t len;
-	const char *data = register_slot_get(vis, c->reg, c->reg_slot, &len);
-
 	for (int i = 0; i < c->count; i++) {
 		char nl;
 		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
 			pos += text_insert(txt, pos, "\n", 1);
-		text_insert(txt, pos, data, len);
-		pos += len;
+		pos += register_slot_insert(vis, c->reg, c->reg_slot, txt, pos);
 		if (c->reg->linewise && pos > 0 && text_byte_get(txt, pos-1, &nl) && nl != '\n')
 			pos += text_insert(txt, pos, "\n", 1);
 	}
@@ -100,6 +117,86 @@ static size_t op_put(Vis *vis, Text *txt, OperatorContext *c) {
 	return pos;
 }
 
+/* offset of the last character of data, as determined by text_char_prev */
+static size_t op_put_char_prev(const char *data, size_t len) {
+	for (size_t pos = len; pos > 0; ) {
+		while (--pos > 0 && ((unsigned char)data[pos] & 0xC0) == 0x80);
+		wchar_t wc;
+		mbstate_t ps = { 0 };
+		size_t wclen = mbrtowc(&wc, data + pos, len - pos, &ps);
+		if (wclen == (size_t)-1 || wclen == (size_t)-2 || wclen == 0 || wcwidth(wc) != 0)
+			return pos;
+	}
+	return EPOS;
+}
+
+/* covers putting without a selection to replace and linewise content
+ * only after the cursor or to the end of the inserted lines */
+static size_t op_put_batch(Vis *vis, Text *txt, OperatorContext *c, Array *edits) {
+	char b;
+	size_t pos = c->pos, newpos;
+	if (text_range_size(&c->range) > 0)
+		return EPOS;
+	size_t len;
+	const char *data = register_slot_get(vis, c->reg, c->reg_slot, &len);
+	bool linewise = c->reg->linewise;
+	if (linewise && (c->arg->i == VIS_OP_PUT_BEFORE || len == 0 || data[len-1] != '\n'))
+		return EPOS;
+
+	switch (c->arg->i) {
+	case VIS_OP_PUT_AFTER:
+	case VIS_OP_PUT_AFTER_END:
+		if (linewise)
+			pos = text_line_next(txt, pos);
+		else if (text_byte_get(txt, pos, &b) && b != '\n')
+			pos = text_char_next(txt, pos);
+		break;
+	case VIS_OP_PUT_BEFORE_END:
+		if (linewise)
+			pos = text_line_begin(txt, pos);
+		break;
+	}
+
+	size_t lead = linewise && pos > 0 && text_byte_get(txt, pos-1, &b) && b != '\n';
+	size_t inserted = lead + len * c->count;
+
+	if (linewise && c->arg->i == VIS_OP_PUT_AFTER) {
+		/* first non-blank of the first inserted line */
+		if (pos == c->pos && !lead)
+			return EPOS;
+		size_t off = 0;
+		while (data[off] == ' ' || data[off] == '\t')
+			off++;
+		newpos = pos + lead + off;
+	} else if (linewise) {
+		/* first non-blank of the line following the inserted ones */
+		Iterator it = text_iterator_get(txt, pos);
+		while (text_iterator_byte_get(&it, &b) && (b == ' ' || b == '\t'))
+			text_iterator_byte_next(&it, NULL);
+		newpos = it.pos + inserted;
+	} else if (c->arg->i == VIS_OP_PUT_AFTER || c->arg->i == VIS_OP_PUT_BEFORE) {
+		/* last character of the inserted text */
+		if (inserted == 0) {
+			newpos = text_char_prev(txt, pos);
+		} else {
+			size_t off = op_put_char_prev(data, len);
+			if (off == EPOS)
+				return EPOS;
+			newpos = pos + inserted - len + off;
+		}
+	} else {
+		newpos = pos + inserted;
+	}
+
+	TextEdit edit[] = {
+		{ .range = { pos, pos }, .data = "\n", .len = 1, .count = lead },
+		{ .range = { pos, pos }, .data = data, .len = len, .count = c->count },
+	};
+	if (!array_add(edits, &edit[0]) || !array_add(edits, &edit[1]))
+		return EPOS;
+	return newpos;
+}
+
 static size_t op_shift_right(Vis *vis, Text *txt, OperatorContext *c) {
 	char spaces[9] = "         ";
 	spaces[MIN(vis->win->view.tabwidth, LENGTH(spaces) - 1)] = '\0';
@@ -222,6 +319,18 @@ static size_t op_replace(Vis *vis, Text *txt, OperatorContext *c) {
 	return c->range.start;
 }
 
+static size_t op_replace_batch(Vis *vis, Text *txt, OperatorContext *c, Array *edits) {
+	size_t count = 0;
+	Iterator it = text_iterator_get(txt, c->range.start);
+	while (it.pos < c->range.end && text_iterator_char_next(&it, NULL))
+		count++;
+	TextEdit edit = { .range = c->range, .data = c->arg->s, .len = strlen(c->arg->s), .count = count };
+	if (!array_add(edits, &edit))
+		return EPOS;
+	op_delete_register(vis, txt, c);
+	return c->range.start;
+}
+
 int vis_operator_register(Vis *vis, VisOperatorFunction *func, void *context) {
 	Operator *op = calloc(1, sizeof *op);
 	if (!op)
@@ -321,14 +430,14 @@ err:
 }
 
 const Operator vis_operators[] = {
-	[VIS_OP_DELETE]      = { op_delete      },
-	[VIS_OP_CHANGE]      = { op_change      },
+	[VIS_OP_DELETE]      = { op_delete,     NULL, op_delete_batch  },
+	[VIS_OP_CHANGE]      = { op_change,     NULL, op_change_batch  },
 	[VIS_OP_YANK]        = { op_yank        },
-	[VIS_OP_PUT_AFTER]   = { op_put         },
+	[VIS_OP_PUT_AFTER]   = { op_put,        NULL, op_put_batch     },
 	[VIS_OP_SHIFT_RIGHT] = { op_shift_right },
 	[VIS_OP_SHIFT_LEFT]  = { op_shift_left  },
 	[VIS_OP_JOIN]        = { op_join        },
 	[VIS_OP_MODESWITCH]  = { op_modeswitch  },
-	[VIS_OP_REPLACE]     = { op_replace     },
+	[VIS_OP_REPLACE]     = { op_replace,    NULL, op_replace_batch },
 	[VIS_OP_CURSOR_SOL]  = { op_cursor      },
 };
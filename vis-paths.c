@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+#include "vis-core.h"
+
+/* Index of the file names below the working directory, used for completion.
+ *
+ * For every directory the names of its entries are kept in a sorted array,
+ * the directories themselves are found by their path relative to the root
+ * in a crit-bit tree, which supports listing whole subtrees. Hidden entries
+ * are skipped and symbolic links are not followed.
+ *
+ * The tree is scanned one directory at a time while the editor is idle. On
+ * Linux each directory is then watched with inotify(7) and rescanned once
+ * an entry is created, deleted or renamed. Otherwise, or once no more
+ * watches can be added, the modification times of the directories are
+ * checked periodically.
+ */
+
+#define PATHS_POLL_INTERVAL 2 /* seconds between checks of the directories which are not watched */
+#define PATHS_POLL_COUNT 256  /* directories checked per idle invocation */
+#define PATHS_QUERY_TIME 0.2  /* seconds a query spends scanning before returning partial results */
+
+struct PathDir {
+	char *path;            /* relative to the root with a trailing slash, empty for the root itself */
+	Array names;           /* char* of the entries in sorted order, directories with a trailing slash */
+	time_t scanned;        /* time of the latest scan */
+	int wd;                /* inotify watch descriptor, -1 if the directory is polled */
+	size_t slot;           /* index into PathIndex.all */
+	bool queued;           /* whether it is waiting to be scanned */
+};
+
+static int name_cmp(const void *a, const void *b) {
+	return strcmp(*(char * const*)a, *(char * const*)b);
+}
+
+static void names_release(Array *names) {
+	array_release_full(names);
+}
+
+static bool path_absolute(PathIndex *idx, const char *rel, char path[static PATH_MAX]) {
+	int len = snprintf(path, PATH_MAX, "%s/%s", idx->root, rel);
+	return len >= 0 && len < PATH_MAX;
+}
+
+static void dir_watch(PathIndex *idx, PathDir *dir) {
+	dir->wd = -1;
+#if HAVE_INOTIFY
+	char path[PATH_MAX];
+	if (idx->inotify == -1 || !path_absolute(idx, dir->path, path))
+		return;
+	int wd = inotify_add_watch(idx->inotify, path, IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR);
+	if (wd < 0)
+		return;
+	while (array_length(&idx->watches) <= (size_t)wd) {
+		if (!array_add_ptr(&idx->watches, NULL)) {
+			inotify_rm_watch(idx->inotify, wd);
+			return;
+		}
+	}
+	array_set_ptr(&idx->watches, wd, dir);
+	dir->wd = wd;
+#endif
+}
+
+static void dir_unwatch(PathIndex *idx, PathDir *dir) {
+#if HAVE_INOTIFY
+	if (dir->wd != -1) {
+		inotify_rm_watch(idx->inotify, dir->wd);
+		array_set_ptr(&idx->watches, dir->wd, NULL);
+	}
+#endif
+	dir->wd = -1;
+}
+
+static void dir_queue(PathIndex *idx, PathDir *dir) {
+	if (!dir->queued)
+		dir->queued = array_add_ptr(&idx->queue, dir);
+}
+
+static PathDir *dir_add(PathIndex *idx, const char *path) {
+	PathDir *dir = calloc(1, sizeof *dir);
+	if (!dir)
+		return NULL;
+	array_init(&dir->names);
+	if (!(dir->path = strdup(path)))
+		goto err;
+	dir->slot = array_length(&idx->all);
+	if (!array_add_ptr(&idx->all, dir))
+		goto err;
+	if (!map_put(idx->dirs, dir->path, dir)) {
+		array_remove(&idx->all, dir->slot);
+		goto err;
+	}
+	dir_watch(idx, dir);
+	dir_queue(idx, dir);
+	return dir;
+err:
+	free(dir->path);
+	free(dir);
+	return NULL;
+}
+
+static void dir_free(PathIndex *idx, PathDir *dir) {
+	dir_unwatch(idx, dir);
+	map_delete(idx->dirs, dir->path);
+	/* move the last directory into the vacated slot */
+	size_t last = array_length(&idx->all) - 1;
+	PathDir *moved = array_get_ptr(&idx->all, last);
+	array_set_ptr(&idx->all, dir->slot, moved);
+	moved->slot = dir->slot;
+	array_truncate(&idx->all, last);
+	if (dir->queued) {
+		for (size_t i = 0, len = array_length(&idx->queue); i < len; i++) {
+			if (array_get_ptr(&idx->queue, i) == dir) {
+				array_remove(&idx->queue, i);
+				break;
+			}
+		}
+	}
+	names_release(&dir->names);
+	free(dir->path);
+	free(dir);
+}
+
+static bool dir_collect(const char *key, void *value, void *data) {
+	return array_add_ptr(data, value);
+}
+
+/* remove a directory together with everything below it */
+static void dir_remove(PathIndex *idx, const char *path) {
+	Array subtree;
+	array_init(&subtree);
+	map_iterate(map_prefix(idx->dirs, path), dir_collect, &subtree);
+	for (size_t i = 0, len = array_length(&subtree); i < len; i++)
+		dir_free(idx, array_get_ptr(&subtree, i));
+	array_release(&subtree);
+}
+
+/* read the entries of a directory, adding and removing subdirectories */
+static void dir_scan(PathIndex *idx, PathDir *dir) {
+	char path[PATH_MAX];
+	dir->queued = false;
+	int fd = path_absolute(idx, dir->path, path) ? open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC) : -1;
+	DIR *d = fd == -1 ? NULL : fdopendir(fd);
+	if (!d) {
+		if (fd != -1)
+			close(fd);
+		/* vanished, its parent is going to notice */
+		names_release(&dir->names);
+		array_init(&dir->names);
+		return;
+	}
+	dir->scanned = time(NULL);
+	Array names;
+	array_init(&names);
+	for (struct dirent *e; (e = readdir(d)); ) {
+		if (e->d_name[0] == '.')
+			continue;
+		struct stat st;
+		bool isdir = fstatat(fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+		size_t len = strlen(e->d_name);
+		char *name = malloc(len + 2);
+		if (!name)
+			continue;
+		memcpy(name, e->d_name, len);
+		name[len] = isdir ? '/' : '\0';
+		name[len+1] = '\0';
+		if (!array_add_ptr(&names, name))
+			free(name);
+	}
+	closedir(d);
+	array_sort(&names, name_cmp);
+
+	/* compare the old and new subdirectories, both lists are sorted */
+	size_t i = 0, j = 0, old = array_length(&dir->names), new = array_length(&names);
+	while (i < old || j < new) {
+		char *a = i < old ? array_get_ptr(&dir->names, i) : NULL;
+		char *b = j < new ? array_get_ptr(&names, j) : NULL;
+		int cmp = !a ? 1 : !b ? -1 : strcmp(a, b);
+		const char *changed = cmp < 0 ? a : cmp > 0 ? b : NULL;
+		if (cmp <= 0)
+			i++;
+		if (cmp >= 0)
+			j++;
+		if (!changed || changed[strlen(changed)-1] != '/')
+			continue;
+		char sub[PATH_MAX];
+		int len = snprintf(sub, sizeof sub, "%s%s", dir->path, changed);
+		if (len < 0 || len >= (int)sizeof sub)
+			continue;
+		if (cmp < 0)
+			dir_remove(idx, sub);
+		else if (!map_get(idx->dirs, sub))
+			dir_add(idx, sub);
+	}
+	names_release(&dir->names);
+	dir->names = names;
+}
+
+/* check at most count polled directories for modifications */
+static void dirs_poll(PathIndex *idx, size_t count) {
+	for (; idx->poll > 0 && count > 0; idx->poll--) {
+		size_t len = array_length(&idx->all);
+		if (!len)
+			break;
+		PathDir *dir = array_get_ptr(&idx->all, idx->poll_next++ % len);
+		if (dir->wd != -1 || dir->queued)
+			continue;
+		char path[PATH_MAX];
+		struct stat st;
+		count--;
+		/* the resolution is a second, modifications within the one of
+		 * the latest scan might have been missed */
+		if (!path_absolute(idx, dir->path, path) || stat(path, &st) == -1 || st.st_mtime >= dir->scanned)
+			dir_queue(idx, dir);
+	}
+}
+
+static bool paths_task(Vis *vis, void *data) {
+	PathIndex *idx = &vis->paths;
+	size_t len = array_length(&idx->queue);
+	if (len) {
+		PathDir *dir = array_get_ptr(&idx->queue, len - 1);
+		array_truncate(&idx->queue, len - 1);
+		dir_scan(idx, dir);
+	} else {
+		dirs_poll(idx, PATHS_POLL_COUNT);
+	}
+	idx->task = array_length(&idx->queue) > 0 || idx->poll > 0;
+	return idx->task;
+}
+
+static void paths_schedule(Vis *vis) {
+	PathIndex *idx = &vis->paths;
+	if (!idx->task && (array_length(&idx->queue) || idx->poll))
+		idx->task = vis_defer(vis, paths_task, NULL, NULL);
+}
+
+static bool paths_timer(Vis *vis, void *data) {
+	PathIndex *idx = &vis->paths;
+	idx->poll = array_length(&idx->all);
+	paths_schedule(vis);
+	return true;
+}
+
+#if HAVE_INOTIFY
+static void paths_inotify_ready(Vis *vis, int fd, short revents, void *data) {
+	PathIndex *idx = &vis->paths;
+	char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof buf)) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *event = (struct inotify_event*)p;
+			p += sizeof(*event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				for (size_t i = 0, n = array_length(&idx->all); i < n; i++)
+					dir_queue(idx, array_get_ptr(&idx->all, i));
+				continue;
+			}
+			PathDir *dir = event->wd >= 0 ? array_get_ptr(&idx->watches, event->wd) : NULL;
+			if (!dir)
+				continue;
+			if (event->mask & IN_IGNORED) {
+				/* removed by the kernel, the directory is gone */
+				array_set_ptr(&idx->watches, event->wd, NULL);
+				dir->wd = -1;
+				continue;
+			}
+			dir_queue(idx, dir);
+		}
+	}
+	if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+		/* fall back to polling */
+		vis_unwatch(vis, fd);
+		for (size_t i = 0, n = array_length(&idx->all); i < n; i++)
+			dir_unwatch(idx, array_get_ptr(&idx->all, i));
+		close(idx->inotify);
+		idx->inotify = -1;
+	}
+	paths_schedule(vis);
+}
+#endif
+
+static bool paths_init(Vis *vis) {
+	PathIndex *idx = &vis->paths;
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof cwd))
+		return false;
+	if (idx->root && !strcmp(idx->root, cwd))
+		return true;
+	vis_paths_free(vis);
+	idx->inotify = -1;
+	array_init(&idx->all);
+	array_init(&idx->queue);
+	array_init(&idx->watches);
+	if (!(idx->root = strdup(cwd)) || !(idx->dirs = map_new()))
+		goto err;
+#if HAVE_INOTIFY
+	idx->inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (idx->inotify != -1 && !vis_watch(vis, idx->inotify, POLLIN, paths_inotify_ready, NULL)) {
+		close(idx->inotify);
+		idx->inotify = -1;
+	}
+#endif
+	if (!dir_add(idx, ""))
+		goto err;
+	if (!(idx->timer = vis_timer(vis, PATHS_POLL_INTERVAL, PATHS_POLL_INTERVAL, paths_timer, NULL, NULL)))
+		goto err;
+	return true;
+err:
+	vis_paths_free(vis);
+	return false;
+}
+
+typedef struct {
+	const char *pattern;
+	bool fuzzy;
+	bool (*func)(const char *path, void *data);
+	void *data;
+	bool done;
+} PathsMatch;
+
+/* report the entries of a directory matching the pattern, which has
+ * already been consumed up to the given offset by the directory path */
+static void match_dir(PathsMatch *match, PathDir *dir, size_t offset) {
+	const char *pattern = match->pattern + offset;
+	size_t plen = strlen(pattern), dlen = strlen(dir->path);
+	for (size_t i = 0, len = array_length(&dir->names); i < len && !match->done; i++) {
+		const char *name = array_get_ptr(&dir->names, i);
+		if (match->fuzzy) {
+			const char *p = pattern;
+			for (const char *n = name; *p && *n; n++) {
+				if (*p == *n)
+					p++;
+			}
+			if (*p)
+				continue;
+		} else if (strncmp(name, pattern, plen)) {
+			continue;
+		}
+		char path[PATH_MAX];
+		int n = snprintf(path, sizeof path, "%.*s%s", (int)dlen, dir->path, name);
+		if (n >= 0 && n < (int)sizeof path)
+			match->done = !match->func(path, match->data);
+	}
+}
+
+static bool match_subtree(const char *key, void *value, void *data) {
+	PathsMatch *match = data;
+	/* the directory the pattern ends in was already listed */
+	if (!strcmp(key, match->pattern))
+		return true;
+	match_dir(match, value, strlen(match->pattern));
+	return !match->done;
+}
+
+bool vis_paths_match(Vis *vis, const char *pattern, bool fuzzy, bool (*func)(const char *path, void *data), void *data) {
+	if (!paths_init(vis))
+		return false;
+	PathIndex *idx = &vis->paths;
+	/* scan synchronously for a while, the rest is done at idle time */
+	for (double end = vis_time() + PATHS_QUERY_TIME; array_length(&idx->queue) && vis_time() < end; )
+		paths_task(vis, NULL);
+	paths_schedule(vis);
+
+	while (pattern[0] == '.' && pattern[1] == '/')
+		pattern += 2;
+	PathsMatch match = { .pattern = pattern, .fuzzy = fuzzy, .func = func, .data = data };
+	if (fuzzy) {
+		for (size_t i = 0, len = array_length(&idx->all); i < len && !match.done; i++) {
+			PathDir *dir = array_get_ptr(&idx->all, i);
+			/* consume as much of the pattern as possible by the directory */
+			const char *p = pattern;
+			for (const char *d = dir->path; *p && *d; d++) {
+				if (*p == *d)
+					p++;
+			}
+			match_dir(&match, dir, p - pattern);
+		}
+	} else {
+		/* entries of the directory the pattern refers to, then everything
+		 * in the subdirectories starting with the pattern */
+		const char *slash = strrchr(pattern, '/');
+		size_t dlen = slash ? slash - pattern + 1 : 0;
+		char path[PATH_MAX];
+		if (dlen < sizeof path) {
+			memcpy(path, pattern, dlen);
+			path[dlen] = '\0';
+			PathDir *dir = map_get(idx->dirs, path);
+			if (dir)
+				match_dir(&match, dir, dlen);
+		}
+		if (!match.done && pattern[0])
+			map_iterate(map_prefix(idx->dirs, pattern), match_subtree, &match);
+	}
+	return array_length(&idx->queue) == 0;
+}
+
+void vis_paths_free(Vis *vis) {
+	PathIndex *idx = &vis->paths;
+	if (!idx->root)
+		return;
+	while (array_length(&idx->all))
+		dir_free(idx, array_get_ptr(&idx->all, 0));
+	if (idx->inotify != -1) {
+		vis_unwatch(vis, idx->inotify);
+		close(idx->inotify);
+	}
+	vis_timer_cancel(vis, idx->timer);
+	array_release(&idx->all);
+	array_release(&idx->queue);
+	array_release(&idx->watches);
+	map_free(idx->dirs);
+	free(idx->root);
+	*idx = (PathIndex){ .inotify = -1 };
+}
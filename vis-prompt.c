@@ -57,14 +57,14 @@ static const char *prompt_enter(Vis *vis, const char *keys, const Arg *arg) {
 	Filerange range = view_selections_get(view->selection);
 	if (!vis->mode->visual) {
 		const char *pattern = NULL;
-		Regex *regex = text_regex_new();
+		Regex *regex = NULL;
 		size_t pos = view_cursor_get(view);
 		if (prompt->file == vis->command_file)
 			pattern = "^:";
 		else if (prompt->file == vis->search_file)
 			pattern = "^(/|\\?)";
 		int cflags = REG_EXTENDED|REG_NEWLINE|(REG_ICASE*vis->ignorecase);
-		if (pattern && regex && text_regex_compile(regex, pattern, cflags) == 0) {
+		if (pattern && (regex = regex_cache_get(vis, pattern, cflags))) {
 			size_t end = text_line_end(txt, pos);
 			size_t prev = text_search_backward(txt, end, regex);
 			if (prev > pos)
@@ -74,7 +74,7 @@ static const char *prompt_enter(Vis *vis, const char *keys, const Arg *arg) {
 				next = text_size(txt);
 			range = text_range_new(prev, next);
 		}
-		text_regex_free(regex);
+		vis_regex_free(vis, regex);
 	}
 	if (text_range_valid(&range))
 		cmd = text_bytes_alloc0(txt, range.start, text_range_size(&range));
@@ -3,14 +3,36 @@
 
 #include "vis-core.h"
 
-static Buffer *register_buffer(Register *reg, size_t slot) {
-	Buffer *buf = array_get(&reg->values, slot);
-	if (buf)
-		return buf;
-	if (array_resize(&reg->values, slot) && (buf = array_get(&reg->values, slot)))
-		return buf;
-	Buffer new;
-	buffer_init(&new);
+/* ranges at least this large are referenced rather than copied, only the
+ * piece boundaries of the text are recorded until the content is needed */
+#define REGISTER_REFERENCE_SIZE (1 << 20)
+
+static void slot_unref(RegisterSlot *s) {
+	text_frozen_release(s->frozen);
+	s->frozen = NULL;
+	s->txt = NULL;
+}
+
+static bool slot_load(RegisterSlot *s) {
+	if (!s->frozen)
+		return true;
+	Buffer *buf = &s->buf;
+	size_t len = text_range_size(&s->range);
+	if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
+		return false;
+	buf->len = text_frozen_bytes_get(s->frozen, s->range.start, len, buf->data);
+	slot_unref(s);
+	return buffer_append(buf, "\0", 1);
+}
+
+static RegisterSlot *register_slot(Register *reg, size_t slot) {
+	RegisterSlot *s = array_get(&reg->values, slot);
+	if (s)
+		return s;
+	if (array_resize(&reg->values, slot) && (s = array_get(&reg->values, slot)))
+		return s;
+	RegisterSlot new = { 0 };
+	buffer_init(&new.buf);
 	if (!array_add(&reg->values, &new))
 		return NULL;
 	size_t capacity = array_capacity(&reg->values);
@@ -21,34 +43,68 @@ static Buffer *register_buffer(Register *reg, size_t slot) {
 	return array_get(&reg->values, slot);
 }
 
+/* buffer of a slot whose content is about to be replaced */
+static Buffer *register_buffer(Register *reg, size_t slot) {
+	RegisterSlot *s = register_slot(reg, slot);
+	if (!s)
+		return NULL;
+	slot_unref(s);
+	return &s->buf;
+}
+
+static bool register_slot_reference(Register *reg, size_t slot, Text *txt, Filerange *range) {
+	RegisterSlot *s = register_slot(reg, slot);
+	TextFrozen *frozen = s ? text_freeze(txt) : NULL;
+	if (!frozen)
+		return false;
+	slot_unref(s);
+	buffer_release(&s->buf);
+	s->frozen = frozen;
+	s->txt = txt;
+	s->range = *range;
+	return true;
+}
+
 static ssize_t read_buffer(void *context, char *data, size_t len) {
 	buffer_append(context, data, len);
 	return len;
 }
 
 bool register_init(Register *reg) {
-	Buffer buf;
-	buffer_init(&buf);
-	array_init_sized(&reg->values, sizeof(Buffer));
-	return array_add(&reg->values, &buf);
+	RegisterSlot s = { 0 };
+	buffer_init(&s.buf);
+	array_init_sized(&reg->values, sizeof(RegisterSlot));
+	return array_add(&reg->values, &s);
 }
 
 void register_release(Register *reg) {
 	if (!reg)
 		return;
 	size_t n = array_capacity(&reg->values);
-	for (size_t i = 0; i < n; i++)
-		buffer_release(array_get(&reg->values, i));
+	for (size_t i = 0; i < n; i++) {
+		RegisterSlot *s = array_get(&reg->values, i);
+		if (!s)
+			continue;
+		slot_unref(s);
+		buffer_release(&s->buf);
+	}
 	array_release(&reg->values);
 }
 
+Buffer *register_slot_buffer(Register *reg, size_t slot) {
+	RegisterSlot *s = array_get(&reg->values, slot);
+	return s && slot_load(s) ? &s->buf : NULL;
+}
+
 const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len) {
 	if (len)
 		*len = 0;
+	if (!register_load(reg))
+		return NULL;
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
-		Buffer *buf = array_get(&reg->values, slot);
+		Buffer *buf = register_slot_buffer(reg, slot);
 		if (!buf)
 			return NULL;
 		buffer_terminate(buf);
@@ -58,7 +114,7 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 	}
 	case REGISTER_NUMBER:
 	{
-		Buffer *buf = array_get(&reg->values, 0);
+		Buffer *buf = array_get(&reg->values, 0) ? register_buffer(reg, 0) : NULL;
 		if (!buf)
 			return NULL;
 		buffer_printf(buf, "%zu", slot+1);
@@ -71,10 +127,15 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 		Buffer buferr;
 		enum VisRegister id = reg - vis->registers;
 		const char *cmd[] = { VIS_CLIPBOARD, "--paste", "--selection", NULL, NULL };
-		buffer_init(&buferr);
-		Buffer *buf = array_get(&reg->values, slot);
+		Buffer *buf = array_get(&reg->values, slot) ? register_buffer(reg, slot) : NULL;
 		if (!buf)
 			return NULL;
+		if (slot == 0 && reg->cached) {
+			if (len)
+				*len = buffer_length0(buf);
+			return buffer_content0(buf);
+		}
+		buffer_init(&buferr);
 		buffer_clear(buf);
 
 		if (id == VIS_REG_PRIMARY)
@@ -88,6 +149,7 @@ const char *register_slot_get(Vis *vis, Register *reg, size_t slot, size_t *len)
 		if (status != 0)
 			vis_info_show(vis, "Command failed %s", buffer_content0(&buferr));
 		buffer_release(&buferr);
+		reg->cached = status == 0 && slot == 0;
 		if (len)
 			*len = buffer_length0(buf);
 		return buffer_content0(buf);
@@ -102,8 +164,29 @@ const char *register_get(Vis *vis, Register *reg, size_t *len) {
 	return register_slot_get(vis, reg, 0, len);
 }
 
+size_t register_slot_insert(Vis *vis, Register *reg, size_t slot, Text *txt, size_t pos) {
+	RegisterSlot *s = reg->type == REGISTER_NORMAL && register_load(reg) ? array_get(&reg->values, slot) : NULL;
+	if (!s || !s->frozen) {
+		size_t len;
+		const char *data = register_slot_get(vis, reg, slot, &len);
+		return data && text_insert(txt, pos, data, len) ? len : 0;
+	}
+	/* copy the referenced content chunk by chunk directly into the text */
+	size_t len = 0, chunk_len;
+	for (size_t off = s->range.start; off < s->range.end; off += chunk_len) {
+		const char *chunk = text_frozen_chunk(s->frozen, off, &chunk_len);
+		if (!chunk)
+			break;
+		chunk_len = MIN(chunk_len, s->range.end - off);
+		if (!text_insert(txt, pos + len, chunk, chunk_len))
+			break;
+		len += chunk_len;
+	}
+	return len;
+}
+
 bool register_slot_put(Vis *vis, Register *reg, size_t slot, const char *data, size_t len) {
-	if (reg->type != REGISTER_NORMAL)
+	if (reg->type != REGISTER_NORMAL || !register_load(reg))
 		return false;
 	Buffer *buf = register_buffer(reg, slot);
 	return buf && buffer_put(buf, data, len);
@@ -122,9 +205,10 @@ static bool register_slot_append_range(Register *reg, size_t slot, Text *txt, Fi
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
-		Buffer *buf = register_buffer(reg, slot);
-		if (!buf)
+		RegisterSlot *s = register_slot(reg, slot);
+		if (!s || !slot_load(s))
 			return false;
+		Buffer *buf = &s->buf;
 		size_t len = text_range_size(range);
 		if (len == SIZE_MAX || !buffer_grow(buf, len+1))
 			return false;
@@ -139,17 +223,20 @@ static bool register_slot_append_range(Register *reg, size_t slot, Text *txt, Fi
 }
 
 bool register_slot_put_range(Vis *vis, Register *reg, size_t slot, Text *txt, Filerange *range) {
+	if (!register_load(reg))
+		return false;
 	if (reg->append)
 		return register_slot_append_range(reg, slot, txt, range);
 
 	switch (reg->type) {
 	case REGISTER_NORMAL:
 	{
-		Buffer *buf = register_buffer(reg, slot);
-		if (!buf)
-			return false;
 		size_t len = text_range_size(range);
-		if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
+		if (len >= REGISTER_REFERENCE_SIZE && len != SIZE_MAX &&
+		    register_slot_reference(reg, slot, txt, range))
+			return true;
+		Buffer *buf = register_buffer(reg, slot);
+		if (!buf || len == SIZE_MAX || !buffer_reserve(buf, len+1))
 			return false;
 		buf->len = text_bytes_get(txt, range->start, len, buf->data);
 		return buffer_append(buf, "\0", 1);
@@ -172,6 +259,16 @@ bool register_slot_put_range(Vis *vis, Register *reg, size_t slot, Text *txt, Fi
 		if (status != 0)
 			vis_info_show(vis, "Command failed %s", buffer_content0(&buferr));
 		buffer_release(&buferr);
+		/* remember what was copied, a subsequent paste returns it */
+		reg->cached = false;
+		if (status == 0 && slot == 0) {
+			Buffer *buf = register_buffer(reg, 0);
+			size_t len = text_range_size(range);
+			if (buf && len < SIZE_MAX && buffer_reserve(buf, len+1)) {
+				buf->len = text_bytes_get(txt, range->start, len, buf->data);
+				reg->cached = buffer_append(buf, "\0", 1);
+			}
+		}
 		return status == 0;
 	}
 	case REGISTER_BLACKHOLE:
@@ -186,6 +283,31 @@ bool register_put_range(Vis *vis, Register *reg, Text *txt, Filerange *range) {
 	       register_resize(reg, 1);
 }
 
+bool register_put_range_lazy(Vis *vis, Register *reg, Text *txt, Filerange *range) {
+	if (reg->type != REGISTER_NORMAL || reg->append)
+		return register_put_range(vis, reg, txt, range);
+	if (!register_resize(reg, 1))
+		return false;
+	reg->lazy.txt = txt;
+	reg->lazy.range = *range;
+	return true;
+}
+
+bool register_load(Register *reg) {
+	Text *txt = reg->lazy.txt;
+	if (!txt)
+		return true;
+	reg->lazy.txt = NULL;
+	Buffer *buf = register_buffer(reg, 0);
+	if (!buf)
+		return false;
+	size_t len = text_range_size(&reg->lazy.range);
+	if (len == SIZE_MAX || !buffer_reserve(buf, len+1))
+		return false;
+	buf->len = text_bytes_get(txt, reg->lazy.range.start, len, buf->data);
+	return buffer_append(buf, "\0", 1);
+}
+
 size_t vis_register_count(Vis *vis, Register *reg) {
 	if (reg->type == REGISTER_NUMBER)
 		return vis->win ? vis->win->view.selection_count : 0;
@@ -193,9 +315,29 @@ size_t vis_register_count(Vis *vis, Register *reg) {
 }
 
 bool register_resize(Register *reg, size_t count) {
+	for (size_t i = count, len = array_length(&reg->values); i < len; i++)
+		slot_unref(array_get(&reg->values, i));
 	return array_truncate(&reg->values, count);
 }
 
+void register_clipboard_invalidate(Vis *vis) {
+	vis->registers[VIS_REG_PRIMARY].cached = false;
+	vis->registers[VIS_REG_CLIPBOARD].cached = false;
+}
+
+void register_text_free(Vis *vis, Text *txt) {
+	for (size_t i = 0; i < LENGTH(vis->registers); i++) {
+		Array *values = &vis->registers[i].values;
+		for (size_t j = 0, len = array_length(values); j < len; j++) {
+			RegisterSlot *s = array_get(values, j);
+			if (s->txt == txt && !slot_load(s)) {
+				slot_unref(s);
+				buffer_clear(&s->buf);
+			}
+		}
+	}
+}
+
 enum VisRegister vis_register_from(Vis *vis, char reg) {
 
 	if (reg == '@')
@@ -273,14 +415,14 @@ Array vis_register_get(Vis *vis, enum VisRegister id) {
 	Array data;
 	array_init_sized(&data, sizeof(TextString));
 	Register *reg = register_from(vis, id);
-	if (reg) {
+	if (reg && register_load(reg)) {
 		size_t len = array_length(&reg->values);
 		array_reserve(&data, len);
 		for (size_t i = 0; i < len; i++) {
-			Buffer *buf = array_get(&reg->values, i);
+			Buffer *buf = register_slot_buffer(reg, i);
 			TextString string = {
-				.data = buffer_content(buf),
-				.len = buffer_length(buf),
+				.data = buf ? buffer_content(buf) : NULL,
+				.len = buf ? buffer_length(buf) : 0,
 			};
 			array_add(&data, &string);
 		}
@@ -0,0 +1,438 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vis-core.h"
+
+/* Index of the matches of the search pattern in the files displayed in a
+ * window, used to report their number and to move between them.
+ *
+ * As for the word index, a file is split into chunks of roughly
+ * SEARCH_CHUNK_SIZE bytes which end after a newline. Only patterns which
+ * can not match a newline are indexed, all matches are thus confined to a
+ * line and every chunk is searched independently of the surrounding text.
+ * A chunk records every position at which a match starts relative to its
+ * own start, including overlapping ones, such that moving between them
+ * yields the same positions as searching the text.
+ *
+ * A modification invalidates the chunks overlapping the lines it touched
+ * and moves the following ones. The uncovered parts of the text are then
+ * searched anew, in slices while the editor is idle. Patterns matching too
+ * often are given up on, movements then search the text as before.
+ */
+
+#define SEARCH_CHUNK_SIZE (1 << 16)
+#define SEARCH_SLICE (1 << 18)       /* bytes searched per idle invocation */
+#define SEARCH_MATCHES_MAX (1 << 20) /* matches recorded per file */
+#define SEARCH_CONTEXT (1 << 12)     /* bytes around a range looked at for its line boundaries */
+
+static int search_cflags(Vis *vis) {
+	return REG_EXTENDED|REG_NEWLINE|(REG_ICASE*vis->ignorecase);
+}
+
+/* invoke func for the successive matches starting in [start, end), which
+ * is searched as a whole and should start at a line boundary. If overlap
+ * is set, the search resumes after the start of the previous match rather
+ * than after its end. Returns false if func asked to stop */
+static bool search_range(Text *txt, Regex *regex, size_t start, size_t end, bool overlap,
+                         bool (*func)(const Filerange *match, void *data), void *data) {
+	size_t size = text_size(txt);
+	char c;
+	int eflags = !start || (text_byte_get(txt, start - 1, &c) && c == '\n') ? 0 : REG_NOTBOL;
+	RegexMatch match[1];
+	for (size_t pos = start; pos < end; ) {
+		if (text_search_range_forward(txt, pos, end - pos, regex, 1, match, eflags))
+			break;
+		/* an empty match at the end belongs to the following line, if any */
+		if (match[0].start == end && (end != size || (text_byte_get(txt, end - 1, &c) && c == '\n')))
+			break;
+		if (!func(&match[0], data))
+			return false;
+		pos = overlap ? match[0].start + 1 : match[0].end + (match[0].start == match[0].end);
+		bool bol = text_byte_get(txt, pos - 1, &c) && c == '\n';
+		/* the end of a line which was partly searched does not match */
+		if (!overlap && !bol && text_byte_get(txt, pos, &c) && c == '\n') {
+			pos++;
+			bol = true;
+		}
+		eflags = bol ? 0 : REG_NOTBOL;
+	}
+	return true;
+}
+
+static void chunk_release(SearchIndex *index, SearchChunk *chunk) {
+	index->count -= array_length(&chunk->matches);
+	array_release(&chunk->matches);
+}
+
+typedef struct {
+	SearchIndex *index;
+	SearchChunk *chunk;
+} ChunkBuild;
+
+static bool chunk_add(const Filerange *match, void *data) {
+	ChunkBuild *build = data;
+	SearchChunk *chunk = build->chunk;
+	if (build->index->count >= SEARCH_MATCHES_MAX)
+		return false;
+	Filerange rel = { match->start - chunk->start, match->end - chunk->start };
+	if (!array_add(&chunk->matches, &rel))
+		return false;
+	build->index->count++;
+	return true;
+}
+
+/* search the content from start up to end, which both need to be at a line
+ * boundary, and append the resulting chunks. Stops after the first chunk
+ * exhausting the budget, returns the position up to which it got. If the
+ * pattern matches too often, the index is disabled */
+static size_t index_range(SearchIndex *index, Text *txt, Regex *regex, Array *chunks,
+                          size_t start, size_t end, size_t *budget) {
+	size_t pos = start;
+	while (pos < end && *budget) {
+		size_t next = end;
+		if (end - pos > SEARCH_CHUNK_SIZE) {
+			size_t nl = text_bytes_find_next(txt, pos + SEARCH_CHUNK_SIZE, end, "\n", 1);
+			if (nl != EPOS)
+				next = nl + 1;
+		}
+		SearchChunk chunk = { .start = pos, .end = next };
+		array_init_sized(&chunk.matches, sizeof(Filerange));
+		ChunkBuild build = { .index = index, .chunk = &chunk };
+		if (!search_range(txt, regex, pos, next, true, chunk_add, &build) || !array_add(chunks, &chunk)) {
+			chunk_release(index, &chunk);
+			index->disabled = true;
+			return pos;
+		}
+		*budget = *budget > next - pos ? *budget - (next - pos) : 0;
+		pos = next;
+	}
+	return pos;
+}
+
+static void index_clear(SearchIndex *index) {
+	for (size_t i = 0, len = array_length(&index->chunks); i < len; i++)
+		chunk_release(index, array_get(&index->chunks, i));
+	array_clear(&index->chunks);
+	index->complete = false;
+}
+
+/* remove the chunks affected by a modification and move the later ones */
+static void index_change(SearchIndex *index, const TextChange *change) {
+	Array *chunks = &index->chunks;
+	size_t lo = change->pos ? change->pos - 1 : 0, hi = change->pos + change->removed;
+	size_t i = 0, len = array_length(chunks);
+	for (size_t l = len; i < l; ) {
+		size_t mid = i + (l - i) / 2;
+		if (((SearchChunk*)array_get(chunks, mid))->end <= lo)
+			i = mid + 1;
+		else
+			l = mid;
+	}
+	while (i < len) {
+		SearchChunk *chunk = array_get(chunks, i);
+		if (chunk->start > hi)
+			break;
+		chunk_release(index, chunk);
+		array_remove(chunks, i);
+		len--;
+	}
+	for (; i < len; i++) {
+		SearchChunk *chunk = array_get(chunks, i);
+		chunk->start = chunk->start - change->removed + change->inserted;
+		chunk->end = chunk->end - change->removed + change->inserted;
+	}
+}
+
+/* whether the chunks cover the whole text */
+static bool index_covered(SearchIndex *index, size_t size) {
+	size_t pos = 0;
+	for (size_t i = 0, len = array_length(&index->chunks); i < len; i++) {
+		SearchChunk *chunk = array_get(&index->chunks, i);
+		if (chunk->start != pos)
+			return false;
+		pos = chunk->end;
+	}
+	return pos == size;
+}
+
+/* make the index refer to the current search pattern and move its chunks
+ * according to the modifications since it was last used. Returns whether
+ * the pattern is indexed */
+static bool index_sync(Vis *vis, File *file) {
+	SearchIndex *index = &file->search;
+	Text *txt = file->text;
+	const char *pattern = register_get(vis, &vis->registers[VIS_REG_SEARCH], NULL);
+	int cflags = search_cflags(vis);
+	if (!pattern || !pattern[0] || file->internal || file->pending) {
+		vis_search_file_free(vis, file);
+		return false;
+	}
+	size_t generation = text_generation(txt);
+	if (!index->pattern || index->cflags != cflags || strcmp(index->pattern, pattern)) {
+		vis_search_file_free(vis, file);
+		index->pattern = strdup(pattern);
+		index->cflags = cflags;
+		index->generation = generation;
+		index->disabled = !index->pattern;
+	}
+	if (index->disabled)
+		return false;
+	if (index->generation == generation)
+		return true;
+	for (size_t g = index->generation; g++ != generation && array_length(&index->chunks); ) {
+		TextChange change;
+		if (!text_change_get(txt, g, &change)) {
+			index_clear(index);
+			break;
+		}
+		index_change(index, &change);
+	}
+	index->generation = generation;
+	index->complete = index_covered(index, text_size(txt));
+	return true;
+}
+
+/* bring the index of a file up to date, searching at most (roughly) budget
+ * bytes of content. Returns whether nothing is left to do */
+static bool index_update(Vis *vis, File *file, size_t *budget) {
+	SearchIndex *index = &file->search;
+	if (!index_sync(vis, file) || index->complete)
+		return true;
+	Text *txt = file->text;
+	Regex *regex = regex_cache_get(vis, index->pattern, index->cflags);
+	if (!regex || text_regex_multiline(regex)) {
+		vis_regex_free(vis, regex);
+		index_clear(index);
+		index->disabled = true;
+		return true;
+	}
+
+	/* search the gaps between the remaining chunks */
+	double start = vis_time();
+	Array chunks;
+	array_init_sized(&chunks, sizeof(SearchChunk));
+	size_t pos = 0, size = text_size(txt);
+	bool complete = true;
+	for (size_t i = 0, len = array_length(&index->chunks); i <= len; i++) {
+		SearchChunk *chunk = i < len ? array_get(&index->chunks, i) : NULL;
+		size_t next = chunk ? chunk->start : size;
+		if (pos < next && *budget && !index->disabled) {
+			/* absorb small neighbours, to keep the number of chunks bounded */
+			size_t count = array_length(&chunks);
+			SearchChunk *prev = count ? array_get(&chunks, count - 1) : NULL;
+			if (prev && prev->end == pos && prev->end - prev->start < SEARCH_CHUNK_SIZE / 4) {
+				pos = prev->start;
+				chunk_release(index, prev);
+				array_truncate(&chunks, count - 1);
+			}
+			if (chunk && chunk->end - chunk->start < SEARCH_CHUNK_SIZE / 4) {
+				next = chunk->end;
+				chunk_release(index, chunk);
+				chunk = NULL;
+			}
+			pos = index_range(index, txt, regex, &chunks, pos, next, budget);
+		}
+		if (pos < next)
+			complete = false;
+		if (chunk) {
+			if (!array_add(&chunks, chunk)) {
+				chunk_release(index, chunk);
+				complete = false;
+			}
+			pos = chunk->end;
+		}
+	}
+	array_release(&index->chunks);
+	index->chunks = chunks;
+	index->complete = complete;
+	vis_regex_free(vis, regex);
+	vis_stats_add(vis, VIS_STAT_SEARCH, 1, vis_time() - start);
+	if (index->disabled) {
+		index_clear(index);
+		return true;
+	}
+	return complete;
+}
+
+/* index of the chunk containing pos, or -1 if it falls into a gap */
+static ssize_t chunk_find(const Array *chunks, size_t pos) {
+	size_t i = 0, len = array_length(chunks);
+	for (size_t l = len; i < l; ) {
+		size_t mid = i + (l - i) / 2;
+		if (((SearchChunk*)array_get(chunks, mid))->end <= pos)
+			i = mid + 1;
+		else
+			l = mid;
+	}
+	if (i == len && len > 0 && ((SearchChunk*)array_get(chunks, len - 1))->end == pos)
+		i--; /* the end of the text belongs to the last chunk */
+	if (i == len || ((SearchChunk*)array_get(chunks, i))->start > pos)
+		return -1;
+	return i;
+}
+
+/* number of matches in the chunk starting before rel */
+static size_t chunk_matches_before(const SearchChunk *chunk, size_t rel) {
+	size_t i = 0, len = array_length(&chunk->matches);
+	for (size_t l = len; i < l; ) {
+		size_t mid = i + (l - i) / 2;
+		if (((Filerange*)array_get(&chunk->matches, mid))->start < rel)
+			i = mid + 1;
+		else
+			l = mid;
+	}
+	return i;
+}
+
+static File *search_file(Vis *vis, Text *txt) {
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->text == txt)
+			return file;
+	}
+	return NULL;
+}
+
+size_t vis_search_next(Vis *vis, Text *txt, size_t pos) {
+	File *file = search_file(vis, txt);
+	if (!file || !index_sync(vis, file))
+		return EPOS;
+	SearchIndex *index = &file->search;
+	Array *chunks = &index->chunks;
+	ssize_t first = chunk_find(chunks, pos);
+	if (first == -1)
+		return EPOS;
+	size_t len = array_length(chunks), size = text_size(txt);
+	for (size_t n = 0, i = first; n <= len; n++) {
+		SearchChunk *chunk = array_get(chunks, i);
+		/* matches after pos, or any of them once wrapped around */
+		size_t m = n == 0 ? chunk_matches_before(chunk, pos - chunk->start + 1) : 0;
+		if (m < array_length(&chunk->matches))
+			return chunk->start + ((Filerange*)array_get(&chunk->matches, m))->start;
+		/* continue with the following chunk, unless there is a gap */
+		size_t next = i + 1 < len ? i + 1 : 0;
+		SearchChunk *after = array_get(chunks, next);
+		if (next == 0 ? chunk->end != size || after->start != 0 : chunk->end != after->start)
+			return EPOS;
+		i = next;
+	}
+	return pos; /* no match at all */
+}
+
+bool vis_search_count(Vis *vis, File *file, size_t pos, size_t *number, size_t *count, bool *complete) {
+	*number = *count = 0;
+	*complete = false;
+	if (!index_sync(vis, file))
+		return false;
+	SearchIndex *index = &file->search;
+	*count = index->count;
+	*complete = index->complete;
+	size_t before = 0, start = 0;
+	for (size_t i = 0, len = array_length(&index->chunks); i < len; i++) {
+		SearchChunk *chunk = array_get(&index->chunks, i);
+		if (chunk->start != start || chunk->start > pos)
+			break;
+		if (pos < chunk->end || (pos == chunk->end && i + 1 == len)) {
+			size_t rel = pos - chunk->start, m = chunk_matches_before(chunk, rel);
+			if (m < array_length(&chunk->matches) && ((Filerange*)array_get(&chunk->matches, m))->start == rel)
+				*number = before + m + 1;
+			break;
+		}
+		before += array_length(&chunk->matches);
+		start = chunk->end;
+	}
+	return true;
+}
+
+typedef struct {
+	bool (*func)(const Filerange *match, void *data);
+	void *data;
+	size_t start, end;
+} SearchVisible;
+
+static bool search_visible(const Filerange *match, void *data) {
+	SearchVisible *visible = data;
+	if (match->end <= visible->start && match->start < visible->start)
+		return true;
+	return match->start < visible->end && visible->func(match, visible->data);
+}
+
+bool vis_search_matches(Vis *vis, Text *txt, Filerange *range, bool (*func)(const Filerange *match, void *data), void *data) {
+	const char *pattern = register_get(vis, &vis->registers[VIS_REG_SEARCH], NULL);
+	if (!pattern || !pattern[0] || !text_range_valid(range))
+		return false;
+	Regex *regex = regex_cache_get(vis, pattern, search_cflags(vis));
+	if (!regex)
+		return false;
+	/* start at the beginning of the line, such that anchors and the
+	 * successive matches are the same as for the whole text */
+	size_t start = range->start, end = range->end, size = text_size(txt);
+	size_t limit = start > SEARCH_CONTEXT ? start - SEARCH_CONTEXT : 0;
+	size_t nl = text_bytes_find_prev(txt, limit, start, "\n", 1);
+	if (nl != EPOS)
+		start = nl + 1;
+	else if (limit == 0)
+		start = 0;
+	limit = size - end > SEARCH_CONTEXT ? end + SEARCH_CONTEXT : size;
+	nl = text_bytes_find_next(txt, end, limit, "\n", 1);
+	if (nl != EPOS)
+		end = nl + 1;
+	else if (limit == size)
+		end = size;
+	SearchVisible visible = { .func = func, .data = data, .start = range->start, .end = range->end };
+	double time = vis_time();
+	search_range(txt, regex, start, end, false, search_visible, &visible);
+	vis_stats_add(vis, VIS_STAT_SEARCH, 1, vis_time() - time);
+	vis_regex_free(vis, regex);
+	return true;
+}
+
+/* have the main loop redraw the windows whose primary cursor is at a match,
+ * to update the number of matches shown in their status bar */
+static void search_redraw(Vis *vis, File *file) {
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file != file)
+			continue;
+		size_t number, count;
+		bool complete;
+		size_t pos = view_cursors_pos(view_selections_primary_get(&win->view));
+		if (vis_search_count(vis, file, pos, &number, &count, &complete) && number) {
+			view_draw(&win->view);
+			vis->need_redraw = true;
+		}
+	}
+}
+
+static bool search_task(Vis *vis, void *data) {
+	size_t budget = SEARCH_SLICE;
+	bool done = true;
+	for (Win *win = vis->windows; win; win = win->next) {
+		File *file = win->file;
+		bool complete = file->search.complete;
+		if (!index_update(vis, file, &budget))
+			done = false;
+		else if (!complete && file->search.complete)
+			search_redraw(vis, file);
+	}
+	if (done)
+		vis->search_task = false;
+	return vis->search_task;
+}
+
+void vis_search_schedule(Vis *vis) {
+	if (vis->search_task)
+		return;
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (index_sync(vis, win->file) && !win->file->search.complete) {
+			vis->search_task = vis_defer(vis, search_task, NULL, NULL);
+			return;
+		}
+	}
+}
+
+void vis_search_file_free(Vis *vis, File *file) {
+	SearchIndex *index = &file->search;
+	index_clear(index);
+	array_release(&index->chunks);
+	free(index->pattern);
+	*index = (SearchIndex){ 0 };
+	array_init_sized(&index->chunks, sizeof(SearchChunk));
+}
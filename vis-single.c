@@ -1,9 +1,12 @@
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +30,11 @@
 #define VIS_TMP ".vis-single-XXXXXX"
 #endif
 
+/* sub directory of $XDG_CACHE_HOME or ~/.cache holding the extracted payloads */
+#ifndef VIS_CACHE
+#define VIS_CACHE "vis-single"
+#endif
+
 #ifndef VIS_TERMINFO
 #define VIS_TERMINFO "/etc/terminfo:/lib/terminfo:/usr/share/terminfo:" \
 	"/usr/lib/terminfo:/usr/local/share/terminfo:/usr/local/lib/terminfo"
@@ -96,20 +104,79 @@ static int unlink_cb(const char *path, const struct stat *sb, int typeflag, stru
 	return remove(path);
 }
 
-int main(int argc, char **argv) {
-	int rc = EXIT_FAILURE;
-	char exe[256], path[PATH_MAX], tmp_dirname[PATH_MAX];
+/* FNV-1a hash of the payload, naming the directory it is extracted to */
+static uint64_t payload_hash(void) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < sizeof(vis_single_payload); i++) {
+		hash ^= vis_single_payload[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 
-	char *tmpdir = getenv("TMPDIR");
-	if (snprintf(tmp_dirname, sizeof(tmp_dirname), "%s/%s",
-	             tmpdir ? tmpdir : VIS_TMP_DIR, VIS_TMP) < 0) {
-		perror("snprintf");
-		return rc;
+/* create a directory only accessible by the user, or check an existing one */
+static bool private_dir(const char *path) {
+	struct stat st;
+	if (mkdir(path, 0700) == -1 && errno != EEXIST)
+		return false;
+	return lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid() &&
+	       !(st.st_mode & (S_IWGRP|S_IWOTH));
+}
+
+/* The payload is extracted once per user and reused by later launches. It is
+ * unpacked into a temporary directory next to its final location, which is
+ * atomically renamed once complete. If another instance wins the race its
+ * result is used instead. Returns false if there is no usable cache. */
+static bool cache(char *dir, size_t size) {
+	char base[PATH_MAX], tmp[PATH_MAX], exe[PATH_MAX];
+	const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+	if (xdg && xdg[0] == '/') {
+		if (snprintf(base, sizeof(base), "%s/%s", xdg, VIS_CACHE) >= (int)sizeof(base))
+			return false;
+	} else if (home && home[0] == '/') {
+		if (snprintf(base, sizeof(base), "%s/.cache", home) >= (int)sizeof(base))
+			return false;
+		if (mkdir(base, 0700) == -1 && errno != EEXIST)
+			return false;
+		if (snprintf(base, sizeof(base), "%s/.cache/%s", home, VIS_CACHE) >= (int)sizeof(base))
+			return false;
+	} else {
+		return false;
 	}
 
-	if (!mkdtemp(tmp_dirname)) {
-		perror("mkdtemp");
-		return rc;
+	if (!private_dir(base) ||
+	    snprintf(dir, size, "%s/%016" PRIx64, base, payload_hash()) >= (int)size ||
+	    snprintf(exe, sizeof(exe), "%s/vis", dir) >= (int)sizeof(exe) ||
+	    snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", base) >= (int)sizeof(tmp))
+		return false;
+	if (access(exe, X_OK) == 0)
+		return true;
+
+	if (!mkdtemp(tmp))
+		return false;
+	bool extracted = extract(tmp) == 0 && rename(tmp, dir) == 0;
+	if (!extracted)
+		nftw(tmp, unlink_cb, 64, FTW_DEPTH|FTW_PHYS|FTW_MOUNT);
+	return access(exe, X_OK) == 0;
+}
+
+int main(int argc, char **argv) {
+	int rc = EXIT_FAILURE;
+	char exe[PATH_MAX], path[PATH_MAX], tmp_dirname[PATH_MAX];
+
+	bool cached = cache(tmp_dirname, sizeof(tmp_dirname));
+	if (!cached) {
+		char *tmpdir = getenv("TMPDIR");
+		if (snprintf(tmp_dirname, sizeof(tmp_dirname), "%s/%s",
+		             tmpdir ? tmpdir : VIS_TMP_DIR, VIS_TMP) < 0) {
+			perror("snprintf");
+			return rc;
+		}
+
+		if (!mkdtemp(tmp_dirname)) {
+			perror("mkdtemp");
+			return rc;
+		}
 	}
 
 	char *old_path = getenv("PATH");
@@ -124,12 +191,19 @@ int main(int argc, char **argv) {
 		goto err;
 	}
 
-	if (extract(tmp_dirname) != 0)
+	if (!cached && extract(tmp_dirname) != 0)
 		goto err;
 
 	if (snprintf(exe, sizeof(exe), "%s/vis", tmp_dirname) < 0)
 		goto err;
 
+	if (cached) {
+		/* nothing to clean up afterwards */
+		execv(exe, argv);
+		perror("execv");
+		return rc;
+	}
+
 	int child_pid = fork();
 	if (child_pid == -1) {
 		perror("fork");
@@ -156,6 +230,7 @@ int main(int argc, char **argv) {
 	}
 
 err:
-	nftw(tmp_dirname, unlink_cb, 64, FTW_DEPTH|FTW_PHYS|FTW_MOUNT);
+	if (!cached)
+		nftw(tmp_dirname, unlink_cb, 64, FTW_DEPTH|FTW_PHYS|FTW_MOUNT);
 	return rc;
 }
@@ -1,8 +1,10 @@
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/wait.h>
 #include "vis-lua.h"
 #include "vis-subprocess.h"
@@ -11,6 +13,11 @@
 /* Pool of information about currently running subprocesses */
 static Process *process_pool;
 
+/* amount of data read from a subprocess output per main loop iteration */
+#define PROCESS_READ_SIZE (1 << 16)
+/* incomplete messages exceeding this size are passed on as they are */
+#define PROCESS_MESSAGE_MAX (1 << 26)
+
 /**
  * Adds new empty process information structure to the process pool and
  * returns it
@@ -26,18 +33,28 @@ static Process *new_process_in_pool(void) {
 	return newprocess;
 }
 
+/**
+ * Stops watching and closes the given file descriptor of a subprocess
+ * @param fd a reference to the file descriptor, set to -1 afterwards
+ */
+static void close_output(Vis *vis, int *fd) {
+	vis_unwatch(vis, *fd);
+	close(*fd);
+	*fd = -1;
+}
+
 /**
  * Removes the subprocess information from the pool, sets invalidator to NULL
  * and frees resources.
  * @param a reference to the process to be removed
  * @return the next process in the pool
  */
-static Process *destroy_process(Process *target) {
+static Process *destroy_process(Vis *vis, Process *target) {
 	if (target->outfd != -1) {
-		close(target->outfd);
+		close_output(vis, &target->outfd);
 	}
 	if (target->errfd != -1) {
-		close(target->errfd);
+		close_output(vis, &target->errfd);
 	}
 	if (target->inpfd != -1) {
 		close(target->inpfd);
@@ -47,12 +64,150 @@ static Process *destroy_process(Process *target) {
 		*(target->invalidator) = NULL;
 	}
 	Process *next = target->next;
+	buffer_release(&target->received[STDOUT]);
+	buffer_release(&target->received[STDERR]);
 	free(target->name);
 	free(target);
 
 	return next;
 }
 
+/**
+ * Reads data from the given subprocess file descriptor `fd` and appends
+ * it to the data not yet passed to Lua.
+ * @param fd the file descriptor to read data from
+ * @param rtype a type of file descriptor where the new data is found
+ * @return the result of the underlying `read` call
+ */
+static ssize_t read_output(Process *current, int fd, ResponseType rtype) {
+	static char buffer[PROCESS_READ_SIZE];
+	ssize_t obtained = read(fd, &buffer, sizeof buffer);
+	if (obtained > 0 && buffer_append(&current->received[rtype], buffer, obtained)) {
+		current->pending[rtype] = true;
+	}
+	return obtained;
+}
+
+/**
+ * Watch function invoked by the main loop once the standard output or
+ * error of a subprocess becomes readable. At most PROCESS_READ_SIZE bytes
+ * are read, such that a process producing output faster than it is
+ * consumed eventually blocks on its full pipe. The descriptor is closed
+ * once the end of file is reached, the process itself is reaped by
+ * `vis_process_tick`.
+ * @param data the Process the descriptor belongs to
+ */
+static void process_ready(Vis *vis, int fd, short revents, void *data) {
+	Process *current = data;
+	int *target = fd == current->outfd ? &current->outfd : &current->errfd;
+	ssize_t obtained = read_output(current, fd, target == &current->outfd ? STDOUT : STDERR);
+	if (obtained == 0 || (obtained == -1 && errno != EINTR && errno != EAGAIN)) {
+		close_output(vis, target);
+	}
+}
+
+/**
+ * Looks for a complete message at the start of `data`.
+ * @param msg the message found, excluding any framing
+ * @return the number of bytes the message occupies, 0 if it is incomplete
+ */
+static size_t frame_next(Framing framing, const char *data, size_t len, ProcessMessage *msg) {
+	switch (framing) {
+	case FRAMING_RAW:
+		*msg = (ProcessMessage){ data, len };
+		return len;
+	case FRAMING_LINE: {
+		const char *end = memchr(data, '\n', len);
+		if (!end)
+			return 0;
+		*msg = (ProcessMessage){ data, end - data };
+		return end - data + 1;
+	}
+	case FRAMING_LENGTH: {
+		if (len < 4)
+			return 0;
+		const unsigned char *prefix = (const unsigned char*)data;
+		size_t size = (size_t)prefix[0] << 24 | prefix[1] << 16 | prefix[2] << 8 | prefix[3];
+		if (len - 4 < size)
+			return 0;
+		*msg = (ProcessMessage){ data + 4, size };
+		return 4 + size;
+	}
+	case FRAMING_JSONRPC: {
+		static const char header[] = "Content-Length:";
+		size_t size = 0, body = 0;
+		bool found = false;
+		for (size_t i = 0; i < len && !body; ) {
+			const char *end = memchr(data + i, '\n', len - i);
+			if (!end)
+				return 0;
+			size_t line = end - (data + i);
+			if (line == 0 || (line == 1 && data[i] == '\r'))
+				body = end - data + 1;
+			else if (line >= sizeof(header) - 1 && !strncasecmp(data + i, header, sizeof(header) - 1))
+				found = (size = strtoul(data + i + sizeof(header) - 1, NULL, 10), true);
+			i += line + 1;
+		}
+		if (!body)
+			return 0;
+		if (!found) {
+			/* no announced length, pass the malformed header on */
+			*msg = (ProcessMessage){ data, body };
+			return body;
+		}
+		if (len - body < size)
+			return 0;
+		*msg = (ProcessMessage){ data + body, size };
+		return body + size;
+	}
+	}
+	return 0;
+}
+
+/**
+ * Passes the complete messages received on the given channel of the
+ * subprocess to Lua, all of them at once.
+ * @param flush whether to pass on an incomplete trailing message as well
+ */
+static void deliver(Vis *vis, Process *current, ResponseType rtype, bool flush) {
+	Buffer *buf = &current->received[rtype];
+	if (!current->pending[rtype] && !(flush && buffer_length(buf)))
+		return;
+	current->pending[rtype] = false;
+	if (current->framing == FRAMING_RAW) {
+		if (buffer_length(buf))
+			vis_lua_process_response(vis, current->name, buf->data, buffer_length(buf), rtype);
+		buffer_clear(buf);
+		return;
+	}
+	Array msgs;
+	array_init_sized(&msgs, sizeof(ProcessMessage));
+	const char *data = buffer_content(buf);
+	size_t len = buffer_length(buf), consumed = 0;
+	for (size_t n; consumed < len; consumed += n) {
+		ProcessMessage msg;
+		n = frame_next(current->framing, data + consumed, len - consumed, &msg);
+		if (!n && (flush || len - consumed > PROCESS_MESSAGE_MAX)) {
+			msg = (ProcessMessage){ data + consumed, len - consumed };
+			n = len - consumed;
+		}
+		if (!n || !array_add(&msgs, &msg))
+			break;
+	}
+	if (array_length(&msgs))
+		vis_lua_process_messages(vis, current->name, array_get(&msgs, 0), array_length(&msgs), rtype);
+	array_release(&msgs);
+	buffer_remove(buf, 0, consumed);
+}
+
+/**
+ * Reads the output which was left in the pipes by a terminated subprocess
+ */
+static void drain(Process *current) {
+	while (current->outfd != -1 && read_output(current, current->outfd, STDOUT) > 0);
+	while (current->errfd != -1 && read_output(current, current->errfd, STDERR) > 0);
+}
+
 /**
  * Starts new subprocess by passing the `command` to the shell and
  * returns the subprocess information structure, containing file descriptors
@@ -68,8 +223,8 @@ static Process *destroy_process(Process *target) {
  * If a caller sets the pointer to NULL the subprocess will be killed on the
  * next main loop iteration.
  */
-Process *vis_process_communicate(Vis *vis, const char *name,
-                                 const char *command, Invalidator **invalidator) {
+Process *vis_process_communicate(Vis *vis, const char *name, const char *command,
+                                 Framing framing, Invalidator **invalidator) {
 	int pin[2], pout[2], perr[2];
 	pid_t pid = (pid_t)-1;
 	if (pipe(perr) == -1) {
@@ -88,6 +243,7 @@ Process *vis_process_communicate(Vis *vis, const char *name,
 		sigset_t sigterm_mask;
 		sigemptyset(&sigterm_mask);
 		sigaddset(&sigterm_mask, SIGTERM);
+		sigaddset(&sigterm_mask, SIGCHLD);
 		if (sigprocmask(SIG_UNBLOCK, &sigterm_mask, NULL) == -1) {
 			fprintf(stderr, "failed to reset signal mask");
 			exit(EXIT_FAILURE);
@@ -101,11 +257,17 @@ Process *vis_process_communicate(Vis *vis, const char *name,
 			vis_info_show(vis, "Cannot create process: %s", strerror(errno));
 			goto closeall;
 		}
+		new->outfd = new->errfd = new->inpfd = -1;
+		new->invalidator = NULL;
+		new->framing = framing;
+		buffer_init(&new->received[STDOUT]);
+		buffer_init(&new->received[STDERR]);
+		new->pending[STDOUT] = new->pending[STDERR] = false;
 		new->name = strdup(name);
 		if (!new->name) {
 			vis_info_show(vis, "Cannot copy process name: %s", strerror(errno));
 			/* pop top element (which is `new`) from the pool */
-			process_pool = destroy_process(process_pool);
+			process_pool = destroy_process(vis, process_pool);
 			goto closeall;
 		}
 		new->outfd = pout[0];
@@ -116,6 +278,13 @@ Process *vis_process_communicate(Vis *vis, const char *name,
 		close(pin[0]);
 		close(pout[1]);
 		close(perr[1]);
+		/* the remaining output is read without blocking once the process terminated */
+		fcntl(new->outfd, F_SETFL, O_NONBLOCK);
+		fcntl(new->errfd, F_SETFL, O_NONBLOCK);
+		if (!vis_watch(vis, new->outfd, POLLIN, process_ready, new) ||
+		    !vis_watch(vis, new->errfd, POLLIN, process_ready, new)) {
+			vis_info_show(vis, "Cannot watch process output: %s", strerror(errno));
+		}
 		return new;
 	}
 closeall:
@@ -138,62 +307,20 @@ closeerr:
 }
 
 /**
- * Adds file descriptors of currently running subprocesses to the `readfds`
- * to track their readiness and returns maximum file descriptor value
- * to pass it to the `pselect` call
- * @param readfds the structure for `pselect` call to fill
- * @return maximum file descriptor number in the readfds structure
- */
-int vis_process_before_tick(fd_set *readfds) {
-	int maxfd = 0;
-	for (Process **pointer = &process_pool; *pointer; pointer = &((*pointer)->next)) {
-		Process *current = *pointer;
-		if (current->outfd != -1) {
-			FD_SET(current->outfd, readfds);
-			maxfd = maxfd < current->outfd ? current->outfd : maxfd;
-		}
-		if (current->errfd != -1) {
-			FD_SET(current->errfd, readfds);
-			maxfd = maxfd < current->errfd ? current->errfd : maxfd;
-		}
-	}
-	return maxfd;
-}
-
-/**
- * Reads data from the given subprocess file descriptor `fd` and fires
- * the PROCESS_RESPONSE event in Lua with given subprocess `name`,
- * `rtype` and the read data as arguments.
- * @param fd the file descriptor to read data from
- * @param name a name of the subprocess
- * @param rtype a type of file descriptor where the new data is found
- */
-static void read_and_fire(Vis* vis, int fd, const char *name, ResponseType rtype) {
-	static char buffer[PIPE_BUF];
-	size_t obtained = read(fd, &buffer, PIPE_BUF-1);
-	if (obtained > 0) {
-		vis_lua_process_response(vis, name, buffer, obtained, rtype);
-	}
-}
-
-/**
- * Checks if `readfds` contains file descriptors of subprocesses from
- * the pool. If so, it reads their data and fires corresponding events.
+ * Passes the output received since the last main loop iteration to Lua.
  * Also checks if each subprocess from the pool is dead or needs to be
- * killed then raises an event or kills it if necessary.
- * @param readfds the structure for `pselect` call with file descriptors
+ * killed then raises an event or kills it if necessary. Terminated
+ * subprocesses are only looked for after a SIGCHLD was received.
  */
-void vis_process_tick(Vis *vis, fd_set *readfds) {
+void vis_process_tick(Vis *vis) {
+	bool reap = vis->children;
+	vis->children = false;
 	for (Process **pointer = &process_pool; *pointer; ) {
 		Process *current = *pointer;
-		if (current->outfd != -1 && FD_ISSET(current->outfd, readfds)) {
-			read_and_fire(vis, current->outfd, current->name, STDOUT);
-		}
-		if (current->errfd != -1 && FD_ISSET(current->errfd, readfds)) {
-			read_and_fire(vis, current->errfd, current->name, STDERR);
-		}
+		deliver(vis, current, STDOUT, current->outfd == -1);
+		deliver(vis, current, STDERR, current->errfd == -1);
 		int status;
-		pid_t wpid = waitpid(current->pid, &status, WNOHANG);
+		pid_t wpid = reap ? waitpid(current->pid, &status, WNOHANG) : 0;
 		if (wpid == -1)	{
 			vis_message_show(vis, strerror(errno));
 		} else if (wpid == current->pid) {
@@ -207,12 +334,15 @@ kill_and_destroy:
 		kill(current->pid, SIGTERM);
 		waitpid(current->pid, &status, 0);
 just_destroy:
+		drain(current);
+		deliver(vis, current, STDOUT, true);
+		deliver(vis, current, STDERR, true);
 		if (WIFSIGNALED(status)) {
 			vis_lua_process_response(vis, current->name, NULL, WTERMSIG(status), SIGNAL);
 		} else {
 			vis_lua_process_response(vis, current->name, NULL, WEXITSTATUS(status), EXIT);
 		}
 		/* update our iteration pointer */
-		*pointer = destroy_process(current);
+		*pointer = destroy_process(vis, current);
 	}
 }
@@ -2,9 +2,23 @@
 #define VIS_SUBPROCESS_H
 #include "vis-core.h"
 #include "vis-lua.h"
-#include <sys/select.h>
+#include "buffer.h"
 
 typedef struct Process Process;
+
+/* how the output of a subprocess is split into messages */
+typedef enum {
+	FRAMING_RAW,     /* data as it was read, no message boundaries */
+	FRAMING_LINE,    /* newline terminated lines, without the newline */
+	FRAMING_LENGTH,  /* prefixed by their length as 4 byte big endian integer */
+	FRAMING_JSONRPC, /* bodies announced by a Content-Length header */
+} Framing;
+
+typedef struct {
+	const char *data;
+	size_t len;
+} ProcessMessage;
+
 #if CONFIG_LUA
 typedef int Invalidator(lua_State*);
 #else
@@ -17,6 +31,9 @@ struct Process {
 	int errfd;
 	int inpfd;
 	pid_t pid;
+	Framing framing;
+	Buffer received[2]; /* stdout/stderr data not yet passed on, indexed by ResponseType */
+	bool pending[2];    /* whether new data was received since */
 	Invalidator** invalidator;
 	Process *next;
 };
@@ -24,7 +41,6 @@ struct Process {
 typedef enum { STDOUT, STDERR, SIGNAL, EXIT } ResponseType;
 
 Process *vis_process_communicate(Vis *, const char *command, const char *name,
-                                 Invalidator **invalidator);
-int vis_process_before_tick(fd_set *);
-void vis_process_tick(Vis *, fd_set *);
+                                 Framing, Invalidator **invalidator);
+void vis_process_tick(Vis *);
 #endif
@@ -34,7 +34,7 @@ static Filerange search_forward(Vis *vis, Text *txt, size_t pos) {
 	Regex *regex = vis_regex(vis, NULL);
 	if (regex)
 		range = text_object_search_forward(txt, pos, regex);
-	text_regex_free(regex);
+	vis_regex_free(vis, regex);
 	return range;
 }
 
@@ -43,7 +43,7 @@ static Filerange search_backward(Vis *vis, Text *txt, size_t pos) {
 	Regex *regex = vis_regex(vis, NULL);
 	if (regex)
 		range = text_object_search_backward(txt, pos, regex);
-	text_regex_free(regex);
+	vis_regex_free(vis, regex);
 	return range;
 }
 
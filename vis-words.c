@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "vis-core.h"
+
+/* Index of the words contained in all open files, used for completion.
+ *
+ * Every file is split into chunks of roughly WORD_CHUNK_SIZE bytes which
+ * end after a non-word byte, hence no word crosses a chunk boundary. For
+ * each chunk the distinct words it contains are recorded together with
+ * their number of occurrences. The counts summed over all chunks of all
+ * files are kept in a crit-bit tree supporting prefix queries.
+ *
+ * A modification invalidates the chunks overlapping its extent, including
+ * the bytes immediately before and after it which might join adjacent
+ * words. Their words are removed from the index and the positions of the
+ * following chunks are adjusted. The uncovered parts of the text are then
+ * indexed anew, in slices while the editor is idle or at once when a query
+ * is made.
+ */
+
+#define WORD_CHUNK_SIZE (1 << 16)
+#define WORD_SLICE (1 << 18) /* bytes indexed per idle invocation */
+#define WORD_MIN 2           /* shorter words are not worth completing */
+#define WORD_MAX 64          /* longer ones are most likely not words at all */
+
+struct Word {
+	size_t count;  /* occurrences in all indexed chunks */
+	size_t chunk;  /* serial number of the chunk being built which last contained it */
+	size_t slot;   /* index of its entry within that chunk */
+	char text[];
+};
+
+typedef struct {
+	Word *word;
+	size_t count;
+} WordRef;
+
+static bool word_char(unsigned char c) {
+	return c >= 0x80 || c == '_' || ('0' <= c && c <= '9') || ('a' <= (c|0x20) && (c|0x20) <= 'z');
+}
+
+static void chunk_release(Vis *vis, WordChunk *chunk) {
+	for (size_t i = 0, len = array_length(&chunk->words); i < len; i++) {
+		WordRef *ref = array_get(&chunk->words, i);
+		Word *word = ref->word;
+		if ((word->count -= ref->count) == 0) {
+			map_delete(vis->words, word->text);
+			free(word);
+		}
+	}
+	array_release(&chunk->words);
+}
+
+static void chunk_add(Vis *vis, WordChunk *chunk, size_t serial, const char *text, size_t len) {
+	Word *word = map_get(vis->words, text);
+	if (!word) {
+		if (!(word = calloc(1, sizeof *word + len + 1)))
+			return;
+		memcpy(word->text, text, len + 1);
+		if (!map_put(vis->words, word->text, word)) {
+			free(word);
+			return;
+		}
+	}
+	if (word->chunk == serial) {
+		WordRef *ref = array_get(&chunk->words, word->slot);
+		ref->count++;
+	} else {
+		WordRef ref = { .word = word, .count = 1 };
+		if (!array_add(&chunk->words, &ref)) {
+			if (!word->count) {
+				map_delete(vis->words, word->text);
+				free(word);
+			}
+			return;
+		}
+		word->chunk = serial;
+		word->slot = array_length(&chunk->words) - 1;
+	}
+	word->count++;
+}
+
+static bool chunk_finish(Vis *vis, Array *chunks, WordChunk *chunk, size_t end) {
+	chunk->end = end;
+	if (chunk->start == end || array_add(chunks, chunk))
+		return true;
+	chunk_release(vis, chunk);
+	return false;
+}
+
+/* index the content from start up to end, which both need to be at a word
+ * boundary, and append the resulting chunks. Stops after the first chunk
+ * exhausting the budget, returns the position up to which it got */
+static size_t index_range(Vis *vis, Text *txt, Array *chunks, size_t start, size_t end, size_t *budget) {
+	char word[WORD_MAX+1];
+	size_t len = 0, pos = start;
+	bool skip = false;
+	WordChunk chunk = { .start = start };
+	array_init_sized(&chunk.words, sizeof(WordRef));
+	size_t serial = ++vis->words_serial;
+	const char *data;
+	size_t n;
+	for (Iterator it = text_iterator_get(txt, start); text_iterator_chunk_next(&it, end, &data, &n); ) {
+		for (size_t i = 0; i < n; i++) {
+			unsigned char c = data[i];
+			pos++;
+			if (word_char(c)) {
+				if (len < WORD_MAX)
+					word[len++] = c;
+				else
+					skip = true;
+				continue;
+			}
+			if (len >= WORD_MIN && !skip) {
+				word[len] = '\0';
+				chunk_add(vis, &chunk, serial, word, len);
+			}
+			len = 0;
+			skip = false;
+			if (pos - chunk.start < WORD_CHUNK_SIZE)
+				continue;
+			size_t size = pos - chunk.start;
+			if (!chunk_finish(vis, chunks, &chunk, pos))
+				return chunk.start;
+			*budget = *budget > size ? *budget - size : 0;
+			if (!*budget)
+				return pos;
+			chunk = (WordChunk){ .start = pos };
+			array_init_sized(&chunk.words, sizeof(WordRef));
+			serial = ++vis->words_serial;
+		}
+	}
+	if (len >= WORD_MIN && !skip) {
+		word[len] = '\0';
+		chunk_add(vis, &chunk, serial, word, len);
+	}
+	size_t size = pos - chunk.start;
+	if (!chunk_finish(vis, chunks, &chunk, pos))
+		return chunk.start;
+	*budget = *budget > size ? *budget - size : 0;
+	return pos;
+}
+
+static void index_clear(Vis *vis, WordIndex *index) {
+	for (size_t i = 0, len = array_length(&index->chunks); i < len; i++)
+		chunk_release(vis, array_get(&index->chunks, i));
+	array_clear(&index->chunks);
+}
+
+/* remove the chunks affected by a modification and move the later ones */
+static void index_change(Vis *vis, WordIndex *index, const TextChange *change) {
+	Array *chunks = &index->chunks;
+	size_t lo = change->pos ? change->pos - 1 : 0, hi = change->pos + change->removed;
+	size_t i = 0, len = array_length(chunks);
+	for (size_t l = len; i < l; ) {
+		size_t mid = i + (l - i) / 2;
+		if (((WordChunk*)array_get(chunks, mid))->end <= lo)
+			i = mid + 1;
+		else
+			l = mid;
+	}
+	while (i < len) {
+		WordChunk *chunk = array_get(chunks, i);
+		if (chunk->start > hi)
+			break;
+		chunk_release(vis, chunk);
+		array_remove(chunks, i);
+		len--;
+	}
+	for (; i < len; i++) {
+		WordChunk *chunk = array_get(chunks, i);
+		chunk->start = chunk->start - change->removed + change->inserted;
+		chunk->end = chunk->end - change->removed + change->inserted;
+	}
+}
+
+/* bring the index of a file up to date, indexing at most (roughly) budget
+ * bytes of content. Returns whether the whole file is indexed */
+static bool index_update(Vis *vis, File *file, size_t *budget) {
+	WordIndex *index = &file->words;
+	Text *txt = file->text;
+	size_t generation = text_generation(txt);
+	if (index->complete && index->generation == generation)
+		return true;
+	for (size_t g = index->generation; g++ != generation && array_length(&index->chunks); ) {
+		TextChange change;
+		if (!text_change_get(txt, g, &change)) {
+			index_clear(vis, index);
+			break;
+		}
+		index_change(vis, index, &change);
+	}
+	index->generation = generation;
+
+	/* index the gaps between the remaining chunks */
+	Array chunks;
+	array_init_sized(&chunks, sizeof(WordChunk));
+	size_t pos = 0, size = text_size(txt);
+	bool complete = true;
+	for (size_t i = 0, len = array_length(&index->chunks); i <= len; i++) {
+		WordChunk *chunk = i < len ? array_get(&index->chunks, i) : NULL;
+		size_t next = chunk ? chunk->start : size;
+		if (pos < next && *budget) {
+			/* absorb small neighbours, to keep the number of chunks bounded */
+			size_t count = array_length(&chunks);
+			WordChunk *prev = count ? array_get(&chunks, count - 1) : NULL;
+			if (prev && prev->end == pos && prev->end - prev->start < WORD_CHUNK_SIZE / 4) {
+				pos = prev->start;
+				chunk_release(vis, prev);
+				array_truncate(&chunks, count - 1);
+			}
+			if (chunk && chunk->end - chunk->start < WORD_CHUNK_SIZE / 4) {
+				next = chunk->end;
+				chunk_release(vis, chunk);
+				chunk = NULL;
+			}
+			pos = index_range(vis, txt, &chunks, pos, next, budget);
+		}
+		if (pos < next)
+			complete = false;
+		if (chunk) {
+			if (!array_add(&chunks, chunk)) {
+				chunk_release(vis, chunk);
+				complete = false;
+			}
+			pos = chunk->end;
+		}
+	}
+	array_release(&index->chunks);
+	index->chunks = chunks;
+	index->complete = complete;
+	return complete;
+}
+
+/* returns whether all files are completely indexed */
+static bool words_update(Vis *vis, size_t *budget) {
+	bool complete = true;
+	for (File *file = vis->files; file; file = file->next) {
+		if (!file->internal && !index_update(vis, file, budget))
+			complete = false;
+	}
+	return complete;
+}
+
+static bool words_task(Vis *vis, void *data) {
+	size_t budget = WORD_SLICE;
+	if (words_update(vis, &budget))
+		vis->words_task = false;
+	return vis->words_task;
+}
+
+void vis_words_schedule(Vis *vis) {
+	if (!vis->words || vis->words_task)
+		return;
+	for (File *file = vis->files; file; file = file->next) {
+		WordIndex *index = &file->words;
+		if (!file->internal && (!index->complete || index->generation != text_generation(file->text))) {
+			vis->words_task = vis_defer(vis, words_task, NULL, NULL);
+			return;
+		}
+	}
+}
+
+typedef struct {
+	size_t len;
+	bool (*func)(const char *word, void *data);
+	void *data;
+} WordsComplete;
+
+static bool words_complete(const char *key, void *value, void *data) {
+	WordsComplete *complete = data;
+	Word *word = value;
+	return !word->text[complete->len] || complete->func(word->text, complete->data);
+}
+
+bool vis_words_complete(Vis *vis, const char *prefix, bool (*func)(const char *word, void *data), void *data) {
+	if (!vis->words && !(vis->words = map_new()))
+		return false;
+	size_t budget = SIZE_MAX;
+	bool complete = words_update(vis, &budget);
+	WordsComplete ctx = { .len = strlen(prefix), .func = func, .data = data };
+	map_iterate(map_prefix(vis->words, prefix), words_complete, &ctx);
+	return complete;
+}
+
+void vis_words_file_free(Vis *vis, File *file) {
+	index_clear(vis, &file->words);
+	array_release(&file->words.chunks);
+}
+
+void vis_words_free(Vis *vis) {
+	for (File *file = vis->files; file; file = file->next)
+		vis_words_file_free(vis, file);
+	map_free(vis->words);
+	vis->words = NULL;
+}
@@ -10,7 +10,7 @@
 #include <limits.h>
 #include <ctype.h>
 #include <time.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
@@ -44,9 +44,28 @@ static void file_free(Vis *vis, File *file) {
 		--file->refcount;
 		return;
 	}
-	vis_event_emit(vis, VIS_EVENT_FILE_CLOSE, file);
+	if (!file->pending && !file->announce)
+		vis_event_emit(vis, VIS_EVENT_FILE_CLOSE, file);
+	file_filter_cancel(vis, file);
+	if (file->loadfd != -1) {
+		vis_unwatch(vis, file->loadfd);
+		close(file->loadfd);
+	}
+	if (file->loadpid != -1) {
+		kill(file->loadpid, SIGKILL);
+		waitpid(file->loadpid, NULL, 0);
+	}
+	if (file->save.ctx) {
+		vis_unwatch(vis, file->save.fd);
+		text_save_cancel(file->save.ctx);
+	}
+	free(file->save.path);
 	for (size_t i = 0; i < LENGTH(file->marks); i++)
 		mark_release(&file->marks[i]);
+	register_text_free(vis, file->text);
+	vis_words_file_free(vis, file);
+	vis_search_file_free(vis, file);
+	vis_monitor_file_free(vis, file);
 	text_free(file->text);
 	free((char*)file->name);
 
@@ -64,10 +83,16 @@ static File *file_new_text(Vis *vis, Text *text) {
 	if (!file)
 		return NULL;
 	file->fd = -1;
+	file->loadfd = -1;
+	file->loadpid = -1;
+	file->save.fd = -1;
+	file->monitor.wd = -1;
 	file->text = text;
 	file->stat = text_stat(text);
 	for (size_t i = 0; i < LENGTH(file->marks); i++)
 		mark_init(&file->marks[i]);
+	array_init_sized(&file->words.chunks, sizeof(WordChunk));
+	array_init_sized(&file->search.chunks, sizeof(SearchChunk));
 	if (vis->files)
 		vis->files->prev = file;
 	file->next = vis->files;
@@ -102,7 +127,57 @@ err:
 	return path_normalized[0] ? strdup(path_normalized) : NULL;
 }
 
-static File *file_new(Vis *vis, const char *name, bool internal) {
+/* compressed files are transparently passed through these programs */
+static const FileCodec file_codecs[] = {
+	{ ".gz",  { "gzip", "-dc", NULL },  { "gzip", "-c", NULL }  },
+	{ ".bz2", { "bzip2", "-dc", NULL }, { "bzip2", "-c", NULL } },
+	{ ".xz",  { "xz", "-dc", NULL },    { "xz", "-c", NULL }    },
+	{ ".zst", { "zstd", "-dcq", NULL }, { "zstd", "-cq", NULL } },
+};
+
+const FileCodec *file_codec(const char *name) {
+	size_t len = name ? strlen(name) : 0;
+	for (size_t i = 0; i < LENGTH(file_codecs); i++) {
+		size_t suffix = strlen(file_codecs[i].suffix);
+		if (len > suffix && strcmp(name + len - suffix, file_codecs[i].suffix) == 0)
+			return &file_codecs[i];
+	}
+	return NULL;
+}
+
+/* load the file content, a compressed file yields an empty text and sets fd
+ * to the output of its decompressor, see file_stream. Otherwise fd is -1 */
+static Text *file_text_load(Vis *vis, const char *name, int *fd, pid_t *pid) {
+	const FileCodec *codec = file_codec(name);
+	*fd = -1;
+	if (!codec)
+		return text_load_method(name, vis->load_method);
+	if ((*fd = text_load_filter(AT_FDCWD, name, codec->decompress, pid)) == -1)
+		return NULL;
+	Text *text = text_load(NULL);
+	if (!text) {
+		close(*fd);
+		*fd = -1;
+		kill(*pid, SIGKILL);
+		waitpid(*pid, NULL, 0);
+	}
+	return text;
+}
+
+static void file_load_ready(Vis*, int fd, short revents, void *data);
+
+/* append the data read from fd to the file, as it becomes available */
+static bool file_stream(Vis *vis, File *file, int fd, pid_t pid) {
+	file->loadfd = fd;
+	file->loadpid = pid;
+	file->loadgen = text_generation(file->text);
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags|O_NONBLOCK) == -1)
+		return false;
+	return vis_watch(vis, fd, POLLIN, file_load_ready, file);
+}
+
+static File *file_new(Vis *vis, const char *name, bool internal, bool deferred) {
 	char *name_absolute = NULL;
 	bool cmp_names = 0;
 	struct stat new;
@@ -132,22 +207,59 @@ static File *file_new(Vis *vis, const char *name, bool internal) {
 		}
 		if (existing) {
 			free(name_absolute);
+			if (!deferred)
+				file_load(vis, existing);
 			return existing;
 		}
 	}
 
 	File *file = NULL;
-	Text *text = text_load_method(name, vis->load_method);
+	/* readable regular files are loaded once their content is needed */
+	if (deferred && name && !cmp_names && S_ISREG(new.st_mode) && access(name_absolute, R_OK) == 0) {
+		Text *empty = text_load(NULL);
+		if (!empty || !(file = file_new_text(vis, empty))) {
+			free(name_absolute);
+			text_free(empty);
+			return NULL;
+		}
+		file->name = name_absolute;
+		file->stat = new;
+		file->pending = true;
+		vis_monitor_file(vis, file);
+		return file;
+	}
+
+	int fd;
+	pid_t pid;
+	Text *text = file_text_load(vis, name, &fd, &pid);
 	if (!text && name && errno == ENOENT)
 		text = text_load(NULL);
 	if (!text)
 		goto err;
-	if (!(file = file_new_text(vis, text)))
+	if (!internal)
+		vis_startup_mark(vis, "load %s", name ? name : "[No Name]");
+	if (!(file = file_new_text(vis, text))) {
+		if (fd != -1) {
+			close(fd);
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
 		goto err;
+	}
 	file->name = name_absolute;
 	file->internal = internal;
-	if (!internal)
+	if (fd != -1) {
+		file->stat = new;
+		if (!file_stream(vis, file, fd, pid)) {
+			vis_info_show(vis, "Can not load `%s': %s", name, strerror(errno));
+			file->incomplete = true;
+		}
+	}
+	if (!internal) {
+		vis_monitor_file(vis, file);
 		vis_event_emit(vis, VIS_EVENT_FILE_OPEN, file);
+		vis_startup_mark(vis, "file_open event");
+	}
 	return file;
 err:
 	free(name_absolute);
@@ -156,8 +268,86 @@ err:
 	return NULL;
 }
 
+/* emit the events withheld until the content was loaded */
+static void file_announce(Vis *vis, File *file) {
+	if (!file->announce)
+		return;
+	file->announce = false;
+	vis_event_emit(vis, VIS_EVENT_FILE_OPEN, file);
+	vis_startup_mark(vis, "file_open event");
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file == file)
+			vis_event_emit(vis, VIS_EVENT_WIN_OPEN, win);
+	}
+}
+
+/* load the content of a deferred file, the events are emitted by file_announce */
+static bool file_load_text(Vis *vis, File *file) {
+	if (!file->pending)
+		return true;
+	if (file->error) {
+		errno = file->error;
+		return false;
+	}
+	int fd;
+	pid_t pid;
+	Text *text = file_text_load(vis, file->name, &fd, &pid);
+	if (!text && errno == ENOENT)
+		text = text_load(NULL);
+	if (!text) {
+		/* keep the placeholder, but never write it to the file */
+		file->error = errno;
+		file->incomplete = true;
+		vis_info_show(vis, "Can not load `%s': %s", file->name, strerror(errno));
+		return false;
+	}
+	file->pending = false;
+	vis_startup_mark(vis, "load %s", file->name);
+	/* the word and match indices refer to the empty placeholder */
+	vis_words_file_free(vis, file);
+	file->words.complete = false;
+	vis_search_file_free(vis, file);
+	text_free(file->text);
+	file->text = text;
+	if (fd == -1)
+		file->stat = text_stat(text);
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file == file)
+			view_reload(&win->view, text);
+	}
+	if (fd != -1 && !file_stream(vis, file, fd, pid)) {
+		vis_info_show(vis, "Can not load `%s': %s", file->name, strerror(errno));
+		file->incomplete = true;
+	}
+	file->announce = true;
+	vis_words_schedule(vis);
+	return true;
+}
+
+bool file_load(Vis *vis, File *file) {
+	bool loaded = file_load_text(vis, file);
+	file_announce(vis, file);
+	return loaded;
+}
+
+/* emit the events of files loaded while drawing, returns whether there were any */
+static bool files_announce(Vis *vis) {
+	bool announced = false;
+	/* event handlers might close files, start over after each one */
+	for (File *file = vis->files; file; ) {
+		if (file->announce) {
+			file_announce(vis, file);
+			announced = true;
+			file = vis->files;
+		} else {
+			file = file->next;
+		}
+	}
+	return announced;
+}
+
 static File *file_new_internal(Vis *vis, const char *filename) {
-	File *file = file_new(vis, filename, true);
+	File *file = file_new(vis, filename, true, false);
 	if (file)
 		file->refcount = 1;
 	return file;
@@ -184,6 +374,13 @@ const char *file_name_get(File *file) {
 	return file->name[cwdlen] == '/' ? file->name+cwdlen+1 : file->name;
 }
 
+/* percentage of the background save completed so far */
+int file_save_progress(File *file) {
+	if (!file->save.ctx || !file->save.size)
+		return 0;
+	return (int)((double)file->save.written / file->save.size * 100);
+}
+
 void window_selection_save(Win *win) {
 	Vis *vis = win->vis;
 	Array sel = view_selections_get_all(&win->view);
@@ -203,8 +400,10 @@ static void window_free(Win *win) {
 	}
 	ui_window_release(&vis->ui, win);
 	view_free(&win->view);
-	for (size_t i = 0; i < LENGTH(win->modes); i++)
+	for (size_t i = 0; i < LENGTH(win->modes); i++) {
 		map_free(win->modes[i].bindings);
+		mode_lookup_free(&win->modes[i]);
+	}
 	marklist_release(&win->jumplist);
 	mark_release(&win->saved_selections);
 	free(win);
@@ -262,15 +461,12 @@ static void window_draw_cursorline(Win *win) {
 	}
 }
 
-static void window_draw_selection(Win *win, Selection *cur) {
+static void window_draw_range(Win *win, const Filerange *range, enum UiStyle style) {
 	View *view = &win->view;
-	Filerange sel = view_selections_get(cur);
-	if (!text_range_valid(&sel))
-		return;
 	Line *start_line; int start_col;
 	Line *end_line; int end_col;
-	view_coord_get(view, sel.start, &start_line, NULL, &start_col);
-	view_coord_get(view, sel.end, &end_line, NULL, &end_col);
+	view_coord_get(view, range->start, &start_line, NULL, &start_col);
+	view_coord_get(view, range->end, &end_line, NULL, &end_col);
 	if (!start_line && !end_line)
 		return;
 	if (!start_line) {
@@ -285,10 +481,29 @@ static void window_draw_selection(Win *win, Selection *cur) {
 		int col = (l == start_line) ? start_col : 0;
 		int end = (l == end_line) ? end_col : l->width;
 		while (col < end)
-			ui_window_style_set(win, &l->cells[col++], UI_STYLE_SELECTION);
+			ui_window_style_set(win, &l->cells[col++], style);
 	}
 }
 
+static void window_draw_selection(Win *win, Selection *cur) {
+	Filerange sel = view_selections_get(cur);
+	if (text_range_valid(&sel))
+		window_draw_range(win, &sel, UI_STYLE_SELECTION);
+}
+
+static bool window_draw_match(const Filerange *match, void *data) {
+	window_draw_range(data, match, UI_STYLE_SEARCH);
+	return true;
+}
+
+static void window_draw_search(Win *win) {
+	Vis *vis = win->vis;
+	if (!vis->search_highlight || win->file->internal)
+		return;
+	Filerange viewport = VIEW_VIEWPORT_GET(win->view);
+	vis_search_matches(vis, win->file->text, &viewport, window_draw_match, win);
+}
+
 static void window_draw_cursor_matching(Win *win, Selection *cur) {
 	if (win->vis->mode->visual)
 		return;
@@ -347,13 +562,22 @@ static void window_draw_eof(Win *win) {
 }
 
 void vis_window_draw(Win *win) {
+	Vis *vis = win->vis;
+	/* windows too small to show any content do not need it */
+	bool visible = win->height > !!(win->options & UI_OPTION_STATUSBAR);
+	/* the events are emitted from the main loop, their handlers might change the layout */
+	if (win->file->pending && (vis->win == win || visible))
+		file_load_text(vis, win->file);
 	if (!view_update(&win->view))
 		return;
-	Vis *vis = win->vis;
+	double start = vis_time();
 	vis_event_emit(vis, VIS_EVENT_WIN_HIGHLIGHT, win);
+	vis_stats_add(vis, VIS_STAT_HIGHLIGHT, 1, vis_time() - start);
+	vis_startup_mark(vis, "win_highlight event");
 
 	window_draw_colorcolumn(win);
 	window_draw_cursorline(win);
+	window_draw_search(win);
 	if (!vis->win || vis->win == win || vis->win->parent == win)
 		window_draw_selections(win);
 	window_draw_eof(win);
@@ -363,8 +587,9 @@ void vis_window_draw(Win *win) {
 
 
 void vis_window_invalidate(Win *win) {
-	for (Win *w = win->vis->windows; w; w = w->next) {
-		if (w->file == win->file)
+	Vis *vis = win->vis;
+	for (Win *w = vis->windows; w; w = w->next) {
+		if (w->file == win->file && (!vis->batch || w == vis->win))
 			view_draw(&w->view);
 	}
 }
@@ -397,7 +622,10 @@ Win *window_new_file(Vis *vis, File *file, enum UiOption options) {
 	ui_window_focus(win);
 	for (size_t i = 0; i < LENGTH(win->modes); i++)
 		win->modes[i].parent = &vis_modes[i];
-	vis_event_emit(vis, VIS_EVENT_WIN_OPEN, win);
+	if (!file->pending && !file->announce)
+		vis_event_emit(vis, VIS_EVENT_WIN_OPEN, win);
+	if (!file->internal && !file->pending && !file->announce)
+		vis_startup_mark(vis, "win_open event");
 	return win;
 }
 
@@ -407,7 +635,7 @@ bool vis_window_reload(Win *win) {
 		return false; /* can't reload unsaved file */
 	/* temporarily unset file name, otherwise file_new returns the same File */
 	win->file->name = NULL;
-	File *file = file_new(win->vis, name, false);
+	File *file = file_new(win->vis, name, false, false);
 	win->file->name = name;
 	if (!file)
 		return false;
@@ -419,7 +647,7 @@ bool vis_window_reload(Win *win) {
 }
 
 bool vis_window_change_file(Win *win, const char* filename) {
-	File *file = file_new(win->vis, filename, false);
+	File *file = file_new(win->vis, filename, false, false);
 	if (!file)
 		return false;
 	file->refcount++;
@@ -453,6 +681,11 @@ void vis_window_focus(Win *win) {
 		return;
 	Vis *vis = win->vis;
 	vis->win = win;
+	if (!file_load(vis, win->file) && win->file->error)
+		vis_info_show(vis, "Can not load `%s': %s", win->file->name, strerror(win->file->error));
+	/* catch up with changes deferred while replaying keys */
+	if (vis->batch)
+		view_draw(&win->view);
 	ui_window_focus(win);
 }
 
@@ -473,9 +706,22 @@ void vis_window_prev(Vis *vis) {
 	vis_window_focus(sel);
 }
 
+/* while keys are replayed only the focused window is kept up to date,
+ * all others are laid out once the outermost replay finished */
 void vis_draw(Vis *vis) {
-	for (Win *win = vis->windows; win; win = win->next)
-		view_draw(&win->view);
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (!vis->batch || win == vis->win)
+			view_draw(&win->view);
+	}
+}
+
+static void batch_begin(Vis *vis) {
+	vis->batch++;
+}
+
+static void batch_end(Vis *vis) {
+	if (--vis->batch == 0)
+		vis_draw(vis);
 }
 
 void vis_redraw(Vis *vis) {
@@ -483,12 +729,17 @@ void vis_redraw(Vis *vis) {
 	ui_draw(&vis->ui);
 }
 
-bool vis_window_new(Vis *vis, const char *filename) {
-	File *file = file_new(vis, filename, false);
+static bool window_new(Vis *vis, const char *filename, bool deferred) {
+	File *file = file_new(vis, filename, false, deferred);
 	if (!file)
 		return false;
 	vis->ui.doupdate = false;
+	/* drawing would load the previously focused window */
+	if (deferred)
+		batch_begin(vis);
 	Win *win = window_new_file(vis, file, UI_OPTION_STATUSBAR|UI_OPTION_SYMBOL_EOF);
+	if (deferred)
+		batch_end(vis);
 	if (!win) {
 		file_free(vis, file);
 		return false;
@@ -498,6 +749,14 @@ bool vis_window_new(Vis *vis, const char *filename) {
 	return true;
 }
 
+bool vis_window_new(Vis *vis, const char *filename) {
+	return window_new(vis, filename, false);
+}
+
+bool vis_window_new_deferred(Vis *vis, const char *filename) {
+	return window_new(vis, filename, true);
+}
+
 bool vis_window_new_fd(Vis *vis, int fd) {
 	if (fd == -1)
 		return false;
@@ -507,6 +766,98 @@ bool vis_window_new_fd(Vis *vis, int fd) {
 	return true;
 }
 
+/* maximal amount of streamed input appended per main loop iteration */
+#define VIS_LOAD_SIZE (1 << 22)
+
+/* check progress of a background save, commit it once completed */
+void file_save_ready(Vis *vis, int fd, short revents, void *data) {
+	File *file = data;
+	int status = text_save_poll(file->save.ctx, &file->save.written);
+	if (status == 1)
+		return;
+	vis_unwatch(vis, fd);
+	TextSave *ctx = file->save.ctx;
+	char *path = file->save.path;
+	file->save.ctx = NULL;
+	file->save.fd = -1;
+	file->save.path = NULL;
+	if (status == -1) {
+		vis_info_show(vis, "Can't write `%s': %s", path, strerror(errno));
+		text_save_cancel(ctx);
+	} else if (!text_save_commit(ctx)) {
+		vis_info_show(vis, "Can't write `%s': %s", path, strerror(errno));
+	} else {
+		if (!file->name) {
+			file_name_set(file, path);
+			file->save.stat = true;
+		}
+		if (file->save.stat) {
+			file->incomplete = false;
+			file->stat = text_stat(file->text);
+			vis_monitor_file(vis, file);
+		}
+		vis_event_emit(vis, VIS_EVENT_FILE_SAVE_POST, file, path);
+	}
+	/* modifications by others were ignored while the save was in progress */
+	vis_monitor_file_check(vis, file);
+	free(path);
+}
+
+/* append the data available on a streamed input file */
+static void file_load_ready(Vis *vis, int fd, short revents, void *data) {
+	static char buf[1 << 16];
+	File *file = data;
+	Text *txt = file->text;
+	bool empty = text_size(txt) == 0;
+	ssize_t len = 0;
+	/* the content only corresponds to the file if it was not edited meanwhile */
+	if (file->loadgen != text_generation(txt))
+		file->loadgen = SIZE_MAX;
+	for (size_t total = 0; total < VIS_LOAD_SIZE; total += len) {
+		len = read(fd, buf, sizeof buf);
+		if (len <= 0 || !text_insert(txt, text_size(txt), buf, len))
+			break;
+	}
+	if (file->loadgen != SIZE_MAX)
+		file->loadgen = text_generation(txt);
+	if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+		if (len == -1) {
+			vis_info_show(vis, "Failed to load file: %s", strerror(errno));
+			file->incomplete = true;
+		}
+		vis_unwatch(vis, fd);
+		close(fd);
+		file->loadfd = -1;
+		text_snapshot(txt);
+		if (file->loadpid != -1) {
+			int status;
+			pid_t pid = file->loadpid;
+			file->loadpid = -1;
+			if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				vis_info_show(vis, "Failed to decompress `%s'", file_name_get(file));
+				file->incomplete = true;
+			} else if (len == 0 && file->loadgen != SIZE_MAX &&
+			           text_load_commit(txt, AT_FDCWD, file->name)) {
+				file->stat = text_stat(txt);
+			}
+		}
+	}
+	for (Win *win = vis->windows; win; win = win->next) {
+		if (win->file != file)
+			continue;
+		/* a cursor in an empty text sticks to its end, keep it at the start */
+		if (empty && text_size(txt) > 0)
+			view_cursors_to(win->view.selection, 0);
+		view_draw(&win->view);
+	}
+}
+
+bool vis_window_new_stream(Vis *vis, int infd, int outfd) {
+	if (infd == -1 || !vis_window_new_fd(vis, outfd))
+		return false;
+	return file_stream(vis, vis->win->file, infd, -1);
+}
+
 bool vis_window_closable(Win *win) {
 	if (!win || !text_modified(win->file->text))
 		return true;
@@ -546,7 +897,8 @@ void vis_window_close(Win *win) {
 	if (!win)
 		return;
 	Vis *vis = win->vis;
-	vis_event_emit(vis, VIS_EVENT_WIN_CLOSE, win);
+	if (!win->file->pending && !win->file->announce)
+		vis_event_emit(vis, VIS_EVENT_WIN_CLOSE, win);
 	file_free(vis, win->file);
 	if (win->prev)
 		win->prev->next = win->next;
@@ -564,11 +916,211 @@ void vis_window_close(Win *win) {
 	vis_draw(vis);
 }
 
+/* the first entries of the polled descriptors are always standard input
+ * and the signal pipe, all following ones are registered watches */
+enum { WATCH_STDIN, WATCH_SIGNAL, WATCH_FIRST };
+
+static bool watch_init(Vis *vis) {
+	if (pipe(vis->signal_pipe) == -1)
+		return false;
+	for (size_t i = 0; i < LENGTH(vis->signal_pipe); i++) {
+		int flags = fcntl(vis->signal_pipe[i], F_GETFL);
+		if (flags == -1 || fcntl(vis->signal_pipe[i], F_SETFL, flags|O_NONBLOCK) == -1 ||
+		    fcntl(vis->signal_pipe[i], F_SETFD, FD_CLOEXEC) == -1)
+			return false;
+	}
+	Watch none = { 0 };
+	struct pollfd in = { .fd = STDIN_FILENO, .events = POLLIN };
+	struct pollfd sig = { .fd = vis->signal_pipe[0], .events = POLLIN };
+	return array_add(&vis->pollfds, &in) && array_add(&vis->watches, &none) &&
+	       array_add(&vis->pollfds, &sig) && array_add(&vis->watches, &none);
+}
+
+bool vis_watch(Vis *vis, int fd, short events, WatchFunction *func, void *data) {
+	if (fd < 0)
+		return false;
+	Watch watch = { .func = func, .data = data };
+	for (size_t i = WATCH_FIRST, len = array_length(&vis->pollfds); i < len; i++) {
+		struct pollfd *pfd = array_get(&vis->pollfds, i);
+		if (pfd->fd == fd) {
+			pfd->events = events;
+			return array_set(&vis->watches, i, &watch);
+		}
+	}
+	struct pollfd pfd = { .fd = fd, .events = events };
+	if (!array_add(&vis->watches, &watch))
+		return false;
+	if (!array_add(&vis->pollfds, &pfd)) {
+		array_truncate(&vis->watches, array_length(&vis->pollfds));
+		return false;
+	}
+	return true;
+}
+
+void vis_unwatch(Vis *vis, int fd) {
+	for (size_t i = WATCH_FIRST, len = array_length(&vis->pollfds); i < len; i++) {
+		struct pollfd *pfd = array_get(&vis->pollfds, i);
+		if (pfd->fd == fd) {
+			array_remove(&vis->pollfds, i);
+			array_remove(&vis->watches, i);
+			return;
+		}
+	}
+}
+
+/* invoke the functions of all ready watches. They might add or remove
+ * watches, hence iterate backwards and clear the reported events such
+ * that an entry moved to a not yet visited index is not invoked twice */
+static void watch_dispatch(Vis *vis) {
+	for (size_t i = array_length(&vis->pollfds); i-- > WATCH_FIRST; ) {
+		struct pollfd *pfd = array_get(&vis->pollfds, i);
+		if (!pfd || !pfd->revents)
+			continue;
+		short revents = pfd->revents;
+		pfd->revents = 0;
+		Watch *watch = array_get(&vis->watches, i);
+		watch->func(vis, pfd->fd, revents, watch->data);
+	}
+}
+
+/* upper bound in seconds on how long deferred tasks run before checking for input */
+#define VIS_IDLE_SLICE 0.01
+/* bytes copied at most by one invocation of the compaction task */
+#define VIS_COMPACT_SLICE (1 << 20)
+
+static void task_release(Vis *vis, Task *task) {
+	if (task->release)
+		task->release(vis, task->data);
+}
+
+bool vis_defer(Vis *vis, TaskFunction *func, TaskRelease *release, void *data) {
+	Task task = { .func = func, .release = release, .data = data };
+	return func && array_add(&vis->tasks, &task);
+}
+
+/* run deferred tasks in order for at most one slice, a task which is not
+ * yet done is moved to the end of the queue. Returns whether any remain */
+static bool task_run(Vis *vis) {
+	double end = vis_time() + VIS_IDLE_SLICE;
+	while (array_length(&vis->tasks) && vis_time() < end) {
+		Task task = *(Task*)array_get(&vis->tasks, 0);
+		array_remove(&vis->tasks, 0);
+		if (!task.func(vis, task.data) || !array_add(&vis->tasks, &task))
+			task_release(vis, &task);
+	}
+	return array_length(&vis->tasks) > 0;
+}
+
+/* coalesce small pieces of the fragmented texts, shared by all slices */
+static bool compact_task(Vis *vis, void *data) {
+	size_t budget = VIS_COMPACT_SLICE;
+	bool fragmented = false;
+	for (File *file = vis->files; file; file = file->next) {
+		if (file->pending)
+			continue;
+		double start = vis_time();
+		size_t removed = budget ? text_compact(file->text, &budget) : 0;
+		if (removed)
+			vis_stats_add(vis, VIS_STAT_COMPACT, removed, vis_time() - start);
+		if (text_fragmented(file->text))
+			fragmented = true;
+	}
+	return vis->compact_task = fragmented;
+}
+
+static void compact_schedule(Vis *vis) {
+	if (vis->compact_task)
+		return;
+	for (File *file = vis->files; file; file = file->next) {
+		if (!file->pending && text_fragmented(file->text)) {
+			vis->compact_task = vis_defer(vis, compact_task, NULL, NULL);
+			return;
+		}
+	}
+}
+
+unsigned int vis_timer(Vis *vis, double timeout, double interval, TaskFunction *func, TaskRelease *release, void *data) {
+	if (!func || timeout < 0 || interval < 0)
+		return 0;
+	if (!++vis->timer_id)
+		vis->timer_id++;
+	Task timer = {
+		.func = func,
+		.release = release,
+		.data = data,
+		.id = vis->timer_id,
+		.due = vis_time() + timeout,
+		.interval = interval,
+	};
+	return array_add(&vis->timers, &timer) ? timer.id : 0;
+}
+
+bool vis_timer_cancel(Vis *vis, unsigned int id) {
+	if (!id)
+		return false;
+	if (id == vis->timer_active) {
+		/* released once its invocation returns */
+		vis->timer_active = 0;
+		return true;
+	}
+	for (size_t i = 0, len = array_length(&vis->timers); i < len; i++) {
+		Task *timer = array_get(&vis->timers, i);
+		if (timer->id == id) {
+			Task copy = *timer;
+			array_remove(&vis->timers, i);
+			task_release(vis, &copy);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* index of the timer expiring first, -1 if there are none */
+static ssize_t timer_next(Vis *vis) {
+	ssize_t next = -1;
+	for (size_t i = 0, len = array_length(&vis->timers); i < len; i++) {
+		Task *timer = array_get(&vis->timers, i);
+		if (next == -1 || timer->due < ((Task*)array_get(&vis->timers, next))->due)
+			next = i;
+	}
+	return next;
+}
+
+/* invoke all timers expired by now, earliest first. They might add or
+ * cancel timers, hence each is removed while it runs */
+static bool timer_run(Vis *vis) {
+	bool fired = false;
+	double now = vis_time();
+	for (ssize_t i; (i = timer_next(vis)) != -1; ) {
+		Task timer = *(Task*)array_get(&vis->timers, i);
+		if (timer.due > now)
+			break;
+		array_remove(&vis->timers, i);
+		vis->timer_active = timer.id;
+		bool again = timer.func(vis, timer.data) && timer.interval > 0;
+		if (again && vis->timer_active) {
+			/* skip intervals missed meanwhile rather than firing repeatedly */
+			timer.due += timer.interval;
+			if (timer.due <= now)
+				timer.due = now + timer.interval;
+			again = array_add(&vis->timers, &timer);
+		} else {
+			again = false;
+		}
+		vis->timer_active = 0;
+		if (!again)
+			task_release(vis, &timer);
+		fired = true;
+	}
+	return fired;
+}
+
 Vis *vis_new(void) {
 	Vis *vis = calloc(1, sizeof(Vis));
 	if (!vis)
 		return NULL;
 	vis->exit_status = -1;
+	vis->signal_pipe[0] = vis->signal_pipe[1] = -1;
 	if (!ui_terminal_init(&vis->ui)) {
 		free(vis);
 		return NULL;
@@ -586,8 +1138,14 @@ Vis *vis_new(void) {
 	array_init(&vis->textobjects);
 	array_init(&vis->bindings);
 	array_init(&vis->actions_user);
+	array_init_sized(&vis->pollfds, sizeof(struct pollfd));
+	array_init_sized(&vis->watches, sizeof(Watch));
+	array_init_sized(&vis->tasks, sizeof(Task));
+	array_init_sized(&vis->timers, sizeof(Task));
 	action_reset(&vis->action);
 	buffer_init(&vis->input_queue);
+	if (!watch_init(vis))
+		goto err;
 	if (!(vis->command_file = file_new_internal(vis, NULL)))
 		goto err;
 	if (!(vis->search_file = file_new_internal(vis, NULL)))
@@ -608,6 +1166,7 @@ Vis *vis_new(void) {
 		shell = "/bin/sh";
 	if (!(vis->shell = strdup(shell)))
 		goto err;
+	vis->filter_jobs = 1;
 	vis->mode_prev = vis->mode = &vis_modes[VIS_MODE_NORMAL];
 	vis_modes[VIS_MODE_INSERT].input  = vis_event_mode_insert_input;
 	vis_modes[VIS_MODE_REPLACE].input = vis_event_mode_replace_input;
@@ -622,12 +1181,24 @@ void vis_free(Vis *vis) {
 		return;
 	while (vis->windows)
 		vis_window_close(vis->windows);
+	vis_paths_free(vis);
+	vis_monitor_free(vis);
+	for (size_t i = 0, len = array_length(&vis->tasks); i < len; i++)
+		task_release(vis, array_get(&vis->tasks, i));
+	for (size_t i = 0, len = array_length(&vis->timers); i < len; i++)
+		task_release(vis, array_get(&vis->timers, i));
+	array_release(&vis->tasks);
+	array_release(&vis->timers);
 	vis_event_emit(vis, VIS_EVENT_QUIT);
 	file_free(vis, vis->command_file);
 	file_free(vis, vis->search_file);
 	file_free(vis, vis->error_file);
 	for (int i = 0; i < LENGTH(vis->registers); i++)
 		register_release(&vis->registers[i]);
+	regex_cache_release(&vis->regex_cache);
+	vis_words_free(vis);
+	if (vis->startup.log)
+		fclose(vis->startup.log);
 	ui_terminal_free(&vis->ui);
 	if (vis->usercmds) {
 		const char *name;
@@ -643,8 +1214,11 @@ void vis_free(Vis *vis) {
 	map_free(vis->actions);
 	map_free(vis->keymap);
 	buffer_release(&vis->input_queue);
-	for (int i = 0; i < VIS_MODE_INVALID; i++)
+	buffer_release(&vis->paste);
+	for (int i = 0; i < VIS_MODE_INVALID; i++) {
 		map_free(vis_modes[i].bindings);
+		mode_lookup_free(&vis_modes[i]);
+	}
 	array_release_full(&vis->operators);
 	array_release_full(&vis->motions);
 	array_release_full(&vis->textobjects);
@@ -654,6 +1228,12 @@ void vis_free(Vis *vis) {
 	while (array_length(&vis->actions_user))
 		vis_action_free(vis, array_get_ptr(&vis->actions_user, 0));
 	array_release(&vis->actions_user);
+	array_release(&vis->pollfds);
+	array_release(&vis->watches);
+	for (size_t i = 0; i < LENGTH(vis->signal_pipe); i++) {
+		if (vis->signal_pipe[i] != -1)
+			close(vis->signal_pipe[i]);
+	}
 	free(vis->shell);
 	free(vis);
 }
@@ -730,6 +1310,178 @@ bool vis_interrupt_requested(Vis *vis) {
 	return vis->interrupted;
 }
 
+/* determine the range an operator acts upon for the given selection, without
+ * an operator the selection is moved instead. Fails if the movement could not
+ * be performed the requested number of times. */
+static bool action_range(Vis *vis, Action *a, Selection *sel, OperatorContext *c) {
+	Win *win = vis->win;
+	File *file = win->file;
+	Text *txt = file->text;
+	View *view = &win->view;
+	size_t pos = c->pos = view_cursors_pos(sel);
+	c->newpos = EPOS;
+	c->range = text_range_empty();
+
+	if (a->movement) {
+		size_t start = pos;
+		for (int i = 0; i < c->count; i++) {
+			size_t pos_prev = pos;
+			if (a->movement->txt)
+				pos = a->movement->txt(txt, pos);
+			else if (a->movement->cur)
+				pos = a->movement->cur(sel);
+			else if (a->movement->file)
+				pos = a->movement->file(vis, file, sel);
+			else if (a->movement->vis)
+				pos = a->movement->vis(vis, txt, pos);
+			else if (a->movement->view)
+				pos = a->movement->view(vis, view);
+			else if (a->movement->win)
+				pos = a->movement->win(vis, win, pos);
+			else if (a->movement->user)
+				pos = a->movement->user(vis, win, a->movement->data, pos);
+			if (pos == EPOS || a->movement->type & IDEMPOTENT || pos == pos_prev) {
+				if (a->movement->type & COUNT_EXACT)
+					return false;
+				break;
+			}
+		}
+
+		if (pos == EPOS) {
+			c->range.start = start;
+			c->range.end = start;
+			pos = start;
+		} else {
+			c->range = text_range_new(start, pos);
+			c->newpos = pos;
+		}
+
+		if (!a->op) {
+			if (a->movement->type & CHARWISE)
+				view_cursors_scroll_to(sel, pos);
+			else
+				view_cursors_to(sel, pos);
+			if (vis->mode->visual)
+				c->range = view_selections_get(sel);
+		} else if (a->movement->type & INCLUSIVE && c->range.end > start) {
+			c->range.end = text_char_next(txt, c->range.end);
+		} else if (c->linewise && (a->movement->type & LINEWISE_INCLUSIVE)) {
+			c->range.end = text_char_next(txt, c->range.end);
+		}
+	} else if (a->textobj) {
+		if (vis->mode->visual)
+			c->range = view_selections_get(sel);
+		else
+			c->range.start = c->range.end = pos;
+		for (int i = 0; i < c->count; i++) {
+			Filerange r = text_range_empty();
+			if (a->textobj->txt)
+				r = a->textobj->txt(txt, pos);
+			else if (a->textobj->vis)
+				r = a->textobj->vis(vis, txt, pos);
+			else if (a->textobj->user)
+				r = a->textobj->user(vis, win, a->textobj->data, pos);
+			if (!text_range_valid(&r))
+				break;
+			if (a->textobj->type & TEXTOBJECT_DELIMITED_OUTER) {
+				r.start--;
+				r.end++;
+			} else if (c->linewise && (a->textobj->type & TEXTOBJECT_DELIMITED_INNER)) {
+				r.start = text_line_next(txt, r.start);
+				r.end = text_line_prev(txt, r.end);
+			}
+
+			if (vis->mode->visual || (i > 0 && !(a->textobj->type & TEXTOBJECT_NON_CONTIGUOUS)))
+				c->range = text_range_union(&c->range, &r);
+			else
+				c->range = r;
+
+			if (i < c->count - 1) {
+				if (a->textobj->type & TEXTOBJECT_EXTEND_BACKWARD) {
+					pos = c->range.start;
+					if ((a->textobj->type & TEXTOBJECT_DELIMITED_INNER) && pos > 0)
+						pos--;
+				} else {
+					pos = c->range.end;
+					if (a->textobj->type & TEXTOBJECT_DELIMITED_INNER)
+						pos++;
+				}
+			}
+		}
+	} else if (vis->mode->visual) {
+		c->range = view_selections_get(sel);
+		if (!text_range_valid(&c->range))
+			c->range.start = c->range.end = pos;
+	}
+
+	if (c->linewise && vis->mode != &vis_modes[VIS_MODE_VISUAL])
+		c->range = text_range_linewise(txt, &c->range);
+	if (vis->mode->visual) {
+		view_selections_set(sel, &c->range);
+		sel->anchored = true;
+	}
+	return true;
+}
+
+typedef struct {
+	Selection *sel;
+	size_t pos;       /* new cursor position once the edits are applied */
+} ActionCursor;
+
+typedef struct {          /* modifications of multiple selections applied in one go */
+	Array edits;      /* TextEdit, relative to the unmodified text */
+	Array cursors;    /* ActionCursor */
+	size_t end;       /* end of the last edit */
+	size_t limit;     /* further edits must not start before, to keep the cursors valid */
+	size_t deleted;   /* total number of bytes removed and inserted by the edits */
+	size_t inserted;
+} ActionBatch;
+
+/* accept the edits appended starting from index first, if they are ordered
+ * and neither overlap nor affect the new cursor positions of preceding
+ * selections, otherwise they are removed again */
+static bool action_batch_add(ActionBatch *b, Selection *sel, size_t first, size_t newpos) {
+	size_t len = array_length(&b->edits), end = b->end, deleted = 0, inserted = 0;
+	bool insertion = false;
+	for (size_t i = first; i < len && newpos != EPOS; i++) {
+		TextEdit *e = array_get(&b->edits, i);
+		if (e->range.start < (i == first ? b->limit : end))
+			newpos = EPOS;
+		end = e->range.end;
+		deleted += text_range_size(&e->range);
+		inserted += e->len * e->count;
+		insertion = e->len * e->count > 0 && text_range_size(&e->range) == 0;
+	}
+	ActionCursor cur = { sel, newpos - b->deleted + b->inserted };
+	if (newpos == EPOS || newpos < b->end || !array_add(&b->cursors, &cur)) {
+		array_truncate(&b->edits, first);
+		return false;
+	}
+	/* a cursor placed beyond the edits refers to unmodified content */
+	size_t pos = newpos + deleted >= end + inserted ? newpos + deleted - inserted : 0;
+	/* the order of insertions at the same position by different selections
+	 * depends on cursors which are not updated until the end */
+	b->limit = pos > end || insertion ? MAX(pos, end) + 1 : end;
+	b->end = end;
+	b->deleted += deleted;
+	b->inserted += inserted;
+	return true;
+}
+
+static void action_batch_apply(Text *txt, ActionBatch *b) {
+	if (text_batch(txt, array_get(&b->edits, 0), array_length(&b->edits))) {
+		for (size_t i = 0, len = array_length(&b->cursors); i < len; i++) {
+			ActionCursor *cur = array_get(&b->cursors, i);
+			if (cur->pos <= text_size(txt)) {
+				view_selection_clear(cur->sel);
+				view_cursors_to(cur->sel, cur->pos);
+			}
+		}
+	}
+	array_clear(&b->edits);
+	array_clear(&b->cursors);
+}
+
 void vis_do(Vis *vis) {
 	Win *win = vis->win;
 	if (!win)
@@ -760,6 +1512,11 @@ void vis_do(Vis *vis) {
 	if (vis->mode->visual && a->op)
 		window_selection_save(win);
 
+	bool batch = multiple_cursors && a->op && a->op->batch;
+	ActionBatch b = { 0 };
+	array_init_sized(&b.edits, sizeof(TextEdit));
+	array_init_sized(&b.cursors, sizeof(ActionCursor));
+
 	for (Selection *sel = view_selections(view), *next; sel; sel = next) {
 		if (vis->interrupted)
 			break;
@@ -775,9 +1532,6 @@ void vis_do(Vis *vis) {
 
 		OperatorContext c = {
 			.count = count,
-			.pos = pos,
-			.newpos = EPOS,
-			.range = text_range_empty(),
 			.reg = reg,
 			.reg_slot = reg_slot == EPOS ? (size_t)view_selections_number(sel) : reg_slot,
 			.linewise = linewise,
@@ -787,108 +1541,24 @@ void vis_do(Vis *vis) {
 
 		last_reg_slot = c.reg_slot;
 
-		bool err = false;
-		if (a->movement) {
-			size_t start = pos;
-			for (int i = 0; i < count; i++) {
-				size_t pos_prev = pos;
-				if (a->movement->txt)
-					pos = a->movement->txt(txt, pos);
-				else if (a->movement->cur)
-					pos = a->movement->cur(sel);
-				else if (a->movement->file)
-					pos = a->movement->file(vis, file, sel);
-				else if (a->movement->vis)
-					pos = a->movement->vis(vis, txt, pos);
-				else if (a->movement->view)
-					pos = a->movement->view(vis, view);
-				else if (a->movement->win)
-					pos = a->movement->win(vis, win, pos);
-				else if (a->movement->user)
-					pos = a->movement->user(vis, win, a->movement->data, pos);
-				if (pos == EPOS || a->movement->type & IDEMPOTENT || pos == pos_prev) {
-					err = a->movement->type & COUNT_EXACT;
-					break;
-				}
-			}
+		if (!action_range(vis, a, sel, &c)) {
+			repeatable = false;
+			continue;
+		}
 
-			if (err) {
+		if (batch) {
+			size_t first = array_length(&b.edits);
+			size_t newpos = a->op->batch(vis, txt, &c, &b.edits);
+			if (action_batch_add(&b, sel, first, newpos))
+				continue;
+			/* apply what was collected so far, continue one selection
+			 * at a time based on the modified text */
+			action_batch_apply(txt, &b);
+			batch = false;
+			if (!action_range(vis, a, sel, &c)) {
 				repeatable = false;
-				continue; // break?
-			}
-
-			if (pos == EPOS) {
-				c.range.start = start;
-				c.range.end = start;
-				pos = start;
-			} else {
-				c.range = text_range_new(start, pos);
-				c.newpos = pos;
-			}
-
-			if (!a->op) {
-				if (a->movement->type & CHARWISE)
-					view_cursors_scroll_to(sel, pos);
-				else
-					view_cursors_to(sel, pos);
-				if (vis->mode->visual)
-					c.range = view_selections_get(sel);
-			} else if (a->movement->type & INCLUSIVE && c.range.end > start) {
-				c.range.end = text_char_next(txt, c.range.end);
-			} else if (linewise && (a->movement->type & LINEWISE_INCLUSIVE)) {
-				c.range.end = text_char_next(txt, c.range.end);
-			}
-		} else if (a->textobj) {
-			if (vis->mode->visual)
-				c.range = view_selections_get(sel);
-			else
-				c.range.start = c.range.end = pos;
-			for (int i = 0; i < count; i++) {
-				Filerange r = text_range_empty();
-				if (a->textobj->txt)
-					r = a->textobj->txt(txt, pos);
-				else if (a->textobj->vis)
-					r = a->textobj->vis(vis, txt, pos);
-				else if (a->textobj->user)
-					r = a->textobj->user(vis, win, a->textobj->data, pos);
-				if (!text_range_valid(&r))
-					break;
-				if (a->textobj->type & TEXTOBJECT_DELIMITED_OUTER) {
-					r.start--;
-					r.end++;
-				} else if (linewise && (a->textobj->type & TEXTOBJECT_DELIMITED_INNER)) {
-					r.start = text_line_next(txt, r.start);
-					r.end = text_line_prev(txt, r.end);
-				}
-
-				if (vis->mode->visual || (i > 0 && !(a->textobj->type & TEXTOBJECT_NON_CONTIGUOUS)))
-					c.range = text_range_union(&c.range, &r);
-				else
-					c.range = r;
-
-				if (i < count - 1) {
-					if (a->textobj->type & TEXTOBJECT_EXTEND_BACKWARD) {
-						pos = c.range.start;
-						if ((a->textobj->type & TEXTOBJECT_DELIMITED_INNER) && pos > 0)
-							pos--;
-					} else {
-						pos = c.range.end;
-						if (a->textobj->type & TEXTOBJECT_DELIMITED_INNER)
-							pos++;
-					}
-				}
+				continue;
 			}
-		} else if (vis->mode->visual) {
-			c.range = view_selections_get(sel);
-			if (!text_range_valid(&c.range))
-				c.range.start = c.range.end = pos;
-		}
-
-		if (linewise && vis->mode != &vis_modes[VIS_MODE_VISUAL])
-			c.range = text_range_linewise(txt, &c.range);
-		if (vis->mode->visual) {
-			view_selections_set(sel, &c.range);
-			sel->anchored = true;
 		}
 
 		if (a->op) {
@@ -902,6 +1572,11 @@ void vis_do(Vis *vis) {
 		}
 	}
 
+	if (batch)
+		action_batch_apply(txt, &b);
+	array_release(&b.edits);
+	array_release(&b.cursors);
+
 	view_selections_normalize(view);
 	if (a->movement && (a->movement->type & JUMP))
 		vis_jumplist_save(vis);
@@ -1042,24 +1717,44 @@ bool vis_keys_utf8(Vis *vis, const char *keys, char utf8[static UTFmax+1]) {
 	return true;
 }
 
-typedef struct {
-	Vis *vis;
-	size_t len;         // length of the prefix
-	int count;          // how many bindings can complete this prefix
-	bool angle_bracket; // does the prefix end with '<'
-} PrefixCompletion;
-
-static bool isprefix(const char *key, void *value, void *data) {
-	PrefixCompletion *completion = data;
-	if (!completion->angle_bracket) {
-		completion->count++;
-	} else {
-		const char *start = key + completion->len;
-		const char *end = vis_keys_next(completion->vis, start);
-		if (end && start + 1 == end)
-			completion->count++;
+/* index of the first entry in [lo, hi) not sorting before key */
+static size_t lookup_search(const KeyEntry *entries, size_t lo, size_t hi, const char *key) {
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strcmp(entries[mid].key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* look up the keys typed so far among the sorted entries [lo, hi) of one
+ * mode. Returns the exactly matching binding, if any, and whether further
+ * keys could complete a longer one. keys[len] is where the latest key
+ * starts, if it is a lone '<' only bindings continuing with a literal '<'
+ * are considered */
+static KeyBinding *lookup_keys(Vis *vis, const KeyEntry *entries, size_t lo, size_t hi,
+                               const char *keys, size_t len, bool *prefix) {
+	size_t keys_len = strlen(keys);
+	bool angle_bracket = !strcmp(keys + len, "<");
+	size_t i = lookup_search(entries, lo, hi, keys);
+	KeyBinding *match = i < hi && !strcmp(entries[i].key, keys) ? entries[i].binding : NULL;
+	int count = 0; /* how many bindings can complete this prefix, at most 2 */
+	for (; i < hi && !strncmp(entries[i].key, keys, keys_len); i++) {
+		if (!angle_bracket) {
+			count++;
+		} else {
+			const char *start = entries[i].key + len;
+			const char *end = vis_keys_next(vis, start);
+			if (end && start + 1 == end)
+				count++;
+		}
+		if (count != 1)
+			break;
 	}
-	return completion->count == 1;
+	*prefix = (!match && count > 0) || (match && count > 1);
+	return match;
 }
 
 static void vis_keys_process(Vis *vis, size_t pos) {
@@ -1079,32 +1774,17 @@ static void vis_keys_process(Vis *vis, size_t pos) {
 		*end = '\0';
 		prefix = false;
 
-		for (Mode *global_mode = vis->mode; global_mode && !prefix; global_mode = global_mode->parent) {
-			for (int global = 0; global < 2 && !prefix; global++) {
-				Mode *mode = (global || !vis->win) ?
-					     global_mode :
-				             &vis->win->modes[global_mode->id];
-				if (!mode->bindings)
-					continue;
-				/* keep track of longest matching binding */
-				KeyBinding *match = map_get(mode->bindings, start);
-				if (match && end > binding_end) {
-					binding = match;
-					binding_end = end;
-				}
-
-				const Map *pmap = map_prefix(mode->bindings, start);
-				PrefixCompletion completions = {
-					.vis = vis,
-					.len = cur - start,
-					.count = 0,
-					.angle_bracket = !strcmp(cur, "<"),
-				};
-				map_iterate(pmap, isprefix, &completions);
-
-				prefix = (!match && completions.count > 0) ||
-				         ( match && completions.count > 1);
+		const KeyTable *table = mode_lookup(vis);
+		const KeyEntry *entries = table ? array_get(&table->entries, 0) : NULL;
+		for (size_t l = 0, lo = 0, levels = table ? array_length(&table->levels) : 0; l < levels && !prefix; l++) {
+			size_t hi = *(size_t*)array_get(&table->levels, l);
+			KeyBinding *match = lookup_keys(vis, entries, lo, hi, start, cur - start, &prefix);
+			/* keep track of longest matching binding */
+			if (match && end > binding_end) {
+				binding = match;
+				binding_end = end;
 			}
+			lo = hi;
 		}
 
 		*end = tmp;
@@ -1171,7 +1851,9 @@ void vis_keys_feed(Vis *vis, const char *input) {
 	if (!macro_append(&macro, input))
 		return;
 	/* use internal function, to keep Lua based tests which use undo points working */
+	batch_begin(vis);
 	macro_replay_internal(vis, &macro);
+	batch_end(vis);
 	macro_release(&macro);
 }
 
@@ -1186,10 +1868,86 @@ static void vis_keys_push(Vis *vis, const char *input, size_t pos, bool record)
 		vis_keys_process(vis, pos);
 }
 
+/* append the text a key of a bracketed paste stands for */
+static void paste_key(Vis *vis, const TermKeyKey *key) {
+	switch (key->type) {
+	case TERMKEY_TYPE_UNICODE:
+		if (key->modifiers & TERMKEY_KEYMOD_CTRL) {
+			/* control characters are reported as Ctrl + letter */
+			char c = key->code.codepoint & 0x1f;
+			buffer_append(&vis->paste, &c, 1);
+		} else {
+			buffer_append0(&vis->paste, key->utf8);
+		}
+		break;
+	case TERMKEY_TYPE_KEYSYM:
+		switch (key->code.sym) {
+		case TERMKEY_SYM_ENTER:
+			buffer_append(&vis->paste, "\n", 1);
+			break;
+		case TERMKEY_SYM_TAB:
+			buffer_append(&vis->paste, "\t", 1);
+			break;
+		case TERMKEY_SYM_SPACE:
+			buffer_append(&vis->paste, " ", 1);
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* insert the pasted text at every selection with one change each, bypassing
+ * all key bindings. the paste forms its own undo revision */
+static void paste_finish(Vis *vis) {
+	Win *win = vis->win;
+	const char *data = buffer_content(&vis->paste);
+	size_t len = buffer_length(&vis->paste);
+	vis->pasting = false;
+	if (!win || !len)
+		return;
+	vis_file_snapshot(vis, win->file);
+	if (vis->mode->id == VIS_MODE_REPLACE)
+		vis_replace_key(vis, data, len);
+	else
+		vis_insert_key(vis, data, len);
+	vis_file_snapshot(vis, win->file);
+	buffer_clear(&vis->paste);
+}
+
 static const char *getkey(Vis *vis) {
 	TermKeyKey key = { 0 };
-	if (!ui_getkey(&vis->ui, &key))
-		return NULL;
+	TermKey *termkey = vis->ui.termkey;
+	for (;;) {
+		if (!ui_getkey(&vis->ui, &key))
+			return NULL;
+		if (key.type != TERMKEY_TYPE_UNKNOWN_CSI) {
+			if (!vis->pasting)
+				break;
+			paste_key(vis, &key);
+			continue;
+		}
+		long args[18];
+		size_t nargs;
+		unsigned long cmd;
+		if (termkey_interpret_csi(termkey, &key, &args[2], &nargs, &cmd) != TERMKEY_RES_KEY)
+			continue;
+		if (cmd == '~' && nargs == 1 && (args[2] == 200 || args[2] == 201)) {
+			/* start and end of a bracketed paste */
+			if (args[2] == 201)
+				paste_finish(vis);
+			else
+				vis->pasting = true;
+			continue;
+		}
+		args[0] = (long)cmd;
+		args[1] = nargs;
+		vis_event_emit(vis, VIS_EVENT_TERM_CSI, args);
+	}
+
 	ui_info_hide(&vis->ui);
 	bool use_keymap = vis->mode->id != VIS_MODE_INSERT &&
 	                  vis->mode->id != VIS_MODE_REPLACE &&
@@ -1204,18 +1962,6 @@ static const char *getkey(Vis *vis) {
 		}
 	}
 
-	TermKey *termkey = vis->ui.termkey;
-	if (key.type == TERMKEY_TYPE_UNKNOWN_CSI) {
-		long args[18];
-		size_t nargs;
-		unsigned long cmd;
-		if (termkey_interpret_csi(termkey, &key, &args[2], &nargs, &cmd) == TERMKEY_RES_KEY) {
-			args[0] = (long)cmd;
-			args[1] = nargs;
-			vis_event_emit(vis, VIS_EVENT_TERM_CSI, args);
-		}
-		return getkey(vis);
-	}
 	termkey_strfkey(termkey, vis->key, sizeof(vis->key), &key, TERMKEY_FORMAT_VIM);
 	return vis->key;
 }
@@ -1233,19 +1979,101 @@ bool vis_signal_handler(Vis *vis, int signum, const siginfo_t *siginfo, const vo
 		return true;
 	case SIGINT:
 		vis->interrupted = true;
-		return true;
+		break;
 	case SIGCONT:
 		vis->resume = true;
 		/* fall through */
 	case SIGWINCH:
 		vis->need_resize = true;
-		return true;
+		break;
 	case SIGTERM:
 	case SIGHUP:
 		vis->terminate = true;
-		return true;
+		break;
+	case SIGCHLD:
+		vis->children = true;
+		break;
+	default:
+		return false;
+	}
+	/* wake up the main loop, in case the signal arrived right before poll(2) */
+	int errsv = errno;
+	if (vis->signal_pipe[1] != -1 && write(vis->signal_pipe[1], "", 1) == -1)
+		errno = errsv;
+	return true;
+}
+
+/* upper bound in seconds on how long input is processed without drawing */
+#define VIS_FRAME_DRAIN_MAX 0.05
+
+static void timespec_set(struct timespec *ts, double seconds) {
+	if (seconds < 0)
+		seconds = 0;
+	ts->tv_sec = seconds;
+	ts->tv_nsec = (seconds - ts->tv_sec) * 1e9;
+}
+
+double vis_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool vis_startuptime(Vis *vis, const char *path, double start) {
+	if (!(vis->startup.log = fopen(path, "a")))
+		return false;
+	vis->startup.start = vis->startup.last = start;
+	fprintf(vis->startup.log, "\ntimes in msec\n"
+		" clock   self+nested  self:  required module\n"
+		" clock   elapsed:              other lines\n\n");
+	vis_startup_mark(vis, "initialize editor");
+	return true;
+}
+
+void vis_startup_mark(Vis *vis, const char *fmt, ...) {
+	FILE *log = vis->startup.log;
+	if (!log)
+		return;
+	double now = vis_time();
+	fprintf(log, "%08.3f %08.3f: ", (now - vis->startup.start) * 1e3, (now - vis->startup.last) * 1e3);
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(log, fmt, ap);
+	va_end(ap);
+	fputc('\n', log);
+	vis->startup.last = now;
+}
+
+void vis_stats_add(Vis *vis, enum VisStats id, unsigned long count, double time) {
+	VisStat *stat = &vis->stats[id];
+	stat->count += count;
+	stat->time += time;
+	stat->pending_count += count;
+	stat->pending_time += time;
+}
+
+/* collect the counters kept by views and files, then make everything
+ * measured since the previous frame the figures of the latest one */
+void vis_stats_frame(Vis *vis, double time) {
+	for (Win *win = vis->windows; win; win = win->next) {
+		View *view = &win->view;
+		vis_stats_add(vis, VIS_STAT_VIEW, view->stats.count, view->stats.time);
+		view->stats.count = 0;
+		view->stats.time = 0;
+	}
+	for (File *file = vis->files; file; file = file->next) {
+		size_t generation = text_generation(file->text);
+		if (generation > file->stats_generation)
+			vis_stats_add(vis, VIS_STAT_EDIT, generation - file->stats_generation, 0);
+		file->stats_generation = generation;
+	}
+	vis_stats_add(vis, VIS_STAT_FRAME, 1, time);
+	for (VisStat *stat = vis->stats; stat < vis->stats + VIS_STAT_LAST; stat++) {
+		stat->frame_count = stat->pending_count;
+		stat->frame_time = stat->pending_time;
+		stat->pending_count = 0;
+		stat->pending_time = 0;
 	}
-	return false;
 }
 
 int vis_run(Vis *vis) {
@@ -1256,10 +2084,30 @@ int vis_run(Vis *vis) {
 	vis->running = true;
 
 	vis_event_emit(vis, VIS_EVENT_START);
+	vis_startup_mark(vis, "start event");
 
+	/* the idle function of the mode is invoked once no input arrived for
+	 * its idle_timeout, counted from idle_since */
 	struct timespec idle = { .tv_nsec = 0 }, *timeout = NULL;
-
-	sigset_t emptyset;
+	double idle_since = 0;
+	/* a frame is only drawn once all pending input has been processed
+	 * and, if a maximum frame rate is set, enough time has passed since
+	 * the previous one. meanwhile poll(2) waits at most frame_wait */
+	struct timespec frame_wait;
+	double frame_last = 0, frame_input = 0;
+	bool redraw = true, drain = false;
+	/* once a frame is drawn, background work runs in slices for as long
+	 * as no input arrives and the idle event reports remaining work */
+	struct timespec idle_wait = { 0 };
+	bool idle_work = false;
+	/* poll(2) returns at the latest when the next timer expires */
+	struct timespec timer_wait;
+	/* time spent outside of poll(2) since the previous frame */
+	double busy = 0, wake = vis_time();
+
+	/* signals are blocked outside of poll(2), a signal arriving right
+	 * before it is noticed through the signal pipe */
+	sigset_t emptyset, blockset;
 	sigemptyset(&emptyset);
 	vis_draw(vis);
 	vis->exit_status = EXIT_SUCCESS;
@@ -1267,10 +2115,6 @@ int vis_run(Vis *vis) {
 	sigsetjmp(vis->sigbus_jmpbuf, 1);
 
 	while (vis->running) {
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(STDIN_FILENO, &fds);
-
 		if (vis->sigbus) {
 			char *name = NULL;
 			for (Win *next, *win = vis->windows; win; win = next) {
@@ -1293,7 +2137,10 @@ int vis_run(Vis *vis) {
 			vis_die(vis, "Killed by SIGTERM\n");
 		if (vis->interrupted) {
 			vis->interrupted = false;
+			if (file_filter_cancel(vis, NULL))
+				vis_info_show(vis, "Command cancelled");
 			vis_keys_push(vis, "<C-c>", 0, true);
+			redraw = true;
 			continue;
 		}
 
@@ -1307,20 +2154,103 @@ int vis_run(Vis *vis) {
 			vis->need_resize = false;
 		}
 
-		ui_draw(&vis->ui);
-		idle.tv_sec = vis->mode->idle_timeout;
-		int r = pselect(vis_process_before_tick(&fds) + 1, &fds, NULL, NULL,
-		                timeout, &emptyset);
-		if (r == -1 && errno == EINTR)
+		if (files_announce(vis) || vis->need_redraw)
+			redraw = true;
+		vis->need_redraw = false;
+
+		if (timeout)
+			timespec_set(&idle, idle_since + vis->mode->idle_timeout - vis_time());
+		struct timespec *wait = timeout;
+		if (drain) {
+			frame_wait = (struct timespec){ 0 };
+			wait = &frame_wait;
+		} else if (redraw && !vis->pasting) {
+			/* a bracketed paste is shown once it is complete */
+			double now = vis_time();
+			double delay = vis->maxfps > 0 ? frame_last + 1.0 / vis->maxfps - now : 0;
+			if (delay <= 0) {
+				ui_draw(&vis->ui);
+				if (vis->startup.log) {
+					vis_startup_mark(vis, "first frame drawn");
+					fclose(vis->startup.log);
+					vis->startup.log = NULL;
+				}
+				double end = vis_time();
+				vis_stats_frame(vis, busy + end - wake);
+				busy = 0;
+				wake = end;
+				frame_last = now;
+				frame_input = 0;
+				redraw = false;
+				idle_work = true;
+				vis_words_schedule(vis);
+				vis_search_schedule(vis);
+				compact_schedule(vis);
+			} else if (!timeout || delay < timeout->tv_sec) {
+				frame_wait.tv_sec = delay;
+				frame_wait.tv_nsec = (delay - frame_wait.tv_sec) * 1e9;
+				wait = &frame_wait;
+			}
+		}
+		if (!redraw && (idle_work || array_length(&vis->tasks)) && wait == timeout)
+			wait = &idle_wait;
+		ssize_t next = timer_next(vis);
+		if (next != -1) {
+			Task *timer = array_get(&vis->timers, next);
+			double delay = timer->due - vis_time();
+			if (!wait || delay < wait->tv_sec + wait->tv_nsec / 1e9) {
+				timespec_set(&timer_wait, delay);
+				wait = &timer_wait;
+			}
+		}
+
+		/* round up, a timeout expiring early would spin until it is due */
+		int ms = wait ? wait->tv_sec * 1000 + (wait->tv_nsec + 999999) / 1000000 : -1;
+		struct pollfd *fds = array_get(&vis->pollfds, 0);
+		busy += vis_time() - wake;
+		sigprocmask(SIG_SETMASK, &emptyset, &blockset);
+		int r = poll(fds, array_length(&vis->pollfds), ms);
+		int errsv = errno;
+		sigprocmask(SIG_SETMASK, &blockset, NULL);
+		wake = vis_time();
+		redraw = true;
+		if (r == -1 && errsv == EINTR)
 			continue;
 
-		if (r < 0) {
+		if (r < 0 || (fds[WATCH_STDIN].revents & POLLNVAL)) {
 			/* TODO save all pending changes to a ~suffixed file */
-			vis_die(vis, "Error in mainloop: %s\n", strerror(errno));
+			vis_die(vis, "Error in mainloop: %s\n", strerror(r < 0 ? errsv : EBADF));
 		}
-		vis_process_tick(vis, &fds);
-
-		if (!FD_ISSET(STDIN_FILENO, &fds)) {
+		if (fds[WATCH_SIGNAL].revents) {
+			char buf[64];
+			while (read(vis->signal_pipe[0], buf, sizeof buf) > 0);
+		}
+		bool input = fds[WATCH_STDIN].revents;
+		watch_dispatch(vis);
+		bool children = vis->children;
+		vis_process_tick(vis);
+		if (children)
+			file_filter_reap(vis);
+		bool fired = timer_run(vis);
+
+		if (!input) {
+			if (wait == &idle_wait) {
+				idle_work = vis_event_emit(vis, VIS_EVENT_IDLE);
+				task_run(vis);
+				wake = vis_time(); /* not part of the next frame */
+				/* nothing visible changed, unless a process responded
+				 * or a timer fired */
+				redraw = r > 0 || fired;
+				continue;
+			}
+			if (wait == &frame_wait) {
+				/* no further input pending, or the next frame is due */
+				drain = false;
+				continue;
+			}
+			/* woken up early by a watch or timer */
+			if (!timeout || vis_time() < idle_since + vis->mode->idle_timeout)
+				continue;
 			if (vis->mode->idle)
 				vis->mode->idle(vis);
 			timeout = NULL;
@@ -1328,13 +2258,33 @@ int vis_run(Vis *vis) {
 		}
 
 		termkey_advisereadable(vis->ui.termkey);
-		const char *key;
-
-		while ((key = getkey(vis)))
+		/* the clipboard might have been changed meanwhile, unless the
+		 * input continues a burst which was already being processed */
+		if (!drain)
+			register_clipboard_invalidate(vis);
+
+		for (;;) {
+			double start = vis_time();
+			const char *key = getkey(vis);
+			double decoded = vis_time();
+			vis_stats_add(vis, VIS_STAT_INPUT, key != NULL, decoded - start);
+			if (!key)
+				break;
 			vis_keys_push(vis, key, 0, true);
+			vis_stats_add(vis, VIS_STAT_KEYS, 1, vis_time() - decoded);
+		}
 
-		if (vis->mode->idle)
+		/* look for more input before drawing, but keep the screen updated
+		 * during long bursts such as a paste */
+		double now = vis_time();
+		if (!frame_input)
+			frame_input = now;
+		drain = now - frame_input < VIS_FRAME_DRAIN_MAX;
+
+		if (vis->mode->idle) {
 			timeout = &idle;
+			idle_since = vis_time();
+		}
 	}
 	return vis->exit_status;
 }
@@ -1344,8 +2294,8 @@ Macro *macro_get(Vis *vis, enum VisRegister id) {
 		return vis->last_recording;
 	if (VIS_REG_A <= id && id <= VIS_REG_Z)
 		id -= VIS_REG_A;
-	if (id < LENGTH(vis->registers))
-		return array_get(&vis->registers[id].values, 0);
+	if (id < LENGTH(vis->registers) && register_load(&vis->registers[id]))
+		return register_slot_buffer(&vis->registers[id], 0);
 	return NULL;
 }
 
@@ -1432,8 +2382,10 @@ bool vis_macro_replay(Vis *vis, enum VisRegister id) {
 		return false;
 	int count = VIS_COUNT_DEFAULT(vis->action.count, 1);
 	vis_cancel(vis);
+	batch_begin(vis);
 	for (int i = 0; i < count; i++)
 		macro_replay(vis, macro);
+	batch_end(vis);
 	Win *win = vis->win;
 	if (win)
 		vis_file_snapshot(vis, win->file);
@@ -1457,12 +2409,14 @@ void vis_repeat(Vis *vis) {
 			count = 1;
 		if (vis->action_prev.op == &vis_operators[VIS_OP_MODESWITCH])
 			vis->action_prev.count = 1;
+		batch_begin(vis);
 		for (int i = 0; i < count; i++) {
 			if (vis->interrupted)
 				break;
 			mode_set(vis, mode);
 			macro_replay(vis, macro);
 		}
+		batch_end(vis);
 		vis->action_prev = action_prev;
 	}
 	vis_cancel(vis);
@@ -1510,7 +2464,7 @@ void vis_insert_tab(Vis *vis) {
 	int tabwidth = MIN(vis->win->view.tabwidth, LENGTH(spaces) - 1);
 	for (Selection *s = view_selections(&win->view); s; s = view_selections_next(s)) {
 		size_t pos = view_cursors_pos(s);
-		int width = text_line_width_get(win->file->text, pos);
+		int width = view_line_width_get(&win->view, pos);
 		int count = tabwidth - (width % tabwidth);
 		for (int i = 0; i < count; i++)
 			spaces[i] = ' ';
@@ -1578,21 +2532,175 @@ void vis_insert_nl(Vis *vis) {
 	vis_window_invalidate(win);
 }
 
-Regex *vis_regex(Vis *vis, const char *pattern) {
-	if (!pattern && !(pattern = register_get(vis, &vis->registers[VIS_REG_SEARCH], NULL)))
-		return NULL;
+Regex *regex_cache_get(Vis *vis, const char *pattern, int cflags) {
+	RegexCache *cache = &vis->regex_cache;
+	RegexCacheEntry *lru = NULL;
+	cache->clock++;
+	for (size_t i = 0; i < LENGTH(cache->entries); i++) {
+		RegexCacheEntry *e = &cache->entries[i];
+		if (e->pattern && e->cflags == cflags && strcmp(e->pattern, pattern) == 0) {
+			cache->hits++;
+			e->refs++;
+			e->used = cache->clock;
+			return e->regex;
+		}
+		if (!e->refs && (!lru || e->used < lru->used))
+			lru = e;
+	}
+	cache->misses++;
 	Regex *regex = text_regex_new();
 	if (!regex)
 		return NULL;
-	int cflags = REG_EXTENDED|REG_NEWLINE|(REG_ICASE*vis->ignorecase);
 	if (text_regex_compile(regex, pattern, cflags) != 0) {
 		text_regex_free(regex);
 		return NULL;
 	}
+	char *copy;
+	if (!lru || !(copy = strdup(pattern)))
+		return regex; /* every entry is in use, hand out an uncached regex */
+	free(lru->pattern);
+	text_regex_free(lru->regex);
+	*lru = (RegexCacheEntry){
+		.pattern = copy,
+		.cflags = cflags,
+		.regex = regex,
+		.refs = 1,
+		.used = cache->clock,
+	};
+	return regex;
+}
+
+void regex_cache_release(RegexCache *cache) {
+	for (size_t i = 0; i < LENGTH(cache->entries); i++) {
+		free(cache->entries[i].pattern);
+		text_regex_free(cache->entries[i].regex);
+	}
+	memset(cache, 0, sizeof *cache);
+}
+
+Regex *vis_regex(Vis *vis, const char *pattern) {
+	if (!pattern && !(pattern = register_get(vis, &vis->registers[VIS_REG_SEARCH], NULL)))
+		return NULL;
+	int cflags = REG_EXTENDED|REG_NEWLINE|(REG_ICASE*vis->ignorecase);
+	Regex *regex = regex_cache_get(vis, pattern, cflags);
+	if (!regex)
+		return NULL;
 	register_put0(vis, &vis->registers[VIS_REG_SEARCH], pattern);
 	return regex;
 }
 
+void vis_regex_free(Vis *vis, Regex *regex) {
+	if (!regex)
+		return;
+	RegexCache *cache = &vis->regex_cache;
+	for (size_t i = 0; i < LENGTH(cache->entries); i++) {
+		if (cache->entries[i].regex == regex) {
+			cache->entries[i].refs--;
+			return;
+		}
+	}
+	text_regex_free(regex);
+}
+
+/* set up the standard file descriptors of a filter process and execute it,
+ * never returns */
+static void pipe_exec(Vis *vis, File *file, const char *argv[], int pin[2], int pout[2], int perr[2],
+                      bool interactive, bool input, bool output, bool error) {
+	sigset_t sigterm_mask;
+	sigemptyset(&sigterm_mask);
+	sigaddset(&sigterm_mask, SIGTERM);
+	sigaddset(&sigterm_mask, SIGCHLD);
+	if (sigprocmask(SIG_UNBLOCK, &sigterm_mask, NULL) == -1) {
+		fprintf(stderr, "failed to reset signal mask");
+		exit(EXIT_FAILURE);
+	}
+
+	int null = open("/dev/null", O_RDWR);
+	if (null == -1) {
+		fprintf(stderr, "failed to open /dev/null");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!interactive) {
+		/* If we have nothing to write, let stdin point to
+		 * /dev/null instead of a pipe which is immediately
+		 * closed. Some programs behave differently when used
+		 * in a pipeline.
+		 */
+		if (!input)
+			dup2(null, STDIN_FILENO);
+		else
+			dup2(pin[0], STDIN_FILENO);
+	}
+
+	close(pin[0]);
+	close(pin[1]);
+	if (interactive) {
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		/* For some reason the first byte written by the
+		 * interactive application is not being displayed.
+		 * It probably has something to do with the terminal
+		 * state change. By writing a dummy byte ourself we
+		 * ensure that the complete output is visible.
+		 */
+		while(write(STDOUT_FILENO, " ", 1) == -1 && errno == EINTR);
+	} else if (output) {
+		dup2(pout[1], STDOUT_FILENO);
+	} else {
+		dup2(null, STDOUT_FILENO);
+	}
+	close(pout[1]);
+	close(pout[0]);
+	if (!interactive) {
+		if (error)
+			dup2(perr[1], STDERR_FILENO);
+		else
+			dup2(null, STDERR_FILENO);
+	}
+	close(perr[0]);
+	close(perr[1]);
+	close(null);
+
+	if (file->name) {
+		char *name = strrchr(file->name, '/');
+		setenv("vis_filepath", file->name, 1);
+		setenv("vis_filename", name ? name+1 : file->name, 1);
+	}
+
+	if (!argv[1])
+		execlp(vis->shell, vis->shell, "-c", argv[0], (char*)NULL);
+	else
+		execvp(argv[0], (char* const*)argv);
+	fprintf(stderr, "exec failure: %s", strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+/* amount of data read from a filter per system call */
+#define VIS_PIPE_READ_SIZE (1 << 16)
+
+/* pass the data currently available to the callback, returns false once
+ * the end of file was reached or an error occured, fd is then closed */
+static bool pipe_drain(Vis *vis, int fd, void *context, ssize_t (*callback)(void *context, char *data, size_t len),
+                       const char *error) {
+	static char buf[VIS_PIPE_READ_SIZE];
+	for (;;) {
+		ssize_t len = read(fd, buf, sizeof buf);
+		if (len > 0) {
+			if (callback)
+				(*callback)(context, buf, len);
+			if ((size_t)len < sizeof buf)
+				return true;
+		} else if (len == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		} else {
+			if (len == -1)
+				vis_info_show(vis, "%s", error);
+			close(fd);
+			return false;
+		}
+	}
+}
+
 int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 	void *stdout_context, ssize_t (*read_stdout)(void *stdout_context, char *data, size_t len),
 	void *stderr_context, ssize_t (*read_stderr)(void *stderr_context, char *data, size_t len),
@@ -1634,72 +2742,8 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 		vis_info_show(vis, "fork failure: %s", strerror(errno));
 		return -1;
 	} else if (pid == 0) { /* child i.e filter */
-		sigset_t sigterm_mask;
-		sigemptyset(&sigterm_mask);
-		sigaddset(&sigterm_mask, SIGTERM);
-		if (sigprocmask(SIG_UNBLOCK, &sigterm_mask, NULL) == -1) {
-			fprintf(stderr, "failed to reset signal mask");
-			exit(EXIT_FAILURE);
-		}
-
-		int null = open("/dev/null", O_RDWR);
-		if (null == -1) {
-			fprintf(stderr, "failed to open /dev/null");
-			exit(EXIT_FAILURE);
-		}
-
-		if (!interactive) {
-			/* If we have nothing to write, let stdin point to
-			 * /dev/null instead of a pipe which is immediately
-			 * closed. Some programs behave differently when used
-			 * in a pipeline.
-			 */
-			if (text_range_size(range) == 0)
-				dup2(null, STDIN_FILENO);
-			else
-				dup2(pin[0], STDIN_FILENO);
-		}
-
-		close(pin[0]);
-		close(pin[1]);
-		if (interactive) {
-			dup2(STDERR_FILENO, STDOUT_FILENO);
-			/* For some reason the first byte written by the
-			 * interactive application is not being displayed.
-			 * It probably has something to do with the terminal
-			 * state change. By writing a dummy byte ourself we
-			 * ensure that the complete output is visible.
-			 */
-			while(write(STDOUT_FILENO, " ", 1) == -1 && errno == EINTR);
-		} else if (read_stdout) {
-			dup2(pout[1], STDOUT_FILENO);
-		} else {
-			dup2(null, STDOUT_FILENO);
-		}
-		close(pout[1]);
-		close(pout[0]);
-		if (!interactive) {
-			if (read_stderr)
-				dup2(perr[1], STDERR_FILENO);
-			else
-				dup2(null, STDERR_FILENO);
-		}
-		close(perr[0]);
-		close(perr[1]);
-		close(null);
-
-		if (file->name) {
-			char *name = strrchr(file->name, '/');
-			setenv("vis_filepath", file->name, 1);
-			setenv("vis_filename", name ? name+1 : file->name, 1);
-		}
-
-		if (!argv[1])
-			execlp(vis->shell, vis->shell, "-c", argv[0], (char*)NULL);
-		else
-			execvp(argv[0], (char* const*)argv);
-		fprintf(stderr, "exec failure: %s", strerror(errno));
-		exit(EXIT_FAILURE);
+		pipe_exec(vis, file, argv, pin, pout, perr, interactive,
+		          !interactive && text_range_size(range) > 0, read_stdout != NULL, read_stderr != NULL);
 	}
 
 	vis->interrupted = false;
@@ -1708,46 +2752,38 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 	close(pout[1]);
 	close(perr[1]);
 
-	if (fcntl(pout[0], F_SETFL, O_NONBLOCK) == -1 ||
+	/* input is written in as large pieces as the pipe accepts, without
+	 * blocking while the command waits for its output to be read */
+	if (fcntl(pin[1], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(pout[0], F_SETFL, O_NONBLOCK) == -1 ||
 	    fcntl(perr[0], F_SETFL, O_NONBLOCK) == -1)
 		goto err;
 
-	fd_set rfds, wfds;
-
 	do {
 		if (vis->interrupted) {
 			kill(0, SIGTERM);
 			break;
 		}
 
-		FD_ZERO(&rfds);
-		FD_ZERO(&wfds);
-		if (pin[1] != -1)
-			FD_SET(pin[1], &wfds);
-		if (pout[0] != -1)
-			FD_SET(pout[0], &rfds);
-		if (perr[0] != -1)
-			FD_SET(perr[0], &rfds);
+		/* closed descriptors are negative and thus ignored by poll(2) */
+		struct pollfd fds[] = {
+			{ .fd = pin[1], .events = POLLOUT },
+			{ .fd = pout[0], .events = POLLIN },
+			{ .fd = perr[0], .events = POLLIN },
+		};
 
-		if (select(FD_SETSIZE, &rfds, &wfds, NULL, NULL) == -1) {
+		if (poll(fds, LENGTH(fds), -1) == -1) {
 			if (errno == EINTR)
 				continue;
-			vis_info_show(vis, "Select failure");
+			vis_info_show(vis, "Poll failure");
 			break;
 		}
 
-		if (pin[1] != -1 && FD_ISSET(pin[1], &wfds)) {
-			Filerange junk = rout;
-			if (junk.end > junk.start + PIPE_BUF)
-				junk.end = junk.start + PIPE_BUF;
-			ssize_t len = text_write_range(text, &junk, pin[1]);
-			if (len > 0) {
+		if (pin[1] != -1 && fds[0].revents) {
+			ssize_t len = text_write_range_nonblock(text, &rout, pin[1]);
+			if (len > 0)
 				rout.start += len;
-				if (text_range_size(&rout) == 0) {
-					close(pin[1]);
-					pin[1] = -1;
-				}
-			} else {
+			if (len == -1 || text_range_size(&rout) == 0) {
 				close(pin[1]);
 				pin[1] = -1;
 				if (len == -1)
@@ -1755,38 +2791,12 @@ int vis_pipe(Vis *vis, File *file, Filerange *range, const char *argv[],
 			}
 		}
 
-		if (pout[0] != -1 && FD_ISSET(pout[0], &rfds)) {
-			char buf[BUFSIZ];
-			ssize_t len = read(pout[0], buf, sizeof buf);
-			if (len > 0) {
-				if (read_stdout)
-					(*read_stdout)(stdout_context, buf, len);
-			} else if (len == 0) {
-				close(pout[0]);
-				pout[0] = -1;
-			} else if (errno != EINTR && errno != EWOULDBLOCK) {
-				vis_info_show(vis, "Error reading from filter stdout");
-				close(pout[0]);
-				pout[0] = -1;
-			}
-		}
-
-		if (perr[0] != -1 && FD_ISSET(perr[0], &rfds)) {
-			char buf[BUFSIZ];
-			ssize_t len = read(perr[0], buf, sizeof buf);
-			if (len > 0) {
-				if (read_stderr)
-					(*read_stderr)(stderr_context, buf, len);
-			} else if (len == 0) {
-				close(perr[0]);
-				perr[0] = -1;
-			} else if (errno != EINTR && errno != EWOULDBLOCK) {
-				vis_info_show(vis, "Error reading from filter stderr");
-				close(perr[0]);
-				perr[0] = -1;
-			}
-		}
-
+		if (pout[0] != -1 && fds[1].revents &&
+		    !pipe_drain(vis, pout[0], stdout_context, read_stdout, "Error reading from filter stdout"))
+			pout[0] = -1;
+		if (perr[0] != -1 && fds[2].revents &&
+		    !pipe_drain(vis, perr[0], stderr_context, read_stderr, "Error reading from filter stderr"))
+			perr[0] = -1;
 	} while (pin[1] != -1 || pout[0] != -1 || perr[0] != -1);
 
 err:
@@ -1847,6 +2857,178 @@ int vis_pipe_collect(Vis *vis, File *file, Filerange *range, const char *argv[],
 	return status;
 }
 
+bool vis_pipe_job_start(Vis *vis, PipeJob *job, File *file, Filerange *range, const char *argv[], bool output) {
+	int pin[2], pout[2], perr[2];
+	memset(job, 0, sizeof *job);
+	job->pid = -1;
+	job->in = job->out = job->err = -1;
+	job->status = -1;
+	buffer_init(&job->output);
+	buffer_init(&job->error);
+
+	if (pipe(pin) == -1)
+		return false;
+	if (pipe(pout) == -1) {
+		close(pin[0]);
+		close(pin[1]);
+		return false;
+	}
+	if (pipe(perr) == -1) {
+		close(pin[0]);
+		close(pin[1]);
+		close(pout[0]);
+		close(pout[1]);
+		return false;
+	}
+	/* other children inheriting the input pipe would keep the filter
+	 * from ever seeing the end of its input */
+	fcntl(pin[1], F_SETFD, FD_CLOEXEC);
+	fcntl(pout[0], F_SETFD, FD_CLOEXEC);
+	fcntl(perr[0], F_SETFD, FD_CLOEXEC);
+
+	bool input = text_range_size(range) > 0;
+	pid_t pid = fork();
+
+	if (pid == -1) {
+		close(pin[0]);
+		close(pin[1]);
+		close(pout[0]);
+		close(pout[1]);
+		close(perr[0]);
+		close(perr[1]);
+		vis_info_show(vis, "fork failure: %s", strerror(errno));
+		return false;
+	} else if (pid == 0) {
+		pipe_exec(vis, file, argv, pin, pout, perr, false, input, output, true);
+	}
+
+	close(pin[0]);
+	close(pout[1]);
+	close(perr[1]);
+	if (!input)
+		close(pin[1]);
+	if (!output)
+		close(pout[0]);
+
+	job->text = file->text;
+	job->pid = pid;
+	job->in = input ? pin[1] : -1;
+	job->out = output ? pout[0] : -1;
+	job->err = perr[0];
+	job->input = *range;
+
+	if ((job->in != -1 && fcntl(job->in, F_SETFL, O_NONBLOCK) == -1) ||
+	    (job->out != -1 && fcntl(job->out, F_SETFL, O_NONBLOCK) == -1) ||
+	    fcntl(job->err, F_SETFL, O_NONBLOCK) == -1) {
+		vis_pipe_job_cancel(job);
+		return false;
+	}
+	return true;
+}
+
+void vis_pipe_job_fds(PipeJob *job, struct pollfd fds[3]) {
+	fds[0] = (struct pollfd){ .fd = job->in, .events = POLLOUT };
+	fds[1] = (struct pollfd){ .fd = job->out, .events = POLLIN };
+	fds[2] = (struct pollfd){ .fd = job->err, .events = POLLIN };
+}
+
+/* like text_write_range_nonblock, but reading from a snapshot */
+static ssize_t frozen_write_range_nonblock(const TextFrozen *frozen, const Filerange *range, int fd) {
+	size_t pos = range->start;
+	const char *chunk;
+	size_t len;
+	while (pos < range->end && (chunk = text_frozen_chunk(frozen, pos, &len))) {
+		if (len > range->end - pos)
+			len = range->end - pos;
+		ssize_t written = write(fd, chunk, len);
+		if (written == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			return -1;
+		}
+		pos += written;
+		if ((size_t)written != len)
+			break;
+	}
+	return pos - range->start;
+}
+
+static ssize_t pipe_job_append(void *buf, char *data, size_t len) {
+	return buffer_append(buf, data, len) ? (ssize_t)len : -1;
+}
+
+bool vis_pipe_job_io(Vis *vis, PipeJob *job, const struct pollfd fds[3]) {
+	if (job->pid == -1)
+		return false;
+
+	if (job->in != -1 && fds[0].revents) {
+		ssize_t len = job->frozen ?
+			frozen_write_range_nonblock(job->frozen, &job->input, job->in) :
+			text_write_range_nonblock(job->text, &job->input, job->in);
+		if (len > 0)
+			job->input.start += len;
+		if (len == -1 || text_range_size(&job->input) == 0) {
+			close(job->in);
+			job->in = -1;
+			if (len == -1)
+				vis_info_show(vis, "Error writing to external command");
+		}
+	}
+
+	if (job->out != -1 && fds[1].revents &&
+	    !pipe_drain(vis, job->out, &job->output, pipe_job_append, "Error reading from filter"))
+		job->out = -1;
+	if (job->err != -1 && fds[2].revents &&
+	    !pipe_drain(vis, job->err, &job->error, pipe_job_append, "Error reading from filter"))
+		job->err = -1;
+
+	return vis_pipe_job_wait(job, false);
+}
+
+bool vis_pipe_job_wait(PipeJob *job, bool block) {
+	if (job->pid == -1 || job->in != -1 || job->out != -1 || job->err != -1)
+		return false;
+	int status;
+	for (;;) {
+		pid_t died = waitpid(job->pid, &status, block ? 0 : WNOHANG);
+		if (died == job->pid) {
+			job->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+			break;
+		} else if (died == 0) {
+			return false;
+		} else if (died == -1 && errno != EINTR) {
+			job->status = -1;
+			break;
+		}
+	}
+	job->pid = -1;
+	return true;
+}
+
+void vis_pipe_job_cancel(PipeJob *job) {
+	if (job->in != -1)
+		close(job->in);
+	if (job->out != -1)
+		close(job->out);
+	if (job->err != -1)
+		close(job->err);
+	job->in = job->out = job->err = -1;
+	if (job->pid != -1) {
+		kill(job->pid, SIGTERM);
+		while (waitpid(job->pid, NULL, 0) == -1 && errno == EINTR);
+	}
+	job->pid = -1;
+	job->status = -1;
+}
+
+void vis_pipe_job_release(PipeJob *job) {
+	if (job->frozen)
+		text_frozen_release(job->frozen);
+	job->frozen = NULL;
+	buffer_release(&job->output);
+	buffer_release(&job->error);
+}
+
 bool vis_cmd(Vis *vis, const char *cmdline) {
 	if (!cmdline)
 		return true;
@@ -1869,8 +3051,15 @@ bool vis_cmd(Vis *vis, const char *cmdline) {
 }
 
 void vis_file_snapshot(Vis *vis, File *file) {
-	if (!vis->replaying)
-		text_snapshot(file->text);
+	if (vis->replaying)
+		return;
+	text_snapshot(file->text);
+	if (!vis->history_revisions && !vis->history_memory)
+		return;
+	double start = vis_time();
+	size_t pruned = text_history_prune(file->text, vis->history_revisions, vis->history_memory);
+	if (pruned)
+		vis_stats_add(vis, VIS_STAT_HISTORY, pruned, vis_time() - start);
 }
 
 Text *vis_text(Vis *vis) {
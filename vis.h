@@ -92,6 +92,15 @@ typedef struct {
  */
 /** Create a new editor instance. */
 Vis *vis_new(void);
+/** Monotonic clock in seconds. */
+double vis_time(void);
+/**
+ * Append the time spent in each startup phase to ``path``, similar to
+ * vim's ``--startuptime``. Logging stops once the first frame was drawn.
+ * @param start The `vis_time` at which startup began.
+ * @return Whether the log file could be opened.
+ */
+bool vis_startuptime(Vis*, const char *path, double start);
 /** Free all resources associated with this editor instance, terminates UI. */
 void vis_free(Vis*);
 /**
@@ -155,6 +164,17 @@ void vis_redraw(Vis*);
  * @endrst
  */
 bool vis_window_new(Vis*, const char *filename);
+/**
+ * Create a new window for a file which is only loaded once it is needed.
+ * @rst
+ * .. note:: Existing, readable files are merely ``stat(2)``-ed. Their content
+ *           is loaded, and the ``FILE_OPEN`` and ``WIN_OPEN`` events are
+ *           emitted, once the window is displayed or focused, or a command
+ *           or Lua function accesses the file. Other file names are handled
+ *           like by ``vis_window_new``.
+ * @endrst
+ */
+bool vis_window_new_deferred(Vis*, const char *filename);
 /**
  * Create a new window associated with a file descriptor.
  * @rst
@@ -163,6 +183,15 @@ bool vis_window_new(Vis*, const char *filename);
  * @endrst
  */
 bool vis_window_new_fd(Vis*, int fd);
+/**
+ * Create a new window whose content is read from ``infd``.
+ *
+ * The data is appended incrementally from within the main loop, the
+ * window is usable while loading is still in progress.
+ * @param infd The input file descriptor, closed once everything is read.
+ * @param outfd The output file descriptor, see `vis_window_new_fd`.
+ */
+bool vis_window_new_stream(Vis*, int infd, int outfd);
 /** Reload the file currently displayed in the window from disk. */
 bool vis_window_reload(Win*);
 /** Change the file currently displayed in the window. */
@@ -918,10 +947,14 @@ void vis_keys_feed(Vis*, const char *keys);
  *        one is substituted.
  * @return A Regex object or ``NULL`` in case of an error.
  * @rst
- * .. warning:: The caller must free the regex object using `text_regex_free`.
+ * .. note:: Compiled patterns are cached, repeated requests for the same
+ *           pattern return the same object.
+ * .. warning:: The caller must release the regex object using `vis_regex_free`.
  * @endrst
  */
 Regex *vis_regex(Vis*, const char *pattern);
+/** Release a regex object obtained from `vis_regex`. */
+void vis_regex_free(Vis*, Regex*);
 
 /**
  * Take an undo snapshot to which we can later revert.